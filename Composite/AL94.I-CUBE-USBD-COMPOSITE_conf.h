@@ -37,7 +37,12 @@
 #define _USBD_USE_CDC_ACM      true
 
 /*---------- _USBD_CDC_ACM_COUNT  -----------*/
+/* Channel 0 is the NyanOS shell, NYAN_TELEMETRY_EN adds the binary telemetry stream as channel 1 */
+#ifdef NYAN_TELEMETRY_EN
+#define _USBD_CDC_ACM_COUNT      2
+#else
 #define _USBD_CDC_ACM_COUNT      1
+#endif
 
 /*---------- _USBD_USE_CDC_RNDIS  -----------*/
 #define _USBD_USE_CDC_RNDIS      false
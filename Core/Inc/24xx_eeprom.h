@@ -3,7 +3,33 @@
  * @brief EEPROM control byte utility for 24XX EEPROM series.
  *
  * Provides utility functions for working with 24XX series EEPROM devices.
- * This includes initialization, read and write operations using DMA.
+ * Every transfer is described by an EepromJob and queued on the driver. Jobs
+ * are started and completed from the I2C DMA interrupts, so callers hand the
+ * work off and get a callback instead of spinning on the bus.
+ *
+ * Reads into a buffer that starts on a cache line and spans whole cache lines
+ * are DMAed straight into that buffer, up to a full 64 KB block in one
+ * sequential read; anything else is staged through the driver rx_buf.
+ *
+ * Writes of any length are split on the 128 byte write pages. After each page
+ * the EEPROM NACKs its address until the internal write cycle is over; the
+ * driver ACK polls it with an exponential backoff timed by TIM5 and gives up
+ * once EEPROM_POLL_DEADLINE_US have passed without an answer.
+ *
+ * The bus runs at one of the EepromBusProfile speeds. At boot the driver
+ * picks the fastest profile that reads the probe pattern back with the CRC-32
+ * stored behind it, so boards with stronger pull-ups load their bitstream
+ * several times faster. The pattern is written once, at 100 kHz, the first
+ * time its CRC does not match.
+ *
+ * A bus error never resets the board. The driver clocks a stuck slave free,
+ * reinitialises I2C1 and runs the interrupted transfer again, up to
+ * EEPROM_JOB_RETRIES times before the job fails.
+ *
+ * A write job with compare set reads every page back before writing it and
+ * skips pages that already hold the data. Re-uploading a mostly unchanged
+ * image then costs a fast sequential read per page instead of a write cycle,
+ * and the unchanged pages are not worn.
  */
 
 #ifndef _24XX_EEPROM_H
@@ -11,6 +37,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 // Definitions
 #define EEPROM_DRIVER_TX_BUF_SZ  128     /**< Size of the transmit buffer. */
@@ -22,20 +49,111 @@
 #define EEPROM_CTRL_MASK_CODE    0xA0    /**< Control byte mask code for EEPROM. */
 #define EEPROM_PAGE_SIZE         0x7F    /**< Maximum number of bytes in a single TX. */
 #define EEPROM_MAX_ADDR_SIZE     0xFFFF  /**< Max address value for a single block (2^16-1). */
+#define EEPROM_BLOCK_SIZE        0x10000 /**< Bytes per B0 block, sequential reads wrap inside a block. */
+#define EEPROM_SIZE              0x20000 /**< Both blocks, linear addresses carry B0 in bit 16. */
+#define EEPROM_WRITE_PAGE_SZ     128     /**< Write page, a single write never crosses one. */
+#define EEPROM_POLL_FIRST_US     50      /**< Delay before the first ACK poll after a NACK. */
+#define EEPROM_POLL_MAX_US       500     /**< Backoff cap, bounds how late the end of a write cycle is seen. */
+#define EEPROM_POLL_DEADLINE_US  20000   /**< Time a transfer keeps being NACKed before it fails, 4x the 24xx1025 tWC. */
+#define EEPROM_JOB_RETRIES       3       /**< Bus recoveries a job survives before it fails. */
+#define EEPROM_RECOVER_DELAY_US  100     /**< Time the bus is left alone after an error before it is recovered. */
+#define EEPROM_RECOVER_PULSES    9       /**< SCL pulses that release a slave stuck mid-byte. */
+#define EEPROM_RECOVER_HALF_US   5       /**< Half period of the recovery clock, 100 kHz. */
+#define EEPROM_PROBE_ADDR        0x0240  /**< Bank 0 probe pattern, ADDR_BUS_PROBE in nyan_eeprom_map.h. */
+#define EEPROM_PROBE_LEN         64      /**< Pattern bytes read per probe pass, the last four are its CRC-32. */
+#define EEPROM_PROBE_PASSES      2       /**< Matching reads a profile needs, a marginal bus can get lucky once. */
+#define EEPROM_DMA_ALIGN         32      /**< Cortex-M7 D-Cache line size. */
+#define EEPROM_DMA_ALIGNED       __attribute__((aligned(EEPROM_DMA_ALIGN))) /**< For buffers read without staging. */
 
 typedef enum {
     EEPROM_FAILURE, /**< Indicates a failure in EEPROM operation. */
     EEPROM_SUCCESS  /**< Indicates a successful EEPROM operation. */
 } EepromReturn;
 
+typedef enum {
+    EEPROM_BUS_100K,    /**< Standard mode, works with any pull-up. */
+    EEPROM_BUS_400K,    /**< Fast mode, the CubeMX default. */
+    EEPROM_BUS_1M,      /**< Fast mode plus. */
+    EEPROM_BUS_PROFILES
+} EepromBusProfile;
+
+typedef enum {
+    EEPROM_JOB_READ,  /**< Read len bytes into data. */
+    EEPROM_JOB_WRITE  /**< Write len bytes from data, split on write pages by the driver. */
+} EepromJobType;
+
+typedef enum {
+    EEPROM_JOB_PRIORITY_LOW,    /**< Background traffic, e.g. statistics. */
+    EEPROM_JOB_PRIORITY_NORMAL, /**< Default. */
+    EEPROM_JOB_PRIORITY_HIGH,   /**< Anything a user is waiting on. */
+    EEPROM_JOB_PRIORITIES
+} EepromJobPriority;
+
+typedef enum {
+    EEPROM_JOB_IDLE,    /**< Never submitted. */
+    EEPROM_JOB_QUEUED,  /**< Waiting for the bus, or for the job it is chained behind. */
+    EEPROM_JOB_ACTIVE,  /**< Owned by the I2C DMA. */
+    EEPROM_JOB_DONE,    /**< Completed, read data is in the caller buffer. */
+    EEPROM_JOB_FAILED   /**< Gave up, or the job it was chained behind failed. */
+} EepromJobState;
+
+typedef struct EepromJob EepromJob;
+
+/**
+ * @brief Job completion callback. Runs in the I2C interrupt, keep it short.
+ * @param job The finished job, it may be resubmitted from here.
+ * @param result EEPROM_SUCCESS if the transfer completed.
+ */
+typedef void (*EepromJobCallback)(EepromJob* job, EepromReturn result);
+
+/**
+ * @struct EepromJob
+ * @brief One queued EEPROM transfer. The job and its data must stay valid until it is done.
+ */
+struct EepromJob {
+    EepromJobType           type;       /**< Read or write. */
+    EepromJobPriority       priority;   /**< Queue the job is served from. */
+    bool                    b0;         /**< Block select bit B0. */
+    uint16_t                address;    /**< EEPROM address of the first byte. */
+    uint8_t*                data;       /**< Destination of a read, source of a write. */
+    uint16_t                len;        /**< Number of bytes, see EepromSubmit for the limits. */
+    EepromJobCallback       callback;   /**< Called on completion, may be NULL. */
+    void*                   ctx;        /**< Free for the owner of the job. */
+    EepromJob*              next;       /**< Chained job, started as soon as this one succeeds and failed with it otherwise. */
+    bool                    compare;    /**< Write only the pages whose EEPROM contents differ from data. */
+    volatile EepromJobState state;      /**< Progress of the job, owned by the driver. */
+    uint16_t                offset;     /**< Bytes of a write already committed, owned by the driver. */
+    uint16_t                segment;    /**< Bytes of the write page in flight, owned by the driver. */
+    uint16_t                polls;      /**< ACK polls of the current transfer, owned by the driver. */
+    uint8_t                 attempts;   /**< Bus recoveries of the current transfer, owned by the driver. */
+    bool                    comparing;  /**< The current page is being read back, owned by the driver. */
+    uint16_t                pages_skipped; /**< Pages of a compare write that already matched, valid once done. */
+    bool                    direct;     /**< The read DMAs straight into data, owned by the driver. */
+    EepromJob*              queue_next; /**< Queue link, owned by the driver. */
+};
+
 typedef struct {
     bool a0;
     bool a1;
-    volatile bool tx_inflight;
-    volatile bool tx_failed;
-    volatile bool rx_inflight; 
-    uint8_t tx_buf[EEPROM_DRIVER_TX_BUF_SZ]; /**< Transmit buffer. */
-    uint8_t rx_buf[EEPROM_DRIVER_RX_BUF_SZ]; /**< Receive buffer. */
+    EepromJob* volatile active;                         /**< Job owned by the I2C DMA, NULL when the bus is idle. */
+    EepromJob* queue_head[EEPROM_JOB_PRIORITIES];       /**< Pending jobs per priority. */
+    EepromJob* queue_tail[EEPROM_JOB_PRIORITIES];       /**< Last pending job per priority. */
+    uint32_t poll_start;                                /**< Cycle count of the first NACK of the current transfer. */
+    uint32_t poll_delay_us;                             /**< Current ACK polling backoff. */
+    EepromBusProfile bus_profile;                       /**< Timing the I2C peripheral runs with. */
+    volatile bool probing;                              /**< A bus profile probe is running, bus errors fail the job without retries. */
+    volatile bool recover_pending;                      /**< A bus recovery is scheduled on TIM5, no job may start. */
+    uint32_t bus_errors;                                /**< I2C errors other than NACKs since boot. */
+    uint32_t bus_recoveries;                            /**< Times the bus was clocked free and I2C1 reinitialised. */
+    uint32_t job_retries;                               /**< Transfers run again after a recovery. */
+    uint32_t jobs_failed;                               /**< Jobs completed with EEPROM_FAILURE. */
+    uint32_t pages_written;                             /**< Write pages committed since boot. */
+    uint32_t pages_skipped;                             /**< Write pages a compare write found unchanged since boot. */
+    EepromJob rate_job;                                 /**< Timed read of EepromMeasureReadRate. */
+    uint32_t rate_start;                                /**< Cycle count the timed read was submitted at. */
+    volatile uint32_t read_rate;                        /**< Bytes per second of the last timed read, 0 until one completed. */
+    uint8_t tx_buf[EEPROM_DRIVER_TX_BUF_SZ] EEPROM_DMA_ALIGNED; /**< Transmit buffer. */
+    uint8_t rx_buf[EEPROM_DRIVER_RX_BUF_SZ] EEPROM_DMA_ALIGNED; /**< Receive buffer for unaligned reads. */
 } Eeprom24xx;
 
 /**
@@ -51,39 +169,133 @@ typedef struct {
 EepromReturn EepromInit(Eeprom24xx* eeprom, bool a0, bool a1);
 
 /**
- * @brief Flushes the transmit buffer of the EEPROM.
+ * @brief Fills in a job with normal priority, no callback, no chained job and no compare.
+ * @param job Job to be initialized, must not be queued.
+ * @param type Read or write.
+ * @param b0 State of address bit B0 for addressing.
+ * @param address EEPROM address of the first byte.
+ * @param data Destination of a read, source of a write.
+ * @param len Number of bytes.
+ */
+void EepromJobInit(EepromJob* job, EepromJobType type, bool b0, uint16_t address, uint8_t* data, uint16_t len);
+
+/**
+ * @brief Fills in a job at a linear address, splitting it where it crosses from block 0 into block 1.
  *
- * Clears the contents of the transmit buffer in preparation for new data.
+ * The 24xx1025 wraps a sequential transfer inside its B0 block, so the part
+ * past the block boundary goes to tail, chained behind job. tail is only
+ * used if the transfer crosses, it may be NULL when it cannot.
+ *
+ * @param job Job to be initialized, must not be queued.
+ * @param tail Second job for the part in block 1, must not be queued.
+ * @param type Read or write.
+ * @param address Linear address of the first byte, below EEPROM_SIZE.
+ * @param data Destination of a read, source of a write.
+ * @param len Number of bytes.
+ * @return EepromJob* Last job of the chain, the one to wait on.
+ */
+EepromJob* EepromJobInitLinear(EepromJob* job, EepromJob* tail, EepromJobType type, uint32_t address, uint8_t* data, uint16_t len);
+
+/**
+ * @brief Queues a job and every job chained behind it. Safe from any interrupt below the I2C priority.
+ *
+ * Writes take any length up to the end of the block. Reads into an EEPROM_DMA_ALIGN
+ * aligned buffer with a length that is a multiple of EEPROM_DMA_ALIGN take up
+ * to the rest of the block, other reads up to EEPROM_DRIVER_RX_BUF_SZ bytes
+ * within the block. EepromJobInitLinear splits transfers that cross it.
+ * The CPU must not touch a direct read buffer until the job is done.
  *
  * @param eeprom Pointer to the Eeprom24xx structure.
- * @return EepromReturn Status of the flush operation (success or failure).
+ * @param job First job of the chain.
+ * @return EepromReturn EEPROM_FAILURE if a job of the chain is still queued or its length is invalid.
+ */
+EepromReturn EepromSubmit(Eeprom24xx* eeprom, EepromJob* job);
+
+/**
+ * @brief Returns true once the job has completed or failed.
+ * @param job The job.
  */
-EepromReturn EepromFlushTxBuff(Eeprom24xx* eeprom);
+bool EepromJobDone(const EepromJob* job);
 
 /**
- * @brief Writes data to the EEPROM using the DMA interface.
+ * @brief Returns true while a job of the chain is queued or active.
+ * @param job The job.
+ */
+bool EepromJobBusy(const EepromJob* job);
+
+/**
+ * @brief Blocks until the job is done. Only for code that cannot continue without the data, e.g. boot.
+ * @param job A submitted job.
+ * @return EepromReturn EEPROM_SUCCESS if the job completed.
+ */
+EepromReturn EepromJobWait(const EepromJob* job);
+
+/**
+ * @brief Returns true while a job owns the bus.
+ * @param eeprom Pointer to the Eeprom24xx structure.
+ */
+bool EepromBusy(Eeprom24xx* eeprom);
+
+/**
+ * @brief Switches the I2C timing. Only while no job owns the bus.
+ * @param eeprom Pointer to the Eeprom24xx structure.
+ * @param profile New bus speed.
+ * @return EepromReturn EEPROM_FAILURE if the bus is busy or the profile is invalid.
+ */
+EepromReturn EepromSetBusProfile(Eeprom24xx* eeprom, EepromBusProfile profile);
+
+/**
+ * @brief Selects the fastest bus profile that reads the probe pattern back intact. Blocks, call at boot.
  *
- * This function initiates a write operation to the EEPROM at a specified address.
+ * Writes the pattern at 100 kHz if its stored CRC does not match. Falls back
+ * to 100 kHz if every faster profile fails, and keeps the default profile if
+ * the pattern can't be read back intact at 100 kHz either.
  *
  * @param eeprom Pointer to the Eeprom24xx structure.
- * @param b0 State of address bit B0 for addressing.
- * @param eeprom_address The EEPROM address where data writing should begin.
- * @param len Number of bytes to read.
- * @return EepromReturn Status of the write operation (success or failure).
+ * @return EepromBusProfile The profile the bus is left running at.
  */
-EepromReturn EepromWrite(Eeprom24xx* eeprom, bool b0, short eeprom_address, size_t len);
+EepromBusProfile EepromProbeBusProfile(Eeprom24xx* eeprom);
 
 /**
- * @brief Reads data from the EEPROM using the DMA interface.
+ * @brief Bus speed of a profile.
+ * @param profile The profile.
+ * @return uint16_t Nominal SCL frequency in kHz.
+ */
+uint16_t EepromBusProfileKhz(EepromBusProfile profile);
+
+/**
+ * @brief Starts a timed EEPROM_DRIVER_RX_BUF_SZ byte sequential read from the start of bank 0. Never blocks.
  *
- * Reads a specified number of bytes from the EEPROM starting from a given address.
+ * The result lands in read_rate when the read completes. Only below the I2C
+ * interrupt priority, like EepromSubmit.
  *
  * @param eeprom Pointer to the Eeprom24xx structure.
- * @param b0 State of address bit B0 for addressing.
- * @param eeprom_address The EEPROM address from where to start reading.
- * @param len Number of bytes to read.
- * @return EepromReturn Status of the read operation (success or failure).
+ * @return EepromReturn EEPROM_FAILURE if the bus is busy, a measurement is running or the read could not be queued.
+ */
+EepromReturn EepromMeasureReadRate(Eeprom24xx* eeprom);
+
+/**
+ * @brief Schedules a bus recovery and a retry of the active job. Called from the I2C error callback for anything but a NACK.
+ * @param eeprom Pointer to the Eeprom24xx structure.
+ */
+void EepromIrqError(Eeprom24xx* eeprom);
+
+/**
+ * @brief Completes the active job. Called from the I2C memory transfer complete callbacks.
+ * @param eeprom Pointer to the Eeprom24xx structure.
+ */
+void EepromIrqComplete(Eeprom24xx* eeprom);
+
+/**
+ * @brief Schedules an ACK poll of the active job after a NACK, or fails it past the deadline. Called from the I2C error callback.
+ * @param eeprom Pointer to the Eeprom24xx structure.
+ */
+void EepromIrqNack(Eeprom24xx* eeprom);
+
+/**
+ * @brief Restarts the active job once the ACK polling backoff elapsed, recovering the bus first if an error is pending. Called from the TIM5 update callback.
+ * @param eeprom Pointer to the Eeprom24xx structure.
  */
-EepromReturn EepromRead(Eeprom24xx* eeprom, bool b0, short eeprom_address, size_t len);
+void EepromIrqPollTimer(Eeprom24xx* eeprom);
 
-#endif // _24XX_EEPROM_H
\ No newline at end of file
+#endif // _24XX_EEPROM_H
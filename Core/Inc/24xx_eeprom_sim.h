@@ -0,0 +1,123 @@
+/**
+ * @file 24xx_eeprom_sim.h
+ * @brief In-memory 24xx1025 behind the HAL I2C memory API, for host builds.
+ *
+ * Build 24xx_eeprom_sim.c with EEPROM_SIM defined in place of
+ * stm32f7xx_hal_i2c.c, stm32f7xx_hal_i2c_ex.c and the HAL tick, and the EEPROM
+ * driver and everything queueing jobs on it run against a RAM model of the
+ * part. aux/eepromsim is that host build, with its tests and benchmarks.
+ *  - two 64 KB blocks selected by B0, A0/A1 compared against the strapping
+ *  - writes wrap inside their 128 byte page, sequential reads inside their block
+ *  - after a write the part NACKs its address for tWC, like the real one
+ *  - transfers take as long as their bytes need at the TIMINGR bus speed
+ *  - TIM5 counts microseconds in one pulse mode, like the driver sets it up
+ *
+ * Nothing completes inside a HAL call. EepromSimAdvance moves simulated time
+ * and delivers the I2C and TIM5 callbacks from the caller's context, so the
+ * host loop plays the part of the interrupts. Reading HAL_GetTick or the DWT
+ * cycle counter costs EEPROM_SIM_CLOCK_US of simulated time, so code spinning
+ * on a deadline sees its transfers complete, and EepromJobWait advances time
+ * itself. Callbacks are never delivered while the firmware masks interrupts or
+ * from inside another callback. Faults can be injected on a chosen transfer to
+ * exercise NACK polling and bus recovery.
+ */
+
+#ifndef _24XX_EEPROM_SIM_H
+#define _24XX_EEPROM_SIM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "main.h"
+#include "24xx_eeprom.h"
+
+#define EEPROM_SIM_TWC_US        5000    /**< Internal write cycle, the 24xx1025 datasheet maximum. */
+#define EEPROM_SIM_I2C_CLK_HZ    54000000 /**< I2C1 kernel clock, PCLK1. */
+#define EEPROM_SIM_BITS_PER_BYTE 9       /**< Eight data bits and the ACK. */
+#define EEPROM_SIM_CLOCK_US      1       /**< Simulated time a read of the HAL tick or the cycle counter costs. */
+#define EEPROM_SIM_CORE_MHZ      216     /**< Core clock the cycle counter runs at. */
+
+typedef enum {
+    EEPROM_SIM_FAULT_NONE,      /**< Transfers behave. */
+    EEPROM_SIM_FAULT_NACK,      /**< The control byte is NACKed as if a write cycle were running. */
+    EEPROM_SIM_FAULT_BUS_ERROR, /**< The transfer ends with a misplaced START/STOP. */
+    EEPROM_SIM_FAULT_CORRUPT    /**< A read completes with one bit flipped. */
+} EepromSimFault;
+
+typedef struct {
+    bool a0;                                /**< Strapping of A0. */
+    bool a1;                                /**< Strapping of A1. */
+    uint8_t mem[2][EEPROM_BLOCK_SIZE];      /**< Contents of both blocks. */
+    I2C_TypeDef regs;                       /**< Register block the I2C handle is pointed at. */
+    TIM_TypeDef tim;                        /**< Register block of htim5, CNT counts microseconds while CEN is set. */
+    DWT_Type dwt;                           /**< Cycle counter, follows simulated time. */
+    uint32_t primask;                       /**< Interrupt mask of the host CMSIS shim, no callback while it is set. */
+    bool in_irq;                            /**< A callback is running, simulated time stands still. */
+    uint32_t clock_reads;                   /**< Clock reads inside callbacks, each one a cycle so spin loops end. */
+    bool fast_mode_plus;                    /**< FM+ drivers enabled, informational only. */
+    uint64_t now_us;                        /**< Simulated time. */
+    uint64_t busy_until_us;                 /**< End of the internal write cycle. */
+    // Transfer in flight
+    I2C_HandleTypeDef* hi2c;                /**< Handle the transfer belongs to, NULL when idle. */
+    bool read;                              /**< Direction of the transfer. */
+    bool b0;                                /**< Block of the transfer. */
+    uint16_t address;                       /**< First byte of the transfer. */
+    uint8_t* data;                          /**< Caller buffer. */
+    uint16_t len;                           /**< Bytes of the transfer. */
+    uint32_t error;                         /**< HAL_I2C_ERROR_* the transfer ends with, 0 on success. */
+    bool corrupt;                           /**< A bit of the read data gets flipped. */
+    uint64_t done_us;                       /**< When the transfer completes. */
+    // Fault injection
+    EepromSimFault fault;                   /**< Fault armed for a later transfer. */
+    uint32_t fault_after;                   /**< Transfers still to go before the fault fires. */
+    // Statistics
+    uint32_t transfers;                     /**< Transfers started. */
+    uint32_t nacks;                         /**< Control bytes NACKed, injected ones included. */
+    uint32_t write_cycles;                  /**< Internal write cycles, one per write transfer. */
+    uint32_t bytes_written;                 /**< Bytes committed to the array. */
+    uint32_t bytes_read;                    /**< Bytes returned by reads. */
+    uint32_t timer_fires;                   /**< TIM5 updates delivered. */
+} EepromSim;
+
+extern EepromSim eeprom_sim;
+
+/**
+ * @brief Erases the simulated part to 0xFF and resets time and statistics.
+ * @param a0 Strapping of A0, has to match the driver for the part to answer.
+ * @param a1 Strapping of A1.
+ */
+void EepromSimInit(bool a0, bool a1);
+
+/**
+ * @brief Moves simulated time forward, delivering every completion that falls due.
+ * @param us Microseconds to advance.
+ */
+void EepromSimAdvance(uint32_t us);
+
+/**
+ * @brief Current simulated time.
+ * @return uint64_t Microseconds since EepromSimInit.
+ */
+uint64_t EepromSimNowUs(void);
+
+/**
+ * @brief DWT of the simulated core, the host CMSIS shim points DWT at it.
+ * @return DWT_Type* Register block with CYCCNT brought up to date.
+ */
+DWT_Type* EepromSimDwt(void);
+
+/**
+ * @brief Arms a fault for one upcoming transfer.
+ * @param fault The fault, EEPROM_SIM_FAULT_NONE disarms.
+ * @param after Transfers the part answers to let through first, 0 hits the next one. NACKs of a write cycle don't count.
+ */
+void EepromSimInjectFault(EepromSimFault fault, uint32_t after);
+
+/**
+ * @brief SCL period the handle's TIMINGR produces, synchronisation and rise time ignored.
+ * @param hi2c I2C handle initialised by the simulator.
+ * @return uint32_t Nanoseconds per bit.
+ */
+uint32_t EepromSimBitNs(I2C_HandleTypeDef* hi2c);
+
+#endif // _24XX_EEPROM_SIM_H
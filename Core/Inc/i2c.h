@@ -35,6 +35,15 @@ extern "C" {
 extern I2C_HandleTypeDef hi2c1;
 
 /* USER CODE BEGIN Private defines */
+// I2C1 TIMINGR values for the 54 MHz PCLK1 with the analog filter on
+#define I2C1_TIMING_100K  0x20404768  /* Standard mode */
+#define I2C1_TIMING_400K  0x6000030D  /* Fast mode, ~200 kHz on the bus with the 10K pull-ups */
+#define I2C1_TIMING_1M    0x00900F1B  /* Fast mode plus, needs the FM+ drivers on PB6/PB7 */
+
+// I2C1 pins, driven as GPIO during a bus recovery
+#define I2C1_GPIO_PORT    GPIOB
+#define I2C1_SCL_PIN      GPIO_PIN_6
+#define I2C1_SDA_PIN      GPIO_PIN_7
 
 /* USER CODE END Private defines */
 
@@ -3,6 +3,18 @@
  * @brief Header file for ICE decompression utility.
  *
  * This file provides the necessary declarations for the ICE decompression utility.
+ * The decoder works straight on the compressed image in memory: input bits are
+ * pulled from a 64 bit reservoir refilled a byte at a time, opcodes are decoded
+ * with a single count-leading-zeros and zero runs are emitted as whole bytes.
+ * Output is staged in a caller buffer and handed to the sink
+ * ICEUNCOMPR_OUT_CHUNK bytes at a time; the sink returns the buffer to fill
+ * next, so a sink can drain one buffer by DMA while the decoder fills another.
+ * An optional input source supplies the image block by block once the first
+ * block runs out, so the image can be decoded while it is still being read.
+ * ice_resume runs the decoder until the source or the sink has to wait and
+ * picks up where it stopped on the next call, so it can be stepped from a
+ * main loop; ice_uncompress simply calls it until the image is done.
+ * Nothing in here touches the hardware, so the same file builds on a host.
  */
 
 #ifndef ICEUNCOMPR_H
@@ -14,7 +26,29 @@
 #include <string.h>
 #include <stdbool.h>
 
-#include "spi.h"
+#define ICEUNCOMPR_OUT_CHUNK 256 ///< Bytes staged before the sink is called.
+#define ICEUNCOMPR_OUT_SLACK 8   ///< Bytes a decoder step may stage past the chunk.
+#define ICEUNCOMPR_OUT_BUF (ICEUNCOMPR_OUT_CHUNK + ICEUNCOMPR_OUT_SLACK) ///< Size of each staging buffer.
+#define ICEUNCOMPR_SOURCE_WAIT UINT32_MAX ///< Source return, the next block is not there yet.
+#define ICEUNCOMPR_BLOCKED 3     ///< ice_resume return, waiting on the source or the sink.
+
+/**
+ * Output sink for decompressed bytes.
+ * @param ctx The output_ctx of the decompressor.
+ * @param data Full staging buffer, owned by the sink until the sink hands it out again.
+ * @param len Number of bytes, at most ICEUNCOMPR_OUT_CHUNK.
+ * @return Buffer of ICEUNCOMPR_OUT_BUF bytes to stage the next bytes in, data if it was consumed during the call,
+ *         NULL if the sink cannot take data yet; the same buffer is offered again by the next ice_resume.
+ */
+typedef uint8_t *(*IceuncomprSink)(void *ctx, uint8_t *data, uint32_t len);
+
+/**
+ * Input source for the next block of the compressed image.
+ * @param ctx The input_ctx of the decompressor.
+ * @param data Set to the next block, which must stay valid until the source is called again.
+ * @return Number of bytes in the block, zero at the end of the image, ICEUNCOMPR_SOURCE_WAIT to be asked again later.
+ */
+typedef uint32_t (*IceuncomprSource)(void *ctx, const uint8_t **data);
 
 /**
  * @struct Iceuncompr
@@ -24,59 +58,52 @@
  * and variables for tracking the state of the decompression process.
  */
 typedef struct {
-    FILE *input_data_fh;       ///< Input data file handle.
-    uint8_t *output_data;      ///< Pointer to the output data buffer. Ensure to free after use.
-    uint32_t input_data_size;  ///< Size of the input data buffer.
-    uint32_t read_bitcounter;  ///< Counter for bits read from the input buffer.
-    uint32_t read_buffer;      ///< Buffer for storing the currently read bits.
-    uint32_t write_bitcounter; ///< Counter for bits written to the output buffer.
-    uint8_t write_buffer;      ///< Buffer for storing the currently written bits.
-    uint32_t write_position;   ///< Current position in the output buffer.
+    const uint8_t *input;      ///< Next unread byte of the compressed image.
+    const uint8_t *input_end;  ///< One past the last byte of the current input block.
+    IceuncomprSource input_source; ///< Supplies the blocks after the first, NULL for a single block.
+    void *input_ctx;           ///< Passed to the input source.
+    uint64_t read_buffer;      ///< Bit reservoir, the next bit is the MSB.
+    uint32_t read_bitcounter;  ///< Valid bits in the reservoir.
+    uint32_t write_buffer;     ///< Output bits not yet forming a byte, right aligned.
+    uint32_t write_bitcounter; ///< Number of bits in write_buffer, always below 8 between calls.
+    uint32_t write_position;   ///< Bytes staged in output_data.
+    uint32_t output_total;     ///< Bytes handed to the sink so far.
+    uint8_t *output_data;      ///< Staging buffer of ICEUNCOMPR_OUT_BUF bytes, swapped by the sink.
+    IceuncomprSink output;     ///< Output sink for decompressed bytes, required.
+    void *output_ctx;          ///< Passed to the output sink.
+    bool input_wait;           ///< The last ice_resume stopped waiting on the source.
+    uint8_t state;             ///< Step ice_resume carries on with.
+    uint8_t opcode;            ///< Leading ZERO bits of the opcode being expanded.
+    uint32_t run;              ///< Bits of the opcode left to expand.
 } Iceuncompr;
 
 /**
- * Reads a bit from the input stream.
+ * Starts a new image, input and output must be set up before the first ice_resume.
  * @param ice Pointer to Iceuncompr structure.
- * @return The read bit, or EOF on error.
  */
-int read_bit(Iceuncompr *ice);
+void ice_start(Iceuncompr *ice);
 
 /**
- * Writes a bit to the output buffer.
- * @param ice Pointer to Iceuncompr structure.
- * @param value The bit value to write.
+ * Decodes until the image is done or the source or the sink has to wait.
+ * @param ice Pointer to Iceuncompr structure, started with ice_start.
+ * @return Zero once the image is done, ICEUNCOMPR_BLOCKED to be called again, otherwise as ice_uncompress.
  */
-void write_bit(Iceuncompr *ice, int value);
-
-/**
- * Reads an integer of specified bit length from the input stream.
- * @param ice Pointer to Iceuncompr structure.
- * @param bits The number of bits to read.
- * @return The read integer, or EOF on error.
- */
-int read_int(Iceuncompr *ice, int bits);
-
-/**
- * Writes a specified number of zero bits to the output buffer.
- * @param ice Pointer to Iceuncompr structure.
- * @param bits The number of zero bits to write.
- */
-void write_zeros(Iceuncompr *ice, int bits);
+int ice_resume(Iceuncompr *ice);
 
 /**
  * Main function for decompressing ICE-compressed data.
- * @param ice Pointer to Iceuncompr structure.
- * @return Zero on success, non-zero on failure.
+ * @param ice Pointer to Iceuncompr structure, input and output already set up.
+ * @return Zero on success, 1 on a bad magic, 2 if the input ends inside an opcode.
  */
 int ice_uncompress(Iceuncompr *ice);
 
 /**
  * Writes decompressed bitstream.
- * @param ice Pointer to Iceuncompr structure.
- * @param input_data Pointer to input data buffer.
+ * @param ice Pointer to Iceuncompr structure with the output sink and first staging buffer set.
+ * @param input_data Pointer to input data buffer, may be NULL if the input source supplies the whole image.
  * @param size Size of input data.
  * @return True on success, false on failure.
  */
-bool WriteUncomprBitstream(Iceuncompr *ice, uint8_t *input_data, uint32_t size);
+bool WriteUncomprBitstream(Iceuncompr *ice, const uint8_t *input_data, uint32_t size);
 
-#endif // ICEUNCOMPR_H
\ No newline at end of file
+#endif // ICEUNCOMPR_H
@@ -4,6 +4,34 @@
  * 
  * This file contains the declarations for the LatticeIceHX type and functions
  * for initializing and managing the Lattice ICE40HX FPGA.
+ *
+ * Configuration is a three stage pipeline: the EEPROM driver DMAs the next
+ * compressed blocks into a ring while the current block is decompressed, and
+ * SPI4 DMA drains one output buffer while the decompressor fills the other.
+ * Boot time is then bounded by the slowest stage instead of the sum of all
+ * three; FPGABootStats records where the time went. An intact copy of the
+ * image in the internal flash cache replaces the EEPROM stage entirely.
+ *
+ * When the EEPROM holds a SHA-256 of the image, every block is hashed as it
+ * arrives and the last block is only released to the decompressor once the
+ * digest matches, so a corrupted image never completes a configuration.
+ *
+ * There are two bitstream slots, A in EEPROM bank 1 and B in bank 0 behind the
+ * config area, and a slot table in the config shadow. An upload always goes
+ * to the slot that is not active and is marked pending; the next configuration
+ * tries it first and only makes it the active slot once CDONE went high. If
+ * it fails the table rolls back and the active slot is loaded instead, so an
+ * interrupted or broken upload never takes the keyboard down.
+ *
+ * Slots are ranges of the linear EEPROM address space, B0 being address bit
+ * 16. An image larger than a slot starts in slot B and runs on across the
+ * block boundary through slot A. It replaces every image it overlaps, so such
+ * an upload has nothing to roll back to.
+ *
+ * Nothing in here blocks: a configuration is a state machine stepped by
+ * FPGAService from the main loop. The reset delays are tick deadlines, the
+ * decompressor yields whenever the next EEPROM block or an SPI4 buffer is not
+ * ready yet, and CDONE is polled, so USB and the shell stay responsive.
  */
 
 #ifndef LATTICE_ICE_HX_H
@@ -13,11 +41,30 @@
 #include <main.h>
 #include "24xx_eeprom.h"
 #include "iceuncompr.h"
+#include "nyan_config.h"
+#include "nyan_flash_cache.h"
+#include "nyan_kv.h"
+#include "nyan_sha256.h"
 
 // External references for EEPROM and uncompression module.
 extern Eeprom24xx nos_eeprom;
+extern NyanConfig nos_config;
+extern NyanKv nos_kv;
 extern Iceuncompr ice_uncompr;
 
+#define FPGA_SPI_BUFFERS    2   ///< Output buffers, one is filled while SPI4 DMA drains the other.
+#define FPGA_SPI_TIMEOUT_MS 10  ///< Longest wait for a buffer to drain, a chunk takes ~0.3ms at 6.75Mbit/s.
+#define FPGA_RX_BLOCK       512 ///< Compressed bytes per EEPROM read, whole cache lines so it is DMAed in place.
+#define FPGA_RX_BLOCKS      4   ///< EEPROM reads kept in flight ahead of the decompressor.
+#define FPGA_CDONE_TIMEOUT_MS 100 ///< Longest wait for CDONE after the trailing dummy bytes.
+#define FPGA_RESET_MS       1   ///< CRESET_B low time, much longer than the needed 200ns.
+#define FPGA_CLEAR_MS       3   ///< Configuration memory clear time after CRESET_B goes high.
+#define FPGA_SPI_BUFFER     ((ICEUNCOMPR_OUT_BUF + 31) & ~31) ///< Staging buffer rounded up to whole cache lines.
+#define FPGA_DIGEST_TAG     0x32414853 ///< "SHA2" in the legacy bitstream length line, a digest is stored.
+#define FPGA_SLOTS          2   ///< Bitstream slots in the EEPROM.
+#define FPGA_SLOT_MAGIC     0x544C5346 ///< "FSLT", its first byte is never a valid key-value record key.
+#define FPGA_SLOT_SYNC_MS   50  ///< Longest wait for a digest to reach the EEPROM before the table points at it.
+
 /**
  * @enum FPGAReturn
  * @brief Enumerates the possible return values for FPGA operations.
@@ -27,51 +74,288 @@ typedef enum {
     FPGA_SUCCESS
 } FPGAReturn;
 
+/**
+ * @enum FPGAState
+ * @brief Step of the configuration FPGAService carries on with.
+ */
+typedef enum {
+    FPGA_STATE_IDLE,   ///< Nothing configured yet, waiting for a request.
+    FPGA_STATE_RESET,  ///< CRESET_B held low.
+    FPGA_STATE_CLEAR,  ///< Configuration memory clearing.
+    FPGA_STATE_STREAM, ///< Bitstream decompressed and sent as it arrives.
+    FPGA_STATE_DRAIN,  ///< Last chunk and EEPROM reads in flight finishing.
+    FPGA_STATE_CDONE,  ///< Trailing dummy bytes sent, waiting for CDONE.
+    FPGA_STATE_DONE,   ///< Configured.
+    FPGA_STATE_FAILED  ///< Every slot failed, held in reset until a new request.
+} FPGAState;
+
+/**
+ * @enum FPGASource
+ * @brief Where the compressed bitstream of a configuration was read from.
+ */
+typedef enum {
+    FPGA_SOURCE_EEPROM, ///< Streamed from EEPROM bank 1.
+    FPGA_SOURCE_FLASH   ///< Memory mapped copy in the internal flash cache.
+} FPGASource;
+
+/**
+ * @enum FPGACacheUpdate
+ * @brief What happened to the flash cache after the configuration.
+ */
+typedef enum {
+    FPGA_CACHE_NONE,    ///< Not touched, the image came from it or has no digest.
+    FPGA_CACHE_PENDING, ///< The next boot copies the image the FPGA started from.
+    FPGA_CACHE_UPDATED, ///< Copied at this boot, the image came from it.
+    FPGA_CACHE_FAILED   ///< The copy at this boot failed, the image came from the EEPROM.
+} FPGACacheUpdate;
+
+/**
+ * @enum FPGASlot
+ * @brief Bitstream slots.
+ */
+typedef enum {
+    FPGA_SLOT_A,            ///< EEPROM bank 1 from ADDR_FPGA_BITSTREAM.
+    FPGA_SLOT_B,            ///< EEPROM bank 0 from ADDR_FPGA_BITSTREAM_B.
+    FPGA_SLOT_NONE = 0xFF   ///< No slot.
+} FPGASlot;
+
+/**
+ * @struct FPGASlotTable
+ * @brief Slot table at ADDR_FPGA_SLOT_TABLE, one config shadow line pair.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;             ///< FPGA_SLOT_MAGIC.
+    uint8_t  active;            ///< Slot that last reached CDONE.
+    uint8_t  pending;           ///< Uploaded slot not yet configured, FPGA_SLOT_NONE if none.
+    uint8_t  digests;           ///< Bit per slot, its SHA-256 is stored.
+    uint8_t  reserved0;
+    uint32_t size[FPGA_SLOTS];  ///< Compressed image size per slot, 0 if empty.
+    uint32_t sequence;          ///< Bumped on every change of the table.
+    uint8_t  reserved1[8];
+    uint32_t crc;               ///< CRC-32 of the bytes before it.
+} FPGASlotTable;
+
+/**
+ * @enum FPGAError
+ * @brief Why the last configuration failed.
+ */
+typedef enum {
+    FPGA_ERROR_NONE,     ///< Configured.
+    FPGA_ERROR_NO_IMAGE, ///< No bitstream length stored.
+    FPGA_ERROR_EEPROM,   ///< An EEPROM read failed.
+    FPGA_ERROR_DIGEST,   ///< The image does not match the stored SHA-256.
+    FPGA_ERROR_DECODE,   ///< The image is not a valid compressed bitstream.
+    FPGA_ERROR_CDONE,    ///< The FPGA did not raise CDONE.
+    FPGA_ERROR_SPI       ///< A configuration chunk failed or timed out on SPI4.
+} FPGAError;
+
+/**
+ * @struct FPGABootStats
+ * @brief Stage timings of the last configuration, all in microseconds.
+ */
+typedef struct {
+    bool     ok;             ///< The whole image was decompressed and sent.
+    FPGAError error;         ///< Why the configuration failed.
+    bool     verified;       ///< The image matched the stored SHA-256.
+    FPGASlot slot;           ///< Slot the image came from.
+    FPGASlot rejected;       ///< Pending slot that failed and was rolled back, FPGA_SLOT_NONE if none.
+    FPGAError rejected_error; ///< Why the rejected slot failed.
+    FPGASource source;       ///< Where the image came from.
+    uint32_t cache_version;  ///< Version of the flash copy used, 0 if read from the EEPROM.
+    FPGACacheUpdate cache_update; ///< Copy of the image into the flash cache.
+    uint32_t bytes_in;       ///< Compressed bytes read from the EEPROM.
+    uint32_t bytes_out;      ///< Configuration bytes sent to the FPGA.
+    uint32_t total_us;       ///< Request picked up to CDONE, across every attempt.
+    uint32_t eeprom_us;      ///< First EEPROM read submitted to the last one done.
+    uint32_t eeprom_wait_us; ///< Decompressor stalled waiting for EEPROM reads.
+    uint32_t decode_us;      ///< Decompressor running, stalls excluded.
+    uint32_t spi_us;         ///< First SPI4 DMA started to the last one done.
+    uint32_t spi_wait_us;    ///< Decompressor stalled waiting for an output buffer.
+    uint32_t spi_chunks;     ///< Buffers sent by DMA.
+    uint32_t spi_errors;     ///< Refused, failed or timed out DMA transfers, only a refused chunk is sent again blocking.
+} FPGABootStats;
+
 /**
  * @struct LatticeIceHX
  * @brief Represents the state and data for an ICE40HX FPGA.
  * 
  * This structure holds information about the FPGA configuration status,
- * the size of the compressed bitstream, and a pointer to the bitstream data.
+ * the size of the compressed bitstream and the buffers of the configuration
+ * pipeline.
  */
 typedef struct {
     bool configured;
-    uint16_t bitstream_compressed_size;
-    uint8_t* p_bitstream_compressed;
+    volatile FPGAState state;          ///< Step of the configuration in progress.
+    volatile bool requested;           ///< A configuration starts once the one in progress is done.
+    bool trying_pending;               ///< The attempt in progress is the pending slot.
+    FPGACacheUpdate cache_boot;        ///< What FPGACacheBoot did with the flash cache.
+    FPGASlot rejected;                 ///< Pending slot rolled back by this configuration.
+    FPGAError rejected_error;          ///< Why the rejected slot failed.
+    uint32_t state_tick;               ///< HAL tick the reset delays and CDONE wait run from.
+    FPGASlotTable slots;               ///< Copy of the slot table.
+    FPGASlot slot;                     ///< Slot being configured from.
+    FPGASlot upload_slot;              ///< Slot of the upload in progress.
+    bool upload_unprotected;           ///< The upload in progress overwrites the active image.
+    volatile bool uploading;           ///< An upload owns the slot table, no configuration starts until it ends.
+    uint32_t bitstream_compressed_size;
+    uint8_t digest[SHA256_BLOCK_SIZE]; ///< Stored SHA-256 of the compressed image.
+    bool has_digest;                   ///< The EEPROM holds a digest for this image.
+    SHA256_CTX sha;                    ///< Running hash of the blocks read so far.
+    uint8_t spi_buf[FPGA_SPI_BUFFERS][FPGA_SPI_BUFFER] EEPROM_DMA_ALIGNED; ///< Cache line aligned for DMA
+    uint8_t rx_buf[FPGA_RX_BLOCKS][FPGA_RX_BLOCK] EEPROM_DMA_ALIGNED;         ///< Ring of compressed blocks
+    EepromJob rx_job[FPGA_RX_BLOCKS];  ///< Read of each ring slot.
+    EepromJob rx_tail[FPGA_RX_BLOCKS]; ///< Part of a read past the end of EEPROM block 0.
+    uint16_t rx_blocks;                ///< Blocks in the compressed image.
+    uint16_t rx_block;                 ///< Next block handed to the decompressor.
+    bool rx_recycled;                  ///< The slot of the block before rx_block took its next read.
+    volatile bool spi_busy;            ///< A buffer is being drained by SPI4 DMA.
+    uint32_t spi_tick;                 ///< HAL tick the DMA in flight started.
+    uint32_t start_cycles;             ///< Cycle count the configuration was picked up.
+    uint32_t rx_start_cycles;          ///< Cycle count of the first EEPROM read.
+    volatile uint32_t rx_done_cycles;  ///< Cycle count of the last completed EEPROM read.
+    volatile uint32_t spi_done_cycles; ///< Cycle count of the last completed SPI4 DMA.
+    uint32_t spi_start_cycles;         ///< Cycle count of the first SPI4 DMA.
+    uint32_t eeprom_wait_cycles;       ///< Decompressor stalls on EEPROM reads.
+    uint32_t spi_wait_cycles;          ///< Decompressor stalls on output buffers.
+    uint32_t decode_cycles;            ///< Decompressor running.
+    uint32_t yield_cycles;             ///< Cycle count the decompressor last yielded.
+    bool yield_input;                  ///< It yielded waiting on the EEPROM, not SPI4.
+    FPGABootStats stats;               ///< Timings of the last configuration.
 } LatticeIceHX;
 
 /**
- * @brief Initializes the FPGA.
+ * @brief Steps the FPGA configuration, call it from the main loop.
+ * 
+ * A requested configuration streams the compressed bitstream from EEPROM,
+ * decompresses it block by block and writes it to the FPGA with SPI4 DMA, all
+ * three stages overlapped. Each call does the work that is ready and returns.
+ * A flash copy that fails is invalidated and the EEPROM is tried once. A
+ * pending slot is tried first and committed as active on CDONE, or rolled
+ * back to the active slot. On failure the FPGA is held in reset.
+ *
+ * An image that configured the FPGA from the EEPROM is marked for the flash
+ * cache in the key-value log, FPGACacheBoot copies it at the next boot.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ * @return FPGAState FPGA_STATE_DONE once configured, FPGA_STATE_FAILED if no image could be read, verified,
+ *         decompressed or raised CDONE, otherwise the step in progress.
+ */
+FPGAState FPGAService(LatticeIceHX* fpga);
+
+/**
+ * @brief Copies the active image into the flash cache if the last boot asked for it.
+ * 
+ * Blocks for the EEPROM read and the sector erase, up to 3 s, and stalls
+ * every interrupt while the sector is erased. Call it once at boot, after
+ * the key-value log is loaded and before USB and the key scan start. The
+ * request is cleared whatever the outcome, a copy that fails is not retried
+ * until the FPGA starts from the EEPROM again.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ */
+void FPGACacheBoot(LatticeIceHX* fpga);
+
+/**
+ * @brief Asks for a configuration, FPGAService starts it once the one in progress is done.
  * 
- * This function performs the initial configuration of the FPGA. It disables
- * the DCache, fetches and uncompresses the bitstream from EEPROM, and writes
- * it to the FPGA.
+ * @param fpga Pointer to an LatticeIceHX structure.
+ */
+void FPGARequestConfig(LatticeIceHX* fpga);
+
+/**
+ * @brief Checks whether a configuration is in progress.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ * @return bool True between the start of a configuration and CDONE or its failure.
+ */
+bool FPGABusy(const LatticeIceHX* fpga);
+
+/**
+ * @brief Progress of the configuration in progress.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ * @return uint8_t Percentage of the compressed image taken by the decompressor.
+ */
+uint8_t FPGAProgress(const LatticeIceHX* fpga);
+
+/**
+ * @brief Loads the slot table from the config shadow.
+ * 
+ * Without a valid table the image described by the legacy bitstream length
+ * line is slot A and active.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ */
+void FPGASlotTableLoad(LatticeIceHX* fpga);
+
+/**
+ * @brief Where a slot lives in the EEPROM.
+ * 
+ * @param slot Bitstream slot.
+ * @param address Set to the linear EEPROM address of the slot.
+ * @return uint32_t Largest image the slot holds without running into the next one.
+ */
+uint32_t FPGASlotLocate(FPGASlot slot, uint32_t* address);
+
+/**
+ * @brief Picks the slot a new upload goes to.
+ * 
+ * That is the slot that is not active if the image fits it, otherwise the
+ * slot it does fit, slot B for an image larger than either slot.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ * @param size Compressed image size.
+ * @return FPGASlot Slot the next upload is written to, FPGA_SLOT_NONE if the image does not fit the EEPROM.
+ */
+FPGASlot FPGASlotUploadTarget(LatticeIceHX* fpga, uint32_t size);
+
+/**
+ * @brief Empties the upload slot, and every slot the image overlaps, before the pages are overwritten.
+ * 
+ * Sets fpga->upload_unprotected if that includes the active slot. From here
+ * until FPGASlotUploadFinish or FPGASlotUploadAbort the upload owns the slot
+ * table, a requested configuration waits for it. Called from the shell
+ * interrupt, which the main loop can't preempt.
+ * 
+ * @param fpga Pointer to an LatticeIceHX structure.
+ * @param size Compressed image size.
+ * @return FPGAReturn FPGA_FAILURE if a configuration is in progress or the image does not fit the slot.
+ */
+FPGAReturn FPGASlotUploadBegin(LatticeIceHX* fpga, uint32_t size);
+
+/**
+ * @brief Ends an upload that will not be finished, the slots it emptied stay empty.
  * 
  * @param fpga Pointer to an LatticeIceHX structure.
- * @return FPGAReturn Indicates the success or failure of the operation.
  */
-FPGAReturn FPGAInit(LatticeIceHX* fpga);
+void FPGASlotUploadAbort(LatticeIceHX* fpga);
 
 /**
- * @brief Fetches the compressed bitstream data for the FPGA from EEPROM.
+ * @brief Stores the digest of a completed upload and marks its slot pending.
  * 
- * This function reads the bitstream data from the EEPROM in chunks and
- * writes it to a buffer.
+ * The table only points at the slot once the digest has reached the EEPROM.
+ * The next configuration starts from it and commits or rolls back. Ends the
+ * upload either way.
  * 
  * @param fpga Pointer to an LatticeIceHX structure.
- * @return FPGAReturn Indicates the success or failure of the operation.
+ * @param size Compressed image size.
+ * @param digest SHA-256 of the image.
+ * @return FPGAReturn FPGA_FAILURE if the digest could not be stored, the slot stays empty.
  */
-FPGAReturn FPGAGetBitstreamData(LatticeIceHX* fpga);
+FPGAReturn FPGASlotUploadFinish(LatticeIceHX* fpga, uint32_t size, const uint8_t* digest);
 
 /**
- * @brief Obtains the size of the compressed bitstream from EEPROM.
+ * @brief Handles the SPI4 DMA transfer complete interrupt, releases the drained buffer.
  * 
- * This function reads the size of the compressed bitstream stored in the
- * EEPROM and updates the LatticeIceHX structure.
+ * @param fpga Pointer to an LatticeIceHX structure.
+ */
+void FPGAIrqTxComplete(LatticeIceHX* fpga);
+
+/**
+ * @brief Handles an SPI4 DMA transfer error, the configuration attempt fails.
  * 
  * @param fpga Pointer to an LatticeIceHX structure.
- * @return FPGAReturn Indicates the success or failure of the operation.
  */
-FPGAReturn FPGAGetBitstreamCompressedSize(LatticeIceHX* fpga);
+void FPGAIrqError(LatticeIceHX* fpga);
 
 #endif // LATTICE_ICE_HX_H
@@ -0,0 +1,65 @@
+/**
+ * @file nyan_bench.h
+ * @brief Built-in microbenchmarks timed with the core cycle counter.
+ *
+ * Each benchmark runs a fixed number of operations NYAN_BENCH_RUNS times and
+ * reports the fastest run, which filters out the key scan and USB interrupts
+ * that preempt a run. Running them with the caches toggled shows what each
+ * optimisation buys on the real part rather than in a simulator.
+ */
+
+#ifndef NYAN_BENCH_H
+#define NYAN_BENCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "24xx_eeprom.h"
+
+#define NYAN_BENCH_RUNS             5       /**< Runs per benchmark, the fastest one is reported. */
+#define NYAN_BENCH_KEY_STATES       64      /**< Random key matrices cycled through by the report benchmark. */
+#define NYAN_BENCH_SHA_BUF_SZ       1024    /**< Bytes hashed per SHA-256 operation, 16 block transforms. */
+#define NYAN_BENCH_ICE_STREAM_SZ    2048    /**< Size of the synthetic compressed bitstream. */
+
+/**
+ * @enum NyanBenchReturn
+ * @brief Return values for the benchmark functions.
+ */
+typedef enum {
+    NYAN_BENCH_FAILURE,
+    NYAN_BENCH_SUCCESS
+} NyanBenchReturn;
+
+/**
+ * @struct NyanBenchResult
+ * @brief Outcome of one benchmark.
+ */
+typedef struct {
+    const char* name;           /**< Name of the benchmark. */
+    uint32_t    iterations;     /**< Operations per run. */
+    uint32_t    cycles_per_op;  /**< Core cycles per operation of the fastest run. */
+    uint32_t    bytes_per_op;   /**< Bytes processed per operation, 0 if throughput is meaningless. */
+} NyanBenchResult;
+
+/**
+ * @brief Number of registered benchmarks.
+ */
+uint8_t NyanBenchCount(void);
+
+/**
+ * @brief Looks a benchmark up by name.
+ * @param name Benchmark name as printed in the results.
+ * @return Index of the benchmark, or NyanBenchCount() if there is no such benchmark.
+ */
+uint8_t NyanBenchFind(const char* name);
+
+/**
+ * @brief Runs one benchmark. Blocks for up to a few hundred milliseconds.
+ * @param idx Index of the benchmark, below NyanBenchCount().
+ * @param eeprom EEPROM used by the EEPROM benchmarks, must be idle.
+ * @param result Output, filled in on success.
+ * @return NyanBenchReturn NYAN_BENCH_FAILURE if the index is invalid or the benchmark failed.
+ */
+NyanBenchReturn NyanBenchRun(uint8_t idx, Eeprom24xx* eeprom, NyanBenchResult* result);
+
+#endif // NYAN_BENCH_H
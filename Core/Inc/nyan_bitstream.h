@@ -0,0 +1,118 @@
+/**
+ * @file nyan_bitstream.h
+ * @brief Streaming FPGA bitstream writer for the 24xx EEPROM.
+ *
+ * Bytes are pushed from the USB receive interrupt into a small ring of EEPROM
+ * page sized slots. NyanBitstreamWriterService hashes each completed page and
+ * queues it as an EEPROM job; the job completion callback frees the slot once
+ * the EEPROM accepted the page. Receiving the next pages overlaps with writing the
+ * previous ones, so an upload takes roughly max(receive, write) time while the
+ * RAM used is bounded by NYAN_BITSTREAM_BUF_SZ regardless of the image size.
+ * Pages are written with the driver compare option, so pages that did not
+ * change since the previous upload are not written again.
+ */
+
+#ifndef NYAN_BITSTREAM_H
+#define NYAN_BITSTREAM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "24xx_eeprom.h"
+#include "nyan_eeprom_map.h"
+#include "nyan_sha256.h"
+
+#define NYAN_BITSTREAM_PAGE_SZ          EEPROM_DRIVER_TX_BUF_SZ                   /**< One EEPROM page per slot. */
+#define NYAN_BITSTREAM_SLOTS            8                                         /**< Number of page slots in the receive ring. */
+#define NYAN_BITSTREAM_BUF_SZ           (NYAN_BITSTREAM_SLOTS * NYAN_BITSTREAM_PAGE_SZ)
+#define NYAN_BITSTREAM_MAX_SIZE         SIZE_FPGA_BITSTREAM_MAX                   /**< Slot B running on through slot A. */
+
+/**
+ * @enum NyanBitstreamReturn
+ * @brief Return values for the bitstream writer functions.
+ */
+typedef enum {
+    NYAN_BITSTREAM_FAILURE,
+    NYAN_BITSTREAM_SUCCESS
+} NyanBitstreamReturn;
+
+/**
+ * @struct NyanBitstreamWriter
+ * @brief State of a streaming bitstream upload.
+ *
+ * received is only advanced by the producer (USB interrupt) and written only by
+ * the consumer (the page job callback), so the ring needs no locking.
+ */
+typedef struct {
+    Eeprom24xx*       eeprom;                       /**< EEPROM the bitstream is written to. */
+    uint32_t          address;                      /**< Linear EEPROM address of the slot. */
+    uint8_t           buf[NYAN_BITSTREAM_BUF_SZ];   /**< Ring of page slots. */
+    uint32_t          size;                         /**< Announced size of the bitstream. */
+    volatile uint32_t received;                     /**< Bytes pushed into the ring. */
+    volatile uint32_t written;                      /**< Bytes committed to the EEPROM, always page aligned until done. */
+    uint32_t          hashed;                       /**< Bytes fed into the SHA-256 context. */
+    uint32_t          pages;                        /**< Pages committed to the EEPROM. */
+    uint32_t          pages_skipped;                /**< Pages the EEPROM already held, read back instead of written. */
+    volatile bool     active;                       /**< An upload is in progress. */
+    volatile bool     page_inflight;                /**< The page at written is queued or being transferred. */
+    volatile bool     failed;                       /**< A page could not be written, the upload is dead. */
+    EepromJob         page_job;                     /**< EEPROM job of the page at written. */
+    SHA256_CTX        ctx;                          /**< Running hash of the pages handed to the EEPROM. */
+} NyanBitstreamWriter;
+
+/**
+ * @brief Starts a new upload.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ * @param eeprom EEPROM the bitstream is written to.
+ * @param address Linear EEPROM address of the slot, write page aligned, see FPGASlotLocate.
+ * @param size Number of bytes that will be pushed, 1 to NYAN_BITSTREAM_MAX_SIZE and within the EEPROM.
+ * @return NyanBitstreamReturn NYAN_BITSTREAM_FAILURE if the size is out of range.
+ */
+NyanBitstreamReturn NyanBitstreamWriterOpen(NyanBitstreamWriter* writer, Eeprom24xx* eeprom, uint32_t address, uint32_t size);
+
+/**
+ * @brief Copies received bytes into the ring. Called from the USB receive interrupt.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ * @param data Received bytes.
+ * @param len Number of bytes in data.
+ * @return Number of bytes accepted. Bytes beyond the announced size or the free space are dropped.
+ */
+uint32_t NyanBitstreamWriterPush(NyanBitstreamWriter* writer, const uint8_t* data, uint32_t len);
+
+/**
+ * @brief Number of bytes the ring can accept right now.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ */
+uint32_t NyanBitstreamWriterFree(NyanBitstreamWriter* writer);
+
+/**
+ * @brief Advances the page pipeline by at most one step. Never blocks.
+ *
+ * Hashes and queues the next full page once the previous one has completed.
+ *
+ * @param writer Pointer to the NyanBitstreamWriter.
+ * @return NyanBitstreamReturn NYAN_BITSTREAM_FAILURE once a page could not be written.
+ */
+NyanBitstreamReturn NyanBitstreamWriterService(NyanBitstreamWriter* writer);
+
+/**
+ * @brief Returns true once every byte has been committed to the EEPROM.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ */
+bool NyanBitstreamWriterDone(NyanBitstreamWriter* writer);
+
+/**
+ * @brief Closes a completed upload and produces its SHA-256 digest.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ * @param digest Output, SHA256_BLOCK_SIZE bytes.
+ * @return NyanBitstreamReturn NYAN_BITSTREAM_FAILURE if the upload is not complete.
+ */
+NyanBitstreamReturn NyanBitstreamWriterFinish(NyanBitstreamWriter* writer, uint8_t* digest);
+
+/**
+ * @brief Abandons the upload. A page already handed to the DMA is left to complete.
+ * @param writer Pointer to the NyanBitstreamWriter.
+ */
+void NyanBitstreamWriterAbort(NyanBitstreamWriter* writer);
+
+#endif // NYAN_BITSTREAM_H
@@ -0,0 +1,102 @@
+/**
+ * @file nyan_config.h
+ * @brief Write-through RAM shadow of the EEPROM bank 0 configuration area.
+ *
+ * The board properties and reserved areas (bank 0, 0x0000 - 0x023F) are read
+ * once at boot with a single DMA transfer. Afterwards every lookup is served
+ * from RAM. Writes update the shadow immediately, mark the 16 byte lines
+ * whose contents changed dirty and queue an EEPROM job; the flush runs in the
+ * background and chains itself from the job callback until no dirty line is
+ * left. Writing bytes the shadow already holds never reaches the EEPROM.
+ *
+ * If the boot read fails the shadow is invalid and writes are refused until
+ * NyanConfigService, called from the main loop, gets a read through. It also
+ * retries flushes the EEPROM did not accept.
+ */
+
+#ifndef NYAN_CONFIG_H
+#define NYAN_CONFIG_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "24xx_eeprom.h"
+
+#define NYAN_CONFIG_SZ          0x240                                   /**< Shadowed bank 0 bytes, see nyan_eeprom_map.h. */
+#define NYAN_CONFIG_LINE_SZ     16                                      /**< Dirty tracking granularity, one map field. */
+#define NYAN_CONFIG_LINES       (NYAN_CONFIG_SZ / NYAN_CONFIG_LINE_SZ)  /**< Must fit the dirty bitmap. */
+#define NYAN_CONFIG_RETRY_MS    100                                     /**< Pause before a failed read or flush is tried again. */
+
+/**
+ * @enum NyanConfigReturn
+ * @brief Return values for the config shadow functions.
+ */
+typedef enum {
+    NYAN_CONFIG_FAILURE,
+    NYAN_CONFIG_SUCCESS
+} NyanConfigReturn;
+
+/**
+ * @struct NyanConfig
+ * @brief Shadow of the configuration area and its flush state.
+ */
+typedef struct {
+    Eeprom24xx*       eeprom;                                   /**< EEPROM behind the shadow. */
+    uint8_t           shadow[NYAN_CONFIG_SZ] EEPROM_DMA_ALIGNED;/**< Bank 0 bytes 0 to NYAN_CONFIG_SZ - 1. */
+    volatile uint64_t dirty;                                    /**< One bit per line changed since it was last flushed. */
+    volatile uint64_t flushing;                                 /**< Lines of the write in flight. */
+    EepromJob         flush_job;                                /**< Write of the lowest run of dirty lines. */
+    volatile bool     loaded;                                   /**< A read of the area succeeded, until then the shadow is zeroed and writes are refused. */
+    volatile bool     late_load;                                /**< Set when a retried read succeeds, reported once by NyanConfigService. */
+    volatile uint32_t retry_tick;                               /**< HAL tick of the last failed read or flush. */
+    uint32_t          flush_errors;                             /**< Flushes the EEPROM did not accept, the lines stay dirty. */
+} NyanConfig;
+
+/**
+ * @brief Loads the shadow with one bulk read. Blocks, boot only.
+ * @param config Pointer to the NyanConfig.
+ * @param eeprom EEPROM holding the configuration area.
+ * @return NyanConfigReturn NYAN_CONFIG_FAILURE if the EEPROM could not be read.
+ */
+NyanConfigReturn NyanConfigInit(NyanConfig* config, Eeprom24xx* eeprom);
+
+/**
+ * @brief Copies bytes out of the shadow.
+ * @param config Pointer to the NyanConfig.
+ * @param address Bank 0 address, e.g. ADDR_BOARD_OWNER.
+ * @param data Output buffer.
+ * @param len Number of bytes.
+ * @return NyanConfigReturn NYAN_CONFIG_FAILURE if the range is outside the shadow.
+ */
+NyanConfigReturn NyanConfigRead(NyanConfig* config, uint16_t address, void* data, uint16_t len);
+
+/**
+ * @brief Updates the shadow and queues the write to the EEPROM. Never blocks.
+ * @param config Pointer to the NyanConfig.
+ * @param address Bank 0 address, e.g. ADDR_BOARD_OWNER.
+ * @param data New bytes.
+ * @param len Number of bytes.
+ * @return NyanConfigReturn NYAN_CONFIG_FAILURE if the range is outside the shadow or the shadow was never loaded.
+ */
+NyanConfigReturn NyanConfigWrite(NyanConfig* config, uint16_t address, const void* data, uint16_t len);
+
+/**
+ * @brief Starts writing dirty lines unless a flush is already in flight. Called by NyanConfigWrite.
+ * @param config Pointer to the NyanConfig.
+ */
+void NyanConfigFlush(NyanConfig* config);
+
+/**
+ * @brief Retries a failed boot read or flush once NYAN_CONFIG_RETRY_MS have passed. Main loop only.
+ * @param config Pointer to the NyanConfig.
+ * @return True once, right after a retried read loaded the shadow, so the caller can set up what it missed at boot.
+ */
+bool NyanConfigService(NyanConfig* config);
+
+/**
+ * @brief Returns true once every write has reached the EEPROM.
+ * @param config Pointer to the NyanConfig.
+ */
+bool NyanConfigClean(NyanConfig* config);
+
+#endif // NYAN_CONFIG_H
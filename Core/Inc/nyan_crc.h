@@ -0,0 +1,41 @@
+/**
+ * @file nyan_crc.h
+ * @brief CRC-32 (IEEE 802.3) helpers for NyanOS.
+ *
+ * Table driven, reflected CRC-32 with polynomial 0xEDB88320. Used to protect
+ * binary frames on the CDC link and records stored in the EEPROM.
+ */
+
+#ifndef NYAN_CRC_H
+#define NYAN_CRC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NYAN_CRC32_INIT 0xFFFFFFFF /**< Starting value of a running CRC-32. */
+
+/**
+ * @brief Feeds more data into a running CRC-32.
+ * @param crc Running CRC, start with NYAN_CRC32_INIT.
+ * @param data Pointer to the data to be checksummed.
+ * @param len Number of bytes in data.
+ * @return The updated running CRC.
+ */
+uint32_t NyanCrc32Update(uint32_t crc, const uint8_t* data, size_t len);
+
+/**
+ * @brief Finalizes a running CRC-32.
+ * @param crc Running CRC returned by NyanCrc32Update.
+ * @return The final CRC-32 value.
+ */
+uint32_t NyanCrc32Final(uint32_t crc);
+
+/**
+ * @brief Computes the CRC-32 of a single buffer.
+ * @param data Pointer to the data to be checksummed.
+ * @param len Number of bytes in data.
+ * @return The CRC-32 value.
+ */
+uint32_t NyanCrc32(const uint8_t* data, size_t len);
+
+#endif // NYAN_CRC_H
@@ -0,0 +1,43 @@
+/**
+ * @file nyan_cycles.h
+ * @brief Core clock cycle counter (DWT CYCCNT) access.
+ *
+ * The counter runs at SystemCoreClock and wraps every ~20 s at 216 MHz, so
+ * differences of two readings are valid as long as the interval is shorter.
+ */
+
+#ifndef NYAN_CYCLES_H
+#define NYAN_CYCLES_H
+
+#include <stdint.h>
+#include <main.h>
+
+/**
+ * @brief Enables the DWT cycle counter. Safe to call more than once.
+ */
+static inline void NyanCyclesInit(void)
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    // The Cortex-M7 DWT is locked after reset
+    DWT->LAR = 0xC5ACCE55;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+ * @brief Returns the current cycle count.
+ */
+static inline uint32_t NyanCyclesNow(void)
+{
+    return DWT->CYCCNT;
+}
+
+/**
+ * @brief Converts a cycle count into microseconds at the current core clock.
+ * @param cycles Number of core clock cycles.
+ */
+static inline uint32_t NyanCyclesToUs(uint32_t cycles)
+{
+    return cycles / (SystemCoreClock / 1000000);
+}
+
+#endif // NYAN_CYCLES_H
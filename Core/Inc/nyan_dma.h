@@ -0,0 +1,76 @@
+/**
+ * @file nyan_dma.h
+ * @brief D-Cache coherency for DMA buffers.
+ *
+ * The D-Cache stays on all the time. Buffers a DMA engine owns for long
+ * stretches, or that the CPU only touches a few bytes of, live in the
+ * .dma_buffer section: SRAM2, which the MPU maps as non-cacheable, so neither
+ * side ever sees a stale line. Buffers the CPU works on heavily stay cacheable
+ * and are kept coherent with the range helpers below, which do nothing for an
+ * address the D-Cache never holds (DTCM or the .dma_buffer section).
+ *
+ * The USB middleware is regenerated by CubeMX, so none of this lives in it.
+ * The buffers it receives into or builds descriptors in are placed in DTCM
+ * by name in the linker script, CDC_Transmit cleans what NyanOS sends and
+ * the HID report sits in DTCM.
+ *
+ * The section is NOLOAD and zeroed by NyanDmaInit, like .bss.
+ */
+
+#ifndef NYAN_DMA_H
+#define NYAN_DMA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <main.h>
+
+#define NYAN_DMA_LINE       32          ///< Cortex-M7 D-Cache line size.
+#define NYAN_DMA_DTCM_BASE  0x20000000  ///< DTCM, never cached.
+#define NYAN_DMA_DTCM_SIZE  0x10000     ///< 64 KB of DTCM on the STM32F723.
+#define NYAN_DMA_BUFFER     __attribute__((section(".dma_buffer"), aligned(NYAN_DMA_LINE))) ///< Non-cacheable, zeroed at boot.
+
+/**
+ * @brief Maps the .dma_buffer section as non-cacheable and zeroes it.
+ *
+ * Must run before the D-Cache is enabled and before any buffer in the
+ * section is used.
+ */
+void NyanDmaInit(void);
+
+/**
+ * @brief Checks whether the D-Cache can hold any byte of a range.
+ * @param data First byte.
+ * @param len Number of bytes.
+ * @return True if the range is in DTCM or the .dma_buffer section, it needs no maintenance.
+ */
+bool NyanDmaCoherent(const void* data, uint32_t len);
+
+/**
+ * @brief Writes dirty lines of a range back before a DMA reads it.
+ * @param data First byte.
+ * @param len Number of bytes, the range is widened to whole lines.
+ */
+void NyanDmaClean(const void* data, uint32_t len);
+
+/**
+ * @brief Drops the lines of a range so the CPU reads what a DMA wrote.
+ *
+ * Lines shared with other data lose whatever the CPU wrote there, so the
+ * range must start and end on a line boundary.
+ *
+ * @param data First byte, line aligned.
+ * @param len Number of bytes, the range is widened to whole lines.
+ */
+void NyanDmaInvalidate(void* data, uint32_t len);
+
+/**
+ * @brief Writes back and drops the lines of a range before a DMA writes it.
+ *
+ * No dirty line can then be evicted on top of the DMA data.
+ *
+ * @param data First byte, line aligned.
+ * @param len Number of bytes, the range is widened to whole lines.
+ */
+void NyanDmaCleanInvalidate(void* data, uint32_t len);
+
+#endif // NYAN_DMA_H
@@ -11,29 +11,24 @@
 #define ADDR_TOTAL_TIMES_POWERED_ON     0x00A0
 #define ADDR_FPGA_BITSTREAM_LEN         0x00B0
 
-// Reserved Areas
-#define ADDR_RESERVED_0                 0x00C0 /*** Now used for storing Super Key Disablement State ***/
-#define ADDR_RESERVED_1                 0x00D0
-#define ADDR_RESERVED_2                 0x00E0
-#define ADDR_RESERVED_3                 0x00F0
-#define ADDR_RESERVED_4                 0x0100
-#define ADDR_RESERVED_5                 0x0110
-#define ADDR_RESERVED_6                 0x0120
-#define ADDR_RESERVED_7                 0x0130
-#define ADDR_RESERVED_8                 0x0140
-#define ADDR_RESERVED_9                 0x0150
-#define ADDR_RESERVED_10                0x0160
-#define ADDR_RESERVED_11                0x0170
-#define ADDR_RESERVED_12                0x0180
-#define ADDR_RESERVED_13                0x0190
-#define ADDR_RESERVED_14                0x01A0
-#define ADDR_RESERVED_15                0x01B0
-#define ADDR_RESERVED_16                0x01C0
-#define ADDR_RESERVED_17                0x01D0
-#define ADDR_RESERVED_18                0x01E0
-#define ADDR_RESERVED_19                0x01F0
-
-// FPGA Bitstream (bank 1)
+// Key-Value Log (see nyan_kv.h), formerly reserved areas 0-19
+#define ADDR_KV_LOG                     0x00C0
+
+// FPGA bitstream slots, the table says which one is active (see lattice_ice_hx.h)
+#define ADDR_FPGA_BITSTREAM_DIGEST      0x01C0
+#define ADDR_FPGA_SLOT_TABLE            0x01E0
+#define ADDR_FPGA_BITSTREAM_B_DIGEST    0x0200
+
+// I2C bus profile probe pattern and its CRC-32, past the config shadow (see 24xx_eeprom.h)
+#define ADDR_BUS_PROBE                  0x0240
+
+// Benchmark scratch page, first write page past the config shadow
+#define ADDR_BENCH_SCRATCH              0x0280
+
+// FPGA Bitstream slot B (bank 0) up to the end of the bank, an image larger than a slot runs on into bank 1
+#define ADDR_FPGA_BITSTREAM_B           0x0300
+
+// FPGA Bitstream slot A (bank 1)
 #define ADDR_FPGA_BITSTREAM             0x0000
 
 // Section Sizes
@@ -45,7 +40,14 @@
 #define SIZE_TOTAL_USB_CONNECTIONS      16
 #define SIZE_TOTAL_TIMES_POWERED_ON     16
 #define SIZE_FPGA_BITSTREAM_LEN         16
-#define SIZE_RESERVED                   16
-#define SIZE_FPGA_BITSTREAM             8192 
+#define SIZE_KV_LOG                     256
+#define SIZE_FPGA_BITSTREAM_DIGEST      32
+#define SIZE_FPGA_SLOT_TABLE            32
+#define SIZE_FPGA_BITSTREAM_B_DIGEST    32
+#define SIZE_BUS_PROBE                  64
+#define SIZE_BENCH_SCRATCH              128
+#define SIZE_FPGA_BITSTREAM             0x10000
+#define SIZE_FPGA_BITSTREAM_B           (0x10000 - ADDR_FPGA_BITSTREAM_B)
+#define SIZE_FPGA_BITSTREAM_MAX         (SIZE_FPGA_BITSTREAM_B + SIZE_FPGA_BITSTREAM)
 
 #endif // _NYAN_EEPROM_MAP_H
\ No newline at end of file
@@ -0,0 +1,88 @@
+/**
+ * @file nyan_flash_cache.h
+ * @brief Copy of the FPGA bitstream in internal flash sector 7.
+ *
+ * Loading the compressed bitstream over I2C dominates the boot time. Once the
+ * FPGA has started from an image in the EEPROM, the next boot reads it back,
+ * checks it against its stored digest and copies it into flash sector 7, which the linker
+ * script keeps out of the FLASH region. FPGAService then decompresses straight
+ * from the memory mapped copy and only falls back to the EEPROM if the copy
+ * is missing, stale or fails its SHA-256.
+ *
+ * The header is programmed after the image and its magic word last, so an
+ * interrupted copy never looks valid. The copy is only used for a bitstream
+ * slot whose length and digest it matches, so it never stands in for a
+ * different image.
+ *
+ * Erasing the sector stalls every flash access, interrupts included, for up
+ * to 2 s. The single bank holds the vector table and every handler, so the
+ * copy is only made at boot, before USB and the key scan are started.
+ */
+
+#ifndef NYAN_FLASH_CACHE_H
+#define NYAN_FLASH_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "24xx_eeprom.h"
+#include "nyan_sha256.h"
+
+#define NYAN_FLASH_CACHE_ADDR       0x08060000U                 /**< Start of sector 7. */
+#define NYAN_FLASH_CACHE_SECTOR     FLASH_SECTOR_7              /**< Sector erased before a new copy. */
+#define NYAN_FLASH_CACHE_SIZE       0x20000U                    /**< 128 KB sector. */
+#define NYAN_FLASH_CACHE_HEADER_SZ  64                          /**< The image starts on the next cache line pair. */
+#define NYAN_FLASH_CACHE_IMAGE      (NYAN_FLASH_CACHE_ADDR + NYAN_FLASH_CACHE_HEADER_SZ)
+#define NYAN_FLASH_CACHE_MAX_IMAGE  (NYAN_FLASH_CACHE_SIZE - NYAN_FLASH_CACHE_HEADER_SZ)
+#define NYAN_FLASH_CACHE_MAGIC      0x4342594EU                 /**< "NYBC" */
+#define NYAN_FLASH_CACHE_BLOCK      512                         /**< EEPROM read per flash programming step. */
+
+/**
+ * @enum NyanFlashCacheReturn
+ * @brief Return values for the flash cache functions.
+ */
+typedef enum {
+    NYAN_FLASH_CACHE_FAILURE,
+    NYAN_FLASH_CACHE_SUCCESS
+} NyanFlashCacheReturn;
+
+/**
+ * @struct NyanFlashCacheHeader
+ * @brief Layout of the start of sector 7.
+ */
+typedef struct {
+    uint32_t magic;                     /**< NYAN_FLASH_CACHE_MAGIC, zero once invalidated. */
+    uint32_t version;                   /**< Copies written into the sector so far, 1 for the first. */
+    uint32_t length;                    /**< Bytes of compressed image after the header. */
+    uint8_t  sha256[SHA256_BLOCK_SIZE]; /**< Digest of the image. */
+} NyanFlashCacheHeader;
+
+/**
+ * @brief Finds a valid copy of the compressed bitstream. Hashes the whole image.
+ * @param length Length of the image in the EEPROM, a copy of any other length is stale.
+ * @param header Set to the header of the copy, the image is at NYAN_FLASH_CACHE_IMAGE.
+ * @return NyanFlashCacheReturn NYAN_FLASH_CACHE_FAILURE if there is no matching intact copy.
+ */
+NyanFlashCacheReturn NyanFlashCacheLookup(uint32_t length, const NyanFlashCacheHeader** header);
+
+/**
+ * @brief Copies a bitstream slot of the EEPROM into the flash cache. Blocks, boot only.
+ *
+ * Nothing is erased if the cache already holds an intact copy with the same
+ * digest. The header is only written if the image read back from the EEPROM
+ * hashes to digest.
+ *
+ * @param eeprom EEPROM holding the bitstream.
+ * @param address Linear EEPROM address of the slot.
+ * @param length Length of the image.
+ * @param digest Stored SHA-256 of the image.
+ * @return NyanFlashCacheReturn NYAN_FLASH_CACHE_FAILURE if the copy was not made, boot then uses the EEPROM.
+ */
+NyanFlashCacheReturn NyanFlashCacheStore(Eeprom24xx* eeprom, uint32_t address, uint32_t length, const uint8_t* digest);
+
+/**
+ * @brief Marks the copy invalid without an erase, called before the EEPROM image is overwritten.
+ */
+void NyanFlashCacheInvalidate(void);
+
+#endif // NYAN_FLASH_CACHE_H
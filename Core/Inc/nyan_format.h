@@ -0,0 +1,60 @@
+/**
+ * @file nyan_format.h
+ * @brief Heap free printf style formatter for NyanOS console output.
+ *
+ * Output is handed to a write callback in spans, literal text is never copied
+ * through an intermediate buffer and numbers are built in a few bytes of stack.
+ * Nothing here touches newlib, so console output does not pull sprintf or the
+ * floating point printf machinery into the image.
+ *
+ * Supported conversions, all integers are 32 bit:
+ * | Conversion | Argument | Output                                             |
+ * | ---------- | -------- | -------------------------------------------------- |
+ * | %d %i      | int32_t  | Signed decimal                                     |
+ * | %u         | uint32_t | Unsigned decimal                                   |
+ * | %x %X      | uint32_t | Hexadecimal, lower / upper case                    |
+ * | %c         | int      | Single character                                   |
+ * | %s         | char*    | String, "(null)" for NULL                          |
+ * | %.Nq       | int32_t  | Fixed point, the value divided by 10^N (N <= 9)    |
+ * | %%         | -        | A literal '%'                                      |
+ *
+ * Flags '-' (left align) and '0' (zero pad) plus a field width are accepted on
+ * every conversion, e.g. %08x or %-12s. Length modifiers l, h and z are parsed
+ * and ignored. %q is a NyanOS extension: %.2q of 2715 prints 27.15.
+ */
+
+#ifndef NYAN_FORMAT_H
+#define NYAN_FORMAT_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Receives formatted output.
+ * @param ctx Opaque pointer passed through from the format call.
+ * @param data Output bytes, not null terminated.
+ * @param len Number of bytes in data.
+ */
+typedef void (*NyanFormatWrite)(void* ctx, const char* data, size_t len);
+
+/**
+ * @brief Formats fmt and its arguments into a write callback.
+ * @param write Callback receiving the output.
+ * @param ctx Passed to write unchanged.
+ * @param fmt Format string, see the table above.
+ * @param args Arguments matching fmt.
+ * @return Number of bytes produced.
+ */
+size_t NyanFormatV(NyanFormatWrite write, void* ctx, const char* fmt, va_list args);
+
+/**
+ * @brief snprintf replacement. The output is always null terminated when size > 0.
+ * @param buf Destination buffer.
+ * @param size Size of buf including the terminator.
+ * @param fmt Format string.
+ * @return Number of bytes the complete output needs, excluding the terminator.
+ */
+size_t NyanFormatBuf(char* buf, size_t size, const char* fmt, ...);
+
+#endif // NYAN_FORMAT_H
@@ -0,0 +1,208 @@
+/**
+ * @file nyan_frame.h
+ * @brief Binary framing layer (COBS + CRC-32) for the NyanOS CDC link.
+ *
+ * Frames are carried on the same CDC channel as the text shell. A 0x00 byte
+ * received while the shell is READY opens a framed session; every frame after
+ * that is COBS encoded and terminated by a 0x00 delimiter.
+ *
+ * Decoded frame layout (all multi-byte fields little endian):
+ * | Offset | Field   | Size | Description                            |
+ * | ------ | ------- | ---- | -------------------------------------- |
+ * | 0      | type    | 1    | NyanFrameType                          |
+ * | 1      | seq     | 1    | Sequence number, echoed in responses   |
+ * | 2      | len     | 2    | Payload length                         |
+ * | 4      | payload | len  | Type specific payload                  |
+ * | 4+len  | crc     | 4    | CRC-32 over type, seq, len and payload |
+ */
+
+#ifndef NYAN_FRAME_H
+#define NYAN_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define NYAN_FRAME_DELIMITER    0x00 /**< COBS frame delimiter, also opens a framed session. */
+#define NYAN_FRAME_MAX_PAYLOAD  512  /**< Largest payload carried by a single frame. */
+#define NYAN_FRAME_HEADER_SZ    4    /**< type + seq + len */
+#define NYAN_FRAME_CRC_SZ       4    /**< Trailing CRC-32 */
+#define NYAN_FRAME_RAW_SZ(len)     (NYAN_FRAME_HEADER_SZ + (len) + NYAN_FRAME_CRC_SZ)
+#define NYAN_FRAME_ENCODED_SZ(len) (NYAN_FRAME_RAW_SZ(len) + (NYAN_FRAME_RAW_SZ(len) / 254) + 2) /**< COBS overhead + delimiter */
+#define NYAN_FRAME_MAX_RAW      NYAN_FRAME_RAW_SZ(NYAN_FRAME_MAX_PAYLOAD)
+#define NYAN_FRAME_MAX_ENCODED  NYAN_FRAME_ENCODED_SZ(NYAN_FRAME_MAX_PAYLOAD)
+
+/**
+ * @enum NyanFrameReturn
+ * @brief Return values for the frame link functions.
+ */
+typedef enum {
+    NYAN_FRAME_FAILURE,
+    NYAN_FRAME_SUCCESS
+} NyanFrameReturn;
+
+/**
+ * @enum NyanFrameType
+ * @brief Frame types understood by NyanOS. Responses have the high bit set.
+ */
+typedef enum {
+    NYAN_FRAME_PING              = 0x01, /**< Echo request, answered with NYAN_FRAME_PONG. */
+    NYAN_FRAME_GET_INFO          = 0x02, /**< Board information request, answered with NYAN_FRAME_INFO. */
+    NYAN_FRAME_STREAM_OPEN       = 0x10, /**< Open a stream: target[1] size[4]. */
+    NYAN_FRAME_STREAM_DATA       = 0x11, /**< Stream data: offset[4] data[n]. */
+    NYAN_FRAME_STREAM_CLOSE      = 0x12, /**< Close the stream once all bytes are acknowledged. */
+    NYAN_FRAME_SESSION_CLOSE     = 0x7F, /**< Leave the framed session and return to the text shell. */
+    NYAN_FRAME_PONG              = 0x81, /**< Echo response. */
+    NYAN_FRAME_INFO              = 0x82, /**< Board information response, see NyanFrameInfo. */
+    NYAN_FRAME_TELEMETRY_STATUS  = 0xA0, /**< Periodic status snapshot on the telemetry channel, see NyanTelemetryStatus. */
+    NYAN_FRAME_TELEMETRY_LATENCY = 0xA1, /**< Key scan interval histogram on the telemetry channel, see NyanTelemetryLatency. */
+    NYAN_FRAME_TELEMETRY_KEYS    = 0xA2, /**< Key state change on the telemetry channel, see NyanTelemetryKeys. */
+    NYAN_FRAME_ACK               = 0xF0, /**< Positive acknowledgement: type[1] error[1] value[4]. */
+    NYAN_FRAME_NACK              = 0xF1  /**< Negative acknowledgement: type[1] error[1] value[4]. */
+} NyanFrameType;
+
+/**
+ * @enum NyanFrameError
+ * @brief Error codes reported in the ACK/NACK payload.
+ */
+typedef enum {
+    NYAN_FRAME_ERR_NONE,           /**< No error. */
+    NYAN_FRAME_ERR_COBS,           /**< The frame could not be COBS decoded. */
+    NYAN_FRAME_ERR_CRC,            /**< CRC-32 mismatch. */
+    NYAN_FRAME_ERR_LENGTH,         /**< Length field disagrees with the received frame. */
+    NYAN_FRAME_ERR_UNKNOWN_TYPE,   /**< The frame type is not supported. */
+    NYAN_FRAME_ERR_STREAM_TARGET,  /**< The stream target does not exist or rejected the size. */
+    NYAN_FRAME_ERR_STREAM_STATE,   /**< Stream operation without an open stream, or one already open. */
+    NYAN_FRAME_ERR_STREAM_OFFSET,  /**< Stream data does not continue at the expected offset. */
+    NYAN_FRAME_ERR_STREAM_WRITE,   /**< The stream target failed to consume the data. */
+    NYAN_FRAME_ERR_BUSY            /**< The stream target is busy, open it again later. */
+} NyanFrameError;
+
+/**
+ * @struct NyanFrame
+ * @brief A validated frame handed to the application.
+ */
+typedef struct {
+    uint8_t  type;     /**< NyanFrameType */
+    uint8_t  seq;      /**< Sequence number chosen by the host */
+    uint16_t len;      /**< Payload length */
+    uint8_t* payload;  /**< Payload, points into the link buffer until NyanFrameRelease */
+} NyanFrame;
+
+/**
+ * @struct NyanFrameLink
+ * @brief Receive assembly and transmit scratch buffers of a framed CDC link.
+ *
+ * Bytes are assembled from the USB receive interrupt, a completed frame is
+ * parked in frame until the application releases it. Frames completing while
+ * one is still parked are dropped and counted; the host retransmits after its
+ * acknowledgement timeout.
+ */
+typedef struct {
+    uint8_t           rx_buf[NYAN_FRAME_MAX_ENCODED]; /**< Encoded bytes of the frame being received. */
+    uint16_t          rx_len;                         /**< Number of bytes in rx_buf. */
+    bool              rx_overflow;                    /**< The frame being received is larger than rx_buf. */
+    uint8_t           frame[NYAN_FRAME_MAX_ENCODED];  /**< Encoded frame waiting for the application. */
+    uint16_t          frame_len;                      /**< Number of bytes in frame. */
+    volatile bool     frame_pending;                  /**< A frame is parked in frame. */
+    uint8_t           tx_raw[NYAN_FRAME_MAX_RAW];     /**< Scratch for building an outgoing frame. */
+    uint8_t           tx_buf[NYAN_FRAME_MAX_ENCODED]; /**< Encoded outgoing frame including delimiter. */
+    volatile uint32_t frames_ok;                      /**< Frames received and validated. */
+    volatile uint32_t frames_bad;                     /**< Frames rejected on COBS, length or CRC. */
+    volatile uint32_t frames_dropped;                 /**< Frames dropped because one was still pending. */
+} NyanFrameLink;
+
+/**
+ * @brief Resets the receive state of a frame link.
+ * @param link Pointer to the NyanFrameLink.
+ */
+void NyanFrameInit(NyanFrameLink* link);
+
+/**
+ * @brief Feeds one received byte into the frame assembler. Interrupt safe.
+ * @param link Pointer to the NyanFrameLink.
+ * @param byte The received byte.
+ */
+void NyanFrameRxByte(NyanFrameLink* link, uint8_t byte);
+
+/**
+ * @brief Decodes and validates the pending frame.
+ *
+ * On success frame->payload points into the link buffer, the caller must call
+ * NyanFrameRelease once it is done with it. On failure the frame is released.
+ *
+ * @param link Pointer to the NyanFrameLink.
+ * @param frame Output for the decoded frame. type and seq are filled whenever
+ *              the header could be recovered so a NACK can be addressed.
+ * @return NYAN_FRAME_ERR_NONE on success, otherwise the reason of rejection.
+ */
+NyanFrameError NyanFrameTake(NyanFrameLink* link, NyanFrame* frame);
+
+/**
+ * @brief Releases the pending frame so the next one can be accepted.
+ * @param link Pointer to the NyanFrameLink.
+ */
+void NyanFrameRelease(NyanFrameLink* link);
+
+/**
+ * @brief Builds, checksums and COBS encodes a frame into link->tx_buf.
+ * @param link Pointer to the NyanFrameLink.
+ * @param type Frame type.
+ * @param seq Sequence number.
+ * @param payload Payload bytes, may be NULL when len is 0.
+ * @param len Payload length, at most NYAN_FRAME_MAX_PAYLOAD.
+ * @return Number of encoded bytes in link->tx_buf including the delimiter, 0 on failure.
+ */
+size_t NyanFrameEncode(NyanFrameLink* link, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len);
+
+/**
+ * @brief Builds, checksums and COBS encodes a frame into caller provided buffers.
+ * @param raw Scratch for the unencoded frame, NYAN_FRAME_RAW_SZ(len) bytes.
+ * @param out Output for the encoded frame, NYAN_FRAME_ENCODED_SZ(len) bytes.
+ * @param type Frame type.
+ * @param seq Sequence number.
+ * @param payload Payload bytes, may be NULL when len is 0.
+ * @param len Payload length, at most NYAN_FRAME_MAX_PAYLOAD.
+ * @return Number of encoded bytes in out including the delimiter, 0 on failure.
+ */
+size_t NyanFrameBuild(uint8_t* raw, uint8_t* out, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len);
+
+/**
+ * @brief COBS encodes a buffer. The delimiter is not appended.
+ * @param src Bytes to be encoded.
+ * @param len Number of bytes in src.
+ * @param dst Output, must hold len + len / 254 + 1 bytes.
+ * @return Number of bytes written to dst.
+ */
+size_t NyanCobsEncode(const uint8_t* src, size_t len, uint8_t* dst);
+
+/**
+ * @brief COBS decodes a buffer that does not contain the delimiter.
+ * @param src Encoded bytes.
+ * @param len Number of bytes in src.
+ * @param dst Output buffer, may alias src.
+ * @param dst_max Size of dst.
+ * @return Number of decoded bytes, 0 if the input is malformed or too large.
+ */
+size_t NyanCobsDecode(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_max);
+
+/**
+ * @brief Reads a little endian 32 bit value from a byte buffer.
+ */
+static inline uint32_t NyanFrameGetU32(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/**
+ * @brief Writes a little endian 32 bit value to a byte buffer.
+ */
+static inline void NyanFramePutU32(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+#endif // NYAN_FRAME_H
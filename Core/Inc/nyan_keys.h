@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <main.h>
+#include "nyan_kv.h"
 
 #define NUM_KEYS 61 /**< Number of key state bits to be read from FPGA over SPI */
 #define NUM_HID_KEYS 60 /**< Number of keys that could have any impact on the HID descriptor - We remove the FN Keys */
@@ -90,18 +91,18 @@ NyanKeysReturn NyanBuildHidReportFromKeyStates(NyanKeys *keys, volatile NyanKeyB
 
 /**
  * @brief Saves the state of the Super Key disablement to the onboard eeprom
- * @param eeprom pointer to the EEPROM driver (extern)
+ * @param kv pointer to the EEPROM key-value log (extern)
  * @param disabled boolean representing if the super key is disabled or not. 
  * @return NyanKeysReturn success or failure. 
  */
-NyanKeysReturn NyanKeysWriteSuperDisableEEPROM(Eeprom24xx* eeprom, bool disabled);
+NyanKeysReturn NyanKeysWriteSuperDisableEEPROM(NyanKv* kv, bool disabled);
 
 /**
  * @brief Reads the state of the Super Key disablement to the onboard eeprom
- * @param eeprom pointer to the EEPROM driver (extern)
+ * @param kv pointer to the EEPROM key-value log (extern)
  * @return Super key enabled or disabled
  */
-bool NyanKeysReadSuperDisableEEPROM(Eeprom24xx* eeprom);
+bool NyanKeysReadSuperDisableEEPROM(NyanKv* kv);
 
 /**
  * @brief Performs the warmup tasks for the Nyan Keys keyboard FPGA key input.
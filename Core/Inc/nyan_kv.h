@@ -0,0 +1,122 @@
+/**
+ * @file nyan_kv.h
+ * @brief Append-only key-value store in the EEPROM reserved area.
+ *
+ * The reserved area of bank 0 is a log of NYAN_KV_SLOTS fixed 16 byte records.
+ * A record carries its key, a sequence number and a CRC-32; the valid record
+ * with the newest sequence number of a key is its current value. Setting a
+ * key writes a new record into the next slot that holds no current value, so
+ * a setting toggled all day rotates across the whole area instead of wearing
+ * out one EEPROM line. Records that fall too far behind the newest sequence
+ * number are copied forward so the 16 bit sequence compare never wraps.
+ *
+ * The log lives in the config shadow: lookups never touch the I2C bus and
+ * every record is one shadow line flushed in the background. Setting a key
+ * only stages the value, so it is safe from any interrupt; NyanKvService
+ * appends staged values from the main loop, the only place a record is
+ * written.
+ *
+ * Adding a setting is one NyanKvKey entry. Key values are stored in the
+ * EEPROM, never renumber or reuse them.
+ */
+
+#ifndef NYAN_KV_H
+#define NYAN_KV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nyan_config.h"
+#include "nyan_eeprom_map.h"
+
+#define NYAN_KV_RECORD_SZ       16                                  /**< One config shadow line. */
+#define NYAN_KV_SLOTS           (SIZE_KV_LOG / NYAN_KV_RECORD_SZ)   /**< Records in the log. */
+#define NYAN_KV_MAX_VALUE       8                                   /**< Largest value of a key. */
+#define NYAN_KV_REFRESH_SPAN    0x4000                              /**< Sequence distance after which a record is copied forward. */
+
+/**
+ * @enum NyanKvKey
+ * @brief Registered settings. 0x00 and 0xFF are never valid keys.
+ */
+typedef enum {
+    NYAN_KV_SUPER_KEY_DISABLED = 0x01,  /**< bool, the super (GUI) key is ignored. */
+    NYAN_KV_FPGA_CACHE_PENDING = 0x02,  /**< bool, the next boot copies the active bitstream into the flash cache. */
+    NYAN_KV_KEYS                        /**< One past the highest key, must stay below NYAN_KV_SLOTS. */
+} NyanKvKey;
+
+/**
+ * @enum NyanKvReturn
+ * @brief Return values for the key-value store functions.
+ */
+typedef enum {
+    NYAN_KV_FAILURE,
+    NYAN_KV_SUCCESS
+} NyanKvReturn;
+
+/**
+ * @struct NyanKvRecord
+ * @brief Layout of one record in the EEPROM.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  key;                       /**< NyanKvKey. */
+    uint8_t  len;                       /**< Bytes of value in use. */
+    uint16_t seq;                       /**< Sequence number, newer records compare greater. */
+    uint8_t  value[NYAN_KV_MAX_VALUE];  /**< Value, unused bytes are zero. */
+    uint32_t crc;                       /**< CRC-32 of the bytes above. */
+} NyanKvRecord;
+
+/**
+ * @struct NyanKv
+ * @brief Index of the log, rebuilt from the shadow at boot.
+ */
+typedef struct {
+    NyanConfig* config;                 /**< Shadow holding the log. */
+    int8_t      current[NYAN_KV_KEYS];  /**< Slot of the current record per key, -1 if unset. */
+    uint16_t    head_seq;               /**< Newest sequence number in the log. */
+    uint8_t     next_slot;              /**< Where the search for a free slot starts. */
+    uint32_t    records_written;        /**< Records appended since boot, copies included. */
+    uint8_t     staged[NYAN_KV_KEYS][NYAN_KV_MAX_VALUE]; /**< Values set but not yet appended. */
+    uint8_t     staged_len[NYAN_KV_KEYS];                /**< Size of each staged value. */
+    volatile uint32_t staged_keys;                       /**< One bit per key with a staged value. */
+} NyanKv;
+
+/**
+ * @brief Scans the log in the config shadow. Imports the legacy super key byte on first boot.
+ *
+ * Can run again after a late load of the shadow, staged values are kept.
+ * @param kv Pointer to the NyanKv.
+ * @param config Loaded config shadow.
+ */
+void NyanKvInit(NyanKv* kv, NyanConfig* config);
+
+/**
+ * @brief Reads the current value of a key.
+ * @param kv Pointer to the NyanKv.
+ * @param key Registered key.
+ * @param value Output buffer, at least len bytes.
+ * @param len Size of the value.
+ * @return NyanKvReturn NYAN_KV_FAILURE if the key has never been set or was stored with another size.
+ *
+ * A staged value is returned ahead of the log.
+ */
+NyanKvReturn NyanKvGet(NyanKv* kv, NyanKvKey key, void* value, uint8_t len);
+
+/**
+ * @brief Stages a new value for a key. Never touches the EEPROM, safe from any interrupt.
+ * @param kv Pointer to the NyanKv.
+ * @param key Registered key.
+ * @param value New value.
+ * @param len Size of the value, up to NYAN_KV_MAX_VALUE.
+ * @return NyanKvReturn NYAN_KV_FAILURE if the key or length is invalid.
+ */
+NyanKvReturn NyanKvSet(NyanKv* kv, NyanKvKey key, const void* value, uint8_t len);
+
+/**
+ * @brief Appends the staged values to the log. Main loop only. Writing the current value again is a no-op.
+ * @param kv Pointer to the NyanKv.
+ *
+ * Values stay staged while the config shadow is not loaded.
+ */
+void NyanKvService(NyanKv* kv);
+
+#endif // NYAN_KV_H
@@ -6,7 +6,12 @@
 #include "24xx_eeprom.h"
 #include "lattice_ice_hx.h"
 #include "nyan_bitcoin.h"
+#include "nyan_bitstream.h"
+#include "nyan_config.h"
+#include "nyan_kv.h"
 #include "nyan_eeprom_map.h"
+#include "nyan_frame.h"
+#include "nyan_telemetry.h"
 
 #include "usb_device.h"
 
@@ -14,6 +19,9 @@
 #define _NYAN_CDC_CHANNEL 0
 #define _NYAN_CDC_RX_BUF_SZ 512
 #define _NYAN_CDC_TX_MAX_LEN 128
+#define _NYAN_CDC_TX_RING_SZ 2048 // Must be a power of two
+#define _NYAN_FRAME_IDLE_MS 30000 // A framed session with no input for this long returns to the shell
+#define _NYAN_UPLOAD_IDLE_MS 10000 // A text mode upload with no input for this long is abandoned, below the cycle counter wrap
 #define _NYAN_CMD_MAX_ARGS 10
 #define _NYAN_CMD_BUF_LEN 128
 
@@ -22,9 +30,16 @@
 #define _NYAN_NUM_COMMANDS (sizeof(nyan_commands) / sizeof(nyan_commands[0]))
 
 extern Eeprom24xx nos_eeprom;         // 24xx Based EEPROM
+extern NyanConfig nos_config;         // RAM shadow of the EEPROM configuration area
+extern NyanKv nos_kv;                 // Key-value log in the EEPROM reserved area
 extern LatticeIceHX nos_fpga;         // Lattice ICE40HX4k FPGA driver access
 extern NyanBitcoin nyan_bitcoin;      // Nyan Keys Background Bitcoin Miner
 extern USBD_HandleTypeDef hUsbDevice; // USB Device for DFU Reset
+extern NyanFrameLink nos_frame_link;  // Binary framed CDC link
+extern NyanBitstreamWriter nos_bitstream_writer; // Streaming FPGA bitstream upload
+#ifdef NYAN_TELEMETRY_EN
+extern NyanTelemetry nos_telemetry;   // Binary telemetry stream on the second CDC channel
+#endif
 
 static const char* const nyan_commands[] = {
     "help",
@@ -33,7 +48,10 @@ static const char* const nyan_commands[] = {
     "write-bitstream",
     "set-owner",
     "bitcoin-miner-set",
-    "dfu-mode"
+    "dfu-mode",
+    "telemetry",
+    "bench",
+    "fpga-stats"
 };
 
 typedef enum {
@@ -52,7 +70,9 @@ typedef enum {
 typedef enum {
     NOT_READY,            /**< The system is not ready for operations. */
     READY,                /**< The system is ready and operational. */
-    DIRECT_BUFFER_ACCESS  /**< The system is in a mode that allows direct buffer access. */
+    DIRECT_BUFFER_ACCESS, /**< The system is in a mode that allows direct buffer access. */
+    FRAMED,               /**< The CDC link carries COBS framed binary traffic, see nyan_frame.h. */
+    BITSTREAM_UPLOAD      /**< Raw CDC bytes are streamed into the bitstream writer, see nyan_bitstream.h. */
 } NyanStates;
 
 /**
@@ -71,22 +91,33 @@ typedef enum {
     NYAN_EXE_SET_OWNER,               /**< Execute command to set the owner of the system. */
     NYAN_EXE_BITCOIN_MINER_SET,       /**< Execute command to configure the Bitcoin miner. */
     NYAN_EXE_DFU_MODE,                /**< Execute command to make nyan keys enter DFU Mode: Board version > .9e*/
+    NYAN_EXE_TELEMETRY,               /**< Execute command to set the telemetry stream rate. */
+    NYAN_EXE_BENCH,                   /**< Execute command to run the built-in microbenchmarks. */
+    NYAN_EXE_FPGA_STATS,              /**< Execute command to print the stage timings of the last FPGA configuration. */
     NYAN_EXE_COMMAND_NOT_SUPPORTED,   /**< Indicator for an unsupported or unrecognized command. */
     NYAN_EXE_IDLE                     /**< System is in an idle state, not currently executing any command. */
 } NyanExe;
 
 /**
- * @struct NyanString
- * @brief Structure for handling strings in NyanOS.
- *
- * This structure is used for managing strings within the NyanOS. It provides a way to handle 
- * dynamic strings with associated size information, facilitating easier management of string 
- * operations such as allocation, resizing, and deallocation.
+ * @enum NyanStreamTargetId
+ * @brief Destinations that can be written with framed STREAM_OPEN/DATA/CLOSE transfers.
  */
-typedef struct {
-    uint8_t* p_array; /**< Pointer to the character array representing the string. */
-    size_t size;      /**< Size of the string, indicating the number of characters it contains. */
-} NyanString;
+typedef enum {
+    NYAN_STREAM_BITCOIN_HEADER = 0x01, /**< The 80 byte block header of the Bitcoin miner. */
+    NYAN_STREAM_FPGA_BITSTREAM = 0x02  /**< Compressed FPGA bitstream, written to EEPROM bank 1 as it arrives. */
+} NyanStreamTargetId;
+
+/**
+ * @struct NyanFrameInfo
+ * @brief Payload of the NYAN_FRAME_INFO response.
+ */
+typedef struct __attribute__((packed)) {
+    uint8_t  version[8];                /**< NOS version string, null padded. */
+    uint8_t  owner[SIZE_BOARD_OWNER];   /**< Board owner as stored in the EEPROM. */
+    uint32_t bitstream_size;            /**< Size of the stored FPGA bitstream. */
+    uint8_t  fpga_configured;           /**< FPGA CDONE state. */
+    uint32_t keys_scans_per_sec;        /**< Key scans over the last second. */
+} NyanFrameInfo;
 
 typedef struct {
     uint16_t raw[2]; /**< Raw values from ADC */
@@ -110,7 +141,12 @@ typedef struct {
     char        exe_char;                               /**< ASCII character that triggers command evaluation. */
 
     Eeprom24xx  *eeprom;                                /**< Pointer to NyanOS EEPROM driver. */
+    NyanConfig  *config;                                /**< Pointer to the EEPROM configuration shadow. */
+    LatticeIceHX *fpga;                                 /**< Pointer to the FPGA driver. */
     NyanBitcoin *nyan_bitcoin;                          /**< Pointer to NyanOS Bitcoin Miner driver. */
+    NyanFrameLink *frame_link;                          /**< Pointer to the binary framed CDC link. */
+    NyanBitstreamWriter *bitstream;                     /**< Pointer to the streaming bitstream writer. */
+    NyanTelemetry *telemetry;                           /**< Pointer to the telemetry channel, NULL when built without NYAN_TELEMETRY_EN. */
 
     NyanStates  state;                                  /**< Current state of NyanOS. */
     NyanExe     exe;                                    /**< The program to be executed. */
@@ -121,22 +157,45 @@ typedef struct {
 
     uint8_t     cdc_ch;                                 /**< Active CDC channel used. Should always be 0 for Nyan OS. */
     bool        tx_inflight;                            /**< Flag for ongoing transmission. Initialized to false. */
-    bool        tx_bulk_transfer_in_progress;           /**< Flag for ongoing bulk transfer over USB. */
-    uint8_t     tx_chunks_solid;                        /**< Number of complete _NYAN_CDC_TX_MAX_LEN sized chunks to be sent. */
-    uint8_t     tx_chunks_partial_bytes;                /**< Number of bytes in a partial chunk. */
-    uint8_t     tx_chunk;                               /**< Current chunk number to be sent. */
-    NyanString  tx_buffer;                              /**< Transmission buffer. */
+    uint8_t     tx_ring[_NYAN_CDC_TX_RING_SZ];          /**< Console transmit ring, filled by NyanPrint and drained by NyanCdcTX. */
+    uint32_t    tx_head;                                /**< Free running write index of tx_ring. */
+    uint32_t    tx_tail;                                /**< Free running index of the oldest unsent byte in tx_ring. */
+    uint32_t    tx_pending;                             /**< Bytes handed to CDC_Transmit, released by NyanCdcTxComplete. */
+    volatile bool rx_paused;                            /**< The CDC OUT endpoint was left un-armed until the input has room again. */
 
     uint32_t    bytes_received;                         /**< Number of bytes received in Direct Buffer Mode. */
     uint32_t    bytes_array_size;                       /**< Size of the receive buffer in Direct Buffer Mode. */
     uint8_t*    bytes_array;                            /**< Buffer holding the received data in Direct Buffer Mode. */
     uint8_t*    command_arg_buffer[_NYAN_CMD_MAX_ARGS]; /**< Buffers to store command arguments. */
 
+    const struct NyanStreamTarget* stream;              /**< Stream target of the open framed transfer, NULL if none. */
+    uint32_t    stream_size;                            /**< Announced size of the open framed transfer. */
+    uint32_t    stream_offset;                          /**< Number of bytes acknowledged in the open framed transfer. */
+    uint32_t    frame_rx_tick;                          /**< HAL tick of the last byte received in the framed session. */
+    volatile bool frame_hangup;                         /**< The host dropped DTR, the framed session is closed by the TIM8 task. */
+
     uint32_t    perf_keys_count_spi_calls;              /**< Current readable value of the number of SPI calls to KEYS IP over 1s */
     uint32_t    perf_keys_count_spi_calls_nxt;          /**< Next readable value of the number of SPI calls to KEYS IP over 1s */
     NyanCPUTemp perf_cpu_temp;                   /*** CPU ADC DMA Temperature storage */
 } NyanOS;
 
+/**
+ * @struct NyanStreamTarget
+ * @brief A destination for framed stream transfers.
+ *
+ * Data is always delivered in order, offset equals the number of bytes already written.
+ * abort may be NULL if the target has nothing to undo.
+ */
+typedef struct NyanStreamTarget {
+    NyanStreamTargetId id;                                                                    /**< Target id used in STREAM_OPEN. */
+    uint32_t   max_size;                                                                      /**< Largest accepted transfer. */
+    NyanReturn (*open)(volatile NyanOS* nos, uint32_t size);                                  /**< Prepare for size bytes. */
+    NyanReturn (*write)(volatile NyanOS* nos, uint32_t offset, const uint8_t* data, uint32_t len); /**< Consume the next chunk. */
+    NyanReturn (*close)(volatile NyanOS* nos);                                                /**< Commit the completed transfer. */
+    void       (*abort)(volatile NyanOS* nos);                                                /**< Discard a partial transfer. */
+    bool       (*busy)(volatile NyanOS* nos);                                                 /**< Optional, the target can't be opened right now. */
+} NyanStreamTarget;
+
 /**
  * @brief Initializes the NyanOS system.
  * @param nos Pointer to the NyanOS struct.
@@ -161,6 +220,22 @@ NyanReturn NyanOsDecodeCommand(volatile NyanOS* nos);
  */
 NyanReturn NyanAddInputBuffer(volatile NyanOS* nos, uint8_t *pbuf, uint32_t *Len);
 
+/**
+ * @brief Returns true if the input path can take another full CDC packet.
+ *
+ * Used by the CDC receive callback to decide whether to re-arm the OUT endpoint.
+ * While it is not re-armed the host is NAK'd, which is the only back pressure
+ * USB offers for streamed uploads.
+ * @param nos Pointer to the NyanOS struct.
+ */
+bool NyanRxReady(volatile NyanOS* nos);
+
+/**
+ * @brief Re-arms a paused CDC OUT endpoint once the input has room again.
+ * @param nos Pointer to the NyanOS struct.
+ */
+void NyanRxResume(volatile NyanOS* nos);
+
 /**
  * @brief Displays a welcome message to the user.
  * @param nos Pointer to the NyanOS struct.
@@ -169,20 +244,38 @@ NyanReturn NyanAddInputBuffer(volatile NyanOS* nos, uint8_t *pbuf, uint32_t *Len
 NyanReturn NyanWelcomeDisplay(volatile NyanOS* nos);
 
 /**
- * @brief Print function for NyanOS, similar to printf.
+ * @brief Queues raw bytes on the console transmit ring.
  * @param nos Pointer to the NyanOS struct.
  * @param data Pointer to the data to be printed.
  * @param len Length of the data to be printed.
- * @return NyanReturn indicating success or failure.
+ * @return NyanReturn NOS_FAILURE if the ring can't take all of data, nothing is queued then.
  */
 NyanReturn NyanPrint(volatile NyanOS* nos, char* data, size_t len);
 
 /**
- * NyanOS Long 128+ character buffer printing support.
+ * @brief Formats into the console transmit ring, see nyan_format.h for the conversions.
+ *
+ * The output is staged on the stack and queued with one NyanPrint, so echo from the
+ * USB interrupt can't land in the middle of it. Output longer than
+ * _NYAN_CDC_TX_MAX_LEN is queued in pieces of that size.
+ *
  * @param nos Pointer to the NyanOS struct.
- * @return NyanReturn indicating success or failure.
+ * @param fmt Format string.
+ * @return NyanReturn NOS_FAILURE if any part of the output did not fit in the ring.
  */
+NyanReturn NyanPrintf(volatile NyanOS* nos, const char* fmt, ...);
 
+/**
+ * @brief Releases the bytes of the completed CDC transfer. Called from the CDC transmit complete callback.
+ * @param nos Pointer to the NyanOS struct.
+ */
+void NyanCdcTxComplete(volatile NyanOS* nos);
+
+/**
+ * @brief Starts the next CDC transfer of up to _NYAN_CDC_TX_MAX_LEN bytes from the transmit ring.
+ * @param nos Pointer to the NyanOS struct.
+ * @return NyanReturn NOS_FAILURE if there is nothing to send.
+ */
 NyanReturn NyanCdcTX(volatile NyanOS* nos);
 /**
  * @brief Decodes, stages, and resets the current input buffer in NyanOS.
@@ -229,13 +322,45 @@ NyanReturn NyanExeHelp(volatile NyanOS* nos);
  */
 NyanReturn NyanExeGetPerformanceStats(volatile NyanOS* nos);
 
+/**
+ * @brief Sets the status rate of the telemetry channel from argument 1, 0 stops the periodic frames.
+ * @param nos Pointer to the NyanOS struct.
+ * @return NyanReturn NOS_FAILURE if telemetry is not built in or the rate is invalid.
+ */
+NyanReturn NyanExeTelemetry(volatile NyanOS* nos);
+
+/**
+ * @brief Runs the microbenchmarks named in the arguments, or all of them, and prints cycles/op and MB/s.
+ *
+ * -icache and -dcache disable the respective cache for the duration of the run.
+ *
+ * @param nos Pointer to the NyanOS struct.
+ * @return NyanReturn NOS_FAILURE if a benchmark is unknown or failed.
+ */
+NyanReturn NyanExeBench(volatile NyanOS* nos);
+
+/**
+ * @brief Prints the per stage timings of the last FPGA configuration pipeline.
+ * @param nos Pointer to the NyanOS struct.
+ * @return NyanReturn always return NOS_SUCCESS;
+ */
+NyanReturn NyanExeFpgaStats(volatile NyanOS* nos);
+
+/**
+ * @brief Queues the periodic status and latency frames when due and drains the telemetry ring. Called from the TIM8 task.
+ * @param nos Pointer to the NyanOS struct.
+ */
+void NyanTelemetryPublish(volatile NyanOS* nos);
+
 /**
  * @brief Writes the name of argument 1 to the owners name address slot.
  */
 NyanReturn NyanExeSetOwner(volatile NyanOS* nos);
 
 /**
- * @brief Write an FPGA Bitstream to the EEPROM in 128 byte chunks 
+ * @brief Streams an FPGA bitstream to the EEPROM, pages are written while the rest is still being received.
+ *
+ * The upload is abandoned if no byte arrives for _NYAN_UPLOAD_IDLE_MS.
  */
 NyanReturn NyanExeWriteFpgaBitstream(volatile NyanOS* nos);
 
@@ -286,10 +411,34 @@ void ClearNyanCommandBuffer(volatile NyanOS* nos);
 void FreeNyanCommandArgs(volatile NyanOS* nos);
 
 /**
- * @brief Frees the contents of a NyanString struct.
- * @param nyanString Pointer to the NyanString to be freed.
+ * @brief Validates and executes the pending binary frame, the response is queued with NyanPrint.
+ * @param nos Pointer to the NyanOS struct.
+ * @return NyanReturn NOS_SUCCESS if the frame was acknowledged positively.
+ */
+NyanReturn NyanExeFrame(volatile NyanOS* nos);
+
+/**
+ * @brief Returns a framed session to the shell once the host dropped DTR or sent nothing for _NYAN_FRAME_IDLE_MS.
+ * @param nos Pointer to the NyanOS struct.
+ */
+void NyanFrameSessionService(volatile NyanOS* nos);
+
+/**
+ * @brief Encodes a frame and queues it on the CDC link.
+ * @param nos Pointer to the NyanOS struct.
+ * @param type NyanFrameType of the outgoing frame.
+ * @param seq Sequence number, responses echo the request.
+ * @param payload Payload bytes.
+ * @param len Payload length.
+ * @return NyanReturn indicating success or failure.
+ */
+NyanReturn NyanFrameSend(volatile NyanOS* nos, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len);
+
+/**
+ * @brief Aborts the open framed stream transfer, if any.
+ * @param nos Pointer to the NyanOS struct.
  */
-void FreeNyanString(NyanString* nyanString);
+void NyanStreamAbort(volatile NyanOS* nos);
 
 /**
  * @brief Pulls pin E0 high to charge capacitor to let Nyan Keys enter th DFU mode
@@ -0,0 +1,87 @@
+/**
+ * @file nyan_pool.h
+ * @brief Fixed-block pools replacing malloc/free in NyanOS.
+ *
+ * Two size classes of blocks live in .bss, each with its own free list, so a
+ * block never gets split or merged and the pools can't fragment. Alloc and
+ * free pop and push the free list with LDREX/STREX: both are O(1), never
+ * mask interrupts and can be called from any interrupt. An exception between
+ * the LDREX and the STREX clears the exclusive monitor, so the STREX fails
+ * and the loop retries instead of losing a block.
+ *
+ * There is no heap: the linker script reserves none, _sbrk always fails and
+ * the Makefiles fail the link if malloc is pulled in.
+ *
+ * The block counts are the sum of the budgets below. Each subsystem checks at
+ * compile time that its worst case fits in its budget, a request that still
+ * doesn't fit fails and is counted rather than taking a block from another
+ * size class.
+ */
+
+#ifndef NYAN_POOL_H
+#define NYAN_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define NYAN_POOL_SMALL_SIZE  32   ///< Bytes in a small block.
+#define NYAN_POOL_LARGE_SIZE  132  ///< Bytes in a large block, a whole command line and its terminator.
+
+// Blocks each subsystem may hold at the same time
+#define NYAN_POOL_SHELL_SMALL 10   ///< Shell arguments, one block each.
+#define NYAN_POOL_SHELL_LARGE 3    ///< Shell arguments too long for a small block.
+#define NYAN_POOL_MINER_SMALL 1    ///< Bitcoin miner header field upload.
+
+#define NYAN_POOL_SMALL_BLOCKS (NYAN_POOL_SHELL_SMALL + NYAN_POOL_MINER_SMALL) ///< Small blocks in total.
+#define NYAN_POOL_LARGE_BLOCKS (NYAN_POOL_SHELL_LARGE)                         ///< Large blocks in total.
+
+/**
+ * @brief Size classes, smallest first.
+ */
+typedef enum {
+    NYAN_POOL_SMALL,
+    NYAN_POOL_LARGE,
+    NYAN_POOL_CLASSES
+} NyanPoolClass;
+
+/**
+ * @brief Counters of one size class.
+ */
+typedef struct {
+    uint32_t block_size; /**< Bytes in a block. */
+    uint32_t blocks;     /**< Blocks in the class. */
+    uint32_t in_use;     /**< Blocks allocated right now. */
+    uint32_t high_water; /**< Most blocks ever allocated at the same time. */
+    uint32_t failures;   /**< Allocations that found the class empty. */
+} NyanPoolStats;
+
+/**
+ * @brief Threads every block onto the free list of its class.
+ *
+ * Must run once before the first NyanPoolAlloc, before any interrupt that
+ * allocates is enabled.
+ */
+void NyanPoolInit(void);
+
+/**
+ * @brief Takes a block of the smallest class that fits.
+ * @param size Bytes needed.
+ * @return Block of at least size bytes, word aligned, NULL if that class is empty or size is larger than any block.
+ */
+void* NyanPoolAlloc(uint32_t size);
+
+/**
+ * @brief Returns a block to its class.
+ * @param block Block from NyanPoolAlloc, NULL is ignored.
+ */
+void NyanPoolFree(void* block);
+
+/**
+ * @brief Reads the counters of a size class.
+ * @param pool_class Size class.
+ * @param stats Filled with the counters.
+ * @return False if pool_class is out of range.
+ */
+bool NyanPoolGetStats(NyanPoolClass pool_class, NyanPoolStats* stats);
+
+#endif // NYAN_POOL_H
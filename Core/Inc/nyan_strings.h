@@ -4,6 +4,8 @@
 
 #include <stdint.h>
 
+#define NOS_VERSION "0.01"
+
 extern const uint8_t nyan_keys_welcome_text[];
 extern const uint8_t nyan_keys_newline[];
 extern const uint8_t nyan_keys_path_text[];
@@ -19,6 +21,11 @@ extern const uint8_t nyan_keys_getinfo_owner[]; // Make sure to newline after th
 extern const uint8_t nyan_keys_getperf_line1[];
 extern const uint8_t nyan_keys_getperf_line2[];
 extern const uint8_t nyan_keys_getperf_times_scanned[];
+extern const uint8_t nyan_keys_getperf_i2c_profile[];
+extern const uint8_t nyan_keys_getperf_eeprom_read[];
+extern const uint8_t nyan_keys_getperf_eeprom_none[];
+extern const uint8_t nyan_keys_getperf_i2c_errors[];
+extern const uint8_t nyan_keys_getperf_pool[];
 
 // COMMAND: set-owner
 extern const uint8_t nyan_keys_set_owner_success[];
@@ -28,9 +35,17 @@ extern const uint8_t nyan_keys_unknown_command[];
 // COMMAND: write-bitstream
 extern const uint8_t nyan_keys_write_bitstream_info_start[];
 extern const uint8_t nyan_keys_write_bitstream_info_eeprom_write_completed[];
+extern const uint8_t nyan_keys_write_bitstream_info_pages_skipped[];
+extern const uint8_t nyan_keys_write_bitstream_error_digest[];
+extern const uint8_t nyan_keys_write_bitstream_info_slot[];
+extern const uint8_t nyan_keys_write_bitstream_info_slot_pending[];
+extern const uint8_t nyan_keys_write_bitstream_info_unprotected[];
 extern const uint8_t nyan_keys_write_bitstream_info_success[];
 extern const uint8_t nyan_keys_write_bitstream_error_size[];
+extern const uint8_t nyan_keys_write_bitstream_error_fpga_busy[];
 extern const uint8_t nyan_keys_write_bitstream_error_size_tx_busy[];
+extern const uint8_t nyan_keys_write_bitstream_error_eeprom[];
+extern const uint8_t nyan_keys_write_bitstream_error_timeout[];
 
 // COMMAND: bitcoin-miner-set
 extern const uint8_t nyan_keys_write_bitcoin_miner_failed_arg[];
@@ -56,4 +71,37 @@ extern const uint8_t nyan_keys_write_bitcoin_miner_nonce[];
 //COMMAND: dfu-mode
 extern const uint8_t nyan_keys_enter_dfu_mode_reboot_warning[];
 
+//COMMAND: telemetry
+extern const uint8_t nyan_keys_telemetry_rate[];
+extern const uint8_t nyan_keys_telemetry_error_rate[];
+extern const uint8_t nyan_keys_telemetry_error_disabled[];
+
+//COMMAND: bench
+extern const uint8_t nyan_keys_bench_header[];
+extern const uint8_t nyan_keys_bench_error_unknown[];
+extern const uint8_t nyan_keys_bench_error_failed[];
+
+//COMMAND: fpga-stats
+extern const uint8_t nyan_keys_fpga_stats_header[];
+extern const uint8_t nyan_keys_fpga_stats_ok[];
+extern const uint8_t nyan_keys_fpga_stats_progress[];
+extern const uint8_t nyan_keys_fpga_stats_failed[];
+extern const uint8_t nyan_keys_fpga_stats_no_image[];
+extern const uint8_t nyan_keys_fpga_stats_error_eeprom[];
+extern const uint8_t nyan_keys_fpga_stats_error_digest[];
+extern const uint8_t nyan_keys_fpga_stats_error_cdone[];
+extern const uint8_t nyan_keys_fpga_stats_error_spi[];
+extern const uint8_t nyan_keys_fpga_stats_digest[];
+extern const uint8_t nyan_keys_fpga_stats_slot[];
+extern const uint8_t nyan_keys_fpga_stats_rollback[];
+extern const uint8_t nyan_keys_fpga_stats_bitstream[];
+extern const uint8_t nyan_keys_fpga_stats_source[];
+extern const uint8_t nyan_keys_fpga_stats_cache_pending[];
+extern const uint8_t nyan_keys_fpga_stats_cache_updated[];
+extern const uint8_t nyan_keys_fpga_stats_cache_failed[];
+extern const uint8_t nyan_keys_fpga_stats_total[];
+extern const uint8_t nyan_keys_fpga_stats_eeprom[];
+extern const uint8_t nyan_keys_fpga_stats_decode[];
+extern const uint8_t nyan_keys_fpga_stats_spi[];
+
 #endif // _NYAN_STRINGS
\ No newline at end of file
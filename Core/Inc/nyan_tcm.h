@@ -0,0 +1,26 @@
+/**
+ * @file nyan_tcm.h
+ * @brief Placement of the key scan path in the tightly coupled memories.
+ *
+ * Code tagged NYAN_ITCM runs from ITCM RAM at 0x00000000, zero wait states
+ * and no dependency on the flash accelerator or the I-Cache. The startup
+ * copies it there from flash before SystemInit. Calls between ITCM and flash
+ * are out of BL range and go through veneers the linker adds.
+ *
+ * Data tagged NYAN_DTCM lives in DTCM next to the stack: single cycle, never
+ * cached and reachable by the DMA engines, so it needs no cache maintenance
+ * either. The section is NOLOAD and zeroed by the startup, only variables
+ * without an initializer can go there.
+ *
+ * The HAL and USB functions and handles on the same path can't be tagged in
+ * place, the linker script picks them up by section name. `make tcm-report`
+ * lists what ended up where.
+ */
+
+#ifndef NYAN_TCM_H
+#define NYAN_TCM_H
+
+#define NYAN_ITCM __attribute__((section(".itcm_text"))) ///< Function runs from ITCM RAM.
+#define NYAN_DTCM __attribute__((section(".dtcm_bss")))  ///< Zero initialized variable in DTCM.
+
+#endif // NYAN_TCM_H
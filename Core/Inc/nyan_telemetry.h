@@ -0,0 +1,157 @@
+/**
+ * @file nyan_telemetry.h
+ * @brief Binary telemetry stream on a dedicated CDC ACM channel.
+ *
+ * Built with NYAN_TELEMETRY_EN the composite device exposes a second CDC ACM
+ * interface next to the NyanOS shell. It carries a continuous stream of frames
+ * in the same COBS + CRC-32 format as nyan_frame.h, so monitoring tools reuse
+ * one decoder for both channels.
+ *
+ * Producers never block: a frame that does not fit in the transmit ring is
+ * dropped and counted, which is exactly what happens while no host has the
+ * port open. The drop counter is part of every status frame.
+ */
+
+#ifndef NYAN_TELEMETRY_H
+#define NYAN_TELEMETRY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "nyan_frame.h"
+
+#define NYAN_TELEMETRY_CDC_CHANNEL      1       /**< CDC channel of the stream, the shell stays on channel 0. */
+#define NYAN_TELEMETRY_RING_SZ          4096    /**< Transmit ring, must be a power of two. */
+#define NYAN_TELEMETRY_TX_MAX_LEN       512     /**< Largest single CDC transfer, one HS bulk packet. */
+#define NYAN_TELEMETRY_MAX_PAYLOAD      96      /**< Largest telemetry frame payload. */
+#define NYAN_TELEMETRY_TICK_HZ          800     /**< Rate of NyanTelemetryTick, the TIM8 task. */
+#define NYAN_TELEMETRY_MAX_HZ           100     /**< Fastest status rate. */
+#define NYAN_TELEMETRY_LATENCY_BUCKETS  16      /**< log2(us) buckets of the scan interval histogram. */
+
+#ifndef NYAN_TELEMETRY_DEFAULT_HZ
+#define NYAN_TELEMETRY_DEFAULT_HZ       10      /**< Status rate after boot, 0 disables the periodic frames. */
+#endif
+
+/**
+ * @enum NyanTelemetryReturn
+ * @brief Return values for the telemetry functions.
+ */
+typedef enum {
+    NYAN_TELEMETRY_FAILURE,
+    NYAN_TELEMETRY_SUCCESS
+} NyanTelemetryReturn;
+
+/**
+ * @struct NyanTelemetryStatus
+ * @brief Payload of NYAN_FRAME_TELEMETRY_STATUS.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t uptime_ms;             /**< HAL tick at the time of the snapshot. */
+    uint32_t keys_scans_per_sec;    /**< Key scans over the last second. */
+    uint32_t frames_emitted;        /**< Telemetry frames queued since boot. */
+    uint32_t frames_dropped;        /**< Telemetry frames dropped because the ring was full. */
+    uint8_t  fpga_configured;       /**< FPGA CDONE state. */
+    uint8_t  eeprom_busy;           /**< Bit 0 an EEPROM job owns the I2C bus. */
+    uint8_t  nos_state;             /**< NyanStates of the shell. */
+    uint8_t  rate_hz;               /**< Current status rate. */
+} NyanTelemetryStatus;
+
+/**
+ * @struct NyanTelemetryLatency
+ * @brief Payload of NYAN_FRAME_TELEMETRY_LATENCY, the histogram restarts after every frame.
+ *
+ * Bucket n counts key scan intervals of [2^(n-1), 2^n) microseconds, bucket 0
+ * counts intervals below 1 us and the last bucket everything above.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t samples;                                   /**< Intervals in this histogram. */
+    uint32_t max_us;                                    /**< Longest interval seen. */
+    uint32_t buckets[NYAN_TELEMETRY_LATENCY_BUCKETS];   /**< Interval counts per bucket. */
+} NyanTelemetryLatency;
+
+/**
+ * @struct NyanTelemetryKeys
+ * @brief Payload of NYAN_FRAME_TELEMETRY_KEYS, sent whenever the key matrix changes.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t cycles;                /**< DWT cycle counter at the scan that saw the change. */
+    uint8_t  key_states[8];         /**< Raw key state bits as read from the FPGA, active low. */
+} NyanTelemetryKeys;
+
+/**
+ * @struct NyanTelemetry
+ * @brief State of the telemetry channel.
+ */
+typedef struct {
+    uint8_t           ring[NYAN_TELEMETRY_RING_SZ]; /**< Encoded frames waiting for the host. */
+    uint32_t          head;                         /**< Free running write index of ring. */
+    uint32_t          tail;                         /**< Free running index of the oldest unsent byte. */
+    volatile uint32_t pending;                      /**< Bytes handed to CDC_Transmit. */
+    volatile bool     tx_inflight;                  /**< A CDC transfer is outstanding. */
+    uint8_t           seq;                          /**< Sequence number of the next frame. */
+    uint8_t           rate_hz;                      /**< Status frames per second, 0 when off. */
+    uint16_t          ticks;                        /**< Ticks since the last status frame. */
+    volatile uint32_t frames_emitted;               /**< Frames queued since boot. */
+    volatile uint32_t frames_dropped;               /**< Frames dropped since boot. */
+    uint32_t          scan_cycles;                  /**< DWT cycle counter at the previous key scan. */
+    NyanTelemetryLatency latency;                   /**< Histogram being accumulated. */
+} NyanTelemetry;
+
+/**
+ * @brief Initializes the telemetry channel and starts the cycle counter.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ */
+void NyanTelemetryInit(NyanTelemetry* telemetry);
+
+/**
+ * @brief Sets the status frame rate.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ * @param rate_hz Frames per second, 0 to NYAN_TELEMETRY_MAX_HZ, 0 stops periodic frames.
+ * @return NyanTelemetryReturn NYAN_TELEMETRY_FAILURE if the rate is out of range.
+ */
+NyanTelemetryReturn NyanTelemetrySetRate(NyanTelemetry* telemetry, uint32_t rate_hz);
+
+/**
+ * @brief Encodes a frame into the transmit ring. Never blocks, safe from any interrupt.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ * @param type NyanFrameType of the frame.
+ * @param payload Payload bytes.
+ * @param len Payload length, at most NYAN_TELEMETRY_MAX_PAYLOAD.
+ * @return NyanTelemetryReturn NYAN_TELEMETRY_FAILURE if the frame was dropped.
+ */
+NyanTelemetryReturn NyanTelemetryEmit(NyanTelemetry* telemetry, uint8_t type, const void* payload, uint16_t len);
+
+/**
+ * @brief Advances the status rate divider. Called from the TIM8 task.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ * @return true when a status frame is due.
+ */
+bool NyanTelemetryTick(NyanTelemetry* telemetry);
+
+/**
+ * @brief Starts the next CDC transfer of up to NYAN_TELEMETRY_TX_MAX_LEN bytes from the ring.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ */
+void NyanTelemetryTX(NyanTelemetry* telemetry);
+
+/**
+ * @brief Queues the accumulated scan interval histogram and restarts it.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ */
+void NyanTelemetryEmitLatency(NyanTelemetry* telemetry);
+
+/**
+ * @brief Records one completed key scan. Called from the SPI2 completion callback.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ * @param key_states Raw key states of the scan, the leading dummy byte stripped.
+ * @param changed The key states differ from the previous scan.
+ */
+void NyanTelemetryKeyScan(NyanTelemetry* telemetry, const volatile uint8_t* key_states, bool changed);
+
+/**
+ * @brief Releases the bytes of the completed CDC transfer. Called from the CDC transmit complete callback.
+ * @param telemetry Pointer to the NyanTelemetry struct.
+ */
+void NyanTelemetryTxComplete(NyanTelemetry* telemetry);
+
+#endif // NYAN_TELEMETRY_H
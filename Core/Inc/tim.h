@@ -34,6 +34,8 @@ extern "C" {
 
 extern TIM_HandleTypeDef htim1;
 
+extern TIM_HandleTypeDef htim5;
+
 extern TIM_HandleTypeDef htim6;
 
 extern TIM_HandleTypeDef htim7;
@@ -47,6 +49,7 @@ extern TIM_HandleTypeDef htim14;
 /* USER CODE END Private defines */
 
 void MX_TIM1_Init(void);
+void MX_TIM5_Init(void);
 void MX_TIM6_Init(void);
 void MX_TIM7_Init(void);
 void MX_TIM8_Init(void);
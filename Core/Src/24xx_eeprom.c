@@ -6,25 +6,44 @@
 #include <string.h>
 
 #include "i2c.h"
+#include "tim.h"
+#include "nyan_crc.h"
+#include "nyan_cycles.h"
+#include "nyan_dma.h"
 #include "24xx_eeprom.h"
+#ifdef EEPROM_SIM
+#include "24xx_eeprom_sim.h"
+#endif
 
+static const uint32_t eeprom_bus_timing[EEPROM_BUS_PROFILES] = {I2C1_TIMING_100K, I2C1_TIMING_400K, I2C1_TIMING_1M};
+static const uint16_t eeprom_bus_khz[EEPROM_BUS_PROFILES] = {100, 400, 1000};
 
-EepromReturn EepromInit(Eeprom24xx* eeprom, bool a0, bool a1)   
+EepromReturn EepromInit(Eeprom24xx* eeprom, bool a0, bool a1)
 {
     eeprom->a0 = a0;
     eeprom->a1 = a1;
-    eeprom->tx_inflight = false;
-    eeprom->rx_inflight = false;
+    eeprom->active = NULL;
+    eeprom->poll_start = 0;
+    eeprom->poll_delay_us = EEPROM_POLL_FIRST_US;
+    eeprom->bus_profile = EEPROM_BUS_400K;
+    eeprom->probing = false;
+    eeprom->recover_pending = false;
+    eeprom->bus_errors = 0;
+    eeprom->bus_recoveries = 0;
+    eeprom->job_retries = 0;
+    eeprom->jobs_failed = 0;
+    eeprom->pages_written = 0;
+    eeprom->pages_skipped = 0;
+    eeprom->rate_job.state = EEPROM_JOB_IDLE;
+    eeprom->read_rate = 0;
 
-    memset((void*)eeprom->tx_buf, 0, sizeof(eeprom->tx_buf));
-    memset((void*)eeprom->rx_buf, 0, sizeof(eeprom->rx_buf));
-
-    return EEPROM_SUCCESS;
-}
+    for (uint8_t priority = 0; priority < EEPROM_JOB_PRIORITIES; ++priority) {
+        eeprom->queue_head[priority] = NULL;
+        eeprom->queue_tail[priority] = NULL;
+    }
 
-EepromReturn EepromFlushTxBuff(Eeprom24xx* eeprom)
-{
     memset((void*)eeprom->tx_buf, 0, sizeof(eeprom->tx_buf));
+    memset((void*)eeprom->rx_buf, 0, sizeof(eeprom->rx_buf));
 
     return EEPROM_SUCCESS;
 }
@@ -45,32 +64,547 @@ uint8_t EepromCreateControlByte(Eeprom24xx* eeprom, bool read, bool b0)
     return ctrl_byte;
 }
 
-EepromReturn EepromWrite(Eeprom24xx* eeprom, bool b0, short eeprom_address, size_t len)
+void EepromJobInit(EepromJob* job, EepromJobType type, bool b0, uint16_t address, uint8_t* data, uint16_t len)
 {
-    if(eeprom->tx_inflight) {
-        return EEPROM_FAILURE;
+    job->type = type;
+    job->priority = EEPROM_JOB_PRIORITY_NORMAL;
+    job->b0 = b0;
+    job->address = address;
+    job->data = data;
+    job->len = len;
+    job->callback = NULL;
+    job->ctx = NULL;
+    job->next = NULL;
+    job->state = EEPROM_JOB_IDLE;
+    job->offset = 0;
+    job->segment = 0;
+    job->polls = 0;
+    job->attempts = 0;
+    job->compare = false;
+    job->comparing = false;
+    job->pages_skipped = 0;
+    job->direct = false;
+    job->queue_next = NULL;
+}
+
+EepromJob* EepromJobInitLinear(EepromJob* job, EepromJob* tail, EepromJobType type, uint32_t address, uint8_t* data, uint16_t len)
+{
+    uint32_t head_len = EEPROM_BLOCK_SIZE - address % EEPROM_BLOCK_SIZE;
+
+    EepromJobInit(job, type, address >= EEPROM_BLOCK_SIZE, (uint16_t)address, data, len);
+    // Without a tail the oversized job is refused by EepromSubmit
+    if (len <= head_len || !tail)
+        return job;
+
+    job->len = head_len;
+    EepromJobInit(tail, type, true, 0x0000, data + head_len, len - head_len);
+    job->next = tail;
+
+    return tail;
+}
+
+// Whole cache lines only, so nothing next to the buffer is written back or dropped,
+// any buffer the D-Cache never holds is fine as it is
+static bool EepromDmaSafe(const uint8_t* data, uint32_t len)
+{
+    return NyanDmaCoherent(data, len) || (((uintptr_t)data % EEPROM_DMA_ALIGN) == 0 && (len % EEPROM_DMA_ALIGN) == 0);
+}
+
+// Callers hold interrupts off around the queue helpers
+static void EepromQueuePush(Eeprom24xx* eeprom, EepromJob* job, bool front)
+{
+    EepromJobPriority priority = job->priority < EEPROM_JOB_PRIORITIES ? job->priority : EEPROM_JOB_PRIORITY_NORMAL;
+
+    if (front) {
+        job->queue_next = eeprom->queue_head[priority];
+        eeprom->queue_head[priority] = job;
+        if (!eeprom->queue_tail[priority])
+            eeprom->queue_tail[priority] = job;
+    } else {
+        job->queue_next = NULL;
+        if (eeprom->queue_tail[priority])
+            eeprom->queue_tail[priority]->queue_next = job;
+        else
+            eeprom->queue_head[priority] = job;
+        eeprom->queue_tail[priority] = job;
+    }
+}
+
+static EepromJob* EepromQueuePop(Eeprom24xx* eeprom)
+{
+    for (int8_t priority = EEPROM_JOB_PRIORITIES - 1; priority >= 0; --priority) {
+        EepromJob* job = eeprom->queue_head[priority];
+        if (job) {
+            eeprom->queue_head[priority] = job->queue_next;
+            if (!eeprom->queue_head[priority])
+                eeprom->queue_tail[priority] = NULL;
+            job->queue_next = NULL;
+            return job;
+        }
+    }
+
+    return NULL;
+}
+
+// Bytes of the write up to the end of the page the next one starts in
+static uint16_t EepromSegmentLen(const EepromJob* job)
+{
+    uint16_t address = job->address + job->offset;
+    uint16_t page_left = EEPROM_WRITE_PAGE_SZ - (address % EEPROM_WRITE_PAGE_SZ);
+    uint16_t remaining = job->len - job->offset;
+
+    return remaining < page_left ? remaining : page_left;
+}
+
+static bool EepromStart(Eeprom24xx* eeprom, EepromJob* job)
+{
+    HAL_StatusTypeDef status;
+
+    if (job->type == EEPROM_JOB_WRITE && job->comparing) {
+        // Read back what the page holds, a sequential read costs no write cycle
+        job->segment = EepromSegmentLen(job);
+        NyanDmaCleanInvalidate(eeprom->rx_buf, job->segment);
+        status = HAL_I2C_Mem_Read_DMA(&hi2c1, EepromCreateControlByte(eeprom, true, job->b0), job->address + job->offset, I2C_MEMADD_SIZE_16BIT, &eeprom->rx_buf[0], job->segment);
+    } else if (job->type == EEPROM_JOB_WRITE) {
+        job->segment = EepromSegmentLen(job);
+        memcpy(eeprom->tx_buf, &job->data[job->offset], job->segment);
+        // The DMA reads RAM, push the staged bytes out of the D-Cache
+        NyanDmaClean(eeprom->tx_buf, job->segment);
+        status = HAL_I2C_Mem_Write_DMA(&hi2c1, EepromCreateControlByte(eeprom, false, job->b0), job->address + job->offset, I2C_MEMADD_SIZE_16BIT, &eeprom->tx_buf[0], job->segment);
+    } else {
+        uint8_t* dst = job->direct ? job->data : &eeprom->rx_buf[0];
+        // No dirty line may be evicted on top of the DMA data
+        NyanDmaCleanInvalidate(dst, job->len);
+        status = HAL_I2C_Mem_Read_DMA(&hi2c1, EepromCreateControlByte(eeprom, true, job->b0), job->address, I2C_MEMADD_SIZE_16BIT, dst, job->len);
+    }
+
+    return status == HAL_OK;
+}
+
+static void EepromFinish(Eeprom24xx* eeprom, EepromJob* job, EepromReturn result)
+{
+    EepromJob* next = job->next;
+
+    if (result == EEPROM_SUCCESS && job->type == EEPROM_JOB_READ) {
+        uint8_t* dst = job->direct ? job->data : &eeprom->rx_buf[0];
+        // Drop lines speculatively fetched while the DMA was running
+        NyanDmaInvalidate(dst, job->len);
+        if (!job->direct)
+            memcpy(job->data, eeprom->rx_buf, job->len);
+    }
+
+    if (result != EEPROM_SUCCESS)
+        eeprom->jobs_failed++;
+
+    // Release the bus first so the callback can submit more work
+    eeprom->active = NULL;
+
+    if (result == EEPROM_SUCCESS && next) {
+        // A chain runs back to back, ahead of anything else at its priority
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        EepromQueuePush(eeprom, next, true);
+        __set_PRIMASK(primask);
     } else {
-        // Place the TX inflight to prevent causing DMA collisions
-        eeprom->tx_inflight = true;
-        if (HAL_I2C_Mem_Write_DMA(&hi2c1,EepromCreateControlByte((Eeprom24xx*) eeprom, false, b0), eeprom_address, I2C_MEMADD_SIZE_16BIT, (uint8_t*)&eeprom->tx_buf[0], len) != HAL_OK)
+        for (EepromJob* dropped = next; dropped; dropped = dropped->next) {
+            dropped->state = EEPROM_JOB_FAILED;
+            if (dropped->callback)
+                dropped->callback(dropped, EEPROM_FAILURE);
+        }
+    }
+
+    job->state = result == EEPROM_SUCCESS ? EEPROM_JOB_DONE : EEPROM_JOB_FAILED;
+    if (job->callback)
+        job->callback(job, result);
+}
+
+static void EepromApplyBusProfile(Eeprom24xx* eeprom, EepromBusProfile profile)
+{
+    // TIMINGR is only writable with the peripheral disabled
+    __HAL_I2C_DISABLE(&hi2c1);
+    hi2c1.Init.Timing = eeprom_bus_timing[profile];
+    WRITE_REG(hi2c1.Instance->TIMINGR, hi2c1.Init.Timing);
+    if (profile == EEPROM_BUS_1M)
+        HAL_I2CEx_EnableFastModePlus(I2C_FASTMODEPLUS_PB6 | I2C_FASTMODEPLUS_PB7);
+    else
+        HAL_I2CEx_DisableFastModePlus(I2C_FASTMODEPLUS_PB6 | I2C_FASTMODEPLUS_PB7);
+    __HAL_I2C_ENABLE(&hi2c1);
+    eeprom->bus_profile = profile;
+}
+
+static void EepromArmTimer(uint32_t delay_us)
+{
+    // TIM5 counts microseconds in one pulse mode, its update interrupt calls EepromIrqPollTimer
+    __HAL_TIM_DISABLE(&htim5);
+    __HAL_TIM_SET_AUTORELOAD(&htim5, delay_us - 1);
+    __HAL_TIM_SET_COUNTER(&htim5, 0);
+    __HAL_TIM_ENABLE(&htim5);
+}
+
+// The job keeps the bus, TIM5 recovers it and then runs the transfer again or gives up
+static void EepromRecover(Eeprom24xx* eeprom, EepromJob* job)
+{
+    eeprom->recover_pending = true;
+    if (job) {
+        job->attempts++;
+        job->polls = 0;
+    }
+    EepromArmTimer(EEPROM_RECOVER_DELAY_US);
+}
+
+static void EepromDelayUs(uint32_t delay_us)
+{
+    uint32_t start = NyanCyclesNow();
+
+    while (NyanCyclesToUs(NyanCyclesNow() - start) < delay_us) {
+    }
+}
+
+// A slave reset mid-byte can hold SDA low forever, clock it out and reinitialise I2C1
+static void EepromBusRecover(Eeprom24xx* eeprom)
+{
+    GPIO_InitTypeDef gpio = {0};
+
+    eeprom->bus_recoveries++;
+    HAL_I2C_DeInit(&hi2c1);
+
+    gpio.Mode = GPIO_MODE_OUTPUT_OD;
+    gpio.Pull = GPIO_NOPULL;
+    gpio.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+    gpio.Pin = I2C1_SCL_PIN | I2C1_SDA_PIN;
+    HAL_GPIO_WritePin(I2C1_GPIO_PORT, I2C1_SCL_PIN | I2C1_SDA_PIN, GPIO_PIN_SET);
+    HAL_GPIO_Init(I2C1_GPIO_PORT, &gpio);
+
+    // Nine clocks finish any byte in flight, the slave lets go of SDA on the NACK
+    for (uint8_t pulse = 0; pulse < EEPROM_RECOVER_PULSES && HAL_GPIO_ReadPin(I2C1_GPIO_PORT, I2C1_SDA_PIN) == GPIO_PIN_RESET; ++pulse) {
+        HAL_GPIO_WritePin(I2C1_GPIO_PORT, I2C1_SCL_PIN, GPIO_PIN_RESET);
+        EepromDelayUs(EEPROM_RECOVER_HALF_US);
+        HAL_GPIO_WritePin(I2C1_GPIO_PORT, I2C1_SCL_PIN, GPIO_PIN_SET);
+        EepromDelayUs(EEPROM_RECOVER_HALF_US);
+    }
+
+    // STOP condition, SDA rising while SCL is high
+    HAL_GPIO_WritePin(I2C1_GPIO_PORT, I2C1_SDA_PIN, GPIO_PIN_RESET);
+    EepromDelayUs(EEPROM_RECOVER_HALF_US);
+    HAL_GPIO_WritePin(I2C1_GPIO_PORT, I2C1_SDA_PIN, GPIO_PIN_SET);
+    EepromDelayUs(EEPROM_RECOVER_HALF_US);
+
+    // The MSP init hands the pins back to the peripheral
+    MX_I2C1_Init();
+    EepromApplyBusProfile(eeprom, eeprom->bus_profile);
+}
+
+static void EepromStartNext(Eeprom24xx* eeprom)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (eeprom->active || eeprom->recover_pending) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    EepromJob* job = EepromQueuePop(eeprom);
+    if (!job) {
+        __set_PRIMASK(primask);
+        return;
+    }
+    job->state = EEPROM_JOB_ACTIVE;
+    job->offset = 0;
+    job->polls = 0;
+    job->attempts = 0;
+    job->comparing = job->compare;
+    job->pages_skipped = 0;
+    eeprom->active = job;
+
+    __set_PRIMASK(primask);
+
+    // The HAL refused the transfer, the peripheral is wedged
+    if (!EepromStart(eeprom, job))
+        EepromRecover(eeprom, job);
+}
+
+EepromReturn EepromSubmit(Eeprom24xx* eeprom, EepromJob* job)
+{
+    for (EepromJob* link = job; link; link = link->next) {
+        uint32_t max_len;
+        if (link->type == EEPROM_JOB_WRITE)
+            max_len = EEPROM_BLOCK_SIZE - link->address;
+        else if (EepromDmaSafe(link->data, link->len))
+            max_len = EEPROM_BLOCK_SIZE - link->address;
+        else
+            max_len = EEPROM_DRIVER_RX_BUF_SZ;
+        // A sequential read wraps inside the block, it would silently return the start of the block
+        if (max_len > EEPROM_BLOCK_SIZE - link->address)
+            max_len = EEPROM_BLOCK_SIZE - link->address;
+        if (link->len == 0 || link->len > max_len || !link->data || EepromJobBusy(link))
             return EEPROM_FAILURE;
     }
 
+    // Only the head is queued, the rest of the chain follows from EepromFinish
+    for (EepromJob* link = job; link; link = link->next) {
+        link->direct = link->type == EEPROM_JOB_READ && EepromDmaSafe(link->data, link->len);
+        link->state = EEPROM_JOB_QUEUED;
+    }
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    EepromQueuePush(eeprom, job, false);
+    __set_PRIMASK(primask);
+
+    EepromStartNext(eeprom);
+
     return EEPROM_SUCCESS;
 }
 
-EepromReturn EepromRead(Eeprom24xx* eeprom, bool b0, short eeprom_address, size_t len)
+bool EepromJobDone(const EepromJob* job)
+{
+    return job->state == EEPROM_JOB_DONE || job->state == EEPROM_JOB_FAILED;
+}
+
+bool EepromJobBusy(const EepromJob* job)
+{
+    return job->state == EEPROM_JOB_QUEUED || job->state == EEPROM_JOB_ACTIVE;
+}
+
+EepromReturn EepromJobWait(const EepromJob* job)
+{
+    while (EepromJobBusy(job)) {
+        // Completion arrives from the I2C interrupt
+#ifdef EEPROM_SIM
+        // The host has none, the simulator delivers it as time passes
+        EepromSimAdvance(EEPROM_SIM_CLOCK_US);
+#endif
+    }
+
+    return job->state == EEPROM_JOB_DONE ? EEPROM_SUCCESS : EEPROM_FAILURE;
+}
+
+bool EepromBusy(Eeprom24xx* eeprom)
+{
+    return eeprom->active != NULL;
+}
+
+void EepromIrqComplete(Eeprom24xx* eeprom)
+{
+    EepromJob* job = eeprom->active;
+
+    if (!job)
+        return;
+
+    if (job->type == EEPROM_JOB_WRITE && job->comparing) {
+        job->comparing = false;
+        NyanDmaInvalidate(eeprom->rx_buf, job->segment);
+        if (memcmp(eeprom->rx_buf, &job->data[job->offset], job->segment) == 0) {
+            job->pages_skipped++;
+            eeprom->pages_skipped++;
+        } else {
+            // Same page, now written
+            job->polls = 0;
+            if (!EepromStart(eeprom, job))
+                EepromRecover(eeprom, job);
+            return;
+        }
+    } else if (job->type == EEPROM_JOB_WRITE) {
+        eeprom->pages_written++;
+    }
+
+    // Keep the bus for the next page of a split write, it is ACK polled like any other transfer
+    if (job->type == EEPROM_JOB_WRITE && job->offset + job->segment < job->len) {
+        job->offset += job->segment;
+        job->polls = 0;
+        job->attempts = 0;
+        job->comparing = job->compare;
+        if (!EepromStart(eeprom, job))
+            EepromRecover(eeprom, job);
+        return;
+    }
+
+    EepromFinish(eeprom, job, EEPROM_SUCCESS);
+    EepromStartNext(eeprom);
+}
+
+void EepromIrqNack(Eeprom24xx* eeprom)
+{
+    EepromJob* job = eeprom->active;
+
+    if (!job)
+        return;
+
+    // The EEPROM does not ACK its address while a write cycle is in progress, poll it with a growing delay
+    if (job->polls++ == 0) {
+        eeprom->poll_start = NyanCyclesNow();
+        eeprom->poll_delay_us = EEPROM_POLL_FIRST_US;
+    } else if (NyanCyclesToUs(NyanCyclesNow() - eeprom->poll_start) >= EEPROM_POLL_DEADLINE_US) {
+        EepromFinish(eeprom, job, EEPROM_FAILURE);
+        EepromStartNext(eeprom);
+        return;
+    } else if (eeprom->poll_delay_us < EEPROM_POLL_MAX_US) {
+        eeprom->poll_delay_us *= 2;
+        if (eeprom->poll_delay_us > EEPROM_POLL_MAX_US)
+            eeprom->poll_delay_us = EEPROM_POLL_MAX_US;
+    }
+
+    EepromArmTimer(eeprom->poll_delay_us);
+}
+
+void EepromIrqPollTimer(Eeprom24xx* eeprom)
+{
+    EepromJob* job = eeprom->active;
+
+    if (eeprom->recover_pending) {
+        EepromBusRecover(eeprom);
+        eeprom->recover_pending = false;
+        // A probe is expected to fail on a profile the bus cannot do, retrying only slows it down
+        if (job && (eeprom->probing || job->attempts > EEPROM_JOB_RETRIES)) {
+            EepromFinish(eeprom, job, EEPROM_FAILURE);
+            EepromStartNext(eeprom);
+            return;
+        }
+        if (!job) {
+            EepromStartNext(eeprom);
+            return;
+        }
+        eeprom->job_retries++;
+    }
+
+    if (!job || EepromStart(eeprom, job))
+        return;
+
+    EepromRecover(eeprom, job);
+}
+
+EepromReturn EepromSetBusProfile(Eeprom24xx* eeprom, EepromBusProfile profile)
 {
-    if(eeprom->rx_inflight) {
+    if (profile >= EEPROM_BUS_PROFILES)
         return EEPROM_FAILURE;
-    } if(len >= EEPROM_DRIVER_RX_BUF_SZ) {
+
+    // Nothing may start a job while the peripheral is down
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (EepromBusy(eeprom) || eeprom->recover_pending) {
+        __set_PRIMASK(primask);
         return EEPROM_FAILURE;
-    } else {
-        memset((void*)eeprom->rx_buf, 0, sizeof(eeprom->rx_buf));
-        eeprom->rx_inflight = true;
-        if(HAL_I2C_Mem_Read_DMA(&hi2c1,EepromCreateControlByte((Eeprom24xx*)eeprom, true, b0), eeprom_address, I2C_MEMADD_SIZE_16BIT, (uint8_t*)&eeprom->rx_buf[0], len) != HAL_OK)
-            Error_Handler();
     }
 
+    EepromApplyBusProfile(eeprom, profile);
+
+    __set_PRIMASK(primask);
+
     return EEPROM_SUCCESS;
-}
\ No newline at end of file
+}
+
+static EepromReturn EepromTimedRead(Eeprom24xx* eeprom, uint16_t address, uint8_t* data, uint16_t len, uint32_t* cycles)
+{
+    EepromJob job;
+
+    EepromJobInit(&job, EEPROM_JOB_READ, false, address, data, len);
+    job.priority = EEPROM_JOB_PRIORITY_HIGH;
+
+    uint32_t start = NyanCyclesNow();
+    if (EepromSubmit(eeprom, &job) != EEPROM_SUCCESS)
+        return EEPROM_FAILURE;
+    EepromReturn result = EepromJobWait(&job);
+    *cycles = NyanCyclesNow() - start;
+
+    return result;
+}
+
+// A read that garbles any bit breaks the CRC, the pattern toggles every data line on every byte
+static bool EepromProbeIntact(Eeprom24xx* eeprom, uint8_t* data)
+{
+    uint32_t cycles;
+    uint32_t crc;
+
+    memset(data, 0, EEPROM_PROBE_LEN);
+    if (EepromTimedRead(eeprom, EEPROM_PROBE_ADDR, data, EEPROM_PROBE_LEN, &cycles) != EEPROM_SUCCESS)
+        return false;
+    memcpy(&crc, &data[EEPROM_PROBE_LEN - sizeof(crc)], sizeof(crc));
+
+    return crc == NyanCrc32(data, EEPROM_PROBE_LEN - sizeof(crc));
+}
+
+// Written at the speed every board manages, only when the stored pattern is missing or damaged
+static bool EepromProbeWrite(Eeprom24xx* eeprom, uint8_t* data)
+{
+    EepromJob job;
+
+    for (uint16_t idx = 0; idx < EEPROM_PROBE_LEN - sizeof(uint32_t); ++idx)
+        data[idx] = (idx & 1) ? (uint8_t)(0x55 ^ idx) : (uint8_t)(0xAA ^ idx);
+    uint32_t crc = NyanCrc32(data, EEPROM_PROBE_LEN - sizeof(crc));
+    memcpy(&data[EEPROM_PROBE_LEN - sizeof(crc)], &crc, sizeof(crc));
+
+    EepromJobInit(&job, EEPROM_JOB_WRITE, false, EEPROM_PROBE_ADDR, data, EEPROM_PROBE_LEN);
+    job.priority = EEPROM_JOB_PRIORITY_HIGH;
+    if (EepromSubmit(eeprom, &job) != EEPROM_SUCCESS || EepromJobWait(&job) != EEPROM_SUCCESS)
+        return false;
+
+    return EepromProbeIntact(eeprom, data);
+}
+
+EepromBusProfile EepromProbeBusProfile(Eeprom24xx* eeprom)
+{
+    uint8_t data[EEPROM_PROBE_LEN];
+    EepromBusProfile fallback = eeprom->bus_profile;
+
+    eeprom->probing = true;
+
+    if (EepromSetBusProfile(eeprom, EEPROM_BUS_100K) == EEPROM_SUCCESS &&
+        (EepromProbeIntact(eeprom, data) || EepromProbeWrite(eeprom, data))) {
+        fallback = EEPROM_BUS_100K;
+
+        for (int8_t profile = EEPROM_BUS_PROFILES - 1; profile > EEPROM_BUS_100K; --profile) {
+            if (EepromSetBusProfile(eeprom, (EepromBusProfile)profile) != EEPROM_SUCCESS)
+                continue;
+            bool intact = true;
+            for (uint8_t pass = 0; pass < EEPROM_PROBE_PASSES && intact; ++pass)
+                intact = EepromProbeIntact(eeprom, data);
+            if (intact) {
+                eeprom->probing = false;
+                return eeprom->bus_profile;
+            }
+        }
+    }
+
+    EepromSetBusProfile(eeprom, fallback);
+    eeprom->probing = false;
+
+    return eeprom->bus_profile;
+}
+
+uint16_t EepromBusProfileKhz(EepromBusProfile profile)
+{
+    return profile < EEPROM_BUS_PROFILES ? eeprom_bus_khz[profile] : 0;
+}
+
+// Runs in the I2C interrupt
+static void EepromReadRateDone(EepromJob* job, EepromReturn result)
+{
+    Eeprom24xx* eeprom = (Eeprom24xx*)job->ctx;
+    uint32_t cycles = NyanCyclesNow() - eeprom->rate_start;
+
+    if (result == EEPROM_SUCCESS && cycles)
+        eeprom->read_rate = (uint32_t)(((uint64_t)sizeof(eeprom->rx_buf) * SystemCoreClock) / cycles);
+}
+
+EepromReturn EepromMeasureReadRate(Eeprom24xx* eeprom)
+{
+    // An idle bus keeps queued jobs out of the timing, and the staging buffer unused for the whole read
+    if (EepromBusy(eeprom) || EepromJobBusy(&eeprom->rate_job))
+        return EEPROM_FAILURE;
+
+    EepromJobInit(&eeprom->rate_job, EEPROM_JOB_READ, false, 0x0000, eeprom->rx_buf, sizeof(eeprom->rx_buf));
+    eeprom->rate_job.priority = EEPROM_JOB_PRIORITY_HIGH;
+    eeprom->rate_job.callback = EepromReadRateDone;
+    eeprom->rate_job.ctx = eeprom;
+    eeprom->rate_start = NyanCyclesNow();
+
+    return EepromSubmit(eeprom, &eeprom->rate_job);
+}
+
+void EepromIrqError(Eeprom24xx* eeprom)
+{
+    // The HAL already aborted the DMA, the active job keeps the bus until TIM5 has recovered it
+    eeprom->bus_errors++;
+    EepromRecover(eeprom, eeprom->active);
+}
@@ -0,0 +1,262 @@
+/**
+ * @auth: Portland.HODL
+ * In-memory 24xx1025 for host builds, replaces the HAL I2C driver, TIM5 and the clocks
+ */
+
+#ifdef EEPROM_SIM
+
+#include <string.h>
+
+#include "tim.h"
+#include "24xx_eeprom_sim.h"
+
+EepromSim eeprom_sim;
+
+void EepromSimInit(bool a0, bool a1)
+{
+    memset(&eeprom_sim, 0, sizeof(eeprom_sim));
+    memset(eeprom_sim.mem, 0xFF, sizeof(eeprom_sim.mem));
+    eeprom_sim.a0 = a0;
+    eeprom_sim.a1 = a1;
+    // Register accesses of the driver's poll timer land in RAM
+    htim5.Instance = &eeprom_sim.tim;
+}
+
+uint64_t EepromSimNowUs(void)
+{
+    return eeprom_sim.now_us;
+}
+
+// Reading a clock takes time, outside an interrupt that lets pending completions land
+static void EepromSimClockRead(void)
+{
+    if (eeprom_sim.in_irq || eeprom_sim.primask)
+        eeprom_sim.clock_reads++;
+    else
+        EepromSimAdvance(EEPROM_SIM_CLOCK_US);
+}
+
+DWT_Type* EepromSimDwt(void)
+{
+    EepromSimClockRead();
+    eeprom_sim.dwt.CYCCNT = (uint32_t)(eeprom_sim.now_us * EEPROM_SIM_CORE_MHZ) + eeprom_sim.clock_reads;
+
+    return &eeprom_sim.dwt;
+}
+
+uint32_t HAL_GetTick(void)
+{
+    EepromSimClockRead();
+
+    return (uint32_t)(eeprom_sim.now_us / 1000);
+}
+
+void EepromSimInjectFault(EepromSimFault fault, uint32_t after)
+{
+    eeprom_sim.fault = fault;
+    eeprom_sim.fault_after = after;
+}
+
+uint32_t EepromSimBitNs(I2C_HandleTypeDef* hi2c)
+{
+    uint32_t timing = hi2c->Instance->TIMINGR;
+    uint32_t presc = (timing >> 28) & 0xF;
+    uint32_t sclh = (timing >> 8) & 0xFF;
+    uint32_t scll = timing & 0xFF;
+
+    return (uint32_t)(((uint64_t)(presc + 1) * (scll + 1 + sclh + 1) * 1000000000ULL) / EEPROM_SIM_I2C_CLK_HZ);
+}
+
+static uint64_t EepromSimBytesUs(I2C_HandleTypeDef* hi2c, uint32_t bytes)
+{
+    uint64_t ns = (uint64_t)bytes * EEPROM_SIM_BITS_PER_BYTE * EepromSimBitNs(hi2c);
+
+    return (ns + 999) / 1000;
+}
+
+static HAL_StatusTypeDef EepromSimStart(I2C_HandleTypeDef* hi2c, bool read, uint16_t dev, uint16_t address, uint8_t* data, uint16_t len)
+{
+    EepromSim* sim = &eeprom_sim;
+
+    if (hi2c->State != HAL_I2C_STATE_READY || sim->hi2c)
+        return HAL_BUSY;
+
+    sim->hi2c = hi2c;
+    sim->read = read;
+    sim->b0 = (dev & EEPROM_CTRL_MASK_B0) != 0;
+    sim->address = address;
+    sim->data = data;
+    sim->len = len;
+    sim->error = HAL_I2C_ERROR_NONE;
+    sim->corrupt = false;
+    sim->transfers++;
+    hi2c->State = read ? HAL_I2C_STATE_BUSY_RX : HAL_I2C_STATE_BUSY_TX;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    bool selected = (dev & 0xF0) == EEPROM_CTRL_MASK_CODE &&
+                    ((dev & EEPROM_CTRL_MASK_A0) != 0) == sim->a0 &&
+                    ((dev & EEPROM_CTRL_MASK_A1) != 0) == sim->a1;
+    bool answered = selected && sim->now_us >= sim->busy_until_us;
+    // Only a transfer the part answers counts towards an armed fault, ACK polls don't use it up
+    EepromSimFault kind = EEPROM_SIM_FAULT_NONE;
+    if (answered && sim->fault != EEPROM_SIM_FAULT_NONE && sim->fault_after-- == 0) {
+        kind = sim->fault;
+        sim->fault = EEPROM_SIM_FAULT_NONE;
+    }
+
+    // Nobody answers a foreign address, and the part ignores its own during a write cycle
+    if (!answered || kind == EEPROM_SIM_FAULT_NACK) {
+        sim->nacks++;
+        sim->error = HAL_I2C_ERROR_AF;
+        sim->done_us = sim->now_us + EepromSimBytesUs(hi2c, 1);
+        return HAL_OK;
+    }
+
+    // Control byte, two address bytes, and the repeated control byte of a read
+    sim->done_us = sim->now_us + EepromSimBytesUs(hi2c, (read ? 4 : 3) + len);
+    if (kind == EEPROM_SIM_FAULT_BUS_ERROR)
+        sim->error = HAL_I2C_ERROR_BERR;
+    sim->corrupt = kind == EEPROM_SIM_FAULT_CORRUPT;
+
+    return HAL_OK;
+}
+
+static void EepromSimComplete(EepromSim* sim)
+{
+    I2C_HandleTypeDef* hi2c = sim->hi2c;
+    uint8_t* block = sim->mem[sim->b0 ? 1 : 0];
+
+    sim->hi2c = NULL;
+    hi2c->State = HAL_I2C_STATE_READY;
+
+    if (sim->error != HAL_I2C_ERROR_NONE) {
+        hi2c->ErrorCode = sim->error;
+        HAL_I2C_ErrorCallback(hi2c);
+        return;
+    }
+
+    if (sim->read) {
+        // Sequential reads roll over at the end of the block
+        for (uint16_t i = 0; i < sim->len; ++i)
+            sim->data[i] = block[(uint16_t)(sim->address + i)];
+        if (sim->corrupt && sim->len)
+            sim->data[sim->len / 2] ^= 0x01;
+        sim->bytes_read += sim->len;
+        HAL_I2C_MemRxCpltCallback(hi2c);
+    } else {
+        // Page writes roll over at the end of the page, later bytes overwrite earlier ones
+        uint16_t page = sim->address & ~(uint16_t)(EEPROM_WRITE_PAGE_SZ - 1);
+        for (uint16_t i = 0; i < sim->len; ++i)
+            block[page | ((sim->address + i) & (EEPROM_WRITE_PAGE_SZ - 1))] = sim->data[i];
+        sim->bytes_written += sim->len;
+        sim->write_cycles++;
+        sim->busy_until_us = sim->now_us + EEPROM_SIM_TWC_US;
+        HAL_I2C_MemTxCpltCallback(hi2c);
+    }
+}
+
+// One pulse mode, the update stops the counter
+static void EepromSimTimerFire(EepromSim* sim)
+{
+    sim->tim.CR1 &= ~TIM_CR1_CEN;
+    sim->tim.CNT = 0;
+    sim->timer_fires++;
+    HAL_TIM_PeriodElapsedCallback(&htim5);
+}
+
+static void EepromSimTimerRun(EepromSim* sim, uint64_t to_us)
+{
+    if (sim->tim.CR1 & TIM_CR1_CEN)
+        sim->tim.CNT += (uint32_t)(to_us - sim->now_us);
+    sim->now_us = to_us;
+}
+
+void EepromSimAdvance(uint32_t us)
+{
+    EepromSim* sim = &eeprom_sim;
+    uint64_t target = sim->now_us + us;
+
+    // Interrupts are masked, or this is one, nothing can be delivered and time stands still
+    if (sim->in_irq || sim->primask)
+        return;
+
+    // A callback may start the next transfer or arm the timer, either can fall due in the same window
+    for (;;) {
+        uint64_t i2c_us = sim->hi2c ? sim->done_us : UINT64_MAX;
+        uint32_t tim_left = sim->tim.CNT <= sim->tim.ARR ? sim->tim.ARR + 1 - sim->tim.CNT : 0;
+        uint64_t tim_us = (sim->tim.CR1 & TIM_CR1_CEN) ? sim->now_us + tim_left : UINT64_MAX;
+        uint64_t next_us = i2c_us < tim_us ? i2c_us : tim_us;
+        if (next_us > target)
+            break;
+
+        EepromSimTimerRun(sim, next_us);
+        sim->in_irq = true;
+        if (next_us == i2c_us)
+            EepromSimComplete(sim);
+        else
+            EepromSimTimerFire(sim);
+        sim->in_irq = false;
+    }
+    EepromSimTimerRun(sim, target);
+}
+
+HAL_StatusTypeDef HAL_I2C_Init(I2C_HandleTypeDef *hi2c)
+{
+    // Register accesses of the driver land in RAM
+    hi2c->Instance = &eeprom_sim.regs;
+    hi2c->Instance->TIMINGR = hi2c->Init.Timing;
+    hi2c->State = HAL_I2C_STATE_READY;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2C_DeInit(I2C_HandleTypeDef *hi2c)
+{
+    // Whatever was in flight is abandoned, the part finishes a write cycle it already started
+    if (eeprom_sim.hi2c == hi2c)
+        eeprom_sim.hi2c = NULL;
+    hi2c->State = HAL_I2C_STATE_RESET;
+    hi2c->ErrorCode = HAL_I2C_ERROR_NONE;
+
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigAnalogFilter(I2C_HandleTypeDef *hi2c, uint32_t AnalogFilter)
+{
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_I2CEx_ConfigDigitalFilter(I2C_HandleTypeDef *hi2c, uint32_t DigitalFilter)
+{
+    return HAL_OK;
+}
+
+void HAL_I2CEx_EnableFastModePlus(uint32_t ConfigFastModePlus)
+{
+    eeprom_sim.fast_mode_plus = true;
+}
+
+void HAL_I2CEx_DisableFastModePlus(uint32_t ConfigFastModePlus)
+{
+    eeprom_sim.fast_mode_plus = false;
+}
+
+uint32_t HAL_I2C_GetError(I2C_HandleTypeDef *hi2c)
+{
+    return hi2c->ErrorCode;
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Write_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                        uint16_t MemAddSize, uint8_t *pData, uint16_t Size)
+{
+    return EepromSimStart(hi2c, false, DevAddress, MemAddress, pData, Size);
+}
+
+HAL_StatusTypeDef HAL_I2C_Mem_Read_DMA(I2C_HandleTypeDef *hi2c, uint16_t DevAddress, uint16_t MemAddress,
+                                       uint16_t MemAddSize, uint8_t *pData, uint16_t Size)
+{
+    return EepromSimStart(hi2c, true, DevAddress, MemAddress, pData, Size);
+}
+
+#endif // EEPROM_SIM
@@ -6,115 +6,256 @@
  */
 #include "iceuncompr.h"
 
-// Function to read a bit from the input stream
-int read_bit(Iceuncompr *ice) {
-    if (ice->read_bitcounter == 0) {
-        ice->read_bitcounter = 8;
-        if (ice->input_data_fh != NULL) {
-            int ch = fgetc(ice->input_data_fh);
-            if (ch != EOF) {
-                ice->read_buffer = ch;
-            } else {
-                // Handle end of file or error
-                return EOF;
+// Count field widths of the opcodes, indexed by the number of leading ZERO bits
+static const uint8_t ice_count_bits[6] = {2, 5, 8, 6, 23, 23};
+
+// Where ice_resume picks up again
+enum {
+    ICE_STATE_MAGIC1,
+    ICE_STATE_MAGIC2,
+    ICE_STATE_OPCODE,
+    ICE_STATE_LITERAL,
+    ICE_STATE_ZEROS,
+    ICE_STATE_FLUSH,
+    ICE_STATE_DONE,
+};
+
+static void ice_refill_blocks(Iceuncompr *ice);
+
+// Tops the reservoir up to at least 57 bits, or as many as the input has left
+static inline void ice_refill(Iceuncompr *ice) {
+    while (ice->read_bitcounter <= 56 && ice->input < ice->input_end) {
+        ice->read_buffer |= (uint64_t)*ice->input++ << (56 - ice->read_bitcounter);
+        ice->read_bitcounter += 8;
+    }
+    if (ice->read_bitcounter <= 56 && ice->input_source)
+        ice_refill_blocks(ice);
+}
+
+// Slow path, the current block ran out, carries on with the blocks of the input source
+static void ice_refill_blocks(Iceuncompr *ice) {
+    ice->input_wait = false;
+    while (ice->read_bitcounter <= 56) {
+        if (ice->input == ice->input_end) {
+            const uint8_t *block = NULL;
+            uint32_t len = ice->input_source(ice->input_ctx, &block);
+            if (len == ICEUNCOMPR_SOURCE_WAIT) {
+                ice->input_wait = true;
+                return;
             }
-        } else {
-            // Handle error if file handle is NULL
-            return EOF;
+            if (!len || !block)
+                return;
+            ice->input = block;
+            ice->input_end = block + len;
         }
+        ice->read_buffer |= (uint64_t)*ice->input++ << (56 - ice->read_bitcounter);
+        ice->read_bitcounter += 8;
     }
+}
 
-    ice->read_bitcounter--;
-    return (ice->read_buffer >> ice->read_bitcounter) & 1;
+// Makes sure the reservoir holds bits, false if the input is exhausted or has to be waited for
+static inline bool ice_have(Iceuncompr *ice, uint32_t bits) {
+    if (ice->read_bitcounter < bits) {
+        ice_refill(ice);
+        if (ice->read_bitcounter < bits)
+            return false;
+    }
+    return true;
 }
 
-// Function to write a bit to the output buffer
-void write_bit(Iceuncompr *ice, int value) {
-    ice->write_bitcounter--;
+// Takes up to 32 bits MSB first, ice_have must have said they are there
+static inline uint32_t ice_take(Iceuncompr *ice, uint32_t bits) {
+    uint32_t value = (uint32_t)(ice->read_buffer >> (64 - bits));
+    ice->read_buffer <<= bits;
+    ice->read_bitcounter -= bits;
+    return value;
+}
 
-    if (value)
-        ice->write_buffer |= 1 << ice->write_bitcounter;
+// Nothing was consumed, a source that has to wait gets asked again by the next ice_resume
+static inline int ice_starved(Iceuncompr *ice) {
+    return ice->input_wait ? ICEUNCOMPR_BLOCKED : 2;
+}
 
-    if (ice->write_bitcounter == 0) {
-        // Write the byte to the SPI channel
-        HAL_SPI_Transmit(&hspi4, (uint8_t*)&ice->write_buffer, 1, 100);
-        ice->write_bitcounter = 8;
-        ice->write_buffer = 0;
-    }
+// Hands a full chunk to the sink, the bytes staged past it move to the buffer the sink returns
+static bool ice_flush(Iceuncompr *ice) {
+    uint8_t *next = ice->output(ice->output_ctx, ice->output_data, ICEUNCOMPR_OUT_CHUNK);
+
+    if (!next)
+        return false;
+    ice->write_position -= ICEUNCOMPR_OUT_CHUNK;
+    memmove(next, &ice->output_data[ICEUNCOMPR_OUT_CHUNK], ice->write_position);
+    ice->output_data = next;
+    ice->output_total += ICEUNCOMPR_OUT_CHUNK;
+    return true;
 }
 
-// Function to read an integer from the input stream
-int read_int(Iceuncompr *ice, int bits) {
-    int ret = 0;
-    while (bits-- > 0) {
-        int bit = read_bit(ice);
-        if (bit == EOF) {
-            return EOF;  // Handle EOF or error
-        }
-        if (bit) {
-            ret |= 1 << bits;
-        }
+// Appends up to 32 bits MSB first
+static inline void ice_put(Iceuncompr *ice, uint32_t value, uint32_t bits) {
+    uint64_t acc = ((uint64_t)ice->write_buffer << bits) | value;
+    uint32_t count = ice->write_bitcounter + bits;
+
+    while (count >= 8) {
+        count -= 8;
+        ice->output_data[ice->write_position++] = (uint8_t)(acc >> count);
     }
-    return ret;
+    ice->write_buffer = (uint32_t)acc & ((1u << count) - 1);
+    ice->write_bitcounter = count;
 }
 
-// Function to write zeros to the output buffer
-void write_zeros(Iceuncompr *ice, int bits) {
-    while (bits-- > 0) {
-        write_bit(ice, 0);
+// Emits zeros of the current run up to the end of the chunk, true once the run is done
+static inline bool ice_put_zeros(Iceuncompr *ice) {
+    // Finish the partial byte, after that the run is byte aligned
+    if (ice->write_bitcounter) {
+        uint32_t fill = 8 - ice->write_bitcounter;
+        if (fill > ice->run)
+            fill = ice->run;
+        ice_put(ice, 0, fill);
+        ice->run -= fill;
     }
+
+    uint32_t bytes = ice->run / 8;
+    uint32_t chunk = ice->write_position < ICEUNCOMPR_OUT_CHUNK ? ICEUNCOMPR_OUT_CHUNK - ice->write_position : 0;
+    if (chunk > bytes)
+        chunk = bytes;
+    memset(&ice->output_data[ice->write_position], 0, chunk);
+    ice->write_position += chunk;
+    ice->run -= chunk * 8;
+    if (ice->run >= 8)
+        return false;
+
+    ice_put(ice, 0, ice->run);
+    ice->run = 0;
+    return true;
 }
 
-// Main decompression function
-int ice_uncompress(Iceuncompr *ice) {
+void ice_start(Iceuncompr *ice) {
+    ice->read_buffer = 0;
     ice->read_bitcounter = 0;
-    ice->write_bitcounter = 8;
     ice->write_buffer = 0;
+    ice->write_bitcounter = 0;
+    ice->write_position = 0;
+    ice->output_total = 0;
+    ice->input_wait = false;
+    ice->state = ICE_STATE_MAGIC1;
+    ice->opcode = 0;
+    ice->run = 0;
+}
 
-    int magic1_ok = read_int(ice, 32) == 0x49434543;
-    int magic2_ok = read_int(ice, 32) == 0x4f4d5052;
+int ice_resume(Iceuncompr *ice) {
+    while (1) {
+        // Only between steps, a step never stages more than the slack past the chunk
+        if (ice->write_position >= ICEUNCOMPR_OUT_CHUNK && !ice_flush(ice))
+            return ICEUNCOMPR_BLOCKED;
 
-    if (!magic1_ok || !magic2_ok) {
-        return 1;
-    }
+        switch (ice->state) {
+        case ICE_STATE_MAGIC1:
+        case ICE_STATE_MAGIC2:
+            if (!ice_have(ice, 32))
+                return ice->input_wait ? ICEUNCOMPR_BLOCKED : 1;
+            if (ice_take(ice, 32) != (ice->state == ICE_STATE_MAGIC1 ? 0x49434543 : 0x4f4d5052))
+                return 1;
+            ice->state++;
+            break;
 
-    while (1) {
-        if (read_bit(ice)) {
-            write_zeros(ice, read_int(ice, 2));
-            write_bit(ice, 1);
-        } else if (read_bit(ice)) {
-            write_zeros(ice, read_int(ice, 5));
-            write_bit(ice, 1);
-        } else if (read_bit(ice)) {
-            write_zeros(ice, read_int(ice, 8));
-            write_bit(ice, 1);
-        } else if (read_bit(ice)) {
-            int n = read_int(ice, 6);
-            while (n--) {
-                write_bit(ice, read_bit(ice));
+        case ICE_STATE_OPCODE:
+            // Opcodes that end inside the chunk are expanded right here, the switch is the slow path
+            while (ice->write_position < ICEUNCOMPR_OUT_CHUNK) {
+                // The longest opcode is 28 bits, with fewer the prefix below could run into missing bits
+                if (!ice_have(ice, 28) && ice->input_wait)
+                    return ICEUNCOMPR_BLOCKED;
+                // The prefix is up to five ZERO bits, the sentinel caps the count there
+                uint32_t zeros = (uint32_t)__builtin_clzll(ice->read_buffer | (1ull << 58));
+                uint32_t prefix = zeros < 5 ? zeros + 1 : 5;
+                // Prefix and count are taken together, a wait in between would lose the opcode
+                if (ice->read_bitcounter < prefix + ice_count_bits[zeros])
+                    return 2;
+                ice_take(ice, prefix);
+                ice->run = ice_take(ice, ice_count_bits[zeros]);
+                ice->opcode = (uint8_t)zeros;
+
+                if (zeros == 3) {
+                    // Escape, run literal bits
+                    if (ice->run > 32 || !ice_have(ice, ice->run)) {
+                        ice->state = ICE_STATE_LITERAL;
+                        break;
+                    }
+                    if (ice->run)
+                        ice_put(ice, ice_take(ice, ice->run), ice->run);
+                    ice->run = 0;
+                } else if (!ice_put_zeros(ice)) {
+                    ice->state = ICE_STATE_ZEROS;
+                    break;
+                } else if (zeros == 5) {
+                    ice->state = ICE_STATE_FLUSH;
+                    break;
+                }
+                ice_put(ice, 1, 1);
+            }
+            break;
+
+        case ICE_STATE_LITERAL:
+            // Escape, run literal bits
+            if (ice->run) {
+                uint32_t chunk = ice->run < 32 ? ice->run : 32;
+                if (!ice_have(ice, chunk))
+                    return ice_starved(ice);
+                ice_put(ice, ice_take(ice, chunk), chunk);
+                ice->run -= chunk;
+                break;
+            }
+            ice_put(ice, 1, 1);
+            ice->state = ICE_STATE_OPCODE;
+            break;
+
+        case ICE_STATE_ZEROS:
+            if (!ice_put_zeros(ice))
+                break;
+            if (ice->opcode == 5) {
+                ice->state = ICE_STATE_FLUSH;
+                break;
             }
-            write_bit(ice, 1);
-        } else if (read_bit(ice)) {
-            write_zeros(ice, read_int(ice, 23));
-            write_bit(ice, 1);
-        } else {
-            write_zeros(ice, read_int(ice, 23));
+            ice_put(ice, 1, 1);
+            ice->state = ICE_STATE_OPCODE;
             break;
+
+        case ICE_STATE_FLUSH:
+            // A trailing partial byte is dropped, like the reference decoder does
+            if (ice->write_position) {
+                uint8_t *next = ice->output(ice->output_ctx, ice->output_data, ice->write_position);
+                if (!next)
+                    return ICEUNCOMPR_BLOCKED;
+                ice->output_data = next;
+                ice->output_total += ice->write_position;
+                ice->write_position = 0;
+            }
+            ice->state = ICE_STATE_DONE;
+            return 0;
+
+        default:
+            return 0;
         }
     }
+}
 
-    return 0;
+// Main decompression function
+int ice_uncompress(Iceuncompr *ice) {
+    int result;
+
+    ice_start(ice);
+    // A source or sink that has to wait is simply asked again
+    while ((result = ice_resume(ice)) == ICEUNCOMPR_BLOCKED) {
+    }
+
+    return result;
 }
 
-bool WriteUncomprBitstream(Iceuncompr *ice, uint8_t *input_data, uint32_t size)
+bool WriteUncomprBitstream(Iceuncompr *ice, const uint8_t *input_data, uint32_t size)
 {
-    // Create a filehandle to work with for bitstream decompression.
-    ice->input_data_fh = fmemopen(input_data, size, "rb");
-    // Flush the contents of the buffer
-    if(!ice->input_data_fh)
+    if (!ice->output || !ice->output_data || (!input_data && !ice->input_source))
         return false;
-    
-    ice_uncompress(ice);
 
-    return true;
+    ice->input = input_data;
+    ice->input_end = input_data ? input_data + size : input_data;
+
+    return ice_uncompress(ice) == 0;
 }
@@ -3,93 +3,634 @@
  * @author Reese Russell
  */
 
-#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "spi.h"
 #include "24xx_eeprom.h"
 #include "iceuncompr.h"
 #include "lattice_ice_hx.h"
+#include "nyan_crc.h"
+#include "nyan_cycles.h"
+#include "nyan_dma.h"
+#include "nyan_eeprom_map.h"
 
-FPGAReturn FPGAInit(LatticeIceHX* fpga)
+typedef struct {
+    uint32_t address;  // Linear EEPROM address of the first byte
+    uint32_t capacity; // Largest image that stays inside the slot
+    uint16_t digest;   // Config shadow address of the SHA-256
+} FPGASlotRegion;
+
+static const FPGASlotRegion fpga_slot_regions[FPGA_SLOTS] = {
+    { EEPROM_BLOCK_SIZE + ADDR_FPGA_BITSTREAM, SIZE_FPGA_BITSTREAM,   ADDR_FPGA_BITSTREAM_DIGEST },
+    { ADDR_FPGA_BITSTREAM_B,                   SIZE_FPGA_BITSTREAM_B, ADDR_FPGA_BITSTREAM_B_DIGEST },
+};
+
+// Largest image starting in the slot, it may run on to the end of the EEPROM
+static uint32_t FPGASlotReach(FPGASlot slot)
+{
+    return EEPROM_SIZE - fpga_slot_regions[slot].address;
+}
+
+// An image of size bytes written to slot would overwrite the image in other
+static bool FPGASlotOverlaps(LatticeIceHX* fpga, FPGASlot slot, uint32_t size, FPGASlot other)
+{
+    uint32_t start = fpga_slot_regions[slot].address;
+    uint32_t other_start = fpga_slot_regions[other].address;
+
+    return fpga->slots.size[other] && start < other_start + fpga->slots.size[other] && other_start < start + size;
+}
+
+// The chunk is lost and the attempt fails, resending it could repeat bytes SPI4 already clocked out
+static void FPGASpiFail(LatticeIceHX* fpga)
+{
+    fpga->spi_busy = false;
+    fpga->stats.spi_errors++;
+    if (fpga->stats.error == FPGA_ERROR_NONE)
+        fpga->stats.error = FPGA_ERROR_SPI;
+}
+
+// True once no DMA is in flight, a stuck transfer is aborted
+static bool FPGASpiIdle(LatticeIceHX* fpga)
+{
+    if (!fpga->spi_busy)
+        return true;
+    if (HAL_GetTick() - fpga->spi_tick <= FPGA_SPI_TIMEOUT_MS)
+        return false;
+
+    HAL_SPI_Abort(&hspi4);
+    FPGASpiFail(fpga);
+    return true;
+}
+
+// Decompressor sink, hands the full buffer to SPI4 DMA and returns the other one to fill,
+// NULL while the previous buffer is still draining or once a transfer failed
+static uint8_t* FPGAWriteBitstreamChunk(void* ctx, uint8_t* data, uint32_t len)
+{
+    LatticeIceHX* fpga = ctx;
+
+    if (!FPGASpiIdle(fpga) || fpga->stats.error == FPGA_ERROR_SPI)
+        return NULL;
+    NyanDmaClean(data, len);
+    fpga->spi_busy = true;
+    fpga->spi_tick = HAL_GetTick();
+    if (HAL_SPI_Transmit_DMA(&hspi4, data, len) != HAL_OK) {
+        // Nothing went out yet, this chunk goes out blocking and the buffer is free again
+        fpga->spi_busy = false;
+        fpga->stats.spi_errors++;
+        if (HAL_SPI_Transmit(&hspi4, data, len, FPGA_SPI_TIMEOUT_MS) != HAL_OK) {
+            FPGASpiFail(fpga);
+            return NULL;
+        }
+        return data;
+    }
+    if (!fpga->stats.spi_chunks++)
+        fpga->spi_start_cycles = NyanCyclesNow();
+
+    return data == fpga->spi_buf[0] ? fpga->spi_buf[1] : fpga->spi_buf[0];
+}
+
+void FPGAIrqTxComplete(LatticeIceHX* fpga)
+{
+    fpga->spi_done_cycles = NyanCyclesNow();
+    fpga->spi_busy = false;
+}
+
+void FPGAIrqError(LatticeIceHX* fpga)
+{
+    FPGASpiFail(fpga);
+}
+
+static void FPGAReadDone(EepromJob* job, EepromReturn result)
+{
+    LatticeIceHX* fpga = job->ctx;
+
+    fpga->rx_done_cycles = NyanCyclesNow();
+}
+
+// Queues the read of a compressed block into its ring slot, nothing past the end of the image
+static void FPGAReadBlock(LatticeIceHX* fpga, uint16_t block)
+{
+    if (block >= fpga->rx_blocks)
+        return;
+
+    uint16_t slot = block % FPGA_RX_BLOCKS;
+    uint32_t offset = (uint32_t)block * FPGA_RX_BLOCK;
+    uint32_t len = fpga->bitstream_compressed_size - offset;
+    if (len > FPGA_RX_BLOCK)
+        len = FPGA_RX_BLOCK;
+
+    EepromJob* job = &fpga->rx_job[slot];
+    // A block straddling the B0 boundary is read as two chained transfers
+    EepromJob* last = EepromJobInitLinear(job, &fpga->rx_tail[slot], EEPROM_JOB_READ, fpga_slot_regions[fpga->slot].address + offset, fpga->rx_buf[slot], len);
+    job->priority = EEPROM_JOB_PRIORITY_HIGH;
+    last->priority = EEPROM_JOB_PRIORITY_HIGH;
+    last->callback = FPGAReadDone;
+    last->ctx = fpga;
+    // A refused job stays idle, the wait for it then fails the configuration
+    EepromSubmit(&nos_eeprom, job);
+}
+
+// Decompressor source, hands out the next block of the ring once its read is done
+static uint32_t FPGAReadNextBlock(void* ctx, const uint8_t** data)
+{
+    LatticeIceHX* fpga = ctx;
+
+    // The decompressor is done with the previous block, its slot takes the read furthest ahead
+    if (fpga->rx_block && !fpga->rx_recycled) {
+        FPGAReadBlock(fpga, fpga->rx_block - 1 + FPGA_RX_BLOCKS);
+        fpga->rx_recycled = true;
+    }
+    if (fpga->rx_block >= fpga->rx_blocks)
+        return 0;
+
+    EepromJob* job = &fpga->rx_job[fpga->rx_block % FPGA_RX_BLOCKS];
+    if (EepromJobBusy(job) || (job->next && EepromJobBusy(job->next)))
+        return ICEUNCOMPR_SOURCE_WAIT;
+    EepromReturn result = EepromJobWait(job);
+    if (result == EEPROM_SUCCESS && job->next)
+        result = EepromJobWait(job->next);
+    if (result != EEPROM_SUCCESS) {
+        fpga->stats.error = FPGA_ERROR_EEPROM;
+        return 0;
+    }
+    // A block straddling B0 was split, its tail landed right behind the head in the same ring slot
+    uint32_t len = job->len + (job->next ? job->next->len : 0);
+
+    // Hashed before the decompressor sees it, a bad image never gets its last block, the one that starts the FPGA
+    if (fpga->has_digest) {
+        sha256_update(&fpga->sha, job->data, len);
+        if (fpga->rx_block + 1 == fpga->rx_blocks) {
+            BYTE digest[SHA256_BLOCK_SIZE];
+            sha256_final(&fpga->sha, digest);
+            if (memcmp(digest, fpga->digest, SHA256_BLOCK_SIZE) != 0) {
+                fpga->stats.error = FPGA_ERROR_DIGEST;
+                return 0;
+            }
+            fpga->stats.verified = true;
+        }
+    }
+
+    fpga->rx_block++;
+    fpga->rx_recycled = false;
+    *data = job->data;
+    return len;
+}
+
+static bool FPGASlotTableWrite(LatticeIceHX* fpga)
+{
+    fpga->slots.sequence++;
+    fpga->slots.crc = NyanCrc32((const uint8_t*)&fpga->slots, offsetof(FPGASlotTable, crc));
+    return NyanConfigWrite(&nos_config, ADDR_FPGA_SLOT_TABLE, &fpga->slots, sizeof(fpga->slots)) == NYAN_CONFIG_SUCCESS;
+}
+
+// The main loop only retries a failed flush after a pause, callers waiting on it keep kicking it until the deadline.
+// They run in the shell interrupt where SysTick can't preempt them, so the deadline is on the cycle counter.
+static bool FPGASlotSync(void)
+{
+    uint32_t start = NyanCyclesNow();
+
+    while (!NyanConfigClean(&nos_config)) {
+        if (NyanCyclesToUs(NyanCyclesNow() - start) > FPGA_SLOT_SYNC_MS * 1000)
+            return false;
+        NyanConfigFlush(&nos_config);
+    }
+    return true;
+}
+
+// Starts one configuration attempt from the given source, stats.error says why it failed
+static void FPGALoad(LatticeIceHX* fpga, FPGASource source, uint32_t cache_version)
 {
-    SCB_DisableDCache();
-    // This needs to be optimized, the current time to program is close to 5 seconds.
+    memset(&fpga->stats, 0, sizeof(fpga->stats));
+    fpga->stats.slot = fpga->slot;
+    fpga->stats.rejected = FPGA_SLOT_NONE;
+    fpga->stats.source = source;
+    fpga->stats.cache_version = cache_version;
     fpga->configured = false;
-    FPGAGetBitstreamCompressedSize(fpga);
-    FPGAGetBitstreamData(fpga);
+
+    // Fill the ring first, the first reads overlap the reset delays
+    fpga->rx_blocks = source == FPGA_SOURCE_EEPROM ? (fpga->bitstream_compressed_size + FPGA_RX_BLOCK - 1) / FPGA_RX_BLOCK : 0;
+    fpga->rx_block = 0;
+    fpga->rx_recycled = false;
+    fpga->spi_busy = false;
+    fpga->eeprom_wait_cycles = 0;
+    fpga->spi_wait_cycles = 0;
+    fpga->decode_cycles = 0;
+    sha256_init(&fpga->sha);
+    fpga->rx_start_cycles = NyanCyclesNow();
+    fpga->rx_done_cycles = fpga->rx_start_cycles;
+    for (uint16_t block = 0; block < FPGA_RX_BLOCKS; ++block)
+        FPGAReadBlock(fpga, block);
+
     // First lets set the CRESET_B Low for more than 200ns and make sure the slave select is low
     HAL_GPIO_WritePin(SPI4_SS_GPIO_Port, SPI4_SS_Pin, GPIO_PIN_RESET);
     HAL_GPIO_WritePin(FPGA_config_nrst_GPIO_Port, FPGA_config_nrst_Pin, GPIO_PIN_RESET);
-    HAL_Delay(1); // Much longer than the needed 200ns but easy to implement
-    HAL_GPIO_WritePin(FPGA_config_nrst_GPIO_Port, FPGA_config_nrst_Pin, GPIO_PIN_SET);
-    HAL_Delay(3); // This lets the internal configuration memory clear
-    // Now we need to pull the slave select high and send 8 dummy cycles
-    HAL_GPIO_WritePin(SPI4_SS_GPIO_Port, SPI4_SS_Pin, GPIO_PIN_SET);
+    fpga->state = FPGA_STATE_RESET;
+    fpga->state_tick = HAL_GetTick();
+}
+
+// One slot from the flash copy if it holds this image, otherwise from the EEPROM, false if there is no image
+static bool FPGALoadSlot(LatticeIceHX* fpga, FPGASlot slot)
+{
+    const FPGASlotRegion* region = &fpga_slot_regions[slot];
+    uint32_t size = fpga->slots.size[slot];
+
+    fpga->slot = slot;
+    if (size == 0 || size > FPGASlotReach(slot)) {
+        memset(&fpga->stats, 0, sizeof(fpga->stats));
+        fpga->stats.slot = slot;
+        fpga->stats.rejected = FPGA_SLOT_NONE;
+        fpga->stats.error = FPGA_ERROR_NO_IMAGE;
+        return false;
+    }
+    fpga->bitstream_compressed_size = size;
+    fpga->has_digest = (fpga->slots.digests & (1u << slot)) &&
+        NyanConfigRead(&nos_config, region->digest, fpga->digest, SHA256_BLOCK_SIZE) == NYAN_CONFIG_SUCCESS;
+
+    // An intact flash copy of the image the digest describes takes the I2C bus out of the boot path,
+    // without a digest the copy could just as well be the other slot's image
+    const NyanFlashCacheHeader* cached;
+    if (fpga->has_digest && NyanFlashCacheLookup(size, &cached) == NYAN_FLASH_CACHE_SUCCESS &&
+        memcmp(cached->sha256, fpga->digest, SHA256_BLOCK_SIZE) == 0)
+        FPGALoad(fpga, FPGA_SOURCE_FLASH, cached->version);
+    else
+        FPGALoad(fpga, FPGA_SOURCE_EEPROM, 0);
+
+    return true;
+}
+
+static void FPGAFinish(LatticeIceHX* fpga, bool ok)
+{
+    fpga->stats.rejected = fpga->rejected;
+    fpga->stats.rejected_error = fpga->rejected_error;
+    fpga->stats.total_us = NyanCyclesToUs(NyanCyclesNow() - fpga->start_cycles);
+    // Erasing flash sector 7 would stall every interrupt, the copy waits for the next boot.
+    // A copy that failed at this boot is not asked for again until the one after.
+    if (ok && fpga->stats.source == FPGA_SOURCE_EEPROM && fpga->has_digest && fpga->cache_boot != FPGA_CACHE_FAILED) {
+        uint8_t pending = true;
+        NyanKvSet(&nos_kv, NYAN_KV_FPGA_CACHE_PENDING, &pending, sizeof(pending));
+        fpga->stats.cache_update = FPGA_CACHE_PENDING;
+    } else if (ok) {
+        fpga->stats.cache_update = fpga->cache_boot;
+    }
+    // No retries until a new image is uploaded, the error is left in the stats
+    fpga->configured = ok;
+    fpga->state = ok ? FPGA_STATE_DONE : FPGA_STATE_FAILED;
+}
+
+// An attempt ended, picks the next one or finishes
+static void FPGAAttemptEnd(LatticeIceHX* fpga, bool ok)
+{
+    if (!ok) {
+        // Hold the half configured FPGA in reset
+        HAL_GPIO_WritePin(SPI4_SS_GPIO_Port, SPI4_SS_Pin, GPIO_PIN_SET);
+        HAL_GPIO_WritePin(FPGA_config_nrst_GPIO_Port, FPGA_config_nrst_Pin, GPIO_PIN_RESET);
+        // A copy that does not start the FPGA is not trusted again, the EEPROM gets a go
+        if (fpga->stats.source == FPGA_SOURCE_FLASH) {
+            NyanFlashCacheInvalidate();
+            FPGALoad(fpga, FPGA_SOURCE_EEPROM, 0);
+            return;
+        }
+    }
+
+    // A new upload gets one attempt, CDONE commits it and anything else rolls back to the active slot
+    if (fpga->trying_pending) {
+        fpga->trying_pending = false;
+        if (ok)
+            fpga->slots.active = fpga->slot;
+        else {
+            fpga->rejected = fpga->slot;
+            fpga->rejected_error = fpga->stats.error;
+        }
+        fpga->slots.pending = FPGA_SLOT_NONE;
+        FPGASlotTableWrite(fpga);
+        if (!ok && fpga->slots.active < FPGA_SLOTS) {
+            if (!FPGALoadSlot(fpga, fpga->slots.active))
+                FPGAAttemptEnd(fpga, false);
+            return;
+        }
+    }
+
+    FPGAFinish(fpga, ok);
+}
+
+static void FPGAStart(LatticeIceHX* fpga)
+{
+    fpga->start_cycles = NyanCyclesNow();
+    fpga->rejected = FPGA_SLOT_NONE;
+    fpga->rejected_error = FPGA_ERROR_NONE;
+    fpga->configured = false;
+    FPGASlotTableLoad(fpga);
+
+    fpga->trying_pending = fpga->slots.pending < FPGA_SLOTS;
+    if (fpga->trying_pending) {
+        if (!FPGALoadSlot(fpga, fpga->slots.pending))
+            FPGAAttemptEnd(fpga, false);
+    } else if (fpga->slots.active < FPGA_SLOTS) {
+        if (!FPGALoadSlot(fpga, fpga->slots.active))
+            FPGAAttemptEnd(fpga, false);
+    } else {
+        FPGAFinish(fpga, false);
+    }
+}
+
+// Slave select high, 8 dummy clocks, then the decompressor takes over the bus
+static void FPGAStreamBegin(LatticeIceHX* fpga)
+{
     const uint8_t lattice_dummy_bits = 0x00;
+
+    HAL_GPIO_WritePin(SPI4_SS_GPIO_Port, SPI4_SS_Pin, GPIO_PIN_SET);
     HAL_SPI_Transmit(&hspi4, (uint8_t *)&lattice_dummy_bits, 1, 100);
     HAL_GPIO_WritePin(SPI4_SS_GPIO_Port, SPI4_SS_Pin, GPIO_PIN_RESET);
-    // Uncompress and write the bitstream - This happens all in one file to keep the ram footprint low.
-    WriteUncomprBitstream(&ice_uncompr, fpga->p_bitstream_compressed, fpga->bitstream_compressed_size);
-    while(!fpga->configured){
+
+    // Uncompress and write the bitstream as the blocks arrive, nothing is buffered beyond the rings
+    fpga->spi_start_cycles = NyanCyclesNow();
+    fpga->spi_done_cycles = fpga->spi_start_cycles;
+    ice_uncompr.input_ctx = fpga;
+    ice_uncompr.output = FPGAWriteBitstreamChunk;
+    ice_uncompr.output_ctx = fpga;
+    ice_uncompr.output_data = fpga->spi_buf[0];
+    if (fpga->stats.source == FPGA_SOURCE_FLASH) {
+        // The copy was hashed by the lookup against a header matching the stored digest
+        fpga->stats.verified = true;
+        ice_uncompr.input_source = NULL;
+        ice_uncompr.input = (const uint8_t*)NYAN_FLASH_CACHE_IMAGE;
+        ice_uncompr.input_end = ice_uncompr.input + fpga->bitstream_compressed_size;
+    } else {
+        ice_uncompr.input_source = FPGAReadNextBlock;
+        ice_uncompr.input = NULL;
+        ice_uncompr.input_end = NULL;
+    }
+    ice_start(&ice_uncompr);
+    fpga->yield_cycles = 0;
+    fpga->state = FPGA_STATE_STREAM;
+}
+
+// Decodes until the EEPROM or SPI4 has to catch up, the wait until the next step counts as their stall
+static void FPGAStreamStep(LatticeIceHX* fpga)
+{
+    uint32_t start = NyanCyclesNow();
+
+    if (fpga->yield_cycles) {
+        if (fpga->yield_input)
+            fpga->eeprom_wait_cycles += start - fpga->yield_cycles;
+        else
+            fpga->spi_wait_cycles += start - fpga->yield_cycles;
+    }
+
+    int result = ice_resume(&ice_uncompr);
+    fpga->yield_cycles = NyanCyclesNow();
+    fpga->yield_input = ice_uncompr.input_wait;
+    fpga->decode_cycles += fpga->yield_cycles - start;
+    // A failed transfer leaves the decoder blocked on the sink for good
+    if (result == ICEUNCOMPR_BLOCKED && fpga->stats.error != FPGA_ERROR_SPI)
+        return;
+
+    fpga->stats.ok = result == 0 && fpga->stats.error == FPGA_ERROR_NONE;
+    if (!fpga->stats.ok && fpga->stats.error == FPGA_ERROR_NONE)
+        fpga->stats.error = FPGA_ERROR_DECODE;
+    fpga->state = FPGA_STATE_DRAIN;
+}
+
+// The last chunk must be clocked out before the trailing dummy bytes,
+// and a failed image stops early, the ring must not be reused while reads are still in flight
+static void FPGADrainStep(LatticeIceHX* fpga)
+{
+    if (!FPGASpiIdle(fpga))
+        return;
+    // The last chunk may still have failed after the decoder finished
+    if (fpga->stats.error != FPGA_ERROR_NONE)
+        fpga->stats.ok = false;
+    for (uint16_t slot = 0; slot < FPGA_RX_BLOCKS; ++slot) {
+        if (EepromJobBusy(&fpga->rx_job[slot]) || EepromJobBusy(&fpga->rx_tail[slot]))
+            return;
+    }
+
+    fpga->stats.bytes_in = fpga->bitstream_compressed_size;
+    fpga->stats.bytes_out = ice_uncompr.output_total;
+    fpga->stats.eeprom_us = NyanCyclesToUs(fpga->rx_done_cycles - fpga->rx_start_cycles);
+    fpga->stats.eeprom_wait_us = NyanCyclesToUs(fpga->eeprom_wait_cycles);
+    fpga->stats.spi_wait_us = NyanCyclesToUs(fpga->spi_wait_cycles);
+    fpga->stats.decode_us = NyanCyclesToUs(fpga->decode_cycles);
+    fpga->stats.spi_us = NyanCyclesToUs(fpga->spi_done_cycles - fpga->spi_start_cycles);
+
+    if (!fpga->stats.ok) {
+        FPGAAttemptEnd(fpga, false);
+        return;
     }
+
     // Send over the remaining dummy bytes 49 of them at minim, we will send 80 to be safe.
+    const uint8_t lattice_dummy_bits = 0x00;
     for(uint8_t dummy_byte = 0; dummy_byte < 10; ++dummy_byte) {
         HAL_SPI_Transmit(&hspi4, (uint8_t *)&lattice_dummy_bits, 1, 100);
     }
-    // We must free up the compressed memory used by the bitstream
-    free(fpga->p_bitstream_compressed);
-    fpga->p_bitstream_compressed = NULL;
-    SCB_EnableDCache();
+    fpga->state = FPGA_STATE_CDONE;
+    fpga->state_tick = HAL_GetTick();
+}
+
+FPGAState FPGAService(LatticeIceHX* fpga)
+{
+    switch (fpga->state) {
+        case FPGA_STATE_IDLE :
+        case FPGA_STATE_DONE :
+        case FPGA_STATE_FAILED : {
+            // Claimed against the shell interrupt, an upload begun after this sees FPGABusy
+            uint32_t primask = __get_PRIMASK();
+            __disable_irq();
+            bool start = fpga->requested && !fpga->uploading;
+            if (start) {
+                fpga->requested = false;
+                fpga->state = FPGA_STATE_RESET;
+            }
+            __set_PRIMASK(primask);
+            if (start)
+                FPGAStart(fpga);
+            break;
+        }
+        case FPGA_STATE_RESET :
+            // Much longer than the needed 200ns but easy to implement
+            if (HAL_GetTick() - fpga->state_tick > FPGA_RESET_MS) {
+                HAL_GPIO_WritePin(FPGA_config_nrst_GPIO_Port, FPGA_config_nrst_Pin, GPIO_PIN_SET);
+                fpga->state = FPGA_STATE_CLEAR;
+                fpga->state_tick = HAL_GetTick();
+            }
+            break;
+        case FPGA_STATE_CLEAR :
+            // This lets the internal configuration memory clear
+            if (HAL_GetTick() - fpga->state_tick > FPGA_CLEAR_MS)
+                FPGAStreamBegin(fpga);
+            break;
+        case FPGA_STATE_STREAM :
+            FPGAStreamStep(fpga);
+            break;
+        case FPGA_STATE_DRAIN :
+            FPGADrainStep(fpga);
+            break;
+        case FPGA_STATE_CDONE :
+            // CDONE follows within microseconds of a good image, a bad one never raises it
+            if (HAL_GPIO_ReadPin(Nyan_FPGA_Config_Done_GPIO_Port, Nyan_FPGA_Config_Done_Pin) == GPIO_PIN_SET) {
+                FPGAAttemptEnd(fpga, true);
+            } else if (HAL_GetTick() - fpga->state_tick > FPGA_CDONE_TIMEOUT_MS) {
+                fpga->stats.ok = false;
+                fpga->stats.error = FPGA_ERROR_CDONE;
+                FPGAAttemptEnd(fpga, false);
+            }
+            break;
+    }
 
-    return FPGA_SUCCESS;
+    return fpga->state;
 }
 
-FPGAReturn FPGAGetBitstreamData(LatticeIceHX* fpga)
+void FPGACacheBoot(LatticeIceHX* fpga)
 {
-    // First lets work out the chunk logic
-    if (fpga->bitstream_compressed_size == 0)
-        return FPGA_FAILURE;
-    
-    // Chunk loading and tracking
-    uint16_t chunks = fpga->bitstream_compressed_size / EEPROM_DRIVER_TX_BUF_SZ;
-    chunks += fpga->bitstream_compressed_size % EEPROM_DRIVER_TX_BUF_SZ  == 0 ? 0 : 1;
-    if(chunks == 0)
-        return FPGA_FAILURE;
-    
-    // Reallocate the memory needed to hold the compressed bitstream
-    uint8_t* temp_ptr = realloc(fpga->p_bitstream_compressed, fpga->bitstream_compressed_size);
-    if (temp_ptr == NULL) {
-        // Free the original memory as its contents are not needed
-        free(fpga->p_bitstream_compressed);
-        fpga->p_bitstream_compressed = NULL; // Avoid dangling pointer
-        return FPGA_FAILURE;
+    uint8_t pending = false;
+
+    fpga->cache_boot = FPGA_CACHE_NONE;
+    if (NyanKvGet(&nos_kv, NYAN_KV_FPGA_CACHE_PENDING, &pending, sizeof(pending)) != NYAN_KV_SUCCESS || !pending)
+        return;
+    // Cleared up front, a copy that keeps failing must not erase the sector on every boot
+    pending = false;
+    NyanKvSet(&nos_kv, NYAN_KV_FPGA_CACHE_PENDING, &pending, sizeof(pending));
+
+    // Only a committed image is active, it raised CDONE when it was asked for
+    FPGASlotTableLoad(fpga);
+    FPGASlot slot = fpga->slots.active;
+    if (slot >= FPGA_SLOTS || !fpga->slots.size[slot] || !(fpga->slots.digests & (1u << slot)) ||
+        NyanConfigRead(&nos_config, fpga_slot_regions[slot].digest, fpga->digest, SHA256_BLOCK_SIZE) != NYAN_CONFIG_SUCCESS)
+        return;
+
+    if (NyanFlashCacheStore(&nos_eeprom, fpga_slot_regions[slot].address, fpga->slots.size[slot], fpga->digest) == NYAN_FLASH_CACHE_SUCCESS)
+        fpga->cache_boot = FPGA_CACHE_UPDATED;
+    else
+        fpga->cache_boot = FPGA_CACHE_FAILED;
+}
+
+void FPGARequestConfig(LatticeIceHX* fpga)
+{
+    fpga->configured = false;
+    fpga->requested = true;
+}
+
+bool FPGABusy(const LatticeIceHX* fpga)
+{
+    return fpga->state != FPGA_STATE_IDLE && fpga->state != FPGA_STATE_DONE && fpga->state != FPGA_STATE_FAILED;
+}
+
+uint8_t FPGAProgress(const LatticeIceHX* fpga)
+{
+    uint32_t done;
+
+    if (!fpga->bitstream_compressed_size)
+        return 0;
+    if (fpga->state < FPGA_STATE_STREAM)
+        return 0;
+    if (fpga->state > FPGA_STATE_STREAM)
+        return 100;
+    // Compressed bytes the decompressor has taken, from the flash copy or the EEPROM ring
+    if (fpga->stats.source == FPGA_SOURCE_FLASH)
+        done = (uint32_t)(ice_uncompr.input - (const uint8_t*)NYAN_FLASH_CACHE_IMAGE);
+    else
+        done = (uint32_t)fpga->rx_block * FPGA_RX_BLOCK;
+    if (done > fpga->bitstream_compressed_size)
+        done = fpga->bitstream_compressed_size;
+
+    return (uint8_t)((uint64_t)done * 100 / fpga->bitstream_compressed_size);
+}
+
+void FPGASlotTableLoad(LatticeIceHX* fpga)
+{
+    FPGASlotTable* table = &fpga->slots;
+
+    NyanConfigRead(&nos_config, ADDR_FPGA_SLOT_TABLE, table, sizeof(*table));
+    if (table->magic == FPGA_SLOT_MAGIC && table->crc == NyanCrc32((const uint8_t*)table, offsetof(FPGASlotTable, crc)))
+        return;
+
+    // Boards from before the slots have their one image in slot A, described by the length line
+    uint32_t len_buf[SIZE_FPGA_BITSTREAM_LEN / 4];
+    NyanConfigRead(&nos_config, ADDR_FPGA_BITSTREAM_LEN, len_buf, SIZE_FPGA_BITSTREAM_LEN);
+    memset(table, 0, sizeof(*table));
+    table->magic = FPGA_SLOT_MAGIC;
+    table->active = FPGA_SLOT_A;
+    table->pending = FPGA_SLOT_NONE;
+    table->size[FPGA_SLOT_A] = len_buf[SIZE_FPGA_BITSTREAM_LEN/4 - 1];
+    table->digests = len_buf[SIZE_FPGA_BITSTREAM_LEN/4 - 2] == FPGA_DIGEST_TAG ? 1u << FPGA_SLOT_A : 0;
+}
+
+uint32_t FPGASlotLocate(FPGASlot slot, uint32_t* address)
+{
+    *address = fpga_slot_regions[slot].address;
+
+    return fpga_slot_regions[slot].capacity;
+}
+
+FPGASlot FPGASlotUploadTarget(LatticeIceHX* fpga, uint32_t size)
+{
+    FPGASlotTableLoad(fpga);
+
+    FPGASlot slot = fpga->slots.active == FPGA_SLOT_A ? FPGA_SLOT_B : FPGA_SLOT_A;
+    if (size <= fpga_slot_regions[slot].capacity)
+        return slot;
+    // Only fits on top of the active image, or across both slots
+    for (slot = FPGA_SLOT_A; slot < FPGA_SLOTS; ++slot) {
+        if (size <= fpga_slot_regions[slot].capacity)
+            return slot;
     }
+    if (size <= FPGASlotReach(FPGA_SLOT_B))
+        return FPGA_SLOT_B;
 
-    // Update the pointer as realloc was successful
-    fpga->p_bitstream_compressed = temp_ptr;
+    return FPGA_SLOT_NONE;
+}
 
-    // Now lets start reading blocks of EEPROM in to the STM32F723's RAM
-    for (uint16_t blk = 0; blk < chunks; ++blk) {
-        // Fetch 128 Bytes
-        EepromRead(&nos_eeprom, true, ADDR_FPGA_BITSTREAM + blk * EEPROM_DRIVER_TX_BUF_SZ, EEPROM_DRIVER_TX_BUF_SZ);
-        while(nos_eeprom.rx_inflight){}
-        // Write them to the allocated compressed bitstream buffer
-        for(uint8_t byte = 0; byte < EEPROM_DRIVER_TX_BUF_SZ; ++byte) {
-            fpga->p_bitstream_compressed[blk * EEPROM_DRIVER_TX_BUF_SZ + byte] = nos_eeprom.rx_buf[byte];
-        }
+FPGAReturn FPGASlotUploadBegin(LatticeIceHX* fpga, uint32_t size)
+{
+    // The configuration in progress reads and rewrites the table
+    if (FPGABusy(fpga))
+        return FPGA_FAILURE;
+
+    FPGASlot slot = FPGASlotUploadTarget(fpga, size);
+    if (size == 0 || slot == FPGA_SLOT_NONE)
+        return FPGA_FAILURE;
+
+    // The table reaches the EEPROM before the first page is queued, no slot the image lands on is described by it
+    // while they are written. Only queueing it is not enough, a flush in flight would put the table behind the pages.
+    fpga->upload_slot = slot;
+    fpga->upload_unprotected = false;
+    for (FPGASlot other = FPGA_SLOT_A; other < FPGA_SLOTS; ++other) {
+        if (other != slot && !FPGASlotOverlaps(fpga, slot, size, other))
+            continue;
+        if (other == fpga->slots.active && fpga->slots.size[other])
+            fpga->upload_unprotected = true;
+        fpga->slots.size[other] = 0;
+        fpga->slots.digests &= ~(1u << other);
+        if (fpga->slots.pending == other)
+            fpga->slots.pending = FPGA_SLOT_NONE;
     }
+    if (!FPGASlotTableWrite(fpga) || !FPGASlotSync())
+        return FPGA_FAILURE;
+    fpga->uploading = true;
 
     return FPGA_SUCCESS;
 }
 
-FPGAReturn FPGAGetBitstreamCompressedSize(LatticeIceHX* fpga)
+void FPGASlotUploadAbort(LatticeIceHX* fpga)
+{
+    fpga->uploading = false;
+}
+
+FPGAReturn FPGASlotUploadFinish(LatticeIceHX* fpga, uint32_t size, const uint8_t* digest)
 {
-    // We need to fetch the owners name from the eeprom - !!!FIXME!!! Polled
-    EepromRead(&nos_eeprom, false, ADDR_FPGA_BITSTREAM_LEN, SIZE_FPGA_BITSTREAM_LEN);
-    while(nos_eeprom.rx_inflight){}
-    // Cast the eeprom as a pointer of shorts
-    uint16_t *rx_buf = (uint16_t *)nos_eeprom.rx_buf;
-    fpga->bitstream_compressed_size = rx_buf[SIZE_FPGA_BITSTREAM_LEN/2 - 2]; //Little Endian Cast? {0xFFxx} !!!FIXME!!! This will work but is not ideal
+    FPGASlot slot = fpga->upload_slot;
+
+    fpga->uploading = false;
+    // The table must never reach the EEPROM ahead of the digest it vouches for
+    if (NyanConfigWrite(&nos_config, fpga_slot_regions[slot].digest, digest, SHA256_BLOCK_SIZE) != NYAN_CONFIG_SUCCESS || !FPGASlotSync())
+        return FPGA_FAILURE;
+
+    FPGASlotTableLoad(fpga);
+    fpga->slots.size[slot] = size;
+    fpga->slots.digests |= 1u << slot;
+    fpga->slots.pending = slot;
+    FPGASlotTableWrite(fpga);
 
     return FPGA_SUCCESS;
 }
\ No newline at end of file
@@ -37,7 +37,13 @@
 #include "iceuncompr.h"
 #include "lattice_ice_hx.h"
 // NyanOS and Packages
+#include "nyan_config.h"
+#include "nyan_kv.h"
+#include "nyan_cycles.h"
+#include "nyan_dma.h"
+#include "nyan_tcm.h"
 #include "nyan_os.h"
+#include "nyan_pool.h"
 #include "nyan_leds.h"
 #include "nyan_strings.h"
 #include "nyan_bitcoin.h"
@@ -65,17 +71,24 @@
 extern USBD_HandleTypeDef hUsbDevice;
 
 // Volatile Interrupt Variables
-volatile NyanOS nos;                                  // NyanOS - Main Operating System
+volatile NyanOS nos NYAN_DTCM;                        // NyanOS - Main Operating System
 volatile double system_status_led_angle;              // Used in the Sin^2(x) + Cos^2(x) = 1 [LED PWM]
-volatile NyanKeys nyan_keys;                          // Nyan Keys FPGA Switch driver FPGA -> SPI -> STM32
-volatile NyanKeyBoardDescriptor nyan_hid_report;      // Global HID Report used in the nyan keys
-volatile NyanKeyBoardDescriptor nyan_hid_report_prv;  // Global HID Report used for comparison optimization
+volatile NyanKeys nyan_keys NYAN_DTCM;                // Nyan Keys FPGA Switch driver FPGA -> SPI -> STM32, key_states is the SPI2 DMA target
+volatile NyanKeyBoardDescriptor nyan_hid_report NYAN_DTCM;     // Global HID Report used in the nyan keys
+volatile NyanKeyBoardDescriptor nyan_hid_report_prv NYAN_DTCM; // Global HID Report used for comparison optimization
 
 // Non-Volatile Globals
 Eeprom24xx   nos_eeprom;   // 24xx Based EEPROM
+NyanConfig   nos_config;   // RAM shadow of the EEPROM configuration area
+NyanKv       nos_kv;       // Key-value log in the EEPROM reserved area
 Iceuncompr   ice_uncompr;  // Decompression agent - FPGA Bitstream 
 LatticeIceHX nos_fpga;     // Lattice ICE40HX4k FPGA driver
 NyanBitcoin  nyan_bitcoin; // Nyan Keys Background Bitcoin Miner
+NyanFrameLink nos_frame_link; // Binary framed CDC link
+NyanBitstreamWriter nos_bitstream_writer; // Streaming FPGA bitstream upload
+#ifdef NYAN_TELEMETRY_EN
+NyanTelemetry nos_telemetry NYAN_DTCM; // Binary telemetry stream on the second CDC channel
+#endif
 /* USER CODE END PV */
 
 /* Private function prototypes -----------------------------------------------*/
@@ -96,6 +109,8 @@ void SystemClock_Config(void);
 int main(void)
 {
   /* USER CODE BEGIN 1 */
+  NyanDmaInit(); // Non-cacheable DMA buffers, before the D-Cache is enabled
+  NyanPoolInit(); // Shell and miner blocks, before the USB and shell interrupts run
   /* USER CODE END 1 */
 
   /* Enable I-Cache---------------------------------------------------------*/
@@ -133,6 +148,7 @@ int main(void)
   MX_RNG_Init();
   MX_TIM8_Init();
   MX_TIM14_Init();
+  MX_TIM5_Init();
   MX_USB_OTG_HS_PCD_Init();
   /* USER CODE BEGIN 2 */
   // Activate the STM32F7 timer interrupts
@@ -143,10 +159,19 @@ int main(void)
   HAL_TIM_OC_Start_IT(&htim1, TIM_CHANNEL_1);
   HAL_TIM_OC_Start_IT(&htim1, TIM_CHANNEL_2);
   HAL_TIM_OC_Start_IT(&htim8, TIM_CHANNEL_1);
-  // USB composite device creation
+  NyanCyclesInit();                    // DWT cycle counter for upload deadlines, bench and telemetry timestamps
+  EepromProbeBusProfile(&nos_eeprom);  // Fastest I2C speed the pull-ups allow, before the first bulk read
+  EepromMeasureReadRate(&nos_eeprom);  // Read rate getperf reports, measured in the background
+  NyanConfigInit(&nos_config, &nos_eeprom); // One bulk read of the EEPROM configuration area
+  NyanKvInit(&nos_kv, &nos_config);    // Settings index, before the keys read theirs
+  FPGACacheBoot(&nos_fpga);            // Flash cache copy asked for by the last boot, its erase stalls every interrupt
+  // USB composite device creation, after the flash cache copy
   MX_USB_DEVICE_Init();
+#ifdef NYAN_TELEMETRY_EN
+  NyanTelemetryInit(&nos_telemetry);   // Telemetry stream, before NOS so the shell finds it
+#endif
   NyanOsInit(&nos);                    // NyanOS (NOS) Initialization
-  FPGAInit((LatticeIceHX*)&nos_fpga);  // FPGA Bitstream Loading 
+  FPGARequestConfig((LatticeIceHX*)&nos_fpga); // FPGA Bitstream Loading, stepped by the main loop 
   NyanKeysInit((NyanKeys*)&nyan_keys); // Load up the fast cat IP for access to your keys; happy typing.
 #ifdef BITCOIN_MINER_EN
   NyanBitcoinInit(&nyan_bitcoin);     // Load up the bitcoin miner, comment this out or delete to disable. 
@@ -158,11 +183,19 @@ int main(void)
   /* USER CODE BEGIN WHILE */
   while (1)
   {
+    // Never blocks, USB and the shell keep running while the FPGA configures
+    FPGAService(&nos_fpga);
+    // Retries a failed boot read or flush, a late read brings up what the boot read missed
+    if(NyanConfigService(&nos_config)) {
+      NyanKvInit(&nos_kv, &nos_config);
+      nyan_keys.super_key_disabled = NyanKeysReadSuperDisableEEPROM(&nos_kv);
+      if(!nos_fpga.configured)
+        FPGARequestConfig(&nos_fpga);
+    }
+    NyanKvService(&nos_kv);              // Settings changed by the key scan interrupt reach the EEPROM from here
     if(nos_fpga.configured && !keys_dma_started) {
       keys_dma_started = true;
       NyanGetKeys((NyanKeys*)&nyan_keys);
-    } else if (!nos_fpga.configured) {
-      FPGAInit(&nos_fpga);
     } else if (nos.dfu_mode) {
       HAL_GPIO_WritePin(Nyan_DFU_Enable_GPIO_Port, Nyan_DFU_Enable_Pin, GPIO_PIN_SET);
       HAL_Delay(1000);
@@ -227,7 +260,7 @@ void SystemClock_Config(void)
 }
 
 /* USER CODE BEGIN 4 */
-void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+NYAN_ITCM void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
 {
   HAL_GPIO_WritePin(GPIOD, Nyan_Keys_LED1_Pin, GPIO_PIN_SET);
   // Increase the performance counter
@@ -236,9 +269,16 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
   if(!nyan_keys.warmed_up) {
     NyanWarmupIncrementor((NyanKeys*)&nyan_keys);
     return;
-  } else if(!(memcmp((uint8_t*)&nyan_keys.key_states[0], (uint8_t*)&nyan_keys.key_states_prv[0], sizeof(nyan_keys.key_states)) == 0)) {
+  }
+  bool keys_changed = memcmp((uint8_t*)&nyan_keys.key_states[0], (uint8_t*)&nyan_keys.key_states_prv[0], sizeof(nyan_keys.key_states)) != 0;
+#ifdef NYAN_TELEMETRY_EN
+  // Scan interval histogram and key events, skip the leading dummy byte
+  NyanTelemetryKeyScan(&nos_telemetry, &nyan_keys.key_states[1], keys_changed);
+#endif
+  if(keys_changed) {
     NyanBuildHidReportFromKeyStates((NyanKeys*)&nyan_keys, &nyan_hid_report);
     memcpy((uint8_t*)&nyan_keys.key_states_prv[0], (uint8_t*)&nyan_keys.key_states[0], sizeof(nyan_keys.key_states));
+    // The report is in DTCM, the OTG DMA reads it without a D-Cache clean
     USBD_HID_Keyboard_SendReport(&hUsbDevice, (uint8_t*)&nyan_hid_report, sizeof(nyan_hid_report));
   }
   HAL_GPIO_WritePin(GPIOD, Nyan_Keys_LED1_Pin, GPIO_PIN_RESET);
@@ -246,17 +286,27 @@ void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
 
 void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *I2cHandle)
 {
-  nos_eeprom.tx_inflight = false;
+  EepromIrqComplete(&nos_eeprom);
 }
 
 
 void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *I2cHandle)
 {
-  nos_eeprom.rx_inflight = false;
+  EepromIrqComplete(&nos_eeprom);
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  if (hspi->Instance == SPI4)
+    FPGAIrqTxComplete(&nos_fpga);
 }
 
 void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
 {
+  if (hspi->Instance == SPI4) {
+    FPGAIrqError(&nos_fpga); // Fails the configuration attempt, the chunk in flight is lost
+    return;
+  }
   MX_SPI2_Init(); //Upon error in the SPI transmission; reset the SPI2 instance.
 }
 
@@ -266,10 +316,11 @@ void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *I2cHandle)
   switch (error)
   {
     case HAL_I2C_ERROR_AF :
-      nos_eeprom.tx_failed = true;
+      EepromIrqNack(&nos_eeprom);
       break;
     default:
-      Error_Handler();
+      // Recovered and retried by the driver, a glitch must not reset the keyboard
+      EepromIrqError(&nos_eeprom);
   }
 }
 
@@ -277,9 +328,8 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
 {
   if (htim->Instance == TIM1) {
     HAL_GPIO_WritePin(GPIOD, Nyan_Keys_LED4_Pin, GPIO_PIN_SET);
-    nos_fpga.configured = HAL_GPIO_ReadPin(Nyan_FPGA_Config_Done_GPIO_Port, Nyan_FPGA_Config_Done_Pin);
-    // FPGA configuration done indicator
-    if(nos_fpga.configured)
+    // FPGA configuration done indicator, nos_fpga.configured belongs to FPGAService
+    if(HAL_GPIO_ReadPin(Nyan_FPGA_Config_Done_GPIO_Port, Nyan_FPGA_Config_Done_Pin) == GPIO_PIN_SET)
       HAL_GPIO_WritePin(Nyan_Keys_LED0_GPIO_Port, Nyan_Keys_LED0_Pin, GPIO_PIN_SET);
     else
       HAL_GPIO_WritePin(Nyan_Keys_LED0_GPIO_Port, Nyan_Keys_LED0_Pin, GPIO_PIN_RESET);
@@ -291,6 +341,9 @@ void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
     if(nos.send_welcome_screen_guard > 0 && ++nos.send_welcome_screen_guard > _NYAN_WELCOME_GUARD_TIME) {
       nos.send_welcome_screen_guard = 0;
     }
+  } if (htim->Instance == TIM5) {
+    // EEPROM ACK polling backoff elapsed
+    EepromIrqPollTimer(&nos_eeprom);
   } if (htim->Instance == TIM14) {
     // 1 second period timer. Used for performance metrics
     nos.perf_keys_count_spi_calls = nos.perf_keys_count_spi_calls_nxt;
@@ -324,6 +377,22 @@ void HAL_TIM_OC_DelayElapsedCallback(TIM_HandleTypeDef *htim)
     if(nos.exe != NYAN_EXE_IDLE && nos.tx_inflight == 0 && nos.exe_in_progress == 0) {
       NyanExecute(&nos);
     }
+    // Binary frame execution - Same guards as program execution, the response shares the TX buffer
+    if(nos.state == FRAMED && nos.frame_link->frame_pending && nos.tx_inflight == 0 && nos.exe_in_progress == 0) {
+      NyanExeFrame(&nos);
+    }
+    // Keep framed bitstream pages moving between data frames
+    if(nos.state == FRAMED && nos.bitstream->active) {
+      NyanBitstreamWriterService(nos.bitstream);
+    }
+    // Leave a framed session the host abandoned
+    if(nos.state == FRAMED) {
+      NyanFrameSessionService(&nos);
+    }
+#ifdef NYAN_TELEMETRY_EN
+    // Periodic telemetry snapshot and drain of the telemetry ring
+    NyanTelemetryPublish(&nos);
+#endif
     // Turn off the RX CDC LED
     HAL_GPIO_WritePin(Nyan_Keys_LED3_GPIO_Port, Nyan_Keys_LED3_Pin, GPIO_PIN_RESET);
   }
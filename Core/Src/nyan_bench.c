@@ -0,0 +1,324 @@
+/**
+ * NyanOS Microbenchmarks
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "iceuncompr.h"
+#include "nyan_bench.h"
+#include "nyan_cycles.h"
+#include "nyan_eeprom_map.h"
+#include "nyan_format.h"
+#include "nyan_keys.h"
+#include "nyan_sha256.h"
+
+// Unused bank 0 page, rewritten with its own contents so nothing changes
+#define NYAN_BENCH_EEPROM_PAGE      ADDR_BENCH_SCRATCH
+#define NYAN_BENCH_EEPROM_PAGE_SZ   EEPROM_DRIVER_TX_BUF_SZ
+
+// FN is active low, holding it released keeps FN combos (and their EEPROM writes) out of the report benchmark
+#define NYAN_BENCH_FN_BYTE          ((FN / 8) + 1)
+#define NYAN_BENCH_FN_MASK          (1 << (FN % 8))
+
+typedef struct {
+    const char* name;                                                               /**< Name used by the bench command. */
+    uint32_t    iterations;                                                         /**< Operations per run. */
+    NyanBenchReturn (*setup)(Eeprom24xx* eeprom);                                   /**< Untimed preparation, may be NULL. */
+    NyanBenchReturn (*run)(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes); /**< Timed operations, reports the bytes processed. */
+} NyanBench;
+
+static NyanBenchReturn NyanBenchReportSetup(Eeprom24xx* eeprom);
+static NyanBenchReturn NyanBenchReport(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+static NyanBenchReturn NyanBenchSha256Setup(Eeprom24xx* eeprom);
+static NyanBenchReturn NyanBenchSha256(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+static NyanBenchReturn NyanBenchUncompressSetup(Eeprom24xx* eeprom);
+static NyanBenchReturn NyanBenchUncompress(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+static NyanBenchReturn NyanBenchEepromRead(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+static NyanBenchReturn NyanBenchEepromWriteSetup(Eeprom24xx* eeprom);
+static NyanBenchReturn NyanBenchEepromWrite(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+static NyanBenchReturn NyanBenchFormat(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes);
+
+static const NyanBench nyan_benches[] = {
+    { "hid-report",   1000, NyanBenchReportSetup,      NyanBenchReport },
+    { "sha256",       64,   NyanBenchSha256Setup,      NyanBenchSha256 },
+    { "uncompress",   4,    NyanBenchUncompressSetup,  NyanBenchUncompress },
+    { "eeprom-read",  32,   NULL,                      NyanBenchEepromRead },
+    { "eeprom-write", 4,    NyanBenchEepromWriteSetup, NyanBenchEepromWrite },
+    { "format",       1000, NULL,                      NyanBenchFormat },
+};
+
+#define _NYAN_NUM_BENCHES (sizeof(nyan_benches) / sizeof(nyan_benches[0]))
+
+static uint8_t nyan_bench_key_states[NYAN_BENCH_KEY_STATES][((NUM_KEYS + 7) / 8) + 1];
+static uint8_t nyan_bench_sha_buf[NYAN_BENCH_SHA_BUF_SZ];
+static uint8_t nyan_bench_ice_stream[NYAN_BENCH_ICE_STREAM_SZ];
+static uint8_t nyan_bench_eeprom_page[NYAN_BENCH_EEPROM_PAGE_SZ] EEPROM_DMA_ALIGNED;
+static volatile uint32_t nyan_bench_ice_out;
+
+// Fixed seed so every run of a benchmark sees the same input
+static uint32_t NyanBenchRandom(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return x;
+}
+
+static NyanBenchReturn NyanBenchReportSetup(Eeprom24xx* eeprom)
+{
+    uint32_t seed = 0x4E59414E;
+
+    for (uint32_t idx = 0; idx < NYAN_BENCH_KEY_STATES; ++idx) {
+        for (uint32_t byte = 0; byte < sizeof(nyan_bench_key_states[0]); ++byte)
+            nyan_bench_key_states[idx][byte] = (uint8_t)NyanBenchRandom(&seed);
+        nyan_bench_key_states[idx][NYAN_BENCH_FN_BYTE] |= NYAN_BENCH_FN_MASK;
+    }
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchReport(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    NyanKeys keys;
+    NyanKeyBoardDescriptor desc;
+
+    memset(&keys, 0, sizeof(keys));
+    keys.warmed_up = true;
+
+    for (uint32_t idx = 0; idx < iterations; ++idx) {
+        memcpy((uint8_t*)&keys.key_states[0], nyan_bench_key_states[idx % NYAN_BENCH_KEY_STATES], sizeof(keys.key_states));
+        NyanBuildHidReportFromKeyStates(&keys, &desc);
+    }
+    *bytes = 0;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchSha256Setup(Eeprom24xx* eeprom)
+{
+    uint32_t seed = 0x53484132;
+
+    for (uint32_t idx = 0; idx < NYAN_BENCH_SHA_BUF_SZ; ++idx)
+        nyan_bench_sha_buf[idx] = (uint8_t)NyanBenchRandom(&seed);
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchSha256(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    SHA256_CTX ctx;
+
+    sha256_init(&ctx);
+    for (uint32_t idx = 0; idx < iterations; ++idx)
+        sha256_update(&ctx, nyan_bench_sha_buf, NYAN_BENCH_SHA_BUF_SZ);
+    *bytes = iterations * NYAN_BENCH_SHA_BUF_SZ;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static void NyanBenchPutBits(uint32_t* pos, uint32_t value, uint8_t bits)
+{
+    // MSB first, the order read_int consumes them in
+    while (bits--) {
+        if ((value >> bits) & 1)
+            nyan_bench_ice_stream[*pos / 8] |= 0x80 >> (*pos % 8);
+        ++*pos;
+    }
+}
+
+static NyanBenchReturn NyanBenchUncompressSetup(Eeprom24xx* eeprom)
+{
+    uint32_t seed = 0x49434543;
+    uint32_t pos = 0;
+
+    // Longest code is a 4 bit prefix, a 6 bit count and 63 literal bits, plus room for the end code
+    const uint32_t limit = NYAN_BENCH_ICE_STREAM_SZ * 8 - (4 + 6 + 63) - (5 + 23);
+
+    memset(nyan_bench_ice_stream, 0, sizeof(nyan_bench_ice_stream));
+    NyanBenchPutBits(&pos, 0x49434543, 32);
+    NyanBenchPutBits(&pos, 0x4f4d5052, 32);
+
+    // A mix of every code the decompressor knows, weighted like nothing in particular
+    while (pos < limit) {
+        uint32_t r = NyanBenchRandom(&seed);
+        switch (r % 5) {
+            case 0:
+                NyanBenchPutBits(&pos, 0x1, 1);
+                NyanBenchPutBits(&pos, r >> 8, 2);
+                break;
+            case 1:
+                NyanBenchPutBits(&pos, 0x1, 2);
+                NyanBenchPutBits(&pos, r >> 8, 5);
+                break;
+            case 2:
+                NyanBenchPutBits(&pos, 0x1, 3);
+                NyanBenchPutBits(&pos, r >> 8, 8);
+                break;
+            case 3: {
+                uint8_t n = (r >> 8) & 0x3F;
+                NyanBenchPutBits(&pos, 0x1, 4);
+                NyanBenchPutBits(&pos, n, 6);
+                while (n) {
+                    uint8_t chunk = n > 31 ? 31 : n;
+                    NyanBenchPutBits(&pos, NyanBenchRandom(&seed), chunk);
+                    n -= chunk;
+                }
+                break;
+            }
+            default:
+                NyanBenchPutBits(&pos, 0x1, 5);
+                NyanBenchPutBits(&pos, (r >> 8) & 0x3FF, 23);
+                break;
+        }
+    }
+    NyanBenchPutBits(&pos, 0x0, 5);
+    NyanBenchPutBits(&pos, 0x0, 23);
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static uint8_t* NyanBenchIceSink(void* ctx, uint8_t* data, uint32_t len)
+{
+    nyan_bench_ice_out += len;
+    return data;
+}
+
+static NyanBenchReturn NyanBenchUncompress(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    // Static, the staging buffer is too big for the interrupt stack the shell runs on
+    static Iceuncompr ice;
+    static uint8_t out[ICEUNCOMPR_OUT_BUF];
+
+    nyan_bench_ice_out = 0;
+    for (uint32_t idx = 0; idx < iterations; ++idx) {
+        memset(&ice, 0, sizeof(ice));
+        ice.output = NyanBenchIceSink;
+        ice.output_data = out;
+        if (!WriteUncomprBitstream(&ice, nyan_bench_ice_stream, sizeof(nyan_bench_ice_stream)))
+            return NYAN_BENCH_FAILURE;
+    }
+    *bytes = nyan_bench_ice_out;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchEepromJob(Eeprom24xx* eeprom, EepromJobType type, uint8_t* data, uint16_t len)
+{
+    EepromJob job;
+
+    EepromJobInit(&job, type, false, NYAN_BENCH_EEPROM_PAGE, data, len);
+    if (EepromSubmit(eeprom, &job) != EEPROM_SUCCESS || EepromJobWait(&job) != EEPROM_SUCCESS)
+        return NYAN_BENCH_FAILURE;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+// The driver ACK polls a NACKed job, so a single byte read completes once the write cycle is over
+static NyanBenchReturn NyanBenchEepromReady(Eeprom24xx* eeprom)
+{
+    uint8_t byte;
+
+    return NyanBenchEepromJob(eeprom, EEPROM_JOB_READ, &byte, 1);
+}
+
+static NyanBenchReturn NyanBenchEepromRead(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    uint8_t page[NYAN_BENCH_EEPROM_PAGE_SZ] EEPROM_DMA_ALIGNED;
+
+    for (uint32_t idx = 0; idx < iterations; ++idx) {
+        if (NyanBenchEepromJob(eeprom, EEPROM_JOB_READ, page, sizeof(page)) != NYAN_BENCH_SUCCESS)
+            return NYAN_BENCH_FAILURE;
+    }
+    *bytes = iterations * NYAN_BENCH_EEPROM_PAGE_SZ;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchEepromWriteSetup(Eeprom24xx* eeprom)
+{
+    if (NyanBenchEepromReady(eeprom) != NYAN_BENCH_SUCCESS)
+        return NYAN_BENCH_FAILURE;
+
+    return NyanBenchEepromJob(eeprom, EEPROM_JOB_READ, nyan_bench_eeprom_page, NYAN_BENCH_EEPROM_PAGE_SZ);
+}
+
+static NyanBenchReturn NyanBenchEepromWrite(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    // One operation is the page transfer plus the write cycle, measured by ACK polling
+    for (uint32_t idx = 0; idx < iterations; ++idx) {
+        if (NyanBenchEepromJob(eeprom, EEPROM_JOB_WRITE, nyan_bench_eeprom_page, NYAN_BENCH_EEPROM_PAGE_SZ) != NYAN_BENCH_SUCCESS ||
+            NyanBenchEepromReady(eeprom) != NYAN_BENCH_SUCCESS)
+            return NYAN_BENCH_FAILURE;
+    }
+    *bytes = iterations * NYAN_BENCH_EEPROM_PAGE_SZ;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+static NyanBenchReturn NyanBenchFormat(Eeprom24xx* eeprom, uint32_t iterations, uint32_t* bytes)
+{
+    char line[64];
+    uint32_t total = 0;
+
+    // Roughly what getperf and the digest printing produce
+    for (uint32_t idx = 0; idx < iterations; ++idx)
+        total += NyanFormatBuf(line, sizeof(line), "%s%u %08x %.2q\r\n", "Total Keyboard Scans 1s: ", 8000 + idx, idx * 2654435761u, -2715);
+    *bytes = total;
+
+    return NYAN_BENCH_SUCCESS;
+}
+
+uint8_t NyanBenchCount(void)
+{
+    return _NYAN_NUM_BENCHES;
+}
+
+uint8_t NyanBenchFind(const char* name)
+{
+    uint8_t idx;
+
+    for (idx = 0; idx < _NYAN_NUM_BENCHES; ++idx) {
+        if (strcmp(nyan_benches[idx].name, name) == 0)
+            break;
+    }
+
+    return idx;
+}
+
+NyanBenchReturn NyanBenchRun(uint8_t idx, Eeprom24xx* eeprom, NyanBenchResult* result)
+{
+    if (idx >= _NYAN_NUM_BENCHES)
+        return NYAN_BENCH_FAILURE;
+
+    const NyanBench* bench = &nyan_benches[idx];
+
+    // Other jobs on the bus would be timed along with the EEPROM benchmarks
+    if (EepromBusy(eeprom))
+        return NYAN_BENCH_FAILURE;
+
+    if (bench->setup && bench->setup(eeprom) != NYAN_BENCH_SUCCESS)
+        return NYAN_BENCH_FAILURE;
+
+    uint32_t best = UINT32_MAX;
+    uint32_t bytes = 0;
+
+    for (uint8_t run = 0; run < NYAN_BENCH_RUNS; ++run) {
+        uint32_t start = NyanCyclesNow();
+        if (bench->run(eeprom, bench->iterations, &bytes) != NYAN_BENCH_SUCCESS)
+            return NYAN_BENCH_FAILURE;
+        uint32_t cycles = NyanCyclesNow() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+
+    result->name = bench->name;
+    result->iterations = bench->iterations;
+    result->cycles_per_op = best / bench->iterations;
+    result->bytes_per_op = bytes / bench->iterations;
+
+    return NYAN_BENCH_SUCCESS;
+}
@@ -0,0 +1,152 @@
+/**
+ * NyanOS Streaming FPGA Bitstream Writer
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "nyan_bitstream.h"
+
+static uint32_t NyanBitstreamPageLen(NyanBitstreamWriter* writer)
+{
+    uint32_t remaining = writer->size - writer->written;
+    return remaining < NYAN_BITSTREAM_PAGE_SZ ? remaining : NYAN_BITSTREAM_PAGE_SZ;
+}
+
+// Runs in the I2C interrupt, the driver already retried the page while the EEPROM was busy
+static void NyanBitstreamPageDone(EepromJob* job, EepromReturn result)
+{
+    NyanBitstreamWriter* writer = (NyanBitstreamWriter*)job->ctx;
+
+    if (result == EEPROM_SUCCESS) {
+        // Page accepted, its slot is free for the receive interrupt again
+        writer->written += job->len;
+        writer->pages++;
+        writer->pages_skipped += job->pages_skipped;
+    } else
+        writer->failed = true;
+    writer->page_inflight = false;
+}
+
+NyanBitstreamReturn NyanBitstreamWriterOpen(NyanBitstreamWriter* writer, Eeprom24xx* eeprom, uint32_t address, uint32_t size)
+{
+    writer->active = false;
+    if (size == 0 || size > NYAN_BITSTREAM_MAX_SIZE || address + size > EEPROM_SIZE)
+        return NYAN_BITSTREAM_FAILURE;
+    // A page of an aborted upload is still owned by the EEPROM driver
+    if (EepromJobBusy(&writer->page_job))
+        return NYAN_BITSTREAM_FAILURE;
+
+    writer->eeprom = eeprom;
+    writer->address = address;
+    writer->size = size;
+    writer->received = 0;
+    writer->written = 0;
+    writer->hashed = 0;
+    writer->pages = 0;
+    writer->pages_skipped = 0;
+    writer->page_inflight = false;
+    writer->failed = false;
+    sha256_init(&writer->ctx);
+
+    // Publish last, the receive interrupt starts pushing as soon as this is set
+    writer->active = true;
+
+    return NYAN_BITSTREAM_SUCCESS;
+}
+
+uint32_t NyanBitstreamWriterFree(NyanBitstreamWriter* writer)
+{
+    if (!writer->active)
+        return 0;
+
+    return NYAN_BITSTREAM_BUF_SZ - (writer->received - writer->written);
+}
+
+uint32_t NyanBitstreamWriterPush(NyanBitstreamWriter* writer, const uint8_t* data, uint32_t len)
+{
+    uint32_t accepted = 0;
+
+    if (!writer->active)
+        return 0;
+
+    while (accepted < len && writer->received < writer->size) {
+        uint32_t free = NyanBitstreamWriterFree(writer);
+        if (free == 0)
+            break;
+
+        // Copy up to the end of the ring, the announced size or the free space, whichever is first
+        uint32_t pos = writer->received % NYAN_BITSTREAM_BUF_SZ;
+        uint32_t chunk = len - accepted;
+        if (chunk > NYAN_BITSTREAM_BUF_SZ - pos)
+            chunk = NYAN_BITSTREAM_BUF_SZ - pos;
+        if (chunk > writer->size - writer->received)
+            chunk = writer->size - writer->received;
+        if (chunk > free)
+            chunk = free;
+
+        memcpy(&writer->buf[pos], &data[accepted], chunk);
+        writer->received += chunk;
+        accepted += chunk;
+    }
+
+    return accepted;
+}
+
+NyanBitstreamReturn NyanBitstreamWriterService(NyanBitstreamWriter* writer)
+{
+    if (!writer->active || writer->failed)
+        return writer->failed ? NYAN_BITSTREAM_FAILURE : NYAN_BITSTREAM_SUCCESS;
+
+    if (writer->page_inflight)
+        return NYAN_BITSTREAM_SUCCESS;
+
+    uint32_t page_len = NyanBitstreamPageLen(writer);
+
+    if (writer->written >= writer->size || writer->received < writer->written + page_len)
+        return NYAN_BITSTREAM_SUCCESS;
+
+    // Pages never wrap since the ring is a whole number of pages and written stays page aligned
+    const uint8_t* slot = &writer->buf[writer->written % NYAN_BITSTREAM_BUF_SZ];
+
+    // Hash once per page, not per attempt, the next page is hashed while the EEPROM is busy
+    if (writer->hashed == writer->written) {
+        sha256_update(&writer->ctx, slot, page_len);
+        writer->hashed += page_len;
+    }
+
+    // The slot stays untouched until the callback advances written
+    // A write page never straddles the B0 blocks, so the job is never split
+    EepromJobInitLinear(&writer->page_job, NULL, EEPROM_JOB_WRITE, writer->address + writer->written, (uint8_t*)slot, page_len);
+    // Pages the previous image already has are only read, iterating on a design rewrites a fraction of the bank
+    writer->page_job.compare = true;
+    writer->page_job.callback = NyanBitstreamPageDone;
+    writer->page_job.ctx = writer;
+    writer->page_inflight = true;
+    if (EepromSubmit(writer->eeprom, &writer->page_job) != EEPROM_SUCCESS)
+        writer->page_inflight = false;
+
+    return NYAN_BITSTREAM_SUCCESS;
+}
+
+bool NyanBitstreamWriterDone(NyanBitstreamWriter* writer)
+{
+    return writer->active && !writer->page_inflight && writer->written == writer->size;
+}
+
+NyanBitstreamReturn NyanBitstreamWriterFinish(NyanBitstreamWriter* writer, uint8_t* digest)
+{
+    if (!NyanBitstreamWriterDone(writer))
+        return NYAN_BITSTREAM_FAILURE;
+
+    sha256_final(&writer->ctx, digest);
+    writer->active = false;
+
+    return NYAN_BITSTREAM_SUCCESS;
+}
+
+void NyanBitstreamWriterAbort(NyanBitstreamWriter* writer)
+{
+    writer->active = false;
+    writer->page_inflight = false;
+}
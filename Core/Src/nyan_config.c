@@ -0,0 +1,176 @@
+/**
+ * NyanOS EEPROM Configuration Shadow
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "nyan_config.h"
+
+static bool NyanConfigInRange(uint16_t address, uint16_t len)
+{
+    return len > 0 && (uint32_t)address + len <= NYAN_CONFIG_SZ;
+}
+
+NyanConfigReturn NyanConfigInit(NyanConfig* config, Eeprom24xx* eeprom)
+{
+    memset(config, 0, sizeof(*config));
+    config->eeprom = eeprom;
+
+    // The whole area in one transfer, straight into the aligned shadow
+    EepromJobInit(&config->flush_job, EEPROM_JOB_READ, false, 0x0000, config->shadow, NYAN_CONFIG_SZ);
+    if (EepromSubmit(eeprom, &config->flush_job) != EEPROM_SUCCESS || EepromJobWait(&config->flush_job) != EEPROM_SUCCESS) {
+        // Writes are refused until NyanConfigService gets a read through
+        memset(config->shadow, 0, sizeof(config->shadow));
+        config->retry_tick = HAL_GetTick();
+        return NYAN_CONFIG_FAILURE;
+    }
+    config->loaded = true;
+
+    return NYAN_CONFIG_SUCCESS;
+}
+
+NyanConfigReturn NyanConfigRead(NyanConfig* config, uint16_t address, void* data, uint16_t len)
+{
+    if (!NyanConfigInRange(address, len))
+        return NYAN_CONFIG_FAILURE;
+
+    memcpy(data, &config->shadow[address], len);
+
+    return NYAN_CONFIG_SUCCESS;
+}
+
+NyanConfigReturn NyanConfigWrite(NyanConfig* config, uint16_t address, const void* data, uint16_t len)
+{
+    // Flushing lines of a zeroed shadow would wipe whatever the EEPROM holds around them
+    if (!config->loaded || !NyanConfigInRange(address, len))
+        return NYAN_CONFIG_FAILURE;
+
+    const uint8_t* bytes = (const uint8_t*)data;
+    uint64_t lines = 0;
+
+    // A line written while it is being flushed is simply flushed again
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    // Only lines whose contents change cost an EEPROM write
+    for (uint16_t pos = address; pos < address + len; ) {
+        uint16_t line_end = (pos / NYAN_CONFIG_LINE_SZ + 1) * NYAN_CONFIG_LINE_SZ;
+        uint16_t chunk = (line_end < address + len ? line_end : address + len) - pos;
+        if (memcmp(&config->shadow[pos], &bytes[pos - address], chunk) != 0) {
+            memcpy(&config->shadow[pos], &bytes[pos - address], chunk);
+            lines |= (uint64_t)1 << (pos / NYAN_CONFIG_LINE_SZ);
+        }
+        pos += chunk;
+    }
+    config->dirty |= lines;
+    __set_PRIMASK(primask);
+
+    if (!lines)
+        return NYAN_CONFIG_SUCCESS;
+
+    NyanConfigFlush(config);
+
+    return NYAN_CONFIG_SUCCESS;
+}
+
+// Runs in the I2C interrupt, carries on with whatever got dirty in the meantime
+static void NyanConfigFlushDone(EepromJob* job, EepromReturn result)
+{
+    NyanConfig* config = (NyanConfig*)job->ctx;
+
+    if (result != EEPROM_SUCCESS) {
+        // Retried by NyanConfigService once NYAN_CONFIG_RETRY_MS have passed, not hammered from here
+        config->dirty |= config->flushing;
+        config->flush_errors++;
+        config->flushing = 0;
+        config->retry_tick = HAL_GetTick();
+        return;
+    }
+
+    config->flushing = 0;
+    NyanConfigFlush(config);
+}
+
+void NyanConfigFlush(NyanConfig* config)
+{
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    if (config->flushing || !config->dirty || EepromJobBusy(&config->flush_job)) {
+        __set_PRIMASK(primask);
+        return;
+    }
+
+    // Lowest run of consecutive dirty lines, the driver splits it on the write pages
+    uint32_t first = __builtin_ctzll(config->dirty);
+    uint32_t last = first;
+    while (last + 1 < NYAN_CONFIG_LINES && (config->dirty & ((uint64_t)1 << (last + 1))))
+        ++last;
+    uint64_t lines = ((uint64_t)1 << (last + 1)) - ((uint64_t)1 << first);
+
+    config->dirty &= ~lines;
+    config->flushing = lines;
+
+    __set_PRIMASK(primask);
+
+    uint16_t address = first * NYAN_CONFIG_LINE_SZ;
+    EepromJobInit(&config->flush_job, EEPROM_JOB_WRITE, false, address, &config->shadow[address], (last + 1 - first) * NYAN_CONFIG_LINE_SZ);
+    config->flush_job.callback = NyanConfigFlushDone;
+    config->flush_job.ctx = config;
+    if (EepromSubmit(config->eeprom, &config->flush_job) != EEPROM_SUCCESS) {
+        config->dirty |= lines;
+        config->flushing = 0;
+        config->retry_tick = HAL_GetTick();
+    }
+}
+
+// Runs in the I2C interrupt, the main loop picks up a late load through NyanConfigService
+static void NyanConfigLoadDone(EepromJob* job, EepromReturn result)
+{
+    NyanConfig* config = (NyanConfig*)job->ctx;
+
+    if (result != EEPROM_SUCCESS) {
+        memset(config->shadow, 0, sizeof(config->shadow));
+        config->retry_tick = HAL_GetTick();
+        return;
+    }
+
+    config->late_load = true;
+    config->loaded = true;
+}
+
+bool NyanConfigService(NyanConfig* config)
+{
+    if (config->late_load) {
+        config->late_load = false;
+        return true;
+    }
+
+    if (EepromJobBusy(&config->flush_job) || HAL_GetTick() - config->retry_tick < NYAN_CONFIG_RETRY_MS)
+        return false;
+
+    if (!config->loaded) {
+        EepromJobInit(&config->flush_job, EEPROM_JOB_READ, false, 0x0000, config->shadow, NYAN_CONFIG_SZ);
+        config->flush_job.callback = NyanConfigLoadDone;
+        config->flush_job.ctx = config;
+        if (EepromSubmit(config->eeprom, &config->flush_job) != EEPROM_SUCCESS)
+            config->retry_tick = HAL_GetTick();
+        return false;
+    }
+
+    NyanConfigFlush(config);
+
+    return false;
+}
+
+bool NyanConfigClean(NyanConfig* config)
+{
+    // The bitmaps are two words each, read them without the flush callback in between
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bool clean = !config->dirty && !config->flushing;
+    __set_PRIMASK(primask);
+
+    return clean;
+}
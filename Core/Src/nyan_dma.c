@@ -0,0 +1,81 @@
+/**
+ * NyanOS DMA buffers - MPU region and D-Cache maintenance
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "nyan_dma.h"
+
+// Linker script, the .dma_buffer section fills SRAM2
+extern uint8_t _sdma_buffer[];
+extern uint8_t _edma_buffer[];
+extern uint8_t _sdma_region[];
+
+void NyanDmaInit(void)
+{
+    MPU_Region_InitTypeDef region = {0};
+
+    HAL_MPU_Disable();
+    // Normal memory, shareable and non-cacheable (TEX 1, C 0, B 0), never executed
+    region.Enable = MPU_REGION_ENABLE;
+    region.Number = MPU_REGION_NUMBER0;
+    region.BaseAddress = (uint32_t)_sdma_region;
+    region.Size = MPU_REGION_SIZE_16KB;
+    region.SubRegionDisable = 0x00;
+    region.TypeExtField = MPU_TEX_LEVEL1;
+    region.AccessPermission = MPU_REGION_FULL_ACCESS;
+    region.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+    region.IsShareable = MPU_ACCESS_SHAREABLE;
+    region.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+    region.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+    HAL_MPU_ConfigRegion(&region);
+    // Everything else keeps the default memory map
+    HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+    memset(_sdma_buffer, 0, _edma_buffer - _sdma_buffer);
+}
+
+bool NyanDmaCoherent(const void* data, uint32_t len)
+{
+    uintptr_t start = (uintptr_t)data;
+    uintptr_t end = start + len;
+
+    if (start >= NYAN_DMA_DTCM_BASE && end <= NYAN_DMA_DTCM_BASE + NYAN_DMA_DTCM_SIZE)
+        return true;
+    return start >= (uintptr_t)_sdma_buffer && end <= (uintptr_t)_edma_buffer;
+}
+
+// Widens a range to the whole lines it touches
+static uint32_t* NyanDmaLine(const void* data, uint32_t* len)
+{
+    uintptr_t start = (uintptr_t)data & ~(uintptr_t)(NYAN_DMA_LINE - 1);
+
+    *len = (uint32_t)((uintptr_t)data - start) + *len;
+    *len = (*len + NYAN_DMA_LINE - 1) & ~(uint32_t)(NYAN_DMA_LINE - 1);
+    return (uint32_t*)start;
+}
+
+void NyanDmaClean(const void* data, uint32_t len)
+{
+    if (!len || NyanDmaCoherent(data, len))
+        return;
+    uint32_t* line = NyanDmaLine(data, &len);
+    SCB_CleanDCache_by_Addr(line, len);
+}
+
+void NyanDmaInvalidate(void* data, uint32_t len)
+{
+    if (!len || NyanDmaCoherent(data, len))
+        return;
+    uint32_t* line = NyanDmaLine(data, &len);
+    SCB_InvalidateDCache_by_Addr(line, len);
+}
+
+void NyanDmaCleanInvalidate(void* data, uint32_t len)
+{
+    if (!len || NyanDmaCoherent(data, len))
+        return;
+    uint32_t* line = NyanDmaLine(data, &len);
+    SCB_CleanInvalidateDCache_by_Addr(line, len);
+}
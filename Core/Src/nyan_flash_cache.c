@@ -0,0 +1,131 @@
+/**
+ * NyanOS Internal Flash Bitstream Cache
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "nyan_flash_cache.h"
+
+// Staging for the EEPROM read back, whole cache lines so it is DMAed in place
+static uint8_t nyan_flash_cache_block[NYAN_FLASH_CACHE_BLOCK] EEPROM_DMA_ALIGNED;
+
+static const NyanFlashCacheHeader* NyanFlashCacheHeaderGet(void)
+{
+    return (const NyanFlashCacheHeader*)NYAN_FLASH_CACHE_ADDR;
+}
+
+// Programs whole words, a trailing partial word is padded with erased bytes
+static bool NyanFlashCacheProgram(uint32_t address, const uint8_t* data, uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i += 4) {
+        uint32_t word = 0xFFFFFFFF;
+        memcpy(&word, &data[i], len - i < 4 ? len - i : 4);
+        if (HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, address + i, word) != HAL_OK)
+            return false;
+    }
+
+    return true;
+}
+
+NyanFlashCacheReturn NyanFlashCacheLookup(uint32_t length, const NyanFlashCacheHeader** header)
+{
+    const NyanFlashCacheHeader* cached = NyanFlashCacheHeaderGet();
+    SHA256_CTX ctx;
+    BYTE digest[SHA256_BLOCK_SIZE];
+
+    if (cached->magic != NYAN_FLASH_CACHE_MAGIC || cached->length != length ||
+        length == 0 || length > NYAN_FLASH_CACHE_MAX_IMAGE)
+        return NYAN_FLASH_CACHE_FAILURE;
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const BYTE*)NYAN_FLASH_CACHE_IMAGE, length);
+    sha256_final(&ctx, digest);
+    if (memcmp(digest, cached->sha256, SHA256_BLOCK_SIZE) != 0)
+        return NYAN_FLASH_CACHE_FAILURE;
+
+    *header = cached;
+    return NYAN_FLASH_CACHE_SUCCESS;
+}
+
+NyanFlashCacheReturn NyanFlashCacheStore(Eeprom24xx* eeprom, uint32_t address, uint32_t length, const uint8_t* digest)
+{
+    const NyanFlashCacheHeader* cached;
+    NyanFlashCacheHeader header;
+    SHA256_CTX ctx;
+    BYTE check[SHA256_BLOCK_SIZE];
+
+    if (length == 0 || length > NYAN_FLASH_CACHE_MAX_IMAGE || address + length > EEPROM_SIZE)
+        return NYAN_FLASH_CACHE_FAILURE;
+
+    // Re-uploading the same image costs neither an erase stall nor flash wear
+    if (NyanFlashCacheLookup(length, &cached) == NYAN_FLASH_CACHE_SUCCESS &&
+        memcmp(cached->sha256, digest, SHA256_BLOCK_SIZE) == 0)
+        return NYAN_FLASH_CACHE_SUCCESS;
+
+    uint32_t version = NyanFlashCacheHeaderGet()->version;
+    header.magic = NYAN_FLASH_CACHE_MAGIC;
+    header.version = version == 0xFFFFFFFF ? 1 : version + 1;
+    header.length = length;
+    memcpy(header.sha256, digest, SHA256_BLOCK_SIZE);
+
+    FLASH_EraseInitTypeDef erase = {
+        .TypeErase = FLASH_TYPEERASE_SECTORS,
+        .Sector = NYAN_FLASH_CACHE_SECTOR,
+        .NbSectors = 1,
+        .VoltageRange = FLASH_VOLTAGE_RANGE_3
+    };
+    uint32_t sector_error;
+
+    HAL_FLASH_Unlock();
+    bool ok = HAL_FLASHEx_Erase(&erase, &sector_error) == HAL_OK;
+    HAL_FLASH_Lock();
+
+    // Copy what the EEPROM actually holds, hashing it on the way
+    sha256_init(&ctx);
+    for (uint32_t offset = 0; ok && offset < length; offset += NYAN_FLASH_CACHE_BLOCK) {
+        uint32_t len = length - offset < NYAN_FLASH_CACHE_BLOCK ? length - offset : NYAN_FLASH_CACHE_BLOCK;
+        EepromJob job;
+        EepromJob tail;
+
+        EepromJob* last = EepromJobInitLinear(&job, &tail, EEPROM_JOB_READ, address + offset, nyan_flash_cache_block, len);
+        ok = EepromSubmit(eeprom, &job) == EEPROM_SUCCESS && EepromJobWait(&job) == EEPROM_SUCCESS && EepromJobWait(last) == EEPROM_SUCCESS;
+        if (ok) {
+            sha256_update(&ctx, nyan_flash_cache_block, len);
+            // Unlocked only while programming, never across the EEPROM read
+            HAL_FLASH_Unlock();
+            ok = NyanFlashCacheProgram(NYAN_FLASH_CACHE_IMAGE + offset, nyan_flash_cache_block, len);
+            HAL_FLASH_Lock();
+        }
+    }
+    if (ok) {
+        sha256_final(&ctx, check);
+        ok = memcmp(check, digest, SHA256_BLOCK_SIZE) == 0;
+    }
+    // Header last and its magic word very last, an interrupted copy stays invalid
+    if (ok) {
+        HAL_FLASH_Unlock();
+        ok = NyanFlashCacheProgram(NYAN_FLASH_CACHE_ADDR + sizeof(header.magic), (const uint8_t*)&header.version,
+                                   sizeof(header) - sizeof(header.magic)) &&
+             NyanFlashCacheProgram(NYAN_FLASH_CACHE_ADDR, (const uint8_t*)&header.magic, sizeof(header.magic));
+        HAL_FLASH_Lock();
+    }
+
+    // Reads of the sector went through the D-Cache
+    SCB_InvalidateDCache_by_Addr((uint32_t*)NYAN_FLASH_CACHE_ADDR, NYAN_FLASH_CACHE_SIZE);
+
+    return ok ? NYAN_FLASH_CACHE_SUCCESS : NYAN_FLASH_CACHE_FAILURE;
+}
+
+void NyanFlashCacheInvalidate(void)
+{
+    if (NyanFlashCacheHeaderGet()->magic != NYAN_FLASH_CACHE_MAGIC)
+        return;
+
+    // Clearing bits needs no erase
+    HAL_FLASH_Unlock();
+    HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, NYAN_FLASH_CACHE_ADDR, 0);
+    HAL_FLASH_Lock();
+    SCB_InvalidateDCache_by_Addr((uint32_t*)NYAN_FLASH_CACHE_ADDR, EEPROM_DMA_ALIGN);
+}
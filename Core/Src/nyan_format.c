@@ -0,0 +1,206 @@
+/**
+ * NyanOS Heap Free Formatter
+ * Portland.HODL
+ */
+
+#include <stdbool.h>
+
+#include "nyan_format.h"
+
+#define NYAN_FORMAT_NUM_MAX 24 /**< Sign, 10 integer digits, point and 9 fraction digits fit with room to spare. */
+
+static const char nyan_format_digits_lower[] = "0123456789abcdef";
+static const char nyan_format_digits_upper[] = "0123456789ABCDEF";
+static const char nyan_format_spaces[] = "                ";
+static const char nyan_format_zeros[]  = "0000000000000000";
+
+typedef struct {
+    char*  buf;
+    size_t size;
+    size_t pos;
+} NyanFormatBufSink;
+
+// Writes digits backwards ending at end, returns the first digit
+static char* NyanFormatDigits(char* end, uint32_t value, uint32_t base, const char* digits, int min_digits)
+{
+    char* p = end;
+    do {
+        *--p = digits[value % base];
+        value /= base;
+        --min_digits;
+    } while (value || min_digits > 0);
+
+    return p;
+}
+
+static void NyanFormatPad(NyanFormatWrite write, void* ctx, const char* pad, int count)
+{
+    while (count > 0) {
+        int chunk = count < (int)(sizeof(nyan_format_spaces) - 1) ? count : (int)(sizeof(nyan_format_spaces) - 1);
+        write(ctx, pad, chunk);
+        count -= chunk;
+    }
+}
+
+size_t NyanFormatV(NyanFormatWrite write, void* ctx, const char* fmt, va_list args)
+{
+    size_t total = 0;
+    const char* run = fmt;
+
+    while (*fmt) {
+        if (*fmt != '%') {
+            ++fmt;
+            continue;
+        }
+
+        // Flush the literal text in one span
+        if (fmt != run) {
+            write(ctx, run, fmt - run);
+            total += fmt - run;
+        }
+        const char* spec = fmt++;
+
+        bool left = false;
+        bool zero = false;
+        int width = 0;
+        int precision = -1;
+
+        for (;; ++fmt) {
+            if (*fmt == '-')
+                left = true;
+            else if (*fmt == '0')
+                zero = true;
+            else
+                break;
+        }
+        while (*fmt >= '0' && *fmt <= '9')
+            width = width * 10 + (*fmt++ - '0');
+        if (*fmt == '.') {
+            precision = 0;
+            ++fmt;
+            while (*fmt >= '0' && *fmt <= '9')
+                precision = precision * 10 + (*fmt++ - '0');
+        }
+        // Every integer on this target is 32 bit
+        while (*fmt == 'l' || *fmt == 'h' || *fmt == 'z')
+            ++fmt;
+
+        char num[NYAN_FORMAT_NUM_MAX];
+        char* end = &num[NYAN_FORMAT_NUM_MAX];
+        const char* out = end;
+        size_t len = 0;
+        bool negative = false;
+
+        switch (*fmt) {
+            case 'd':
+            case 'i': {
+                int32_t value = va_arg(args, int32_t);
+                negative = value < 0;
+                out = NyanFormatDigits(end, negative ? 0u - (uint32_t)value : (uint32_t)value, 10, nyan_format_digits_lower, 1);
+                break;
+            }
+            case 'u':
+                out = NyanFormatDigits(end, va_arg(args, uint32_t), 10, nyan_format_digits_lower, 1);
+                break;
+            case 'x':
+                out = NyanFormatDigits(end, va_arg(args, uint32_t), 16, nyan_format_digits_lower, 1);
+                break;
+            case 'X':
+                out = NyanFormatDigits(end, va_arg(args, uint32_t), 16, nyan_format_digits_upper, 1);
+                break;
+            case 'q': {
+                int32_t value = va_arg(args, int32_t);
+                uint32_t magnitude;
+                uint32_t scale = 1;
+                if (precision < 0)
+                    precision = 0;
+                if (precision > 9)
+                    precision = 9;
+                for (int i = 0; i < precision; ++i)
+                    scale *= 10;
+                negative = value < 0;
+                magnitude = negative ? 0u - (uint32_t)value : (uint32_t)value;
+                char* p = end;
+                if (precision > 0) {
+                    p = NyanFormatDigits(p, magnitude % scale, 10, nyan_format_digits_lower, precision);
+                    *--p = '.';
+                }
+                out = NyanFormatDigits(p, magnitude / scale, 10, nyan_format_digits_lower, 1);
+                break;
+            }
+            case 'c':
+                *--end = (char)va_arg(args, int);
+                out = end;
+                end = &num[NYAN_FORMAT_NUM_MAX];
+                break;
+            case 's': {
+                out = va_arg(args, const char*);
+                if (!out)
+                    out = "(null)";
+                const char* s = out;
+                while (*s)
+                    ++s;
+                end = (char*)s;
+                zero = false;
+                break;
+            }
+            case '%':
+                write(ctx, "%", 1);
+                ++total;
+                run = ++fmt;
+                continue;
+            default:
+                // Unknown conversion, emit it untouched so the mistake is visible
+                run = spec;
+                if (*fmt)
+                    ++fmt;
+                continue;
+        }
+
+        len = end - out;
+        int pad = width - (int)len - (negative ? 1 : 0);
+
+        if (!left && !zero)
+            NyanFormatPad(write, ctx, nyan_format_spaces, pad);
+        if (negative)
+            write(ctx, "-", 1);
+        if (!left && zero)
+            NyanFormatPad(write, ctx, nyan_format_zeros, pad);
+        write(ctx, out, len);
+        if (left)
+            NyanFormatPad(write, ctx, nyan_format_spaces, pad);
+
+        total += len + (negative ? 1 : 0) + (pad > 0 ? pad : 0);
+        run = ++fmt;
+    }
+
+    if (fmt != run) {
+        write(ctx, run, fmt - run);
+        total += fmt - run;
+    }
+
+    return total;
+}
+
+static void NyanFormatBufWrite(void* ctx, const char* data, size_t len)
+{
+    NyanFormatBufSink* sink = (NyanFormatBufSink*)ctx;
+
+    for (size_t idx = 0; idx < len && sink->pos + 1 < sink->size; ++idx)
+        sink->buf[sink->pos++] = data[idx];
+}
+
+size_t NyanFormatBuf(char* buf, size_t size, const char* fmt, ...)
+{
+    NyanFormatBufSink sink = { buf, size, 0 };
+    va_list args;
+
+    va_start(args, fmt);
+    size_t total = NyanFormatV(NyanFormatBufWrite, &sink, fmt, args);
+    va_end(args);
+
+    if (size)
+        buf[sink.pos] = '\0';
+
+    return total;
+}
@@ -0,0 +1,193 @@
+/**
+ * NyanOS Binary Frame Link - COBS + CRC-32
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "nyan_crc.h"
+#include "nyan_frame.h"
+
+void NyanFrameInit(NyanFrameLink* link)
+{
+    link->rx_len = 0;
+    link->rx_overflow = false;
+    link->frame_len = 0;
+    link->frame_pending = false;
+}
+
+void NyanFrameRxByte(NyanFrameLink* link, uint8_t byte)
+{
+    if (byte != NYAN_FRAME_DELIMITER) {
+        if (link->rx_len < sizeof(link->rx_buf))
+            link->rx_buf[link->rx_len++] = byte;
+        else
+            link->rx_overflow = true;
+        return;
+    }
+
+    // Delimiter - back to back delimiters are legal and carry no frame
+    if (link->rx_len == 0)
+        return;
+
+    if (link->rx_overflow) {
+        link->frames_bad++;
+    } else if (link->frame_pending) {
+        link->frames_dropped++;
+    } else {
+        memcpy(link->frame, link->rx_buf, link->rx_len);
+        link->frame_len = link->rx_len;
+        link->frame_pending = true;
+    }
+
+    link->rx_len = 0;
+    link->rx_overflow = false;
+}
+
+// Recovers type and seq from the first COBS group(s) of a frame that doesn't decode as a whole
+static void NyanFramePeekHeader(const uint8_t* src, size_t len, NyanFrame* frame)
+{
+    uint8_t header[2];
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len && out < sizeof(header)) {
+        uint8_t code = src[in++];
+        if (code == 0x00)
+            return;
+        for (uint8_t i = 1; i < code && in < len && out < sizeof(header); ++i)
+            header[out++] = src[in++];
+        if (out < sizeof(header) && code != 0xFF && in < len)
+            header[out++] = 0x00;
+    }
+
+    if (out == sizeof(header)) {
+        frame->type = header[0];
+        frame->seq = header[1];
+    }
+}
+
+NyanFrameError NyanFrameTake(NyanFrameLink* link, NyanFrame* frame)
+{
+    frame->type = 0;
+    frame->seq = 0;
+    frame->len = 0;
+    frame->payload = NULL;
+
+    // Decoding in place overwrites the encoded header, so it is peeked first for the NACK
+    NyanFramePeekHeader(link->frame, link->frame_len, frame);
+
+    // Decoding in place is safe since COBS output is never longer than its input
+    size_t raw_len = NyanCobsDecode(link->frame, link->frame_len, link->frame, sizeof(link->frame));
+    if (raw_len == 0) {
+        link->frames_bad++;
+        NyanFrameRelease(link);
+        return NYAN_FRAME_ERR_COBS;
+    }
+
+    if (raw_len < NYAN_FRAME_HEADER_SZ + NYAN_FRAME_CRC_SZ) {
+        link->frames_bad++;
+        NyanFrameRelease(link);
+        return NYAN_FRAME_ERR_LENGTH;
+    }
+
+    uint16_t len = (uint16_t)link->frame[2] | ((uint16_t)link->frame[3] << 8);
+    if (len > NYAN_FRAME_MAX_PAYLOAD || raw_len != (size_t)len + NYAN_FRAME_HEADER_SZ + NYAN_FRAME_CRC_SZ) {
+        link->frames_bad++;
+        NyanFrameRelease(link);
+        return NYAN_FRAME_ERR_LENGTH;
+    }
+
+    uint32_t crc = NyanCrc32(link->frame, NYAN_FRAME_HEADER_SZ + len);
+    if (crc != NyanFrameGetU32(&link->frame[NYAN_FRAME_HEADER_SZ + len])) {
+        link->frames_bad++;
+        NyanFrameRelease(link);
+        return NYAN_FRAME_ERR_CRC;
+    }
+
+    frame->len = len;
+    frame->payload = &link->frame[NYAN_FRAME_HEADER_SZ];
+    link->frames_ok++;
+
+    return NYAN_FRAME_ERR_NONE;
+}
+
+void NyanFrameRelease(NyanFrameLink* link)
+{
+    link->frame_len = 0;
+    link->frame_pending = false;
+}
+
+size_t NyanFrameEncode(NyanFrameLink* link, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len)
+{
+    return NyanFrameBuild(link->tx_raw, link->tx_buf, type, seq, payload, len);
+}
+
+size_t NyanFrameBuild(uint8_t* raw, uint8_t* out, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len)
+{
+    if (len > NYAN_FRAME_MAX_PAYLOAD || (len && !payload))
+        return 0;
+
+    raw[0] = type;
+    raw[1] = seq;
+    raw[2] = (uint8_t)len;
+    raw[3] = (uint8_t)(len >> 8);
+    if (len)
+        memcpy(&raw[NYAN_FRAME_HEADER_SZ], payload, len);
+    NyanFramePutU32(&raw[NYAN_FRAME_HEADER_SZ + len], NyanCrc32(raw, NYAN_FRAME_HEADER_SZ + len));
+
+    size_t encoded = NyanCobsEncode(raw, NYAN_FRAME_HEADER_SZ + len + NYAN_FRAME_CRC_SZ, out);
+    out[encoded++] = NYAN_FRAME_DELIMITER;
+
+    return encoded;
+}
+
+size_t NyanCobsEncode(const uint8_t* src, size_t len, uint8_t* dst)
+{
+    size_t code_idx = 0;
+    size_t out = 1;
+    uint8_t code = 1;
+
+    for (size_t idx = 0; idx < len; ++idx) {
+        if (src[idx] == 0x00) {
+            dst[code_idx] = code;
+            code_idx = out++;
+            code = 1;
+        } else {
+            dst[out++] = src[idx];
+            if (++code == 0xFF) {
+                dst[code_idx] = code;
+                code_idx = out++;
+                code = 1;
+            }
+        }
+    }
+    dst[code_idx] = code;
+
+    return out;
+}
+
+size_t NyanCobsDecode(const uint8_t* src, size_t len, uint8_t* dst, size_t dst_max)
+{
+    size_t in = 0;
+    size_t out = 0;
+
+    while (in < len) {
+        uint8_t code = src[in++];
+        if (code == 0x00 || in + code - 1 > len)
+            return 0;
+        for (uint8_t i = 1; i < code; ++i) {
+            if (out >= dst_max)
+                return 0;
+            dst[out++] = src[in++];
+        }
+        // A group shorter than 0xFF implies a zero, except after the final group
+        if (code != 0xFF && in < len) {
+            if (out >= dst_max)
+                return 0;
+            dst[out++] = 0x00;
+        }
+    }
+
+    return out;
+}
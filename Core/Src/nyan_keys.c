@@ -6,17 +6,17 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "24xx_eeprom.h"
-#include "nyan_eeprom_map.h"
+#include "nyan_tcm.h"
 #include "nyan_keys.h"
 #include "spi.h"
 #include "usb_hid_keys.h"
 
-extern Eeprom24xx nos_eeprom;
+extern NyanKv nos_kv;
 
-static uint8_t keys_registers_addresses[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x00, 0x00}; // We need the last dummy byte to extract the last byte from the keys IP
+static const uint8_t keys_registers_addresses[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x00, 0x00}; // We need the last dummy byte to extract the last byte from the keys IP
+static uint8_t keys_tx_frame[sizeof(keys_registers_addresses)] NYAN_DTCM; // What SPI2 DMA actually sends, filled at init
 
-inline bool NyanGetKeyState(NyanKeys *keys, int key)
+NYAN_ITCM bool NyanGetKeyState(NyanKeys *keys, int key)
 {
     int byteIndex = key / 8;
     int bitIndex = key % 8;
@@ -25,7 +25,7 @@ inline bool NyanGetKeyState(NyanKeys *keys, int key)
     return (keys->key_states[byteIndex + 1] & (1 << bitIndex)) != 0;
 }
 
-NyanKeysReturn NyanStuctAllocator(NyanKeys *keys, volatile NyanKeyBoardDescriptor *desc, uint8_t hid_scan_code)
+NYAN_ITCM NyanKeysReturn NyanStuctAllocator(NyanKeys *keys, volatile NyanKeyBoardDescriptor *desc, uint8_t hid_scan_code)
 {
     if(keys->boot_byte_cnt < NUM_BOOT_KEYS)
         desc->BOOTKEYCODE[keys->boot_byte_cnt++] = hid_scan_code;
@@ -41,9 +41,10 @@ NyanKeysReturn NyanKeysInit(NyanKeys *keys)
     // We only have one device on the bus so we will just leave SS Low
     HAL_GPIO_WritePin(Keys_Slave_Select_GPIO_Port, Keys_Slave_Select_Pin, GPIO_PIN_RESET);
 
+    memcpy(keys_tx_frame, keys_registers_addresses, sizeof(keys_tx_frame));
     keys->warm_up_reads = 0;
     keys->warmed_up = false;
-    keys->super_key_disabled = NyanKeysReadSuperDisableEEPROM(&nos_eeprom);
+    keys->super_key_disabled = NyanKeysReadSuperDisableEEPROM(&nos_kv);
 
     return NYAN_KEYS_SUCCESS;
 }
@@ -51,36 +52,33 @@ NyanKeysReturn NyanKeysInit(NyanKeys *keys)
 NyanKeysReturn NyanGetKeys(NyanKeys *keys)
 {
     // Send out the DMA and we will get the results back from the FPGA 
-    if(HAL_SPI_TransmitReceive_DMA(&hspi2, &keys_registers_addresses[0], (uint8_t*)&keys->key_states[0], sizeof(keys_registers_addresses)) != HAL_OK) {
+    if(HAL_SPI_TransmitReceive_DMA(&hspi2, &keys_tx_frame[0], (uint8_t*)&keys->key_states[0], sizeof(keys_tx_frame)) != HAL_OK) {
         return NYAN_KEYS_FAILURE;
     }
     
     return NYAN_KEYS_SUCCESS;
 }
 
-NyanKeysReturn NyanKeysWriteSuperDisableEEPROM(Eeprom24xx* eeprom, bool disabled)
+NyanKeysReturn NyanKeysWriteSuperDisableEEPROM(NyanKv* kv, bool disabled)
 {   
-    // First lets clear out the TX buff
-    if(EepromFlushTxBuff(eeprom) != EEPROM_SUCCESS){
+    uint8_t disabled_byte = (uint8_t)disabled;
+    // Appends a record to the key-value log, the toggle wears a different EEPROM line each time
+    if(NyanKvSet(kv, NYAN_KV_SUPER_KEY_DISABLED, &disabled_byte, sizeof(disabled_byte)) != NYAN_KV_SUCCESS){
         return NYAN_KEYS_FAILURE;
     }
-    // Second lets copy our new buffer over to the EEPROM driver
-    eeprom->tx_buf[0] = (uint8_t)disabled;
-    // Write the state to the eeprom. Don't overwrite the full 16 bytes of slot one because we will use it for other things.
-    EepromWrite(eeprom, false, ADDR_RESERVED_0, 1);
 
     return NYAN_KEYS_SUCCESS;
 }
 
-bool NyanKeysReadSuperDisableEEPROM(Eeprom24xx* eeprom)
-{   // Fetch the state of the super key disablement from the eeprom
-    EepromRead(eeprom, false, ADDR_RESERVED_0, 1);
-    while(eeprom->rx_inflight){}
-    return (bool)(eeprom->rx_buf[0] == 0x00 ? false : true);
+bool NyanKeysReadSuperDisableEEPROM(NyanKv* kv)
+{   // Fetch the state of the super key disablement from the key-value log, enabled if never set
+    uint8_t disabled = 0x00;
+    NyanKvGet(kv, NYAN_KV_SUPER_KEY_DISABLED, &disabled, sizeof(disabled));
+    return (bool)(disabled == 0x00 ? false : true);
 }
 
 
-NyanKeysReturn NyanBuildHidReportFromKeyStates(NyanKeys *keys, volatile NyanKeyBoardDescriptor *desc)
+NYAN_ITCM NyanKeysReturn NyanBuildHidReportFromKeyStates(NyanKeys *keys, volatile NyanKeyBoardDescriptor *desc)
 {
     // Nullify the descriptor report
     if(keys->warmed_up)
@@ -121,7 +119,7 @@ NyanKeysReturn NyanBuildHidReportFromKeyStates(NyanKeys *keys, volatile NyanKeyB
                     /*** Handle the disablement of the windows logo (super) for gaming ***/
                     if(alt_fn) {
                         keys->super_key_disabled = !keys->super_key_disabled;
-                        NyanKeysWriteSuperDisableEEPROM(&nos_eeprom, keys->super_key_disabled);
+                        NyanKeysWriteSuperDisableEEPROM(&nos_kv, keys->super_key_disabled);
                     } if (keys->super_key_disabled) {
                         //If the super key is disabled we do nothing on press
                     } else {
@@ -203,7 +201,7 @@ NyanKeysReturn NyanBuildHidReportFromKeyStates(NyanKeys *keys, volatile NyanKeyB
                     /*** Handle the disablement of the windows logo (super) for gaming ***/
                     if(alt_fn) {
                         keys->super_key_disabled = !keys->super_key_disabled;
-                        NyanKeysWriteSuperDisableEEPROM(&nos_eeprom, keys->super_key_disabled);
+                        NyanKeysWriteSuperDisableEEPROM(&nos_kv, keys->super_key_disabled);
                     } if (keys->super_key_disabled) {
                         //If the super key is disabled we do nothing on press
                     } else {
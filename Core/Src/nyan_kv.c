@@ -0,0 +1,194 @@
+/**
+ * NyanOS EEPROM Key-Value Log
+ * Portland.HODL
+ */
+
+#include <stddef.h>
+#include <string.h>
+
+#include "main.h"
+#include "nyan_crc.h"
+#include "nyan_kv.h"
+
+_Static_assert(ADDR_KV_LOG + SIZE_KV_LOG <= ADDR_FPGA_BITSTREAM_DIGEST, "the log must end before the bitstream digest");
+_Static_assert(SIZE_KV_LOG % NYAN_KV_RECORD_SZ == 0, "the log must hold whole records");
+
+static const NyanKvRecord* NyanKvSlot(NyanKv* kv, uint8_t slot)
+{
+    return (const NyanKvRecord*)&kv->config->shadow[ADDR_KV_LOG + slot * NYAN_KV_RECORD_SZ];
+}
+
+static bool NyanKvValid(const NyanKvRecord* record)
+{
+    if (record->key == 0x00 || record->key >= NYAN_KV_KEYS || record->len > NYAN_KV_MAX_VALUE)
+        return false;
+
+    return record->crc == NyanCrc32((const uint8_t*)record, offsetof(NyanKvRecord, crc));
+}
+
+// Sequence numbers wrap, a record is newer if it is less than half the range ahead
+static bool NyanKvNewer(uint16_t seq, uint16_t than)
+{
+    return (int16_t)(seq - than) > 0;
+}
+
+static bool NyanKvLive(NyanKv* kv, uint8_t slot)
+{
+    for (uint8_t key = 0; key < NYAN_KV_KEYS; ++key) {
+        if (kv->current[key] == slot)
+            return true;
+    }
+
+    return false;
+}
+
+// Main loop only, interrupts are held off so a lookup never sees a half written index
+static void NyanKvAppend(NyanKv* kv, uint8_t key, const uint8_t* value, uint8_t len)
+{
+    NyanKvRecord record;
+    uint8_t slot = kv->next_slot;
+
+    // There are fewer keys than slots, so a slot without a current record always exists
+    while (NyanKvLive(kv, slot))
+        slot = (slot + 1) % NYAN_KV_SLOTS;
+
+    memset(&record, 0, sizeof(record));
+    record.key = key;
+    record.len = len;
+    record.seq = ++kv->head_seq;
+    memcpy(record.value, value, len);
+    record.crc = NyanCrc32((const uint8_t*)&record, offsetof(NyanKvRecord, crc));
+
+    NyanConfigWrite(kv->config, ADDR_KV_LOG + slot * NYAN_KV_RECORD_SZ, &record, sizeof(record));
+    kv->current[key] = (int8_t)slot;
+    kv->next_slot = (slot + 1) % NYAN_KV_SLOTS;
+    kv->records_written++;
+}
+
+// Copies forward records the head is about to lap, the only compaction a log this small needs
+static void NyanKvRefresh(NyanKv* kv)
+{
+    for (uint8_t key = 1; key < NYAN_KV_KEYS; ++key) {
+        if (kv->current[key] < 0)
+            continue;
+        const NyanKvRecord* record = NyanKvSlot(kv, kv->current[key]);
+        if ((uint16_t)(kv->head_seq - record->seq) >= NYAN_KV_REFRESH_SPAN) {
+            uint8_t value[NYAN_KV_MAX_VALUE];
+            memcpy(value, record->value, record->len);
+            NyanKvAppend(kv, key, value, record->len);
+        }
+    }
+}
+
+void NyanKvInit(NyanKv* kv, NyanConfig* config)
+{
+    bool found = false;
+
+    kv->config = config;
+    kv->head_seq = 0;
+    kv->next_slot = 0;
+    kv->records_written = 0;
+    for (uint8_t key = 0; key < NYAN_KV_KEYS; ++key)
+        kv->current[key] = -1;
+
+    // Newest valid record per key, the newest record overall sets the head
+    for (uint8_t slot = 0; slot < NYAN_KV_SLOTS; ++slot) {
+        const NyanKvRecord* record = NyanKvSlot(kv, slot);
+        if (!NyanKvValid(record))
+            continue;
+        int8_t current = kv->current[record->key];
+        if (current < 0 || NyanKvNewer(record->seq, NyanKvSlot(kv, current)->seq))
+            kv->current[record->key] = (int8_t)slot;
+        if (!found || NyanKvNewer(record->seq, kv->head_seq)) {
+            kv->head_seq = record->seq;
+            kv->next_slot = (slot + 1) % NYAN_KV_SLOTS;
+        }
+        found = true;
+    }
+
+    // Staged values survive a rebuild, NyanKvService appends them once the shadow is loaded
+
+    // Before the log the super key state was a raw byte at the start of the reserved area, any non-zero value meant disabled
+    if (!found && config->loaded) {
+        uint8_t legacy = config->shadow[ADDR_KV_LOG] != 0x00 ? 0x01 : 0x00;
+        NyanKvSet(kv, NYAN_KV_SUPER_KEY_DISABLED, &legacy, sizeof(legacy));
+    }
+}
+
+NyanKvReturn NyanKvGet(NyanKv* kv, NyanKvKey key, void* value, uint8_t len)
+{
+    if (key == 0 || key >= NYAN_KV_KEYS)
+        return NYAN_KV_FAILURE;
+
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if (kv->staged_keys & (1u << key)) {
+        bool match = kv->staged_len[key] == len;
+        if (match)
+            memcpy(value, kv->staged[key], len);
+        __set_PRIMASK(primask);
+        return match ? NYAN_KV_SUCCESS : NYAN_KV_FAILURE;
+    }
+    __set_PRIMASK(primask);
+
+    if (kv->current[key] < 0)
+        return NYAN_KV_FAILURE;
+
+    const NyanKvRecord* record = NyanKvSlot(kv, kv->current[key]);
+    if (record->len != len)
+        return NYAN_KV_FAILURE;
+    memcpy(value, record->value, len);
+
+    return NYAN_KV_SUCCESS;
+}
+
+NyanKvReturn NyanKvSet(NyanKv* kv, NyanKvKey key, const void* value, uint8_t len)
+{
+    if (key == 0 || key >= NYAN_KV_KEYS || len > NYAN_KV_MAX_VALUE)
+        return NYAN_KV_FAILURE;
+
+    // The key scan interrupt sets keys, the EEPROM job queue is only safe below the I2C priority
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    memcpy(kv->staged[key], value, len);
+    kv->staged_len[key] = len;
+    kv->staged_keys |= 1u << key;
+    __set_PRIMASK(primask);
+
+    return NYAN_KV_SUCCESS;
+}
+
+void NyanKvService(NyanKv* kv)
+{
+    if (!kv->staged_keys || !kv->config->loaded)
+        return;
+
+    for (uint8_t key = 1; key < NYAN_KV_KEYS; ++key) {
+        uint8_t value[NYAN_KV_MAX_VALUE];
+        uint8_t len;
+
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        if (!(kv->staged_keys & (1u << key))) {
+            __set_PRIMASK(primask);
+            continue;
+        }
+        len = kv->staged_len[key];
+        memcpy(value, kv->staged[key], len);
+        kv->staged_keys &= ~(1u << key);
+
+        // Unchanged values cost no EEPROM write at all
+        if (kv->current[key] >= 0) {
+            const NyanKvRecord* record = NyanKvSlot(kv, kv->current[key]);
+            if (record->len == len && memcmp(record->value, value, len) == 0) {
+                __set_PRIMASK(primask);
+                continue;
+            }
+        }
+
+        NyanKvAppend(kv, key, value, len);
+        NyanKvRefresh(kv);
+
+        __set_PRIMASK(primask);
+    }
+}
@@ -5,19 +5,50 @@
  */
 
 #include <ctype.h>
-#include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "main.h"
 #include "24xx_eeprom.h"
+#include "nyan_bench.h"
+#include "nyan_cycles.h"
+#include "nyan_flash_cache.h"
 #include "tim.h"
+#include "nyan_format.h"
 #include "nyan_os.h"
+#include "nyan_pool.h"
 #include "nyan_sha256.h"
 #include "nyan_strings.h"
 
 #include "usbd_cdc_acm_if.h"
 
+static NyanReturn NyanStreamBitcoinHeaderOpen(volatile NyanOS* nos, uint32_t size);
+static NyanReturn NyanStreamBitcoinHeaderWrite(volatile NyanOS* nos, uint32_t offset, const uint8_t* data, uint32_t len);
+static NyanReturn NyanStreamBitcoinHeaderClose(volatile NyanOS* nos);
+static NyanReturn NyanStreamBitstreamOpen(volatile NyanOS* nos, uint32_t size);
+static NyanReturn NyanStreamBitstreamWrite(volatile NyanOS* nos, uint32_t offset, const uint8_t* data, uint32_t len);
+static NyanReturn NyanStreamBitstreamClose(volatile NyanOS* nos);
+static void NyanStreamBitstreamAbort(volatile NyanOS* nos);
+static NyanReturn NyanWriteBitstreamBegin(volatile NyanOS* nos, uint32_t size);
+static bool NyanStreamBitstreamBusy(volatile NyanOS* nos);
+
+static const NyanStreamTarget nyan_stream_targets[] = {
+    { NYAN_STREAM_BITCOIN_HEADER, sizeof(NyanBitcoinHeader), NyanStreamBitcoinHeaderOpen, NyanStreamBitcoinHeaderWrite, NyanStreamBitcoinHeaderClose, NULL, NULL },
+    { NYAN_STREAM_FPGA_BITSTREAM, NYAN_BITSTREAM_MAX_SIZE, NyanStreamBitstreamOpen, NyanStreamBitstreamWrite, NyanStreamBitstreamClose, NyanStreamBitstreamAbort, NyanStreamBitstreamBusy },
+};
+
+#define _NYAN_NUM_STREAM_TARGETS (sizeof(nyan_stream_targets) / sizeof(nyan_stream_targets[0]))
+
+// Pool budgets: every argument takes a block, only a few of them can be too long for a small one
+_Static_assert(_NYAN_CMD_MAX_ARGS <= NYAN_POOL_SHELL_SMALL, "shell arguments exceed their small block budget");
+_Static_assert(_NYAN_CMD_BUF_LEN + 1 <= NYAN_POOL_LARGE_SIZE, "a whole command line must fit in a large block");
+_Static_assert((_NYAN_CMD_BUF_LEN + 1) / (NYAN_POOL_SMALL_SIZE + 1) <= NYAN_POOL_SHELL_LARGE, "shell arguments exceed their large block budget");
+_Static_assert(sizeof(((NyanBitcoinHeader*)0)->merkle_root_hash) <= NYAN_POOL_SMALL_SIZE, "miner fields must fit in a small block");
+
+// Staging area so a partially streamed header never reaches the miner
+static NyanBitcoinHeader nyan_stream_bitcoin_header;
+
 NyanReturn NyanOsInit(volatile NyanOS* nos)
 {
     // Set the operational state
@@ -26,16 +57,28 @@ NyanReturn NyanOsInit(volatile NyanOS* nos)
 
     // Init the driver pointers
     nos->eeprom = (Eeprom24xx*)&nos_eeprom;
+    nos->config = &nos_config;
+    nos->fpga = &nos_fpga;
     nos->nyan_bitcoin = &nyan_bitcoin;
+    nos->frame_link = &nos_frame_link;
+    nos->bitstream = &nos_bitstream_writer;
+#ifdef NYAN_TELEMETRY_EN
+    nos->telemetry = &nos_telemetry;
+#else
+    nos->telemetry = NULL;
+#endif
 
     // Default init the OS vars
     nos->command_buffer_num_args = 0;
     nos->command_buffer_pos = 0;
     nos->exe_in_progress = false;
-    nos->tx_chunks_solid = 0;
-    nos->tx_chunks_partial_bytes = 0;
-    nos->tx_chunk = 0;
     nos->cdc_ch = _NYAN_CDC_CHANNEL;
+    nos->rx_paused = false;
+    nos->frame_hangup = false;
+
+    // Binary framing starts closed, the host opens a session with a delimiter
+    NyanStreamAbort(nos);
+    NyanFrameInit(nos->frame_link);
 
     // Default the OS Performance Counters
     nos->perf_keys_count_spi_calls_nxt = 0;
@@ -48,9 +91,10 @@ NyanReturn NyanOsInit(volatile NyanOS* nos)
         nos->command_arg_buffer[i] = NULL;
     }
 
-    // Output Buffer Creation
-    nos->tx_buffer.p_array = NULL;
-    nos->tx_buffer.size = 0;
+    // Output ring starts empty
+    nos->tx_head = 0;
+    nos->tx_tail = 0;
+    nos->tx_pending = 0;
 
     return NOS_SUCCESS;
 }
@@ -86,7 +130,18 @@ NyanReturn NyanAddInputBuffer(volatile NyanOS *nos, uint8_t *pbuf, uint32_t *Len
     switch(nos->state){
         case READY: {
             for(uint32_t idx = 0; idx < rx_buffer_sz; ++idx) {
-                if((rx_buffer[idx] == backspace_char ||  rx_buffer[idx] == del_char) && nos->command_buffer_pos > 0) {
+                if(rx_buffer[idx] == NYAN_FRAME_DELIMITER) {
+                    // A delimiter opens a framed session, the rest of the packet already belongs to it
+                    ClearNyanCommandBuffer(nos);
+                    NyanFrameInit(nos->frame_link);
+                    nos->frame_rx_tick = HAL_GetTick();
+                    nos->frame_hangup = false;
+                    nos->state = FRAMED;
+                    for(++idx; idx < rx_buffer_sz; ++idx) {
+                        NyanFrameRxByte(nos->frame_link, rx_buffer[idx]);
+                    }
+                    break;
+                } else if((rx_buffer[idx] == backspace_char ||  rx_buffer[idx] == del_char) && nos->command_buffer_pos > 0) {
                     // Handle backspace
                     uint8_t backspace_seq[3] = {backspace_char, ' ', backspace_char};
                     NyanPrint(nos, (char*)&backspace_seq[0], sizeof(backspace_seq));
@@ -113,6 +168,20 @@ NyanReturn NyanAddInputBuffer(volatile NyanOS *nos, uint8_t *pbuf, uint32_t *Len
                 if(nos->bytes_received < nos->bytes_array_size)
                     nos->bytes_array[nos->bytes_received++] = rx_buffer[idx];
             }
+            break;
+        }
+        case BITSTREAM_UPLOAD: {
+            // Back pressure is applied through NyanRxReady, anything past the announced size is dropped
+            NyanBitstreamWriterPush(nos->bitstream, rx_buffer, rx_buffer_sz);
+            break;
+        }
+        case FRAMED: {
+            // Frames are assembled here and executed from the TIM8 task
+            nos->frame_rx_tick = HAL_GetTick();
+            for(uint32_t idx = 0; idx < rx_buffer_sz; ++idx) {
+                NyanFrameRxByte(nos->frame_link, rx_buffer[idx]);
+            }
+            break;
         }
         default:
             break;
@@ -120,86 +189,130 @@ NyanReturn NyanAddInputBuffer(volatile NyanOS *nos, uint8_t *pbuf, uint32_t *Len
     return NOS_SUCCESS;
 }
 
+bool NyanRxReady(volatile NyanOS* nos)
+{
+    // Framed uploads need no help here, a frame arriving while one is parked is dropped and retransmitted
+    if (nos->state == BITSTREAM_UPLOAD)
+        return NyanBitstreamWriterFree(nos->bitstream) >= _NYAN_CDC_RX_BUF_SZ;
+
+    return true;
+}
+
+void NyanRxResume(volatile NyanOS* nos)
+{
+    // The OUT endpoint is idle while paused so the USB interrupt can't race this
+    if (nos->rx_paused && NyanRxReady(nos)) {
+        nos->rx_paused = false;
+        USBD_CDC_ReceivePacket(nos->cdc_ch, &hUsbDevice);
+    }
+}
+
 NyanReturn NyanPrint(volatile NyanOS *nos, char* data, size_t len)
 {
     if (!nos || !data)
         return NOS_FAILURE;
 
-    if (nos->tx_buffer.size + len > 2048) {
-            return NOS_FAILURE;
-    }
-    if (nos->tx_buffer.p_array == NULL) {
-        // Since the pointer is null we need to create a new one to hold our new data!
-        nos->tx_buffer.p_array = (uint8_t *)malloc(len);
-        if (nos->tx_buffer.p_array == NULL) {
-            return NOS_FAILURE;
-        }
-        nos->tx_buffer.size = len;
-        memcpy(nos->tx_buffer.p_array, data, len); // Copy the data into the buffer
-    } else {
+    // Prints come from both the USB interrupt (echo) and the TIM8 task, keep the reservation atomic
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
 
-        // The pointer is not null, so we realloc and then add the contents of data to it
-        uint8_t *new_buffer = (uint8_t *)realloc(nos->tx_buffer.p_array, nos->tx_buffer.size + len);
-        if (new_buffer == NULL) {
-            return NOS_FAILURE;
-        }
-        nos->tx_buffer.p_array = new_buffer;
-        memcpy(nos->tx_buffer.p_array + nos->tx_buffer.size, data, len); // Append the new data
-        nos->tx_buffer.size += len; // Increase the size to reflect the new total size
+    if (len > _NYAN_CDC_TX_RING_SZ - (nos->tx_head - nos->tx_tail)) {
+        __set_PRIMASK(primask);
+        return NOS_FAILURE;
     }
 
-    // Now calculate the chunks
-    nos->tx_chunks_solid = nos->tx_buffer.size / _NYAN_CDC_TX_MAX_LEN;
-    nos->tx_chunks_partial_bytes = nos->tx_buffer.size % _NYAN_CDC_TX_MAX_LEN;
+    uint32_t pos = nos->tx_head & (_NYAN_CDC_TX_RING_SZ - 1);
+    size_t first = len < _NYAN_CDC_TX_RING_SZ - pos ? len : _NYAN_CDC_TX_RING_SZ - pos;
+    memcpy((uint8_t*)&nos->tx_ring[pos], data, first);
+    memcpy((uint8_t*)&nos->tx_ring[0], data + first, len - first);
+    nos->tx_head += len;
+
+    __set_PRIMASK(primask);
 
     return NOS_SUCCESS;
 }
 
-NyanReturn NyanCdcTX(volatile NyanOS* nos)
-{
-    // First we need to determine how many chunks we need to send
-    uint8_t total_chunks = nos->tx_chunks_solid;
-    uint8_t length = 0;
-    uint32_t address_offset = nos->tx_chunk * _NYAN_CDC_TX_MAX_LEN;
+typedef struct {
+    volatile NyanOS* nos;
+    NyanReturn result;
+    size_t len;
+    char buf[_NYAN_CDC_TX_MAX_LEN];
+} NyanPrintfSink;
 
-    // If there are partial bytes we need to increment the send chunks by 1
-    if(nos->tx_chunks_partial_bytes) {
-        total_chunks++;
-    }
+static void NyanPrintfFlush(NyanPrintfSink* sink)
+{
+    if (sink->len && NyanPrint(sink->nos, sink->buf, sink->len) != NOS_SUCCESS)
+        sink->result = NOS_FAILURE;
+    sink->len = 0;
+}
 
-    // If there are no chunks to send than just return a failure
-    if(total_chunks == 0) {
-        return NOS_FAILURE;
+static void NyanPrintfWrite(void* ctx, const char* data, size_t len)
+{
+    NyanPrintfSink* sink = (NyanPrintfSink*)ctx;
+
+    // The spans of one line are collected first, a single NyanPrint keeps the echo out of it
+    while (len) {
+        if (sink->len == sizeof(sink->buf))
+            NyanPrintfFlush(sink);
+        size_t chunk = len < sizeof(sink->buf) - sink->len ? len : sizeof(sink->buf) - sink->len;
+        memcpy(&sink->buf[sink->len], data, chunk);
+        sink->len += chunk;
+        data += chunk;
+        len -= chunk;
     }
+}
 
-    // Do checks and transmit data;
-    if((nos->tx_buffer.p_array != NULL || nos->tx_buffer.size != 0) && nos->tx_inflight == 0) {
-        nos->tx_bulk_transfer_in_progress = false;
+NyanReturn NyanPrintf(volatile NyanOS* nos, const char* fmt, ...)
+{
+    NyanPrintfSink sink;
+    va_list args;
+
+    sink.nos = nos;
+    sink.result = NOS_SUCCESS;
+    sink.len = 0;
+    va_start(args, fmt);
+    NyanFormatV(NyanPrintfWrite, &sink, fmt, args);
+    va_end(args);
+    NyanPrintfFlush(&sink);
+
+    return sink.result;
+}
 
-        // Lets begin to process the chunks
-        if(nos->tx_chunk == total_chunks - 1) { // This would be the processing of the last chunk
-            length = nos->tx_chunks_partial_bytes;
-            ++nos->tx_chunk;
-        } else if (nos->tx_chunk < total_chunks - 1) {
-            length = _NYAN_CDC_TX_MAX_LEN;
-            nos->tx_bulk_transfer_in_progress = true;
-            ++nos->tx_chunk;
-        }
+NyanReturn NyanCdcTX(volatile NyanOS* nos)
+{
+    // One transfer at a time, the completion callback releases its bytes
+    if (nos->tx_inflight)
+        return NOS_SUCCESS;
 
-        // If we have reach the end reset everything
-        if (nos->tx_chunk > total_chunks - 1) {
-            // Set all of the counter values to 0; Once we have cleared the buffer.
-            nos->tx_chunks_solid = 0;
-            nos->tx_chunks_partial_bytes = 0;
-            nos->tx_chunk = 0;
-        }
+    uint32_t used = nos->tx_head - nos->tx_tail;
+    if (used == 0)
+        return NOS_FAILURE;
 
-        CDC_Transmit(nos->cdc_ch, nos->tx_buffer.p_array + address_offset, length);
+    // Send up to the end of the ring, the wrapped part goes out with the next transfer
+    uint32_t pos = nos->tx_tail & (_NYAN_CDC_TX_RING_SZ - 1);
+    uint32_t length = used;
+    if (length > _NYAN_CDC_TX_RING_SZ - pos)
+        length = _NYAN_CDC_TX_RING_SZ - pos;
+    if (length > _NYAN_CDC_TX_MAX_LEN)
+        length = _NYAN_CDC_TX_MAX_LEN;
+
+    nos->tx_pending = length;
+    if (CDC_Transmit(nos->cdc_ch, (uint8_t*)&nos->tx_ring[pos], length) != USBD_OK) {
+        // Nothing was queued, retry on the next tick
+        nos->tx_pending = 0;
+        nos->tx_inflight = false;
     }
 
     return NOS_SUCCESS;
 }
 
+void NyanCdcTxComplete(volatile NyanOS* nos)
+{
+    nos->tx_tail += nos->tx_pending;
+    nos->tx_pending = 0;
+    nos->tx_inflight = false;
+}
+
 NyanReturn NyanDecode(volatile NyanOS* nos)
 {
     // First set the nos state to idle
@@ -228,7 +341,6 @@ NyanReturn NyanExecute(volatile NyanOS* nos) {
             NyanExeGetinfo(nos);
             NyanPrint(nos, (char*)&nyan_keys_newline[0], strlen((char*)nyan_keys_newline));
             NyanPrint(nos, (char*)&nyan_keys_path_text[0], strlen((char*)nyan_keys_path_text));
-            // Not located inside NyanExeGetInfo because it's not atomic because of the EEPROM read.
             nos->exe = NYAN_EXE_IDLE;
             return NOS_SUCCESS;
 
@@ -281,6 +393,28 @@ NyanReturn NyanExecute(volatile NyanOS* nos) {
             HAL_TIM_OC_Start_IT(&htim8, TIM_CHANNEL_1);
             return NOS_SUCCESS;
 
+        case NYAN_EXE_TELEMETRY :
+            NyanExeTelemetry(nos);
+            NyanPrint(nos, (char*)&nyan_keys_path_text[0], strlen((char*)nyan_keys_path_text));
+            nos->exe = NYAN_EXE_IDLE;
+            return NOS_SUCCESS;
+
+        case NYAN_EXE_BENCH :
+            HAL_TIM_OC_Stop_IT(&htim8, TIM_CHANNEL_1);
+            nos->exe_in_progress = true;
+            NyanExeBench(nos);
+            NyanPrint(nos, (char*)&nyan_keys_path_text[0], strlen((char*)nyan_keys_path_text));
+            nos->exe_in_progress = false;
+            nos->exe = NYAN_EXE_IDLE;
+            HAL_TIM_OC_Start_IT(&htim8, TIM_CHANNEL_1);
+            return NOS_SUCCESS;
+
+        case NYAN_EXE_FPGA_STATS :
+            NyanExeFpgaStats(nos);
+            NyanPrint(nos, (char*)&nyan_keys_path_text[0], strlen((char*)nyan_keys_path_text));
+            nos->exe = NYAN_EXE_IDLE;
+            return NOS_SUCCESS;
+
         case NYAN_EXE_IDLE :
             return NOS_SUCCESS;
 
@@ -322,12 +456,10 @@ NyanReturn NyanDecodeArgs(volatile NyanOS* nos)
     while (token != NULL) {
         if (arg_count < _NYAN_CMD_MAX_ARGS) {
             size_t tokenLength = strlen(token);
-            nos->command_arg_buffer[arg_count] = malloc(tokenLength + 1); // Allocate memory for the argument
+            nos->command_arg_buffer[arg_count] = NyanPoolAlloc(tokenLength + 1); // Allocate memory for the argument
             if (nos->command_arg_buffer[arg_count] == NULL) {
                 // Free any previously allocated memory
-                for (int i = 0; i < arg_count; ++i) {
-                    free(nos->command_arg_buffer[i]);
-                }
+                FreeNyanCommandArgs(nos);
                 return NOS_FAILURE;
             }
             strcpy((char *)nos->command_arg_buffer[arg_count], token);
@@ -346,17 +478,12 @@ NyanReturn NyanDecodeArgs(volatile NyanOS* nos)
 
 NyanReturn NyanExeGetinfo(volatile NyanOS* nos)
 {
-    // We need to fetch the owners name from the eeprom
-    EepromRead(nos->eeprom, false, ADDR_BOARD_OWNER, SIZE_BOARD_OWNER);
-
-    // This has to be polling until callbacks are improved
-    while(nos->eeprom->rx_inflight){}
+    // The owner comes from the RAM shadow of the EEPROM
+    char owner[SIZE_BOARD_OWNER];
+    NyanConfigRead(nos->config, ADDR_BOARD_OWNER, owner, SIZE_BOARD_OWNER);
 
     // Ensure data from EEPROM is null-terminated
-    nos->eeprom->rx_buf[SIZE_BOARD_OWNER - 1] = '\0';
-
-    char owner[SIZE_BOARD_OWNER];
-    strncpy(owner, (const char *)nos->eeprom->rx_buf, SIZE_BOARD_OWNER);
+    owner[SIZE_BOARD_OWNER - 1] = '\0';
 
     NyanPrint(nos, (char*)&nyan_keys_getinfo[0], strlen((char*)nyan_keys_getinfo));
     NyanPrint(nos, (char*)&nyan_keys_getinfo_owner[0], strlen((char*)nyan_keys_getinfo_owner));
@@ -388,16 +515,10 @@ NyanReturn NyanExeSetOwner(volatile NyanOS* nos)
         return NOS_FAILURE; // Would overflow memory boundaries
     }
 
-    // Allocate memory for the new owner name
-    char* owners_name = (char*)malloc(SIZE_BOARD_OWNER);
-    if (!owners_name) {
-        return NOS_FAILURE; // Handle allocation failure
-    }
+    char owners_name[SIZE_BOARD_OWNER];
 
     // Zero out the SIZE_BOARD_OWNER bytes
-    for (int i = 0; i < SIZE_BOARD_OWNER; ++i) {
-        owners_name[i] = '\0';
-    }
+    memset(owners_name, 0, sizeof(owners_name));
 
     // Concatenate arguments with spaces
     char* current_pos = owners_name;
@@ -412,147 +533,112 @@ NyanReturn NyanExeSetOwner(volatile NyanOS* nos)
         }
     }
 
-    // First lets clear out the TX buff
-    if(EepromFlushTxBuff(nos->eeprom) != EEPROM_SUCCESS){
+    // Write the name to the eeprom, the shadow flushes it in the background
+    if (NyanConfigWrite(nos->config, ADDR_BOARD_OWNER, owners_name, SIZE_BOARD_OWNER) != NYAN_CONFIG_SUCCESS) {
         return NOS_FAILURE;
     }
 
-    // Second lets copy our new buffer over to the EEPROM driver
-    for (int i = 0; i < SIZE_BOARD_OWNER; ++i){
-        nos->eeprom->tx_buf[i]  = owners_name[i];
-    }
-
-    // Free up the allocated memory
-    free(owners_name);
-
-    // Write the name to the eeprom, the delay exists to ensure the write, later the callback can be used to free
-    EepromWrite(nos->eeprom, false, ADDR_BOARD_OWNER, SIZE_BOARD_OWNER);
-
     return NOS_SUCCESS;
 }
 
 NyanReturn NyanExeWriteFpgaBitstream(volatile NyanOS* nos)
 {
     // If we get here an are already in direct buffer access mode; FAIL
-    if(nos->state == DIRECT_BUFFER_ACCESS)
+    if(nos->state == DIRECT_BUFFER_ACCESS || nos->state == BITSTREAM_UPLOAD)
         return NOS_FAILURE;
     // Set the state to NYAN_EXE_IDLE to show that we have ack'd the command
     nos->exe = NYAN_EXE_IDLE;
 
-    nos->bytes_array_size = 0;
-    // Now we need to convert the arg 1 into an int - skip arg 0 because that is the command.
-    nos->bytes_array_size = atoi((char *)nos->command_arg_buffer[1]);
-    // Safety the size of the buffer to ensure that it doesn't exceed the size of a block
-    if(nos->bytes_array_size  > 0xFFFF) {
-        //Print Error, Clear buffer, Set ready state.
-        nos->bytes_array_size = 0;
-        NyanPrint(nos, (char*)&nyan_keys_write_bitstream_error_size[0], strlen((char*)nyan_keys_write_bitstream_error_size));
+    // The configuration in progress owns the slot table, fpga-stats shows when it is done
+    if(FPGABusy(nos->fpga)) {
+        NyanPrint(nos, (char*)&nyan_keys_write_bitstream_error_fpga_busy[0], strlen((char*)nyan_keys_write_bitstream_error_fpga_busy));
         return NOS_FAILURE;
     }
-    // Write the length of the bitstream we are accepting to the EEPROM - 16 bytes -
-    uint32_t size_array[4] = { 0x00, 0x00, 0x00, nos->bytes_array_size };
-    if(nos->eeprom->tx_inflight) {
-        //Print Error, Clear buffer, Set ready state.
-        NyanPrint(nos, (char*)&nyan_keys_write_bitstream_error_size_tx_busy[0], strlen((char*)nyan_keys_write_bitstream_error_size_tx_busy));
+
+    // Now we need to convert the arg 1 into an int - skip arg 0 because that is the command.
+    uint32_t size = atoi((char *)nos->command_arg_buffer[1]);
+    // Safety the size of the buffer to ensure that it doesn't exceed the size of the slot it goes to
+    if(size == 0 || size > NYAN_BITSTREAM_MAX_SIZE || FPGASlotUploadTarget(nos->fpga, size) == FPGA_SLOT_NONE) {
+        // The limit is printed from the macro so the message can't drift from the check
+        NyanPrintf(nos, "%s%u bytes.%s", nyan_keys_write_bitstream_error_size, (uint32_t)NYAN_BITSTREAM_MAX_SIZE, nyan_keys_newline);
         return NOS_FAILURE;
     }
-    // Copy the data to the EEPROM buffer for writing
-    for(short i = 0; i < sizeof(size_array); ++i) {
-        nos->eeprom->tx_buf[i] = ((uint8_t*)size_array)[i];
-    }
-    // Write the data to the eeprom - wait for the write to complete since this is DMA and order matters
-    EepromWrite(nos->eeprom, false, ADDR_FPGA_BITSTREAM_LEN, SIZE_FPGA_BITSTREAM_LEN);
-    while(nos->eeprom->tx_inflight){
-        // Wait while the TX is in flight as to avoid bogus writes;
-    }
-
-    // Print the ready to accept bytes confirmation message - This does nothing because it's executed in the same interrupt - Just delay for 10ms
-    // NyanPrint(nos, (char*)&nyan_keys_write_bitstream_info_start[0], sizeof(nyan_keys_write_bitstream_info_start));
-
-    // Lets allocate some memory to save this bitstream we are importing
-    nos->bytes_array = (uint8_t*)malloc(nos->bytes_array_size * sizeof(uint8_t));
-    if(nos->bytes_array == NULL) {
-        // Handle memory allocation failure
-        nos->state = READY; // or appropriate error state
+    if(NyanWriteBitstreamBegin(nos, size) != NOS_SUCCESS) {
+        NyanPrint(nos, (char*)&nyan_keys_write_bitstream_error_size_tx_busy[0], strlen((char*)nyan_keys_write_bitstream_error_size_tx_busy));
         return NOS_FAILURE;
     }
 
-    // Enter direct buffer access mode
-    nos->state = DIRECT_BUFFER_ACCESS;
-
-    while(nos->bytes_received != nos->bytes_array_size) {
-        // During this period we just loop until the byte array is full
-        // The user can exit this loop by just filling the buffer up for now.
-        // Enabling am abort sequence would be a next step
+    if(nos->fpga->upload_unprotected)
+        NyanPrint(nos, (char*)nyan_keys_write_bitstream_info_unprotected, strlen((char*)nyan_keys_write_bitstream_info_unprotected));
+
+    // Enter the upload state, from here every received byte goes straight into the writer ring
+    nos->state = BITSTREAM_UPLOAD;
+
+    // Pages are hashed and written while the next ones are still arriving. A host that stops sending
+    // must not hang the shell, SysTick can't preempt this interrupt so the idle deadline is on the cycle counter.
+    uint32_t received = nos->bitstream->received;
+    uint32_t rx_cycles = NyanCyclesNow();
+    while(!NyanBitstreamWriterDone(nos->bitstream)) {
+        bool failed = NyanBitstreamWriterService(nos->bitstream) != NYAN_BITSTREAM_SUCCESS;
+        bool idle = false;
+        if(nos->bitstream->received != received) {
+            received = nos->bitstream->received;
+            rx_cycles = NyanCyclesNow();
+        } else if(received < nos->bitstream->size) {
+            idle = NyanCyclesToUs(NyanCyclesNow() - rx_cycles) > _NYAN_UPLOAD_IDLE_MS * 1000;
+        }
+        if(failed || idle) {
+            NyanBitstreamWriterAbort(nos->bitstream);
+            FPGASlotUploadAbort(nos->fpga);
+            nos->state = READY;
+            NyanRxResume(nos);
+            if(failed)
+                NyanPrint(nos, (char*)nyan_keys_write_bitstream_error_eeprom, strlen((char*)nyan_keys_write_bitstream_error_eeprom));
+            else
+                NyanPrintf(nos, "%s%u s.%s", nyan_keys_write_bitstream_error_timeout, (uint32_t)(_NYAN_UPLOAD_IDLE_MS / 1000), nyan_keys_newline);
+            return NOS_FAILURE;
+        }
+        NyanRxResume(nos);
     }
 
-    // Take a Sha256 Hash of the inputs for the user display
+    // Print the sha256 output for the user to verify their bitstream
     BYTE buf[SHA256_BLOCK_SIZE];
-    SHA256_CTX ctx;
-
-    sha256_init(&ctx);
-    sha256_update(&ctx, nos->bytes_array, nos->bytes_array_size);
-    sha256_final(&ctx, buf);
+    NyanBitstreamWriterFinish(nos->bitstream, buf);
+    nos->state = READY;
+    NyanRxResume(nos);
 
-    // Print the sha256 output for the user to verify their bitstream
-    char hexString[SHA256_BLOCK_SIZE * 2 + 1];
+    NyanPrint(nos, (char*)nyan_keys_write_bitstream_info_eeprom_write_completed, strlen((char*)nyan_keys_write_bitstream_info_eeprom_write_completed));
     for (int i = 0; i < SHA256_BLOCK_SIZE; i++) {
-        sprintf(&hexString[i * 2], "%02x", buf[i]);
+        NyanPrintf(nos, "%02x", buf[i]);
     }
-    hexString[SHA256_BLOCK_SIZE * 2] = '\0';
-
-    NyanPrint(nos, (char*)nyan_keys_write_bitstream_info_eeprom_write_completed, strlen((char*)nyan_keys_write_bitstream_info_eeprom_write_completed));
-    NyanPrint(nos, (char*)&hexString[0], SHA256_BLOCK_SIZE * 2);
     NyanPrint(nos, (char*)&nyan_keys_newline[0], strlen((char*)nyan_keys_newline));
-
-    // Calculate the number iterations
-    unsigned int r = nos->bytes_array_size % EEPROM_DRIVER_TX_BUF_SZ;
-    unsigned int q = nos->bytes_array_size / EEPROM_DRIVER_TX_BUF_SZ;
-    if(r > 0)
-        ++q;
-    if (q == 0)
+    NyanPrintf(nos, "%s%u/%u%s", nyan_keys_write_bitstream_info_pages_skipped, nos->bitstream->pages_skipped,
+               nos->bitstream->pages, nyan_keys_newline);
+    // Every later configuration checks the image against this digest, the slot only goes live with it
+    if (FPGASlotUploadFinish(nos->fpga, nos->bitstream->size, buf) != FPGA_SUCCESS) {
+        NyanPrint(nos, (char*)nyan_keys_write_bitstream_error_digest, strlen((char*)nyan_keys_write_bitstream_error_digest));
         return NOS_FAILURE;
-
-    // Fill and iterate over pages in the EEPROM, write, wait ...
-    for(unsigned short page = 0; page < q; ++page) {
-        bool txSuccess = false;
-        bool txRetry = false;
-        // Flush the transmit buffer
-        EepromFlushTxBuff(nos->eeprom);
-        // Prepare the data for transmission
-        for(uint8_t byte = 0; byte < EEPROM_DRIVER_TX_BUF_SZ; ++byte) {
-            nos->eeprom->tx_buf[byte] = nos->bytes_array[EEPROM_DRIVER_TX_BUF_SZ * page + byte];
-        }
-        // Attempt to write the data to the EEPROM - Until the job is done.
-        while(!txSuccess) {
-            if(EepromWrite(nos->eeprom, true, (EEPROM_DRIVER_TX_BUF_SZ * page) + ADDR_FPGA_BITSTREAM, 128) != EEPROM_FAILURE) {
-                while(nos->eeprom->tx_inflight) {
-                    // Check for transmission success
-                    if(nos->eeprom->tx_failed) {
-                        nos->eeprom->tx_inflight = false;
-                        nos->eeprom->tx_failed = false;
-                        txRetry = true;
-                        break; // Break from the while loop on success
-                    }
-                    txRetry = false;
-                }
-                if(nos->eeprom->tx_inflight == 0 && txRetry == false) {
-                    txSuccess = true;
-                    txRetry = false;
-                }
-            }
-        }
     }
+    NyanPrintf(nos, "%s%c%s", nyan_keys_write_bitstream_info_slot, 'A' + nos->fpga->upload_slot, nyan_keys_write_bitstream_info_slot_pending);
 
-    // Perform function cleanup maintenance
-    nos->bytes_array_size = 0;
-    nos->bytes_received = 0;
-    free(nos->bytes_array);
-    nos->bytes_array = NULL;
-    nos->state = READY;
+    // main() picks the request up and steps the programming
+    FPGARequestConfig(nos->fpga);
+
+    return NOS_SUCCESS;
+}
 
-    // Set the FPGA configuration to false - main() will pick it up to perform the programming.
-    nos_fpga.configured = false;
+static NyanReturn NyanWriteBitstreamBegin(volatile NyanOS* nos, uint32_t size)
+{
+    uint32_t address;
+
+    // The active slot is left alone unless the image only fits on top of it
+    if(FPGASlotUploadBegin(nos->fpga, size) != FPGA_SUCCESS)
+        return NOS_FAILURE;
+    FPGASlotLocate(nos->fpga->upload_slot, &address);
+    if (NyanBitstreamWriterOpen(nos->bitstream, nos->eeprom, address, size) != NYAN_BITSTREAM_SUCCESS) {
+        FPGASlotUploadAbort(nos->fpga);
+        return NOS_FAILURE;
+    }
 
     return NOS_SUCCESS;
 }
@@ -585,13 +671,15 @@ NyanReturn NyanExeWriteBitcoinMiner(volatile NyanOS* nos)
     }
 
 
-    nos->bytes_array = (uint8_t*)malloc(nos->bytes_array_size * sizeof(uint8_t));
+    nos->bytes_array = (uint8_t*)NyanPoolAlloc(nos->bytes_array_size * sizeof(uint8_t));
     if(nos->bytes_array == NULL) {
         // Handle memory allocation failure
         nos->state = READY;
         return NOS_FAILURE;
     }
 
+    // Counted from zero for every field, the receive path fills the block up to bytes_array_size
+    nos->bytes_received = 0;
     nos->state = DIRECT_BUFFER_ACCESS;
 
     while(nos->bytes_received != nos->bytes_array_size) {
@@ -621,7 +709,9 @@ NyanReturn NyanExeWriteBitcoinMiner(volatile NyanOS* nos)
         NyanPrint(nos, (char*)&nyan_keys_write_bitcoin_miner_nonce[0], strlen((char*)nyan_keys_write_bitcoin_miner_nonce));
     }
 
-    free(nos->bytes_array);
+    NyanPoolFree(nos->bytes_array);
+    nos->bytes_array = NULL;
+    nos->bytes_received = 0;
     nos->state = READY;
 
     return NOS_SUCCESS;
@@ -642,15 +732,454 @@ NyanReturn NyanExeGetPerformanceStats(volatile NyanOS* nos)
     NyanPrint(nos, (char*)&nyan_keys_getperf_line1[0], strlen((char*)nyan_keys_getperf_line1));
     NyanPrint(nos, (char*)&nyan_keys_getperf_line2[0], strlen((char*)nyan_keys_getperf_line2));
     // Now we need to print the stats for the keyboard in a way that means something to the user
-    char keys_poll_cnt[10]; //Using 10 bytes to achieve max possible value of 2^32-1
-    itoa(nos->perf_keys_count_spi_calls, keys_poll_cnt, 10);
-    NyanPrint(nos, (char*)&nyan_keys_getperf_times_scanned[0], strlen((char*)nyan_keys_getperf_times_scanned));
-    NyanPrint(nos, (char*)&keys_poll_cnt[0], strlen((char*)keys_poll_cnt));
+    NyanPrintf(nos, "%s%u%s", nyan_keys_getperf_times_scanned, nos->perf_keys_count_spi_calls, nyan_keys_newline);
+    NyanPrintf(nos, "%s%u kHz%s", nyan_keys_getperf_i2c_profile, EepromBusProfileKhz(nos->eeprom->bus_profile), nyan_keys_newline);
+
+    // Last measurement, the next one runs in the background and shows on the next getperf
+    uint32_t bytes_per_s = nos->eeprom->read_rate;
+    if (bytes_per_s)
+        NyanPrintf(nos, "%s%u B/s%s", nyan_keys_getperf_eeprom_read, bytes_per_s, nyan_keys_newline);
+    else
+        NyanPrint(nos, (char*)&nyan_keys_getperf_eeprom_none[0], strlen((char*)nyan_keys_getperf_eeprom_none));
+    EepromMeasureReadRate(nos->eeprom);
+    NyanPrintf(nos, "%s%u, %u recoveries, %u retries, %u failed jobs%s", nyan_keys_getperf_i2c_errors,
+               nos->eeprom->bus_errors, nos->eeprom->bus_recoveries, nos->eeprom->job_retries,
+               nos->eeprom->jobs_failed, nyan_keys_newline);
+
+    NyanPoolStats pool;
+    for (uint32_t cls = 0; NyanPoolGetStats((NyanPoolClass)cls, &pool); ++cls)
+        NyanPrintf(nos, "%s%u B: %u/%u in use, peak %u, %u failed%s", nyan_keys_getperf_pool, pool.block_size,
+                   pool.in_use, pool.blocks, pool.high_water, pool.failures, nyan_keys_newline);
+
+    return NOS_SUCCESS;
+}
+
+NyanReturn NyanExeFpgaStats(volatile NyanOS* nos)
+{
+    const FPGABootStats* stats = &nos->fpga->stats;
+
+    // Set the state to NYAN_EXE_IDLE to show that we have ack'd the command
+    nos->exe = NYAN_EXE_IDLE;
+    NyanPrint(nos, (char*)&nyan_keys_fpga_stats_header[0], strlen((char*)nyan_keys_fpga_stats_header));
+    // The stats are only complete once the configuration is done
+    if (FPGABusy(nos->fpga)) {
+        NyanPrintf(nos, "%s%u%%%s", nyan_keys_fpga_stats_progress, FPGAProgress(nos->fpga), nyan_keys_newline);
+        return NOS_SUCCESS;
+    }
+    switch (stats->error) {
+        case FPGA_ERROR_NONE :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_ok[0], strlen((char*)nyan_keys_fpga_stats_ok));
+            break;
+        case FPGA_ERROR_NO_IMAGE :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_no_image[0], strlen((char*)nyan_keys_fpga_stats_no_image));
+            break;
+        case FPGA_ERROR_EEPROM :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_error_eeprom[0], strlen((char*)nyan_keys_fpga_stats_error_eeprom));
+            break;
+        case FPGA_ERROR_DIGEST :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_error_digest[0], strlen((char*)nyan_keys_fpga_stats_error_digest));
+            break;
+        case FPGA_ERROR_DECODE :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_failed[0], strlen((char*)nyan_keys_fpga_stats_failed));
+            break;
+        case FPGA_ERROR_CDONE :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_error_cdone[0], strlen((char*)nyan_keys_fpga_stats_error_cdone));
+            break;
+        case FPGA_ERROR_SPI :
+            NyanPrint(nos, (char*)&nyan_keys_fpga_stats_error_spi[0], strlen((char*)nyan_keys_fpga_stats_error_spi));
+            break;
+    }
+    NyanPrintf(nos, "%s%s%s", nyan_keys_fpga_stats_digest, stats->verified ? "verified" : "not verified", nyan_keys_newline);
+    NyanPrintf(nos, "%s%c%s", nyan_keys_fpga_stats_slot, 'A' + stats->slot, nyan_keys_newline);
+    if (stats->rejected != FPGA_SLOT_NONE)
+        NyanPrintf(nos, "%s%c failed with error %u%s", nyan_keys_fpga_stats_rollback, 'A' + stats->rejected, stats->rejected_error, nyan_keys_newline);
+    NyanPrintf(nos, "%s%u B -> %u B%s", nyan_keys_fpga_stats_bitstream, stats->bytes_in, stats->bytes_out, nyan_keys_newline);
+    if (stats->source == FPGA_SOURCE_FLASH)
+        NyanPrintf(nos, "%sflash cache v%u%s", nyan_keys_fpga_stats_source, stats->cache_version, nyan_keys_newline);
+    else
+        NyanPrintf(nos, "%sEEPROM%s", nyan_keys_fpga_stats_source, nyan_keys_newline);
+    if (stats->cache_update == FPGA_CACHE_PENDING)
+        NyanPrint(nos, (char*)&nyan_keys_fpga_stats_cache_pending[0], strlen((char*)nyan_keys_fpga_stats_cache_pending));
+    else if (stats->cache_update == FPGA_CACHE_UPDATED)
+        NyanPrint(nos, (char*)&nyan_keys_fpga_stats_cache_updated[0], strlen((char*)nyan_keys_fpga_stats_cache_updated));
+    else if (stats->cache_update == FPGA_CACHE_FAILED)
+        NyanPrint(nos, (char*)&nyan_keys_fpga_stats_cache_failed[0], strlen((char*)nyan_keys_fpga_stats_cache_failed));
+    NyanPrintf(nos, "%s%u us%s", nyan_keys_fpga_stats_total, stats->total_us, nyan_keys_newline);
+    NyanPrintf(nos, "%s%u us, %u us stalled%s", nyan_keys_fpga_stats_eeprom, stats->eeprom_us, stats->eeprom_wait_us, nyan_keys_newline);
+    NyanPrintf(nos, "%s%u us%s", nyan_keys_fpga_stats_decode, stats->decode_us, nyan_keys_newline);
+    NyanPrintf(nos, "%s%u us, %u us stalled, %u chunks, %u errors%s", nyan_keys_fpga_stats_spi, stats->spi_us,
+               stats->spi_wait_us, stats->spi_chunks, stats->spi_errors, nyan_keys_newline);
+
+    return NOS_SUCCESS;
+}
+
+NyanReturn NyanExeTelemetry(volatile NyanOS* nos)
+{
+    // Set the state to NYAN_EXE_IDLE to show that we have ack'd the command
+    nos->exe = NYAN_EXE_IDLE;
+
+    if (!nos->telemetry) {
+        NyanPrint(nos, (char*)&nyan_keys_telemetry_error_disabled[0], strlen((char*)nyan_keys_telemetry_error_disabled));
+        return NOS_FAILURE;
+    }
+
+    if (nos->command_buffer_num_args < 2 || !isdigit(nos->command_arg_buffer[1][0]) ||
+        NyanTelemetrySetRate(nos->telemetry, atoi((char *)nos->command_arg_buffer[1])) != NYAN_TELEMETRY_SUCCESS) {
+        NyanPrint(nos, (char*)&nyan_keys_telemetry_error_rate[0], strlen((char*)nyan_keys_telemetry_error_rate));
+        return NOS_FAILURE;
+    }
+
+    NyanPrintf(nos, "%s%u Hz, %u frames dropped%s", nyan_keys_telemetry_rate, nos->telemetry->rate_hz,
+               nos->telemetry->frames_dropped, nyan_keys_newline);
+
+    return NOS_SUCCESS;
+}
+
+static NyanReturn NyanBenchPrint(volatile NyanOS* nos, uint8_t idx)
+{
+    NyanBenchResult result;
+
+    if (NyanBenchRun(idx, nos->eeprom, &result) != NYAN_BENCH_SUCCESS) {
+        NyanPrint(nos, (char*)&nyan_keys_bench_error_failed[0], strlen((char*)nyan_keys_bench_error_failed));
+        return NOS_FAILURE;
+    }
+
+    NyanPrintf(nos, "%-14s%10u cycles/op", result.name, result.cycles_per_op);
+    if (result.bytes_per_op && result.cycles_per_op) {
+        // Hundredths of a MB/s, bytes per op times ops per second
+        uint32_t mbps = (uint32_t)(((uint64_t)result.bytes_per_op * (SystemCoreClock / 10000)) / result.cycles_per_op);
+        NyanPrintf(nos, "%10.2q MB/s", mbps);
+    }
     NyanPrint(nos, (char*)&nyan_keys_newline[0], strlen((char*)nyan_keys_newline));
 
     return NOS_SUCCESS;
 }
 
+NyanReturn NyanExeBench(volatile NyanOS* nos)
+{
+    NyanReturn ret = NOS_SUCCESS;
+    bool icache_off = false;
+    bool dcache_off = false;
+    bool named = false;
+
+    // Set the state to NYAN_EXE_IDLE to show that we have ack'd the command
+    nos->exe = NYAN_EXE_IDLE;
+
+    // Validate every argument before touching the caches
+    for (uint8_t arg = 1; arg < nos->command_buffer_num_args && nos->command_arg_buffer[arg] != NULL; ++arg) {
+        const char* name = (const char*)nos->command_arg_buffer[arg];
+        if (strcmp(name, "-icache") == 0) {
+            icache_off = true;
+        } else if (strcmp(name, "-dcache") == 0) {
+            dcache_off = true;
+        } else if (strcmp(name, "all") != 0) {
+            if (NyanBenchFind(name) >= NyanBenchCount()) {
+                NyanPrint(nos, (char*)&nyan_keys_bench_error_unknown[0], strlen((char*)nyan_keys_bench_error_unknown));
+                return NOS_FAILURE;
+            }
+            named = true;
+        }
+    }
+
+    bool icache_was_on = (SCB->CCR & SCB_CCR_IC_Msk) != 0;
+    bool dcache_was_on = (SCB->CCR & SCB_CCR_DC_Msk) != 0;
+    if (icache_off && icache_was_on)
+        SCB_DisableICache();
+    if (dcache_off && dcache_was_on)
+        SCB_DisableDCache();
+
+    NyanPrintf(nos, "%sICache %s, DCache %s, %u MHz%s", nyan_keys_bench_header,
+               (SCB->CCR & SCB_CCR_IC_Msk) ? "on" : "off", (SCB->CCR & SCB_CCR_DC_Msk) ? "on" : "off",
+               SystemCoreClock / 1000000, nyan_keys_newline);
+
+    if (named) {
+        for (uint8_t arg = 1; arg < nos->command_buffer_num_args && nos->command_arg_buffer[arg] != NULL; ++arg) {
+            uint8_t idx = NyanBenchFind((const char*)nos->command_arg_buffer[arg]);
+            if (idx < NyanBenchCount() && NyanBenchPrint(nos, idx) != NOS_SUCCESS)
+                ret = NOS_FAILURE;
+        }
+    } else {
+        for (uint8_t idx = 0; idx < NyanBenchCount(); ++idx) {
+            if (NyanBenchPrint(nos, idx) != NOS_SUCCESS)
+                ret = NOS_FAILURE;
+        }
+    }
+
+    if (icache_off && icache_was_on)
+        SCB_EnableICache();
+    if (dcache_off && dcache_was_on)
+        SCB_EnableDCache();
+
+    return ret;
+}
+
+void NyanTelemetryPublish(volatile NyanOS* nos)
+{
+    NyanTelemetry* telemetry = nos->telemetry;
+
+    if (!telemetry)
+        return;
+
+    if (NyanTelemetryTick(telemetry)) {
+        NyanTelemetryStatus status;
+        status.uptime_ms = HAL_GetTick();
+        status.keys_scans_per_sec = nos->perf_keys_count_spi_calls;
+        status.frames_emitted = telemetry->frames_emitted;
+        status.frames_dropped = telemetry->frames_dropped;
+        status.fpga_configured = nos_fpga.configured;
+        status.eeprom_busy = EepromBusy(nos->eeprom) ? 0x01 : 0x00;
+        status.nos_state = (uint8_t)nos->state;
+        status.rate_hz = telemetry->rate_hz;
+        NyanTelemetryEmit(telemetry, NYAN_FRAME_TELEMETRY_STATUS, &status, sizeof(status));
+        NyanTelemetryEmitLatency(telemetry);
+    }
+
+    NyanTelemetryTX(telemetry);
+}
+
+NyanReturn NyanFrameSend(volatile NyanOS* nos, uint8_t type, uint8_t seq, const uint8_t* payload, uint16_t len)
+{
+    size_t encoded = NyanFrameEncode(nos->frame_link, type, seq, payload, len);
+    if (encoded == 0)
+        return NOS_FAILURE;
+
+    return NyanPrint(nos, (char*)nos->frame_link->tx_buf, encoded);
+}
+
+static NyanReturn NyanFrameSendAck(volatile NyanOS* nos, uint8_t seq, uint8_t type, NyanFrameError error, uint32_t value)
+{
+    uint8_t ack[6] = { type, (uint8_t)error };
+    NyanFramePutU32(&ack[2], value);
+
+    return NyanFrameSend(nos, error == NYAN_FRAME_ERR_NONE ? NYAN_FRAME_ACK : NYAN_FRAME_NACK, seq, ack, sizeof(ack));
+}
+
+static NyanReturn NyanFrameSendInfo(volatile NyanOS* nos, uint8_t seq)
+{
+    NyanFrameInfo info;
+    memset(&info, 0, sizeof(info));
+
+    NyanConfigRead(nos->config, ADDR_BOARD_OWNER, info.owner, SIZE_BOARD_OWNER);
+    info.owner[SIZE_BOARD_OWNER - 1] = '\0';
+
+    strncpy((char*)info.version, NOS_VERSION, sizeof(info.version));
+    info.bitstream_size = nos_fpga.bitstream_compressed_size;
+    info.fpga_configured = nos_fpga.configured;
+    info.keys_scans_per_sec = nos->perf_keys_count_spi_calls;
+
+    return NyanFrameSend(nos, NYAN_FRAME_INFO, seq, (uint8_t*)&info, sizeof(info));
+}
+
+void NyanStreamAbort(volatile NyanOS* nos)
+{
+    if (nos->stream && nos->stream->abort)
+        nos->stream->abort(nos);
+    nos->stream = NULL;
+    nos->stream_size = 0;
+    nos->stream_offset = 0;
+}
+
+static NyanFrameError NyanFrameStreamOpen(volatile NyanOS* nos, NyanFrame* frame)
+{
+    if (frame->len != 5)
+        return NYAN_FRAME_ERR_LENGTH;
+
+    // Opening a new stream implicitly abandons a stale one, e.g. after a host restart
+    NyanStreamAbort(nos);
+
+    uint8_t id = frame->payload[0];
+    uint32_t size = NyanFrameGetU32(&frame->payload[1]);
+    for (uint8_t idx = 0; idx < _NYAN_NUM_STREAM_TARGETS; ++idx) {
+        const NyanStreamTarget* target = &nyan_stream_targets[idx];
+        if (target->id != id)
+            continue;
+        if (target->busy && target->busy(nos))
+            return NYAN_FRAME_ERR_BUSY;
+        if (size == 0 || size > target->max_size || target->open(nos, size) != NOS_SUCCESS)
+            return NYAN_FRAME_ERR_STREAM_TARGET;
+        nos->stream = target;
+        nos->stream_size = size;
+        nos->stream_offset = 0;
+        return NYAN_FRAME_ERR_NONE;
+    }
+
+    return NYAN_FRAME_ERR_STREAM_TARGET;
+}
+
+static NyanFrameError NyanFrameStreamData(volatile NyanOS* nos, NyanFrame* frame)
+{
+    if (!nos->stream)
+        return NYAN_FRAME_ERR_STREAM_STATE;
+    if (frame->len < 4)
+        return NYAN_FRAME_ERR_LENGTH;
+
+    uint32_t offset = NyanFrameGetU32(&frame->payload[0]);
+    uint32_t len = frame->len - 4;
+
+    // A retransmission of data we already own only needs its ACK repeated
+    if (offset + len <= nos->stream_offset)
+        return NYAN_FRAME_ERR_NONE;
+    if (offset != nos->stream_offset || offset + len > nos->stream_size)
+        return NYAN_FRAME_ERR_STREAM_OFFSET;
+    if (nos->stream->write(nos, offset, &frame->payload[4], len) != NOS_SUCCESS)
+        return NYAN_FRAME_ERR_STREAM_WRITE;
+
+    nos->stream_offset += len;
+
+    return NYAN_FRAME_ERR_NONE;
+}
+
+static NyanFrameError NyanFrameStreamClose(volatile NyanOS* nos)
+{
+    if (!nos->stream)
+        return NYAN_FRAME_ERR_STREAM_STATE;
+    if (nos->stream_offset != nos->stream_size)
+        return NYAN_FRAME_ERR_STREAM_OFFSET;
+
+    NyanFrameError error = nos->stream->close(nos) == NOS_SUCCESS ? NYAN_FRAME_ERR_NONE : NYAN_FRAME_ERR_STREAM_WRITE;
+    nos->stream = NULL;
+    nos->stream_size = 0;
+    nos->stream_offset = 0;
+
+    return error;
+}
+
+static void NyanFrameSessionClose(volatile NyanOS* nos)
+{
+    NyanStreamAbort(nos);
+    NyanFrameInit(nos->frame_link);
+    nos->frame_hangup = false;
+    nos->state = READY;
+}
+
+void NyanFrameSessionService(volatile NyanOS* nos)
+{
+    // A host that went away without SESSION_CLOSE must not leave the shell stuck in framed mode
+    if (nos->frame_hangup || HAL_GetTick() - nos->frame_rx_tick > _NYAN_FRAME_IDLE_MS)
+        NyanFrameSessionClose(nos);
+}
+
+NyanReturn NyanExeFrame(volatile NyanOS* nos)
+{
+    NyanFrame frame;
+    NyanFrameError error = NyanFrameTake(nos->frame_link, &frame);
+
+    if (error != NYAN_FRAME_ERR_NONE) {
+        NyanFrameSendAck(nos, frame.seq, frame.type, error, 0);
+        return NOS_FAILURE;
+    }
+
+    switch (frame.type) {
+        case NYAN_FRAME_PING:
+            NyanFrameSend(nos, NYAN_FRAME_PONG, frame.seq, frame.payload, frame.len);
+            break;
+
+        case NYAN_FRAME_GET_INFO:
+            NyanFrameSendInfo(nos, frame.seq);
+            break;
+
+        case NYAN_FRAME_STREAM_OPEN:
+            error = NyanFrameStreamOpen(nos, &frame);
+            NyanFrameSendAck(nos, frame.seq, frame.type, error, nos->stream_size);
+            break;
+
+        case NYAN_FRAME_STREAM_DATA:
+            error = NyanFrameStreamData(nos, &frame);
+            // The value is always the next expected offset so the host can resume from a NACK
+            NyanFrameSendAck(nos, frame.seq, frame.type, error, nos->stream_offset);
+            break;
+
+        case NYAN_FRAME_STREAM_CLOSE:
+            error = NyanFrameStreamClose(nos);
+            NyanFrameSendAck(nos, frame.seq, frame.type, error, 0);
+            break;
+
+        case NYAN_FRAME_SESSION_CLOSE:
+            NyanFrameSendAck(nos, frame.seq, frame.type, NYAN_FRAME_ERR_NONE, 0);
+            NyanFrameSessionClose(nos);
+            break;
+
+        default:
+            error = NYAN_FRAME_ERR_UNKNOWN_TYPE;
+            NyanFrameSendAck(nos, frame.seq, frame.type, error, 0);
+            break;
+    }
+
+    NyanFrameRelease(nos->frame_link);
+
+    return error == NYAN_FRAME_ERR_NONE ? NOS_SUCCESS : NOS_FAILURE;
+}
+
+static NyanReturn NyanStreamBitcoinHeaderOpen(volatile NyanOS* nos, uint32_t size)
+{
+    memset(&nyan_stream_bitcoin_header, 0, sizeof(nyan_stream_bitcoin_header));
+    return size == sizeof(NyanBitcoinHeader) ? NOS_SUCCESS : NOS_FAILURE;
+}
+
+static NyanReturn NyanStreamBitcoinHeaderWrite(volatile NyanOS* nos, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    memcpy((uint8_t*)&nyan_stream_bitcoin_header + offset, data, len);
+    return NOS_SUCCESS;
+}
+
+static NyanReturn NyanStreamBitcoinHeaderClose(volatile NyanOS* nos)
+{
+    memcpy(&nos->nyan_bitcoin->block_header, &nyan_stream_bitcoin_header, sizeof(NyanBitcoinHeader));
+    return NOS_SUCCESS;
+}
+
+static NyanReturn NyanStreamBitstreamOpen(volatile NyanOS* nos, uint32_t size)
+{
+    return NyanWriteBitstreamBegin(nos, size);
+}
+
+static NyanReturn NyanStreamBitstreamWrite(volatile NyanOS* nos, uint32_t offset, const uint8_t* data, uint32_t len)
+{
+    // A frame carries at most NYAN_FRAME_MAX_PAYLOAD bytes, drain pages until it fits
+    while (NyanBitstreamWriterFree(nos->bitstream) < len) {
+        if (NyanBitstreamWriterService(nos->bitstream) != NYAN_BITSTREAM_SUCCESS)
+            return NOS_FAILURE;
+    }
+
+    return NyanBitstreamWriterPush(nos->bitstream, data, len) == len ? NOS_SUCCESS : NOS_FAILURE;
+}
+
+static NyanReturn NyanStreamBitstreamClose(volatile NyanOS* nos)
+{
+    BYTE digest[SHA256_BLOCK_SIZE];
+
+    // The framing layer drops the stream after a failed close without aborting it
+    while (!NyanBitstreamWriterDone(nos->bitstream)) {
+        if (NyanBitstreamWriterService(nos->bitstream) != NYAN_BITSTREAM_SUCCESS) {
+            NyanStreamBitstreamAbort(nos);
+            return NOS_FAILURE;
+        }
+    }
+    if (NyanBitstreamWriterFinish(nos->bitstream, digest) != NYAN_BITSTREAM_SUCCESS) {
+        NyanStreamBitstreamAbort(nos);
+        return NOS_FAILURE;
+    }
+    // The slot only goes live once its digest is stored
+    if (FPGASlotUploadFinish(nos->fpga, nos->bitstream->size, digest) != FPGA_SUCCESS)
+        return NOS_FAILURE;
+
+    // main() picks the request up and steps the programming
+    FPGARequestConfig(nos->fpga);
+
+    return NOS_SUCCESS;
+}
+
+static void NyanStreamBitstreamAbort(volatile NyanOS* nos)
+{
+    NyanBitstreamWriterAbort(nos->bitstream);
+    FPGASlotUploadAbort(nos->fpga);
+}
+
+static bool NyanStreamBitstreamBusy(volatile NyanOS* nos)
+{
+    return FPGABusy(nos->fpga);
+}
+
 void FreeNyanCommandArgs(volatile NyanOS* nos)
 {
     if (!nos) {
@@ -659,24 +1188,12 @@ void FreeNyanCommandArgs(volatile NyanOS* nos)
 
     for (int i = 0; i < _NYAN_CMD_MAX_ARGS; i++) {
         if (nos->command_arg_buffer[i] != NULL) {
-            free(nos->command_arg_buffer[i]);
+            NyanPoolFree(nos->command_arg_buffer[i]);
             nos->command_arg_buffer[i] = NULL;
         }
     }
 }
 
-void FreeNyanString(NyanString* nyanString)
-{
-    // Clear the memory contents
-    for (uint32_t i = 0; i < nyanString->size; ++i) {
-        nyanString->p_array[i] = 0x00;
-    }
-    // Free up the pointer and memory
-    free(nyanString->p_array);
-    nyanString->p_array = NULL;
-    nyanString->size = 0;
-}
-
 void ClearNyanCommandBuffer(volatile NyanOS* nos)
 {
     nos->command_buffer_pos = 0;
@@ -0,0 +1,149 @@
+/**
+ * NyanOS fixed-block pools - lock-free size classes
+ * Portland.HODL
+ */
+
+#include <errno.h>
+#include <stddef.h>
+
+#include "main.h"
+#include "nyan_pool.h"
+
+_Static_assert(NYAN_POOL_SMALL_SIZE % 4 == 0 && NYAN_POOL_LARGE_SIZE % 4 == 0, "pool blocks must keep word alignment");
+_Static_assert(NYAN_POOL_SMALL_SIZE < NYAN_POOL_LARGE_SIZE, "pool classes must be ordered by size");
+
+// A free block holds the link to the next free block in its first word
+typedef struct NyanPoolBlock {
+    struct NyanPoolBlock* next;
+} NyanPoolBlock;
+
+typedef struct {
+    NyanPoolBlock* volatile free;
+    uint8_t*          base;
+    uint32_t          block_size;
+    uint32_t          blocks;
+    volatile uint32_t in_use;
+    volatile uint32_t high_water;
+    volatile uint32_t failures;
+} NyanPool;
+
+static uint32_t pool_small[NYAN_POOL_SMALL_BLOCKS * NYAN_POOL_SMALL_SIZE / 4];
+static uint32_t pool_large[NYAN_POOL_LARGE_BLOCKS * NYAN_POOL_LARGE_SIZE / 4];
+
+static NyanPool nyan_pools[NYAN_POOL_CLASSES] = {
+    [NYAN_POOL_SMALL] = { NULL, (uint8_t*)pool_small, NYAN_POOL_SMALL_SIZE, NYAN_POOL_SMALL_BLOCKS, 0, 0, 0 },
+    [NYAN_POOL_LARGE] = { NULL, (uint8_t*)pool_large, NYAN_POOL_LARGE_SIZE, NYAN_POOL_LARGE_BLOCKS, 0, 0, 0 },
+};
+
+static uint32_t NyanPoolAtomicAdd(volatile uint32_t* value, int32_t delta)
+{
+    uint32_t next;
+
+    do {
+        next = __LDREXW(value) + delta;
+    } while (__STREXW(next, value));
+
+    return next;
+}
+
+void NyanPoolInit(void)
+{
+    for (uint32_t cls = 0; cls < NYAN_POOL_CLASSES; ++cls) {
+        NyanPool* pool = &nyan_pools[cls];
+        NyanPoolBlock* head = NULL;
+
+        // Threaded back to front, so blocks go out lowest address first
+        for (uint32_t idx = pool->blocks; idx > 0; --idx) {
+            NyanPoolBlock* block = (NyanPoolBlock*)&pool->base[(idx - 1) * pool->block_size];
+            block->next = head;
+            head = block;
+        }
+        pool->free = head;
+        pool->in_use = 0;
+        pool->high_water = 0;
+        pool->failures = 0;
+    }
+}
+
+void* NyanPoolAlloc(uint32_t size)
+{
+    NyanPool* pool = NULL;
+
+    for (uint32_t cls = 0; cls < NYAN_POOL_CLASSES; ++cls) {
+        if (size <= nyan_pools[cls].block_size) {
+            pool = &nyan_pools[cls];
+            break;
+        }
+    }
+    if (!pool)
+        return NULL;
+
+    NyanPoolBlock* block;
+    do {
+        block = (NyanPoolBlock*)__LDREXW((volatile uint32_t*)&pool->free);
+        if (!block) {
+            __CLREX();
+            NyanPoolAtomicAdd(&pool->failures, 1);
+            return NULL;
+        }
+        // A free in between would have cleared the monitor, block->next is still the link
+    } while (__STREXW((uint32_t)block->next, (volatile uint32_t*)&pool->free));
+
+    uint32_t in_use = NyanPoolAtomicAdd(&pool->in_use, 1);
+    uint32_t high_water;
+    do {
+        high_water = __LDREXW(&pool->high_water);
+        if (in_use <= high_water) {
+            __CLREX();
+            break;
+        }
+    } while (__STREXW(in_use, &pool->high_water));
+
+    return block;
+}
+
+void NyanPoolFree(void* block)
+{
+    if (!block)
+        return;
+
+    for (uint32_t cls = 0; cls < NYAN_POOL_CLASSES; ++cls) {
+        NyanPool* pool = &nyan_pools[cls];
+        uint8_t* data = (uint8_t*)block;
+
+        if (data < pool->base || data >= pool->base + pool->blocks * pool->block_size)
+            continue;
+
+        NyanPoolBlock* head;
+        do {
+            head = (NyanPoolBlock*)__LDREXW((volatile uint32_t*)&pool->free);
+            ((NyanPoolBlock*)block)->next = head;
+        } while (__STREXW((uint32_t)block, (volatile uint32_t*)&pool->free));
+        NyanPoolAtomicAdd(&pool->in_use, -1);
+        return;
+    }
+}
+
+// Replaces the libnosys heap, the linker script reserves none. The build already fails if malloc
+// is linked in, this only keeps a heap from ever growing into the rest of RAM
+void* _sbrk(ptrdiff_t incr)
+{
+    (void)incr;
+    errno = ENOMEM;
+    return (void*)-1;
+}
+
+bool NyanPoolGetStats(NyanPoolClass pool_class, NyanPoolStats* stats)
+{
+    if ((uint32_t)pool_class >= NYAN_POOL_CLASSES || !stats)
+        return false;
+
+    const NyanPool* pool = &nyan_pools[pool_class];
+    stats->block_size = pool->block_size;
+    stats->blocks = pool->blocks;
+    stats->in_use = pool->in_use;
+    stats->high_water = pool->high_water;
+    stats->failures = pool->failures;
+
+    return true;
+}
@@ -2,8 +2,6 @@
 
 #include <nyan_strings.h>
 
-#define NOS_VERSION "0.01"
-
 const uint8_t nyan_keys_welcome_text[] =
 "Nyan Keys Operating System (NOS) V" NOS_VERSION "\r\n"
 "Made by Portland.HODL\r\n"
@@ -19,7 +17,10 @@ const uint8_t nyan_keys_help[] =
 "\tgetperf\r\n"
 "\tset-owner <name with spaces>\r\n"
 "\twrite-bitstream <size in bytes>\r\n"
-"\tbitcoin-miner-set <args | run with no args for help>\r\n";
+"\tbitcoin-miner-set <args | run with no args for help>\r\n"
+"\ttelemetry <status frames per second, 0 to stop>\r\n"
+"\tbench <all | hid-report | sha256 | uncompress | eeprom-read | eeprom-write | format> [-icache] [-dcache]\r\n"
+"\tfpga-stats\r\n";
 
 // COMMAND: getinfo
 const uint8_t nyan_keys_getinfo[] =
@@ -33,6 +34,11 @@ const uint8_t nyan_keys_getinfo_owner[] = "Owner: "; // Make sure to newline aft
 const uint8_t nyan_keys_getperf_line1[] = "Nyan Keys Performance Stats\r\n";
 const uint8_t nyan_keys_getperf_line2[] = " ------------------------- \r\n";
 const uint8_t nyan_keys_getperf_times_scanned[] = "Total Keyboard Scans 1s: ";
+const uint8_t nyan_keys_getperf_i2c_profile[] = "EEPROM I2C Profile: ";
+const uint8_t nyan_keys_getperf_eeprom_read[] = "EEPROM Read Rate: ";
+const uint8_t nyan_keys_getperf_eeprom_none[] = "EEPROM Read Rate: not measured yet\r\n";
+const uint8_t nyan_keys_getperf_i2c_errors[] = "EEPROM I2C Errors: ";
+const uint8_t nyan_keys_getperf_pool[] = "Memory Pool ";
 
 //COMMAND: set-owner
 const uint8_t nyan_keys_set_owner_success[] = "Nyan Keys owner has been successfully set\r\n";
@@ -42,9 +48,17 @@ const uint8_t nyan_keys_unknown_command[] = "Command not supported by NyanOS";
 //COMMAND: write-bitstream
 const uint8_t nyan_keys_write_bitstream_info_start[] = "ready\r\n";
 const uint8_t nyan_keys_write_bitstream_info_eeprom_write_completed[] = "Write to Nyan EEPROM completed.\r\n";
+const uint8_t nyan_keys_write_bitstream_info_pages_skipped[] = "Unchanged pages skipped: ";
+const uint8_t nyan_keys_write_bitstream_error_digest[] = "Error: Bitstream digest could not be stored, the active image stays in use.\r\n";
+const uint8_t nyan_keys_write_bitstream_info_slot[] = "Bitstream stored in slot ";
+const uint8_t nyan_keys_write_bitstream_info_slot_pending[] = ", it becomes active once the FPGA configures from it and is copied to the flash cache at the next boot.\r\n";
+const uint8_t nyan_keys_write_bitstream_info_unprotected[] = "Warning: the image does not fit beside the active one and replaces it, there is no rollback for this upload.\r\n";
 const uint8_t nyan_keys_write_bitstream_info_success[] = "Nyan Keys FPGA bitstream has been written\r\n";
-const uint8_t nyan_keys_write_bitstream_error_size[] = "Failed to parse bitstream length, size must be less than 65535 bytes.\r\n";
+const uint8_t nyan_keys_write_bitstream_error_size[] = "Failed to parse bitstream length, size must be at most ";
+const uint8_t nyan_keys_write_bitstream_error_fpga_busy[] = "Failed to write bitstream, the FPGA is being configured. Try again once fpga-stats shows a result.\r\n";
 const uint8_t nyan_keys_write_bitstream_error_size_tx_busy[] = "Failed to write bitstream length, TX buffer is busy.\r\n";
+const uint8_t nyan_keys_write_bitstream_error_eeprom[] = "Failed to write bitstream, the EEPROM stopped acknowledging pages.\r\n";
+const uint8_t nyan_keys_write_bitstream_error_timeout[] = "Failed to write bitstream, no data arrived for ";
 
 // COMMAND: bitcoin-miner-set
 const uint8_t nyan_keys_write_bitcoin_miner_failed_arg[] = 
@@ -76,3 +90,36 @@ const uint8_t nyan_keys_write_bitcoin_miner_nonce[] = "Nyan BitCoin Miner nonce
 
 //COMMAND: dfu-mode
 const uint8_t nyan_keys_enter_dfu_mode_reboot_warning[] = "Nyan Keys entering DFU mode and rebooting\r\n";
+
+//COMMAND: telemetry
+const uint8_t nyan_keys_telemetry_rate[] = "Telemetry rate: ";
+const uint8_t nyan_keys_telemetry_error_rate[] = "Telemetry rate must be 0 to 100 frames per second.\r\n";
+const uint8_t nyan_keys_telemetry_error_disabled[] = "Telemetry is not enabled in this build, rebuild with NYAN_TELEMETRY_EN.\r\n";
+
+//COMMAND: bench
+const uint8_t nyan_keys_bench_header[] = "Nyan Keys Benchmarks\r\n ------------------------- \r\n";
+const uint8_t nyan_keys_bench_error_unknown[] = "Unknown benchmark, run help for the list.\r\n";
+const uint8_t nyan_keys_bench_error_failed[] = "Benchmark failed.\r\n";
+
+//COMMAND: fpga-stats
+const uint8_t nyan_keys_fpga_stats_header[] = "Nyan Keys FPGA Boot\r\n ------------------------- \r\n";
+const uint8_t nyan_keys_fpga_stats_ok[] = "Result: configured\r\n";
+const uint8_t nyan_keys_fpga_stats_progress[] = "Result: configuring, ";
+const uint8_t nyan_keys_fpga_stats_failed[] = "Result: bitstream could not be decompressed\r\n";
+const uint8_t nyan_keys_fpga_stats_no_image[] = "Result: no bitstream stored\r\n";
+const uint8_t nyan_keys_fpga_stats_error_eeprom[] = "Result: EEPROM read failed\r\n";
+const uint8_t nyan_keys_fpga_stats_error_digest[] = "Result: bitstream does not match its SHA-256, FPGA held in reset\r\n";
+const uint8_t nyan_keys_fpga_stats_error_cdone[] = "Result: CDONE never went high, FPGA held in reset\r\n";
+const uint8_t nyan_keys_fpga_stats_error_spi[] = "Result: SPI4 transfer failed, FPGA held in reset\r\n";
+const uint8_t nyan_keys_fpga_stats_digest[] = "SHA-256: ";
+const uint8_t nyan_keys_fpga_stats_slot[] = "Slot: ";
+const uint8_t nyan_keys_fpga_stats_rollback[] = "Rolled back: slot ";
+const uint8_t nyan_keys_fpga_stats_bitstream[] = "Bitstream: ";
+const uint8_t nyan_keys_fpga_stats_source[] = "Source: ";
+const uint8_t nyan_keys_fpga_stats_cache_pending[] = "Flash cache: this image is copied at the next boot\r\n";
+const uint8_t nyan_keys_fpga_stats_cache_updated[] = "Flash cache: copied at boot\r\n";
+const uint8_t nyan_keys_fpga_stats_cache_failed[] = "Flash cache: the copy at boot failed, the next boot loads from the EEPROM\r\n";
+const uint8_t nyan_keys_fpga_stats_total[] = "Boot to CDONE: ";
+const uint8_t nyan_keys_fpga_stats_eeprom[] = "EEPROM read: ";
+const uint8_t nyan_keys_fpga_stats_decode[] = "Decompress: ";
+const uint8_t nyan_keys_fpga_stats_spi[] = "SPI4 DMA: ";
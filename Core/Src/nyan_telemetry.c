@@ -0,0 +1,153 @@
+/**
+ * NyanOS Telemetry Channel
+ * Portland.HODL
+ */
+
+#include <string.h>
+
+#include "main.h"
+#include "nyan_cycles.h"
+#include "nyan_tcm.h"
+#include "nyan_telemetry.h"
+
+#include "usbd_cdc_acm_if.h"
+
+void NyanTelemetryInit(NyanTelemetry* telemetry)
+{
+    memset(telemetry, 0, sizeof(*telemetry));
+    telemetry->rate_hz = NYAN_TELEMETRY_DEFAULT_HZ;
+
+    // Scan intervals and key events are stamped with the cycle counter
+    NyanCyclesInit();
+}
+
+NyanTelemetryReturn NyanTelemetrySetRate(NyanTelemetry* telemetry, uint32_t rate_hz)
+{
+    if (rate_hz > NYAN_TELEMETRY_MAX_HZ)
+        return NYAN_TELEMETRY_FAILURE;
+
+    telemetry->rate_hz = (uint8_t)rate_hz;
+    telemetry->ticks = 0;
+
+    return NYAN_TELEMETRY_SUCCESS;
+}
+
+NyanTelemetryReturn NyanTelemetryEmit(NyanTelemetry* telemetry, uint8_t type, const void* payload, uint16_t len)
+{
+    uint8_t raw[NYAN_FRAME_RAW_SZ(NYAN_TELEMETRY_MAX_PAYLOAD)];
+    uint8_t out[NYAN_FRAME_ENCODED_SZ(NYAN_TELEMETRY_MAX_PAYLOAD)];
+
+    if (len > NYAN_TELEMETRY_MAX_PAYLOAD)
+        return NYAN_TELEMETRY_FAILURE;
+
+    // Sequence number and ring slot are taken together, or a preempting emitter could store its
+    // frame ahead of one with a lower number; the frame is at most 104 bytes so encoding stays short
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+
+    // A dropped frame still uses up its number, the gap tells the host
+    uint8_t seq = telemetry->seq++;
+    size_t encoded = NyanFrameBuild(raw, out, type, seq, (const uint8_t*)payload, len);
+    if (encoded == 0 || encoded > NYAN_TELEMETRY_RING_SZ - (telemetry->head - telemetry->tail)) {
+        // Nobody is reading, keep the newest state in the counters instead of blocking
+        ++telemetry->frames_dropped;
+        __set_PRIMASK(primask);
+        return NYAN_TELEMETRY_FAILURE;
+    }
+
+    uint32_t pos = telemetry->head & (NYAN_TELEMETRY_RING_SZ - 1);
+    size_t first = encoded < NYAN_TELEMETRY_RING_SZ - pos ? encoded : NYAN_TELEMETRY_RING_SZ - pos;
+    memcpy(&telemetry->ring[pos], out, first);
+    memcpy(&telemetry->ring[0], out + first, encoded - first);
+    telemetry->head += encoded;
+    ++telemetry->frames_emitted;
+
+    __set_PRIMASK(primask);
+
+    return NYAN_TELEMETRY_SUCCESS;
+}
+
+void NyanTelemetryTX(NyanTelemetry* telemetry)
+{
+    if (telemetry->tx_inflight)
+        return;
+
+    uint32_t used = telemetry->head - telemetry->tail;
+    if (used == 0)
+        return;
+
+    uint32_t pos = telemetry->tail & (NYAN_TELEMETRY_RING_SZ - 1);
+    uint32_t length = used;
+    if (length > NYAN_TELEMETRY_RING_SZ - pos)
+        length = NYAN_TELEMETRY_RING_SZ - pos;
+    if (length > NYAN_TELEMETRY_TX_MAX_LEN)
+        length = NYAN_TELEMETRY_TX_MAX_LEN;
+
+    // Claim the endpoint before the transfer, its completion can preempt this task
+    telemetry->pending = length;
+    telemetry->tx_inflight = true;
+    if (CDC_Transmit(NYAN_TELEMETRY_CDC_CHANNEL, &telemetry->ring[pos], length) != USBD_OK) {
+        // Port closed or endpoint busy, retry on the next tick
+        telemetry->pending = 0;
+        telemetry->tx_inflight = false;
+    }
+}
+
+bool NyanTelemetryTick(NyanTelemetry* telemetry)
+{
+    bool due = false;
+
+    if (telemetry->rate_hz && ++telemetry->ticks >= NYAN_TELEMETRY_TICK_HZ / telemetry->rate_hz) {
+        telemetry->ticks = 0;
+        due = true;
+    }
+
+    return due;
+}
+
+void NyanTelemetryEmitLatency(NyanTelemetry* telemetry)
+{
+    NyanTelemetryLatency snapshot;
+
+    // The key scan interrupt outranks the TIM8 task, take the histogram in one piece
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    snapshot = telemetry->latency;
+    memset(&telemetry->latency, 0, sizeof(telemetry->latency));
+    __set_PRIMASK(primask);
+
+    NyanTelemetryEmit(telemetry, NYAN_FRAME_TELEMETRY_LATENCY, &snapshot, sizeof(snapshot));
+}
+
+NYAN_ITCM void NyanTelemetryKeyScan(NyanTelemetry* telemetry, const volatile uint8_t* key_states, bool changed)
+{
+    uint32_t now = NyanCyclesNow();
+
+    if (telemetry->scan_cycles) {
+        uint32_t us = NyanCyclesToUs(now - telemetry->scan_cycles);
+        uint32_t bucket = us ? 32 - __CLZ(us) : 0;
+        if (bucket >= NYAN_TELEMETRY_LATENCY_BUCKETS)
+            bucket = NYAN_TELEMETRY_LATENCY_BUCKETS - 1;
+
+        ++telemetry->latency.buckets[bucket];
+        ++telemetry->latency.samples;
+        if (us > telemetry->latency.max_us)
+            telemetry->latency.max_us = us;
+    }
+    telemetry->scan_cycles = now ? now : 1;
+
+    if (changed) {
+        NyanTelemetryKeys keys;
+        keys.cycles = now;
+        for (uint8_t idx = 0; idx < sizeof(keys.key_states); ++idx)
+            keys.key_states[idx] = key_states[idx];
+        NyanTelemetryEmit(telemetry, NYAN_FRAME_TELEMETRY_KEYS, &keys, sizeof(keys));
+    }
+}
+
+void NyanTelemetryTxComplete(NyanTelemetry* telemetry)
+{
+    telemetry->tail += telemetry->pending;
+    telemetry->pending = 0;
+    telemetry->tx_inflight = false;
+}
@@ -26,6 +26,7 @@
 //#include "usart.h"
 //#include "tim.h"
 #include "nyan_os.h"
+#include "nyan_dma.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -94,8 +95,8 @@ extern NyanOS nos;
 #define APP_RX_DATA_SIZE _NYAN_CDC_RX_BUF_SZ
 #define APP_TX_DATA_SIZE 1024
 
-/** RX buffer for USB */
-uint8_t RX_Buffer[NUMBER_OF_CDC][APP_RX_DATA_SIZE];
+/** RX buffer for USB, written by the OTG DMA */
+uint8_t RX_Buffer[NUMBER_OF_CDC][APP_RX_DATA_SIZE] NYAN_DMA_BUFFER;
 
 /** TX buffer for USB, RX buffer for UART */
 uint8_t TX_Buffer[NUMBER_OF_CDC][APP_TX_DATA_SIZE];
@@ -160,6 +161,11 @@ static int8_t CDC_Init(uint8_t cdc_ch)
   /* USER CODE BEGIN 3 */
 
   /* ##-1- Set Application Buffers */
+  // The OTG DMA writes OUT packets behind the CPU's back, a buffer the D-Cache can hold would be read stale
+  if (!NyanDmaCoherent(RX_Buffer[cdc_ch], APP_RX_DATA_SIZE))
+  {
+    Error_Handler();
+  }
   USBD_CDC_SetRxBuffer(cdc_ch, &hUsbDevice, RX_Buffer[cdc_ch]);
 
   //  /*##-2- Start the TIM Base generation in interrupt mode ####################*/
@@ -257,10 +263,14 @@ static int8_t CDC_Control(uint8_t cdc_ch, uint8_t cmd, uint8_t *pbuf, uint16_t l
     break;
 
   case CDC_SET_CONTROL_LINE_STATE:
-    if (pbuf[0] & 0x01 && nos.send_welcome_screen_guard == 0x00) { // Check if DTR bit is set and there hasn't been a recent connection
+    // Only the shell channel greets the host, the telemetry channel just streams
+    if (cdc_ch == _NYAN_CDC_CHANNEL && pbuf[0] & 0x01 && nos.send_welcome_screen_guard == 0x00) { // Check if DTR bit is set and there hasn't been a recent connection
       // Init the Nyan Keys Operating System and send the welcome screen.
       NyanOsInit(&nos);
       nos.send_welcome_screen = true;
+    } else if (cdc_ch == _NYAN_CDC_CHANNEL && !(pbuf[0] & 0x01)) {
+      // The port was closed, a framed session it left open is ended by the TIM8 task
+      nos.frame_hangup = true;
     }
     break;
 
@@ -294,31 +304,28 @@ static int8_t CDC_Control(uint8_t cdc_ch, uint8_t cmd, uint8_t *pbuf, uint16_t l
 static int8_t CDC_Receive(uint8_t cdc_ch, uint8_t *Buf, uint32_t *Len)
 {
   /* USER CODE BEGIN 6 */
-  // Check if there is something to copy.
-  if (Buf != NULL && Len != NULL && *Len > 0) {
-    // Allocate memory for the temporary buffer.
-    // Make sure to free this buffer once you're done with it if it's no longer needed.
-    uint8_t* tBuf = (uint8_t*)malloc(*Len * sizeof(uint8_t));
-    if (tBuf == NULL) {
-      // Handle memory allocation error
-      return (USBD_FAIL);
-    }
-    
-    // Copy the contents of Buf into tBuf.
-    memcpy(tBuf, Buf, *Len);
-
-    // Clear the buffers and ready for more data to be received.
+  // Only the shell channel takes input, anything sent to another channel is dropped
+  if (cdc_ch != _NYAN_CDC_CHANNEL) {
     USBD_CDC_SetRxBuffer(cdc_ch, &hUsbDevice, &Buf[0]);
     USBD_CDC_ReceivePacket(cdc_ch, &hUsbDevice);
+    return (USBD_OK);
+  }
 
+  // Check if there is something to copy.
+  if (Buf != NULL && Len != NULL && *Len > 0) {
     // Activate led to signal data received by MCU
     HAL_GPIO_WritePin(GPIOD, Nyan_Keys_LED3_Pin, GPIO_PIN_SET);
 
-    // Pass the USB CDC input to NyanOS(nos)
-    NyanAddInputBuffer(&nos, tBuf, Len);
+    // Pass the USB CDC input to NyanOS(nos), Buf is not re-armed until it has been consumed
+    NyanAddInputBuffer(&nos, Buf, Len);
 
-    // Free the temporary buffer if it's no longer needed.
-    free(tBuf);
+    // Clear the buffers and ready for more data to be received, unless NyanOS has no room for
+    // another packet; the host is NAK'd until NyanRxResume re-arms the endpoint.
+    USBD_CDC_SetRxBuffer(cdc_ch, &hUsbDevice, &Buf[0]);
+    if (NyanRxReady(&nos))
+      USBD_CDC_ReceivePacket(cdc_ch, &hUsbDevice);
+    else
+      nos.rx_paused = true;
   }
 
   return (USBD_OK);
@@ -339,9 +346,13 @@ static int8_t CDC_Receive(uint8_t cdc_ch, uint8_t *Buf, uint32_t *Len)
   */
 static int8_t CDC_TransmitCplt(uint8_t cdc_ch, uint8_t *Buf, uint32_t *Len, uint8_t epnum)
 {
-  if(!nos.tx_bulk_transfer_in_progress)
-    FreeNyanString(&nos.tx_buffer);
-  nos.tx_inflight = 0;
+#ifdef NYAN_TELEMETRY_EN
+  if (cdc_ch == NYAN_TELEMETRY_CDC_CHANNEL) {
+    NyanTelemetryTxComplete(&nos_telemetry);
+    return (USBD_OK);
+  }
+#endif
+  NyanCdcTxComplete(&nos);
   return (USBD_OK);
 }
 
@@ -358,8 +369,10 @@ static int8_t CDC_TransmitCplt(uint8_t cdc_ch, uint8_t *Buf, uint32_t *Len, uint
   */
 uint8_t CDC_Transmit(uint8_t cdc_ch, uint8_t *Buf, uint16_t Len)
 {
-  // Take a semaphore and lock up the TX buffer from sends until the CDC_TransmitCplt occours
-  nos.tx_inflight = 1;
+  // Take a semaphore and lock up the TX buffer from sends until the CDC_TransmitCplt occours,
+  // other channels track their own transfers
+  if (cdc_ch == _NYAN_CDC_CHANNEL)
+    nos.tx_inflight = 1;
   uint8_t result = USBD_OK;
   /* USER CODE BEGIN 7 */
   extern USBD_CDC_ACM_HandleTypeDef CDC_ACM_Class_Data[];
@@ -369,6 +382,8 @@ uint8_t CDC_Transmit(uint8_t cdc_ch, uint8_t *Buf, uint16_t Len)
   {
     return USBD_BUSY;
   }
+  // The OTG DMA reads the data from RAM, lines still dirty in the D-Cache go out first
+  NyanDmaClean(Buf, Len);
   USBD_CDC_SetTxBuffer(cdc_ch, &hUsbDevice, Buf, Len);
   result = USBD_CDC_TransmitPacket(cdc_ch, &hUsbDevice);
   /* USER CODE END 7 */
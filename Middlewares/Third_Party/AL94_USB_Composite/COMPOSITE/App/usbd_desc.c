@@ -26,6 +26,7 @@
 
 /* USER CODE BEGIN INCLUDE */
 #include "usbd_composite.h"
+#include "nyan_dma.h"
 /* USER CODE END INCLUDE */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -289,7 +290,8 @@ uint8_t * USBD_SerialStrDescriptor(USBD_SpeedTypeDef speed, uint16_t *length)
    * ID */
   Get_SerialNum();
   /* USER CODE BEGIN USBD_SerialStrDescriptor */
-
+  // Just written through the D-Cache, the OTG DMA reads it from RAM
+  NyanDmaClean(USBD_StringSerial, USB_SIZ_STRING_SERIAL);
   /* USER CODE END USBD_SerialStrDescriptor */
 
   return (uint8_t *) USBD_StringSerial;
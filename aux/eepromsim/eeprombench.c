@@ -0,0 +1,147 @@
+// Host benchmark of the EEPROM stack on the simulated 24xx1025, in simulated
+// time: bulk reads at each bus profile, page writes with and without the
+// compare option, a bitstream upload and a key-value setting reaching the
+// part. The simulator times transfers from TIMINGR and the 5 ms write cycle,
+// so the numbers are what the bus allows, not what the host CPU does.
+//
+// Usage: eeprombench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "24xx_eeprom.h"
+#include "24xx_eeprom_sim.h"
+#include "nyan_bitstream.h"
+#include "nyan_config.h"
+#include "nyan_eeprom_map.h"
+#include "nyan_kv.h"
+
+extern Eeprom24xx nos_eeprom;
+void MX_I2C1_Init(void);
+
+static NyanConfig config;
+static NyanKv kv;
+static NyanBitstreamWriter writer;
+static uint8_t image[0x10000] EEPROM_DMA_ALIGNED;
+
+static void power_on(void)
+{
+	EepromSimInit(false, false);
+	EepromInit(&nos_eeprom, false, false);
+	MX_I2C1_Init();
+}
+
+static void fill(uint8_t *data, uint32_t len, uint32_t seed)
+{
+	for (uint32_t i = 0; i < len; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+// Simulated microseconds a job takes from submit to done
+static uint64_t timed(EepromJobType type, uint16_t address, uint8_t *data, uint16_t len, bool compare)
+{
+	EepromJob job;
+	uint64_t start = EepromSimNowUs();
+
+	EepromJobInit(&job, type, false, address, data, len);
+	job.compare = compare;
+	if (EepromSubmit(&nos_eeprom, &job) != EEPROM_SUCCESS || EepromJobWait(&job) != EEPROM_SUCCESS) {
+		fprintf(stderr, "job at 0x%04x failed\n", address);
+		exit(1);
+	}
+	return EepromSimNowUs() - start;
+}
+
+static void bench_profiles(void)
+{
+	printf("%-8s %14s %14s %14s %14s\n", "profile", "64 KB read", "512 B reads", "8 KB write", "8 KB same");
+	for (int profile = 0; profile < EEPROM_BUS_PROFILES; ++profile) {
+		power_on();
+		EepromSetBusProfile(&nos_eeprom, (EepromBusProfile)profile);
+
+		// One sequential read of a whole block, then the loader's 512 byte blocks
+		uint64_t bulk = timed(EEPROM_JOB_READ, 0x0000, image, 0xFFE0, false);
+		uint64_t blocks = 0;
+		for (uint32_t offset = 0; offset < 0x10000; offset += 512)
+			blocks += timed(EEPROM_JOB_READ, offset, &image[offset], 512, false);
+
+		fill(image, 8192, profile);
+		uint64_t write = timed(EEPROM_JOB_WRITE, 0x2000, image, 8192, true);
+		uint64_t same = timed(EEPROM_JOB_WRITE, 0x2000, image, 8192, true);
+
+		printf("%4u kHz %9.1f KB/s %9.1f KB/s %11.1f ms %11.1f ms\n", EepromBusProfileKhz((EepromBusProfile)profile),
+		       0xFFE0 * 1e6 / 1024 / bulk, 0x10000 * 1e6 / 1024 / blocks, write / 1000.0, same / 1000.0);
+	}
+}
+
+static uint64_t bench_upload(uint32_t size)
+{
+	uint8_t digest[SHA256_BLOCK_SIZE];
+	uint32_t pushed = 0;
+	uint64_t start = EepromSimNowUs();
+
+	NyanBitstreamWriterOpen(&writer, &nos_eeprom, ADDR_FPGA_BITSTREAM_B, size);
+	while (!NyanBitstreamWriterDone(&writer)) {
+		if (pushed < size)
+			pushed += NyanBitstreamWriterPush(&writer, &image[pushed % sizeof(image)], size - pushed < 64 ? size - pushed : 64);
+		if (NyanBitstreamWriterService(&writer) != NYAN_BITSTREAM_SUCCESS) {
+			fprintf(stderr, "upload failed\n");
+			exit(1);
+		}
+		EepromSimAdvance(10);
+	}
+	NyanBitstreamWriterFinish(&writer, digest);
+	return EepromSimNowUs() - start;
+}
+
+static void bench_writer(void)
+{
+	const uint32_t size = 54350;
+
+	power_on();
+	EepromSetBusProfile(&nos_eeprom, EEPROM_BUS_400K);
+	fill(image, sizeof(image), 7);
+	uint64_t first = bench_upload(size);
+	uint64_t again = bench_upload(size);
+	printf("\nbitstream upload, %u bytes at 400 kHz: %.2f s, unchanged %.2f s (%u of %u pages skipped)\n",
+	       size, first / 1e6, again / 1e6, writer.pages_skipped, writer.pages);
+}
+
+static void bench_kv(void)
+{
+	uint8_t value;
+
+	power_on();
+	EepromSetBusProfile(&nos_eeprom, EEPROM_BUS_400K);
+	NyanConfigInit(&config, &nos_eeprom);
+	NyanKvInit(&kv, &config);
+	NyanKvService(&kv);
+	while (!NyanConfigClean(&config))
+		EepromSimAdvance(10);
+
+	uint64_t total = 0;
+	for (uint32_t i = 0; i < 100; ++i) {
+		uint64_t start = EepromSimNowUs();
+		value = i & 1;
+		NyanKvSet(&kv, NYAN_KV_SUPER_KEY_DISABLED, &value, sizeof(value));
+		NyanKvService(&kv);
+		while (!NyanConfigClean(&config))
+			EepromSimAdvance(10);
+		total += EepromSimNowUs() - start;
+		// The part finishes its write cycle before the next toggle
+		EepromSimAdvance(EEPROM_SIM_TWC_US);
+	}
+	printf("key-value setting in the EEPROM after %.2f ms, %u records for 100 toggles\n", total / 100 / 1000.0, kv.records_written);
+}
+
+int main(void)
+{
+	bench_profiles();
+	bench_writer();
+	bench_kv();
+	return 0;
+}
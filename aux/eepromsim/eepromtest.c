@@ -0,0 +1,451 @@
+// Host tests of the EEPROM stack against the simulated 24xx1025: the job
+// driver, the config shadow and key-value log on top of it, the streaming
+// bitstream writer and an FPGA configuration read back from the EEPROM.
+//
+// Usage: eepromtest image.compr image.bin
+// The compressed image must be larger than slot B, so it straddles B0.
+// Prints one line per failed check and exits non-zero if there was any.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "24xx_eeprom.h"
+#include "24xx_eeprom_sim.h"
+#include "lattice_ice_hx.h"
+#include "nyan_bitstream.h"
+#include "nyan_config.h"
+#include "nyan_eeprom_map.h"
+#include "nyan_kv.h"
+#include "nyan_sha256.h"
+
+extern Eeprom24xx nos_eeprom;
+extern NyanConfig nos_config;
+extern LatticeIceHX nos_fpga;
+extern uint8_t sim_spi_out[];
+extern uint32_t sim_spi_len;
+extern uint32_t sim_cache_stores;
+void MX_I2C1_Init(void);
+
+static NyanKv kv;
+static NyanBitstreamWriter writer;
+static int failures;
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__, __func__, #cond); \
+		failures++; \
+	} \
+} while (0)
+
+static void pattern(uint8_t *data, uint32_t len, uint32_t seed)
+{
+	for (uint32_t i = 0; i < len; ++i) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = seed >> 16;
+	}
+}
+
+// Blank part, driver and I2C1 as main() brings them up
+static void power_on(bool strap_a0)
+{
+	EepromSimInit(false, false);
+	EepromInit(&nos_eeprom, strap_a0, false);
+	MX_I2C1_Init();
+}
+
+// Driver and shadow come up again, the simulated part keeps its contents
+static void reboot(void)
+{
+	EepromInit(&nos_eeprom, false, false);
+	MX_I2C1_Init();
+	CHECK(NyanConfigInit(&nos_config, &nos_eeprom) == NYAN_CONFIG_SUCCESS);
+	NyanKvInit(&kv, &nos_config);
+}
+
+static EepromReturn run(EepromJobType type, bool b0, uint16_t address, uint8_t *data, uint16_t len, bool compare)
+{
+	EepromJob job;
+
+	EepromJobInit(&job, type, b0, address, data, len);
+	job.compare = compare;
+	if (EepromSubmit(&nos_eeprom, &job) != EEPROM_SUCCESS)
+		return EEPROM_FAILURE;
+	return EepromJobWait(&job);
+}
+
+static EepromReturn run_linear(EepromJobType type, uint32_t address, uint8_t *data, uint16_t len)
+{
+	EepromJob job, tail;
+
+	EepromJob *last = EepromJobInitLinear(&job, &tail, type, address, data, len);
+	if (EepromSubmit(&nos_eeprom, &job) != EEPROM_SUCCESS)
+		return EEPROM_FAILURE;
+	if (EepromJobWait(&job) != EEPROM_SUCCESS)
+		return EEPROM_FAILURE;
+	return EepromJobWait(last);
+}
+
+static void config_settle(void)
+{
+	for (int i = 0; i < 100000 && !NyanConfigClean(&nos_config); ++i)
+		EepromSimAdvance(10);
+}
+
+static void test_driver_pages(void)
+{
+	uint8_t data[300], back[300];
+	uint8_t aligned[512] EEPROM_DMA_ALIGNED;
+
+	power_on(false);
+	pattern(data, sizeof(data), 1);
+	// 0x0F70 to 0x109B touches four write pages
+	CHECK(run(EEPROM_JOB_WRITE, false, 0x0F70, data, sizeof(data), false) == EEPROM_SUCCESS);
+	CHECK(memcmp(&eeprom_sim.mem[0][0x0F70], data, sizeof(data)) == 0);
+	CHECK(eeprom_sim.write_cycles == 4);
+	CHECK(nos_eeprom.pages_written == 4);
+
+	// Staged through rx_buf, then straight into an aligned buffer
+	memset(back, 0, sizeof(back));
+	CHECK(run(EEPROM_JOB_READ, false, 0x0F70, back, sizeof(back), false) == EEPROM_SUCCESS);
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+	CHECK(run(EEPROM_JOB_READ, false, 0x0F00, aligned, sizeof(aligned), false) == EEPROM_SUCCESS);
+	CHECK(memcmp(&aligned[0x70], data, sizeof(data)) == 0);
+
+	// Same bytes again, every page is only read back
+	uint32_t cycles = eeprom_sim.write_cycles;
+	CHECK(run(EEPROM_JOB_WRITE, false, 0x0F70, data, sizeof(data), true) == EEPROM_SUCCESS);
+	CHECK(eeprom_sim.write_cycles == cycles);
+	CHECK(nos_eeprom.pages_skipped == 4);
+
+	// One byte changed, one page written
+	data[150] ^= 0xFF;
+	CHECK(run(EEPROM_JOB_WRITE, false, 0x0F70, data, sizeof(data), true) == EEPROM_SUCCESS);
+	CHECK(eeprom_sim.write_cycles == cycles + 1);
+	CHECK(memcmp(&eeprom_sim.mem[0][0x0F70], data, sizeof(data)) == 0);
+}
+
+static void test_driver_block_boundary(void)
+{
+	uint8_t data[256], back[256];
+
+	power_on(false);
+	pattern(data, sizeof(data), 2);
+	CHECK(run_linear(EEPROM_JOB_WRITE, EEPROM_BLOCK_SIZE - 128, data, sizeof(data)) == EEPROM_SUCCESS);
+	CHECK(memcmp(&eeprom_sim.mem[0][EEPROM_BLOCK_SIZE - 128], data, 128) == 0);
+	CHECK(memcmp(&eeprom_sim.mem[1][0], &data[128], 128) == 0);
+
+	memset(back, 0, sizeof(back));
+	CHECK(run_linear(EEPROM_JOB_READ, EEPROM_BLOCK_SIZE - 128, back, sizeof(back)) == EEPROM_SUCCESS);
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+
+	// Without a tail the driver refuses what the part would wrap
+	EepromJob job;
+	EepromJobInitLinear(&job, NULL, EEPROM_JOB_READ, EEPROM_BLOCK_SIZE - 128, back, sizeof(back));
+	CHECK(EepromSubmit(&nos_eeprom, &job) == EEPROM_FAILURE);
+}
+
+static void test_driver_faults(void)
+{
+	uint8_t data[64], back[64];
+
+	power_on(false);
+	pattern(data, sizeof(data), 3);
+
+	// A NACK is polled through, no recovery needed
+	EepromSimInjectFault(EEPROM_SIM_FAULT_NACK, 0);
+	CHECK(run(EEPROM_JOB_WRITE, false, 0x1000, data, sizeof(data), false) == EEPROM_SUCCESS);
+	CHECK(eeprom_sim.nacks >= 1);
+	CHECK(nos_eeprom.bus_recoveries == 0);
+
+	// A bus error is recovered and the transfer runs again
+	EepromSimInjectFault(EEPROM_SIM_FAULT_BUS_ERROR, 0);
+	CHECK(run(EEPROM_JOB_READ, false, 0x1000, back, sizeof(back), false) == EEPROM_SUCCESS);
+	CHECK(memcmp(back, data, sizeof(data)) == 0);
+	CHECK(nos_eeprom.bus_recoveries == 1);
+	CHECK(nos_eeprom.job_retries == 1);
+
+	// A part that never answers fails the job once the poll deadline has passed
+	nos_eeprom.a0 = true;
+	uint64_t start = EepromSimNowUs();
+	CHECK(run(EEPROM_JOB_READ, false, 0x1000, back, sizeof(back), false) == EEPROM_FAILURE);
+	CHECK(EepromSimNowUs() - start >= EEPROM_POLL_DEADLINE_US);
+	CHECK(nos_eeprom.jobs_failed == 1);
+	nos_eeprom.a0 = false;
+	CHECK(run(EEPROM_JOB_READ, false, 0x1000, back, sizeof(back), false) == EEPROM_SUCCESS);
+}
+
+static void test_probe(void)
+{
+	power_on(false);
+	// Blank part, the pattern is written once at 100 kHz and then read at 1 MHz
+	CHECK(EepromProbeBusProfile(&nos_eeprom) == EEPROM_BUS_1M);
+	CHECK(eeprom_sim.write_cycles == 1);
+	CHECK(EepromProbeBusProfile(&nos_eeprom) == EEPROM_BUS_1M);
+	CHECK(eeprom_sim.write_cycles == 1);
+
+	// The pattern read at 100 kHz, then a corrupted read at 1 MHz
+	EepromSimInjectFault(EEPROM_SIM_FAULT_CORRUPT, 1);
+	CHECK(EepromProbeBusProfile(&nos_eeprom) == EEPROM_BUS_400K);
+	CHECK(eeprom_sim.write_cycles == 1);
+
+	// The read rate lands in the background
+	CHECK(EepromMeasureReadRate(&nos_eeprom) == EEPROM_SUCCESS);
+	CHECK(nos_eeprom.read_rate == 0);
+	EepromSimAdvance(100000);
+	CHECK(nos_eeprom.read_rate > 0);
+}
+
+static void test_config_kv(void)
+{
+	uint8_t value = 0;
+
+	power_on(false);
+	CHECK(NyanConfigInit(&nos_config, &nos_eeprom) == NYAN_CONFIG_SUCCESS);
+	NyanKvInit(&kv, &nos_config);
+	NyanKvService(&kv);
+	config_settle();
+
+	// Staged until the main loop appends it
+	value = 0x00;
+	CHECK(NyanKvSet(&kv, NYAN_KV_SUPER_KEY_DISABLED, &value, sizeof(value)) == NYAN_KV_SUCCESS);
+	uint32_t written = kv.records_written;
+	value = 0xAA;
+	CHECK(NyanKvGet(&kv, NYAN_KV_SUPER_KEY_DISABLED, &value, sizeof(value)) == NYAN_KV_SUCCESS);
+	CHECK(value == 0x00);
+	CHECK(kv.records_written == written);
+	NyanKvService(&kv);
+	config_settle();
+
+	// Toggled far more often than there are slots, the last value survives a reboot
+	for (uint8_t i = 0; i < 3 * NYAN_KV_SLOTS; ++i) {
+		value = i & 1;
+		NyanKvSet(&kv, NYAN_KV_SUPER_KEY_DISABLED, &value, sizeof(value));
+		NyanKvService(&kv);
+		config_settle();
+	}
+	CHECK(nos_config.flush_errors == 0);
+	reboot();
+	value = 0xAA;
+	CHECK(NyanKvGet(&kv, NYAN_KV_SUPER_KEY_DISABLED, &value, sizeof(value)) == NYAN_KV_SUCCESS);
+	CHECK(value == 0x01);
+
+	// Every slot of the log has been used
+	uint32_t valid = 0;
+	for (uint32_t slot = 0; slot < NYAN_KV_SLOTS; ++slot) {
+		const NyanKvRecord *record = (const NyanKvRecord *)&eeprom_sim.mem[0][ADDR_KV_LOG + slot * NYAN_KV_RECORD_SZ];
+		valid += record->key == NYAN_KV_SUPER_KEY_DISABLED;
+	}
+	CHECK(valid == NYAN_KV_SLOTS);
+}
+
+static void test_config_retry(void)
+{
+	const char owner[] = "nyan";
+	char back[sizeof(owner)];
+
+	// The part does not answer at boot, the shadow refuses writes
+	power_on(true);
+	CHECK(NyanConfigInit(&nos_config, &nos_eeprom) == NYAN_CONFIG_FAILURE);
+	CHECK(!nos_config.loaded);
+	CHECK(NyanConfigWrite(&nos_config, ADDR_BOARD_OWNER, owner, sizeof(owner)) == NYAN_CONFIG_FAILURE);
+
+	// It does now, the main loop loads it late
+	nos_eeprom.a0 = false;
+	bool late = false;
+	for (int i = 0; i < 1000 && !late; ++i) {
+		late = NyanConfigService(&nos_config);
+		EepromSimAdvance(1000);
+	}
+	CHECK(late);
+	CHECK(nos_config.loaded);
+	CHECK(NyanConfigWrite(&nos_config, ADDR_BOARD_OWNER, owner, sizeof(owner)) == NYAN_CONFIG_SUCCESS);
+	config_settle();
+	CHECK(memcmp(&eeprom_sim.mem[0][ADDR_BOARD_OWNER], owner, sizeof(owner)) == 0);
+
+	// A flush that fails is retried by the main loop without another write
+	nos_eeprom.a0 = true;
+	NyanConfigWrite(&nos_config, ADDR_BOARD_OWNER, "cat", 4);
+	for (int i = 0; i < 100 && nos_config.flush_errors == 0; ++i)
+		EepromSimAdvance(1000);
+	CHECK(nos_config.flush_errors == 1);
+	CHECK(!NyanConfigClean(&nos_config));
+	nos_eeprom.a0 = false;
+	for (int i = 0; i < 1000 && !NyanConfigClean(&nos_config); ++i) {
+		NyanConfigService(&nos_config);
+		EepromSimAdvance(1000);
+	}
+	CHECK(NyanConfigClean(&nos_config));
+	CHECK(memcmp(&eeprom_sim.mem[0][ADDR_BOARD_OWNER], "cat", 4) == 0);
+	NyanConfigRead(&nos_config, ADDR_BOARD_OWNER, back, 4);
+	CHECK(memcmp(back, "cat", 4) == 0);
+}
+
+// Pushes the image in USB packet sized pieces, servicing the page pipeline in between
+static bool upload(uint32_t address, const uint8_t *image, uint32_t size, uint8_t *digest)
+{
+	uint32_t pushed = 0;
+
+	if (NyanBitstreamWriterOpen(&writer, &nos_eeprom, address, size) != NYAN_BITSTREAM_SUCCESS)
+		return false;
+	for (int i = 0; i < 10000000 && !NyanBitstreamWriterDone(&writer); ++i) {
+		if (pushed < size) {
+			uint32_t len = size - pushed < 64 ? size - pushed : 64;
+			pushed += NyanBitstreamWriterPush(&writer, &image[pushed], len);
+		}
+		if (NyanBitstreamWriterService(&writer) != NYAN_BITSTREAM_SUCCESS)
+			return false;
+		EepromSimAdvance(50);
+	}
+	return NyanBitstreamWriterFinish(&writer, digest) == NYAN_BITSTREAM_SUCCESS;
+}
+
+static void test_bitstream_writer(void)
+{
+	static uint8_t image[70000];
+	uint8_t digest[SHA256_BLOCK_SIZE], expect[SHA256_BLOCK_SIZE];
+	SHA256_CTX ctx;
+
+	power_on(false);
+	pattern(image, sizeof(image), 4);
+	sha256_init(&ctx);
+	sha256_update(&ctx, image, sizeof(image));
+	sha256_final(&ctx, expect);
+
+	// Slot B runs on across the B0 boundary into block 1
+	uint32_t head = EEPROM_BLOCK_SIZE - ADDR_FPGA_BITSTREAM_B;
+	CHECK(upload(ADDR_FPGA_BITSTREAM_B, image, sizeof(image), digest));
+	CHECK(memcmp(digest, expect, sizeof(digest)) == 0);
+	CHECK(memcmp(&eeprom_sim.mem[0][ADDR_FPGA_BITSTREAM_B], image, head) == 0);
+	CHECK(memcmp(&eeprom_sim.mem[1][0], &image[head], sizeof(image) - head) == 0);
+	CHECK(writer.pages_skipped == 0);
+
+	// The same image again costs no write cycle
+	uint32_t cycles = eeprom_sim.write_cycles;
+	CHECK(upload(ADDR_FPGA_BITSTREAM_B, image, sizeof(image), digest));
+	CHECK(eeprom_sim.write_cycles == cycles);
+	CHECK(writer.pages_skipped == writer.pages);
+
+	// A size beyond the EEPROM is refused up front
+	CHECK(NyanBitstreamWriterOpen(&writer, &nos_eeprom, ADDR_FPGA_BITSTREAM_B, NYAN_BITSTREAM_MAX_SIZE + 1) == NYAN_BITSTREAM_FAILURE);
+}
+
+static uint8_t *load(const char *path, uint32_t *size)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *data = NULL;
+	long len;
+
+	if (!f)
+		return NULL;
+	if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0) {
+		data = malloc(len);
+		if (data && fread(data, 1, len, f) != (size_t)len) {
+			free(data);
+			data = NULL;
+		}
+		*size = len;
+	}
+	fclose(f);
+	return data;
+}
+
+// Uploaded the way the shell does it into slot B, then configured from it: the block that
+// straddles B0 must reach the hash and the decompressor whole
+static void test_fpga_straddle(const char *compr_path, const char *bin_path)
+{
+	uint32_t compr_size = 0, bin_size = 0, address;
+	uint8_t *compr = load(compr_path, &compr_size);
+	uint8_t *bin = load(bin_path, &bin_size);
+	uint8_t digest[SHA256_BLOCK_SIZE];
+
+	CHECK(compr && bin);
+	if (!compr || !bin)
+		goto out;
+	CHECK(compr_size > SIZE_FPGA_BITSTREAM_B);
+
+	power_on(false);
+	CHECK(NyanConfigInit(&nos_config, &nos_eeprom) == NYAN_CONFIG_SUCCESS);
+	NyanKvInit(&nos_kv, &nos_config);
+	memset(&nos_fpga, 0, sizeof(nos_fpga));
+	CHECK(FPGASlotUploadTarget(&nos_fpga, compr_size) == FPGA_SLOT_B);
+	CHECK(FPGASlotUploadBegin(&nos_fpga, compr_size) == FPGA_SUCCESS);
+	FPGASlotLocate(nos_fpga.upload_slot, &address);
+	CHECK(address == ADDR_FPGA_BITSTREAM_B);
+	// A configuration asked for meanwhile waits for the upload
+	FPGARequestConfig(&nos_fpga);
+	CHECK(FPGAService(&nos_fpga) == FPGA_STATE_IDLE);
+	CHECK(upload(address, compr, compr_size, digest));
+	CHECK(FPGASlotUploadFinish(&nos_fpga, compr_size, digest) == FPGA_SUCCESS);
+	config_settle();
+
+	sim_spi_len = 0;
+	sim_cache_stores = 0;
+	FPGAState state = FPGAService(&nos_fpga);
+	// The slot table is the configuration's until it is done
+	CHECK(FPGABusy(&nos_fpga));
+	CHECK(FPGASlotUploadBegin(&nos_fpga, compr_size) == FPGA_FAILURE);
+	for (int i = 0; i < 1000000 && state != FPGA_STATE_DONE && state != FPGA_STATE_FAILED; ++i) {
+		EepromSimAdvance(100);
+		state = FPGAService(&nos_fpga);
+	}
+	CHECK(state == FPGA_STATE_DONE);
+	CHECK(nos_fpga.stats.ok);
+	CHECK(nos_fpga.stats.verified);
+	CHECK(nos_fpga.stats.slot == FPGA_SLOT_B);
+	CHECK(nos_fpga.stats.bytes_out == bin_size);
+	// A dummy byte ahead of the image and ten behind it
+	CHECK(sim_spi_len == 1 + bin_size + 10);
+	CHECK(memcmp(&sim_spi_out[1], bin, bin_size) == 0);
+	// Committed on CDONE, the flash cache copy is left to the next boot
+	CHECK(nos_fpga.slots.active == FPGA_SLOT_B);
+	FPGAService(&nos_fpga);
+	CHECK(sim_cache_stores == 0);
+	CHECK(nos_fpga.stats.cache_update == FPGA_CACHE_PENDING);
+	NyanKvService(&nos_kv);
+	config_settle();
+
+	// The next boot makes the copy once and clears the request
+	uint8_t pending = false;
+	EepromInit(&nos_eeprom, false, false);
+	MX_I2C1_Init();
+	CHECK(NyanConfigInit(&nos_config, &nos_eeprom) == NYAN_CONFIG_SUCCESS);
+	NyanKvInit(&nos_kv, &nos_config);
+	CHECK(NyanKvGet(&nos_kv, NYAN_KV_FPGA_CACHE_PENDING, &pending, sizeof(pending)) == NYAN_KV_SUCCESS && pending);
+	memset(&nos_fpga, 0, sizeof(nos_fpga));
+	FPGACacheBoot(&nos_fpga);
+	CHECK(sim_cache_stores == 1);
+	CHECK(nos_fpga.cache_boot == FPGA_CACHE_UPDATED);
+	CHECK(NyanKvGet(&nos_kv, NYAN_KV_FPGA_CACHE_PENDING, &pending, sizeof(pending)) == NYAN_KV_SUCCESS && !pending);
+	FPGACacheBoot(&nos_fpga);
+	CHECK(sim_cache_stores == 1);
+
+out:
+	free(compr);
+	free(bin);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s image.compr image.bin\n", argv[0]);
+		return 2;
+	}
+
+	test_driver_pages();
+	test_driver_block_boundary();
+	test_driver_faults();
+	test_probe();
+	test_config_kv();
+	test_config_retry();
+	test_bitstream_writer();
+	test_fpga_straddle(argv[1], argv[2]);
+
+	if (failures) {
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("all checks passed\n");
+	return 0;
+}
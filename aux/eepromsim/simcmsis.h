@@ -0,0 +1,46 @@
+// Included ahead of every source of the host build. The CMSIS intrinsics
+// that are ARM assembly are renamed out of the way while the device header
+// is read, then replaced by versions working on the simulator's interrupt
+// mask, and DWT is pointed at the simulated cycle counter.
+
+#ifndef SIMCMSIS_H
+#define SIMCMSIS_H
+
+#define __get_PRIMASK	__arm_get_PRIMASK
+#define __set_PRIMASK	__arm_set_PRIMASK
+#define __disable_irq	__arm_disable_irq
+#define __enable_irq	__arm_enable_irq
+
+#include "stm32f7xx.h"
+
+#undef __get_PRIMASK
+#undef __set_PRIMASK
+#undef __disable_irq
+#undef __enable_irq
+
+#include "24xx_eeprom_sim.h"
+
+static inline uint32_t __get_PRIMASK(void)
+{
+	return eeprom_sim.primask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask)
+{
+	eeprom_sim.primask = primask;
+}
+
+static inline void __disable_irq(void)
+{
+	eeprom_sim.primask = 1;
+}
+
+static inline void __enable_irq(void)
+{
+	eeprom_sim.primask = 0;
+}
+
+#undef DWT
+#define DWT (EepromSimDwt())
+
+#endif
@@ -0,0 +1,148 @@
+// Firmware pieces the host build of the EEPROM stack links against: the
+// peripheral handles, the HAL callbacks main.c routes to the driver, and
+// GPIO and D-Cache stand-ins. The simulator provides the I2C HAL, TIM5 and
+// the clocks. SPI4 captures what the FPGA would have been sent. The flash
+// cache is always empty so configurations stream from the EEPROM, copies
+// into it are only counted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "main.h"
+#include "i2c.h"
+#include "spi.h"
+#include "tim.h"
+#include "nyan_dma.h"
+#include "nyan_flash_cache.h"
+#include "24xx_eeprom.h"
+#include "24xx_eeprom_sim.h"
+#include "lattice_ice_hx.h"
+
+I2C_HandleTypeDef hi2c1;
+SPI_HandleTypeDef hspi4;
+TIM_HandleTypeDef htim5;
+uint32_t SystemCoreClock = EEPROM_SIM_CORE_MHZ * 1000000;
+Eeprom24xx nos_eeprom;
+NyanConfig nos_config;
+NyanKv nos_kv;
+LatticeIceHX nos_fpga;
+Iceuncompr ice_uncompr;
+
+uint8_t sim_spi_out[0x80000];
+uint32_t sim_spi_len;
+uint32_t sim_cache_stores;
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler called\n");
+	exit(2);
+}
+
+void MX_I2C1_Init(void)
+{
+	hi2c1.Init.Timing = I2C1_TIMING_400K;
+	hi2c1.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+	if (HAL_I2C_Init(&hi2c1) != HAL_OK)
+		Error_Handler();
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+}
+
+// SDA is never held low, CDONE always rises
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	return GPIO_PIN_SET;
+}
+
+// Treated like SRAM1, reads take the direct or the staged path by alignment as on the board
+bool NyanDmaCoherent(const void *data, uint32_t len)
+{
+	return false;
+}
+
+void NyanDmaClean(const void *data, uint32_t len)
+{
+}
+
+void NyanDmaInvalidate(void *data, uint32_t len)
+{
+}
+
+void NyanDmaCleanInvalidate(void *data, uint32_t len)
+{
+}
+
+// Every byte sent to the FPGA, the DMA completes as soon as it starts
+static HAL_StatusTypeDef sim_spi_capture(const uint8_t *data, uint16_t len)
+{
+	if (sim_spi_len + len > sizeof(sim_spi_out))
+		return HAL_ERROR;
+	memcpy(&sim_spi_out[sim_spi_len], data, len);
+	sim_spi_len += len;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	return sim_spi_capture(pData, Size);
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+	HAL_StatusTypeDef status = sim_spi_capture(pData, Size);
+
+	if (status == HAL_OK)
+		FPGAIrqTxComplete(&nos_fpga);
+	return status;
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+	return HAL_OK;
+}
+
+NyanFlashCacheReturn NyanFlashCacheLookup(uint32_t length, const NyanFlashCacheHeader **header)
+{
+	return NYAN_FLASH_CACHE_FAILURE;
+}
+
+NyanFlashCacheReturn NyanFlashCacheStore(Eeprom24xx *eeprom, uint32_t address, uint32_t length, const uint8_t *digest)
+{
+	sim_cache_stores++;
+	return NYAN_FLASH_CACHE_SUCCESS;
+}
+
+void NyanFlashCacheInvalidate(void)
+{
+}
+
+void HAL_I2C_MemTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	EepromIrqComplete(&nos_eeprom);
+}
+
+void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	EepromIrqComplete(&nos_eeprom);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	if (HAL_I2C_GetError(hi2c) == HAL_I2C_ERROR_AF)
+		EepromIrqNack(&nos_eeprom);
+	else
+		EepromIrqError(&nos_eeprom);
+}
+
+void HAL_TIM_PeriodElapsedCallback(TIM_HandleTypeDef *htim)
+{
+	if (htim == &htim5)
+		EepromIrqPollTimer(&nos_eeprom);
+}
@@ -0,0 +1,137 @@
+// Host benchmark of the NyanOS console formatter against the C library's
+// snprintf, on the lines getperf, fpga-stats and the digest printing produce.
+//
+// Usage: formatbench [-n iterations]
+// Every case is first checked against snprintf, %.Nq against the equivalent
+// "%d.%0Nd", then both are timed. Built with the host compiler it compares
+// against the host libc; built with arm-none-eabi-gcc --specs=nano.specs and
+// run under qemu-arm it compares against the newlib-nano the firmware links.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "nyan_format.h"
+
+typedef struct {
+	const char *name;
+	int (*libc)(char *buf, size_t size, uint32_t idx);
+	size_t (*nyan)(char *buf, size_t size, uint32_t idx);
+} FormatCase;
+
+static int libc_getperf(char *buf, size_t size, uint32_t idx)
+{
+	return snprintf(buf, size, "%s%u%s", "Total Keyboard Scans 1s: ", (unsigned)(8000 + idx), "\r\n");
+}
+
+static size_t nyan_getperf(char *buf, size_t size, uint32_t idx)
+{
+	return NyanFormatBuf(buf, size, "%s%u%s", "Total Keyboard Scans 1s: ", 8000 + idx, "\r\n");
+}
+
+static int libc_digest(char *buf, size_t size, uint32_t idx)
+{
+	return snprintf(buf, size, "%02x", (unsigned)(idx & 0xff));
+}
+
+static size_t nyan_digest(char *buf, size_t size, uint32_t idx)
+{
+	return NyanFormatBuf(buf, size, "%02x", idx & 0xff);
+}
+
+static int libc_stats(char *buf, size_t size, uint32_t idx)
+{
+	return snprintf(buf, size, "%-12s%8u us %08X %d%s", "EEPROM read", (unsigned)idx, (unsigned)(idx * 2654435761u), -(int)idx, "\r\n");
+}
+
+static size_t nyan_stats(char *buf, size_t size, uint32_t idx)
+{
+	return NyanFormatBuf(buf, size, "%-12s%8u us %08X %d%s", "EEPROM read", idx, idx * 2654435761u, -(int32_t)idx, "\r\n");
+}
+
+static int libc_temp(char *buf, size_t size, uint32_t idx)
+{
+	int value = 2715 - (int)(idx % 5000);
+	return snprintf(buf, size, "CPU %s%d.%02d C\r\n", value < 0 ? "-" : "", abs(value) / 100, abs(value) % 100);
+}
+
+static size_t nyan_temp(char *buf, size_t size, uint32_t idx)
+{
+	return NyanFormatBuf(buf, size, "CPU %.2q C\r\n", 2715 - (int32_t)(idx % 5000));
+}
+
+static const FormatCase cases[] = {
+	{ "getperf", libc_getperf, nyan_getperf },
+	{ "digest",  libc_digest,  nyan_digest },
+	{ "stats",   libc_stats,   nyan_stats },
+	{ "temp",    libc_temp,    nyan_temp },
+};
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int check(const FormatCase *c, uint32_t iterations)
+{
+	char expect[128], got[128];
+
+	for (uint32_t idx = 0; idx < iterations; idx += 97) {
+		int len = c->libc(expect, sizeof(expect), idx);
+		size_t nlen = c->nyan(got, sizeof(got), idx);
+		if (len < 0 || (size_t)len != nlen || strcmp(expect, got)) {
+			fprintf(stderr, "%s: mismatch at %u: \"%s\" vs \"%s\"\n", c->name, (unsigned)idx, expect, got);
+			return 1;
+		}
+	}
+	// Truncation must still terminate and report the full length
+	size_t full = c->nyan(got, sizeof(got), 7);
+	if (c->nyan(got, 4, 7) != full || strlen(got) != (full < 3 ? full : 3)) {
+		fprintf(stderr, "%s: truncation broken\n", c->name);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iterations = 1000000;
+	int failed = 0;
+
+	if (argc == 3 && !strcmp(argv[1], "-n"))
+		iterations = strtoul(argv[2], NULL, 0);
+	else if (argc != 1) {
+		fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+		return 2;
+	}
+
+	printf("%-8s %12s %12s %8s\n", "case", "libc ns", "nyan ns", "speedup");
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		const FormatCase *c = &cases[i];
+		char buf[128];
+		volatile size_t sink = 0;
+
+		if (check(c, iterations)) {
+			failed = 1;
+			continue;
+		}
+
+		double t0 = now_s();
+		for (uint32_t idx = 0; idx < iterations; idx++)
+			sink += c->libc(buf, sizeof(buf), idx);
+		double t1 = now_s();
+		for (uint32_t idx = 0; idx < iterations; idx++)
+			sink += c->nyan(buf, sizeof(buf), idx);
+		double t2 = now_s();
+
+		double libc_ns = (t1 - t0) * 1e9 / iterations;
+		double nyan_ns = (t2 - t1) * 1e9 / iterations;
+		printf("%-8s %12.1f %12.1f %7.2fx\n", c->name, libc_ns, nyan_ns, libc_ns / nyan_ns);
+	}
+
+	return failed;
+}
@@ -0,0 +1,238 @@
+// Host benchmark of the NyanOS bitstream decompressor against the
+// byte-at-a-time reference decoder it replaced.
+//
+// Usage: icebench [-n iterations] file.compr [file.bin] ...
+// Each compressed file is followed by its uncompressed original if the next
+// argument does not end in .compr; both decoders must reproduce it exactly.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "iceuncompr.h"
+
+// Output buffer size of both decoders
+static size_t out_max;
+
+// Reference decoder, a bit per call and a byte per fgetc like iceuncompr.c
+
+typedef struct {
+	FILE *in;
+	int read_bitcounter, read_buffer;
+	int write_bitcounter, write_buffer;
+	uint8_t *out;
+	size_t out_len;
+} RefDecoder;
+
+static int ref_read_bit(RefDecoder *d)
+{
+	if (d->read_bitcounter == 0) {
+		d->read_bitcounter = 8;
+		d->read_buffer = fgetc(d->in);
+		if (d->read_buffer == EOF)
+			return EOF;
+	}
+	d->read_bitcounter--;
+	return (d->read_buffer >> d->read_bitcounter) & 1;
+}
+
+static void ref_write_bit(RefDecoder *d, int value)
+{
+	if (d->out_len == out_max)
+		return;
+	d->write_bitcounter--;
+	if (value)
+		d->write_buffer |= 1 << d->write_bitcounter;
+	if (d->write_bitcounter == 0) {
+		d->out[d->out_len++] = d->write_buffer;
+		d->write_bitcounter = 8;
+		d->write_buffer = 0;
+	}
+}
+
+static int ref_read_int(RefDecoder *d, int bits)
+{
+	int ret = 0;
+	while (bits-- > 0) {
+		int bit = ref_read_bit(d);
+		if (bit == EOF)
+			return EOF;
+		if (bit)
+			ret |= 1 << bits;
+	}
+	return ret;
+}
+
+static void ref_write_zeros(RefDecoder *d, int bits)
+{
+	while (bits-- > 0)
+		ref_write_bit(d, 0);
+}
+
+static int ref_uncompress(const uint8_t *data, size_t len, uint8_t *out, size_t *out_len)
+{
+	RefDecoder d = { .write_bitcounter = 8, .out = out };
+
+	d.in = fmemopen((void *)data, len, "rb");
+	if (!d.in)
+		return 1;
+	if (ref_read_int(&d, 32) != 0x49434543 || ref_read_int(&d, 32) != 0x4f4d5052) {
+		fclose(d.in);
+		return 1;
+	}
+	while (1) {
+		// The firmware decoder never checked, a truncated file used to run away
+		if (feof(d.in)) {
+			fclose(d.in);
+			return 1;
+		}
+		if (ref_read_bit(&d)) {
+			ref_write_zeros(&d, ref_read_int(&d, 2));
+			ref_write_bit(&d, 1);
+		} else if (ref_read_bit(&d)) {
+			ref_write_zeros(&d, ref_read_int(&d, 5));
+			ref_write_bit(&d, 1);
+		} else if (ref_read_bit(&d)) {
+			ref_write_zeros(&d, ref_read_int(&d, 8));
+			ref_write_bit(&d, 1);
+		} else if (ref_read_bit(&d)) {
+			int n = ref_read_int(&d, 6);
+			while (n--)
+				ref_write_bit(&d, ref_read_bit(&d));
+			ref_write_bit(&d, 1);
+		} else if (ref_read_bit(&d)) {
+			ref_write_zeros(&d, ref_read_int(&d, 23));
+			ref_write_bit(&d, 1);
+		} else {
+			ref_write_zeros(&d, ref_read_int(&d, 23));
+			break;
+		}
+	}
+	fclose(d.in);
+	*out_len = d.out_len;
+	return 0;
+}
+
+// NyanOS decoder, collecting the chunks it hands to the sink
+
+typedef struct {
+	uint8_t *out;
+	size_t out_len;
+} Collector;
+
+static uint8_t *collect(void *ctx, uint8_t *data, uint32_t len)
+{
+	Collector *c = ctx;
+	if (c->out_len + len > out_max)
+		len = out_max - c->out_len;
+	memcpy(c->out + c->out_len, data, len);
+	c->out_len += len;
+	return data;
+}
+
+static int nyan_uncompress(const uint8_t *data, size_t len, uint8_t *out, size_t *out_len)
+{
+	static Iceuncompr ice;
+	static uint8_t staging[ICEUNCOMPR_OUT_BUF];
+	Collector c = { .out = out };
+
+	ice.output = collect;
+	ice.output_data = staging;
+	ice.output_ctx = &c;
+	if (!WriteUncomprBitstream(&ice, data, len))
+		return 1;
+	*out_len = c.out_len;
+	return 0;
+}
+
+static uint8_t *load(const char *path, size_t *len)
+{
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	*len = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t *buf = malloc(*len ? *len : 1);
+	if (fread(buf, 1, *len, f) != *len) {
+		perror(path);
+		exit(1);
+	}
+	fclose(f);
+	return buf;
+}
+
+static double now_s(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+typedef int (*Decoder)(const uint8_t *, size_t, uint8_t *, size_t *);
+
+static double bench(Decoder decode, const uint8_t *in, size_t in_len, uint8_t *out, size_t *out_len, int iterations)
+{
+	double start = now_s();
+	for (int i = 0; i < iterations; i++) {
+		if (decode(in, in_len, out, out_len)) {
+			fprintf(stderr, "decode failed\n");
+			exit(1);
+		}
+	}
+	return (now_s() - start) / iterations;
+}
+
+static int ends_with(const char *s, const char *suffix)
+{
+	size_t ls = strlen(s), lx = strlen(suffix);
+	return ls >= lx && !strcmp(s + ls - lx, suffix);
+}
+
+int main(int argc, char **argv)
+{
+	int iterations = 20;
+	int argi = 1;
+
+	if (argi + 1 < argc && !strcmp(argv[argi], "-n")) {
+		iterations = atoi(argv[argi + 1]);
+		argi += 2;
+	}
+	if (argi >= argc || iterations <= 0) {
+		fprintf(stderr, "Usage: %s [-n iterations] file.compr [file.bin] ...\n", argv[0]);
+		return 1;
+	}
+
+	// Zero runs are up to 2^23 bits, far more than any real image needs
+	out_max = 8u << 20;
+	uint8_t *ref_out = malloc(out_max), *nyan_out = malloc(out_max);
+	int status = 0;
+
+	while (argi < argc) {
+		const char *path = argv[argi++];
+		size_t in_len, ref_len = 0, nyan_len = 0, orig_len = 0;
+		uint8_t *in = load(path, &in_len), *orig = NULL;
+
+		if (argi < argc && !ends_with(argv[argi], ".compr"))
+			orig = load(argv[argi++], &orig_len);
+
+		double ref_s = bench(ref_uncompress, in, in_len, ref_out, &ref_len, iterations);
+		double nyan_s = bench(nyan_uncompress, in, in_len, nyan_out, &nyan_len, iterations);
+
+		int ok = ref_len == nyan_len && !memcmp(ref_out, nyan_out, ref_len) &&
+		         (!orig || (orig_len == nyan_len && !memcmp(orig, nyan_out, orig_len)));
+		printf("%-24s %7zu -> %7zu bytes  reference %8.3f ms  nyan %8.3f ms  %6.1fx  %s\n",
+		       path, in_len, nyan_len, ref_s * 1e3, nyan_s * 1e3, ref_s / nyan_s, ok ? "ok" : "MISMATCH");
+		status |= !ok;
+		free(in);
+		free(orig);
+	}
+
+	free(ref_out);
+	free(nyan_out);
+	return status;
+}
@@ -91,6 +91,37 @@ LoopFillZerobss:
   cmp r2, r4
   bcc FillZerobss
 
+/* Copy the key path code from flash to ITCM RAM */
+  ldr r0, =_sitcm_text
+  ldr r1, =_eitcm_text
+  ldr r2, =_siitcm_text
+  movs r3, #0
+  b LoopCopyItcmInit
+
+CopyItcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcmInit
+
+/* Zero fill the DTCM bss segment. */
+  ldr r2, =_sdtcm_bss
+  ldr r4, =_edtcm_bss
+  movs r3, #0
+  b LoopFillZeroDtcm
+
+FillZeroDtcm:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillZeroDtcm:
+  cmp r2, r4
+  bcc FillZeroDtcm
+
 /* Call the clock system intitialization function.*/
   bl  SystemInit   
 /* Call static constructors */